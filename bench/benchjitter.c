@@ -0,0 +1,196 @@
+
+/* Measure the wakeup-to-write latency of the threads owned by the library
+   with each real time configuration, in the manner of cyclictest.
+
+   An output scheduler writes a pin at a fixed interval, and the lateness of
+   each write (from the time it was due to the end of the write) is collected
+   from its callback. For each configuration set with rfs_thread_set_config
+   the minimum, average, 50th, 99th and 99.9th percentiles and maximum of the
+   lateness are reported, in microseconds. The configurations the process is
+   not allowed to use (usually the real time policies without CAP_SYS_NICE)
+   are reported as such.
+
+   By default a fake sysfs tree is created in a temporary directory and used as
+   root (see benchutil.h), and the pin is driven with RFS_MMIO through a
+   regular file, so only the wakeup is measured. With the option -r an
+   existing tree is used instead (-r "" for the real sysfs), with the pin
+   already exported and kept opened.
+*/
+
+#include "rfsgpio.h"
+#include "benchutil.h"
+
+#include <err.h>        // err
+#include <errno.h>      // errno
+#include <stdio.h>      // printf
+#include <stdlib.h>     // malloc
+#include <time.h>       // nanosleep
+#include <unistd.h>     // getopt, sysconf
+
+#define DEFAULT_WRITES      1000
+#define DEFAULT_INTERVAL    1000
+#define TICK                1000
+
+// Configurations measured: the changes from the default one
+struct setting_t {
+    const char *name;
+    enum thread_policy_t policy;
+    int priority;
+    int last_cpu;
+    int lock_memory;
+    unsigned long timer_slack;
+};
+
+static const struct setting_t settings[] = {
+    {"default", RFS_THREAD_DEFAULT, 0, 0, 0, 0},
+    {"other", RFS_THREAD_OTHER, 0, 0, 0, 0},
+    {"other+slack", RFS_THREAD_OTHER, 0, 0, 0, 1000},
+    {"fifo", RFS_THREAD_FIFO, 80, 0, 0, 0},
+    {"fifo+cpu+mlock", RFS_THREAD_FIFO, 80, 1, 1, 0},
+    {"deadline", RFS_THREAD_DEADLINE, 0, 0, 0, 0}
+};
+
+#define NUM_SETTINGS    (sizeof(settings) / sizeof(struct setting_t))
+
+// Lateness of each write, and number of writes done
+static uint64_t *samples;
+static unsigned long written = 0;
+
+static void
+collect(struct gpio_t *gpio, enum gpio_value_t value, uint64_t time,
+    uint64_t lateness, void *data)
+{
+    samples[written++] = lateness;
+}
+
+static int
+compare_samples(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void
+report(const char *name, unsigned long n)
+{
+    uint64_t sum = 0;
+    unsigned long i;
+
+    qsort(samples, n, sizeof(uint64_t), compare_samples);
+    for (i = 0; i < n; i++) {
+        sum += samples[i];
+    }
+    printf("%-16s %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f\n", name,
+        samples[0] / 1e3, sum / 1e3 / n, samples[n * 50 / 100] / 1e3,
+        samples[n * 99 / 100] / 1e3, samples[n * 999 / 1000] / 1e3,
+        samples[n - 1] / 1e3);
+}
+
+/* Measure the lateness of n writes, one each interval (in nanoseconds), with
+   a configuration.
+*/
+static void
+bench_setting(const struct setting_t *setting, struct gpio_t *g,
+    unsigned long n, uint64_t interval)
+{
+    struct timespec ts = {0, 1000000};
+    struct thread_config_t config;
+    struct gpio_scheduler_t s;
+    unsigned long i;
+    uint64_t t;
+
+    config = rfs_thread_default;
+    config.policy = setting->policy;
+    config.priority = setting->priority;
+    config.lock_memory = setting->lock_memory;
+    config.timer_slack = setting->timer_slack;
+    if (setting->last_cpu) {
+        config.cpus = 1ULL << ((sysconf(_SC_NPROCESSORS_ONLN) - 1) % 64);
+        config.prefault = 64 * 1024;
+    }
+    if (setting->policy == RFS_THREAD_DEADLINE) {
+        config.runtime = interval / 4;
+        config.deadline = interval;
+        config.period = interval;
+    }
+    if (rfs_thread_set_config(&config)) {
+        err(1, "setting configuration %s", setting->name);
+    }
+    written = 0;
+    if (rfs_gpio_scheduler_open(&s, TICK, n, collect, NULL)) {
+        if (errno != EPERM) {
+            err(1, "opening scheduler (%s)", setting->name);
+        }
+        printf("%-16s not allowed\n", setting->name);
+        return;
+    }
+    t = now() + interval;
+    for (i = 0; i < n; i++) {
+        if (rfs_gpio_schedule(&s, g, i & 1, t + i * interval)) {
+            err(1, "scheduling a write");
+        }
+    }
+    while (rfs_gpio_scheduler_pending(&s)) {
+        nanosleep(&ts, NULL);
+    }
+    if (rfs_gpio_scheduler_close(&s)) {
+        err(1, "closing scheduler");
+    }
+    report(setting->name, written);
+}
+
+int
+main(int argc, char **argv)
+{
+    char tmpdir[] = BENCH_ROOT_TEMPLATE;
+    const char *root = NULL;
+    gpio_pin_t pin = 4;
+    unsigned long n = DEFAULT_WRITES, interval = DEFAULT_INTERVAL;
+    struct gpio_t g;
+    unsigned int i;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:p:n:i:")) != -1) {
+        switch (opt) {
+        case 'r': root = optarg; break;
+        case 'p': pin = atoi(optarg); break;
+        case 'n': n = strtoul(optarg, NULL, 10); break;
+        case 'i': interval = strtoul(optarg, NULL, 10); break;
+        default:
+            errx(1, "usage: %s [-r root] [-p pin] [-n writes] "
+                "[-i interval in us]", argv[0]);
+        }
+    }
+    if (!n || !interval || !(samples = malloc(n * sizeof(uint64_t)))) {
+        errx(1, "wrong number of writes or interval");
+    }
+    if (!root) {
+        make_tree(tmpdir, pin, 0, 0);
+        root = tmpdir;
+    }
+    if (rfs_set_root(root)) {
+        err(1, "setting root %s", root);
+    }
+    g.pin = pin;
+    g.flags = RFS_DONT_EXPORT | ((root == tmpdir) ? RFS_MMIO : RFS_KEEP_OPEN);
+    if (rfs_gpio_open(&g, RFS_GPIO_OUT_LOW)) {
+        err(1, "opening GPIO pin %u", pin);
+    }
+    printf("%-16s %8s %8s %8s %8s %8s %8s\n", "setting", "min", "avg", "p50",
+        "p99", "p99.9", "max");
+    for (i = 0; i < NUM_SETTINGS; i++) {
+        bench_setting(&settings[i], &g, n, interval * 1000ULL);
+    }
+    if (rfs_thread_set_config(&rfs_thread_default)) {
+        err(1, "setting configuration");
+    }
+    if (rfs_gpio_close(&g)) {
+        err(1, "closing GPIO pin %u", pin);
+    }
+    if (root == tmpdir) {
+        remove_tree(tmpdir);
+    }
+    free(samples);
+    return 0;
+}
@@ -0,0 +1,235 @@
+
+/* Compare the cost of the GPIO and PWM operations with and without the flag
+   RFS_KEEP_OPEN.
+
+   By default a fake sysfs tree is created in a temporary directory (in
+   /dev/shm if available, to have it in a tmpfs) and used as root. With the
+   option -r an existing tree is used instead (-r "" for the real sysfs), in
+   that case the pin and channel must already be exported.
+
+   The syscalls done by the library are counted by interposing the libc
+   wrappers of open, close, read, write, pread and pwrite.
+*/
+
+#define _GNU_SOURCE
+
+#include "rfsgpio.h"
+#include "benchutil.h"
+
+#include <dlfcn.h>      // dlsym
+#include <err.h>        // err
+#include <fcntl.h>      // open
+#include <stdarg.h>     // va_list
+#include <stdio.h>      // printf
+#include <stdlib.h>     // atoi
+#include <unistd.h>     // getopt
+
+#define DEFAULT_ITERATIONS  100000
+
+// Number of syscalls done since the last reset
+static unsigned long syscalls = 0;
+
+int
+open(const char *file, int flags, ...)
+{
+    static int (*real_open)(const char *, int, ...) = NULL;
+    va_list ap;
+    mode_t mode = 0;
+
+    if (!real_open) {
+        real_open = dlsym(RTLD_NEXT, "open");
+    }
+    if (flags & O_CREAT) {
+        va_start(ap, flags);
+        mode = va_arg(ap, mode_t);
+        va_end(ap);
+    }
+    syscalls++;
+    return real_open(file, flags, mode);
+}
+
+int
+close(int fd)
+{
+    static int (*real_close)(int) = NULL;
+
+    if (!real_close) {
+        real_close = dlsym(RTLD_NEXT, "close");
+    }
+    syscalls++;
+    return real_close(fd);
+}
+
+ssize_t
+read(int fd, void *buf, size_t n)
+{
+    static ssize_t (*real_read)(int, void *, size_t) = NULL;
+
+    if (!real_read) {
+        real_read = dlsym(RTLD_NEXT, "read");
+    }
+    syscalls++;
+    return real_read(fd, buf, n);
+}
+
+ssize_t
+write(int fd, const void *buf, size_t n)
+{
+    static ssize_t (*real_write)(int, const void *, size_t) = NULL;
+
+    if (!real_write) {
+        real_write = dlsym(RTLD_NEXT, "write");
+    }
+    syscalls++;
+    return real_write(fd, buf, n);
+}
+
+ssize_t
+pread(int fd, void *buf, size_t n, off_t offset)
+{
+    static ssize_t (*real_pread)(int, void *, size_t, off_t) = NULL;
+
+    if (!real_pread) {
+        real_pread = dlsym(RTLD_NEXT, "pread");
+    }
+    syscalls++;
+    return real_pread(fd, buf, n, offset);
+}
+
+ssize_t
+pwrite(int fd, const void *buf, size_t n, off_t offset)
+{
+    static ssize_t (*real_pwrite)(int, const void *, size_t, off_t) = NULL;
+
+    if (!real_pwrite) {
+        real_pwrite = dlsym(RTLD_NEXT, "pwrite");
+    }
+    syscalls++;
+    return real_pwrite(fd, buf, n, offset);
+}
+
+void
+report(const char *op, const char *mode, uint64_t start, unsigned long n)
+{
+    printf("%-24s %-10s %10.1f %12.2f\n", op, mode,
+        (double)(now() - start) / n, (double)syscalls / n);
+}
+
+void
+bench_gpio(gpio_pin_t pin, int flags, const char *mode, unsigned long n)
+{
+    struct gpio_t g;
+    unsigned long i;
+    uint64_t start;
+
+    g.pin = pin;
+    g.flags = RFS_DONT_EXPORT | flags;
+    if (rfs_gpio_open(&g, RFS_GPIO_OUT_LOW)) {
+        err(1, "opening GPIO pin %u", pin);
+    }
+    syscalls = 0;
+    start = now();
+    for (i = 0; i < n; i++) {
+        if (rfs_gpio_set_value(&g, i & 1)) {
+            err(1, "setting value");
+        }
+    }
+    report("rfs_gpio_set_value", mode, start, n);
+    syscalls = 0;
+    start = now();
+    for (i = 0; i < n; i++) {
+        if (rfs_gpio_get_value(&g) < 0) {
+            err(1, "getting value");
+        }
+    }
+    report("rfs_gpio_get_value", mode, start, n);
+    syscalls = 0;
+    start = now();
+    for (i = 0; i < n; i++) {
+        if (rfs_gpio_get_direction(&g) < 0) {
+            err(1, "getting direction");
+        }
+    }
+    report("rfs_gpio_get_direction", mode, start, n);
+    if (rfs_gpio_close(&g)) {
+        err(1, "closing GPIO pin %u", pin);
+    }
+}
+
+void
+bench_pwm(pwm_chip_t chip, pwm_channel_t channel, int flags, const char *mode,
+    unsigned long n)
+{
+    struct pwm_t p;
+    unsigned long i;
+    uint64_t start;
+
+    p.chip = chip;
+    p.channel = channel;
+    p.flags = RFS_DONT_EXPORT | flags;
+    p.period = 1000000;
+    if (rfs_pwm_open(&p)) {
+        err(1, "opening PWM channel %u", channel);
+    }
+    syscalls = 0;
+    start = now();
+    for (i = 0; i < n; i++) {
+        if (rfs_pwm_set_duty_cycle(&p, i % p.period)) {
+            err(1, "setting duty cycle");
+        }
+    }
+    report("rfs_pwm_set_duty_cycle", mode, start, n);
+    syscalls = 0;
+    start = now();
+    for (i = 0; i < n; i++) {
+        if (rfs_pwm_get_duty_cycle(&p) < 0) {
+            err(1, "getting duty cycle");
+        }
+    }
+    report("rfs_pwm_get_duty_cycle", mode, start, n);
+    if (rfs_pwm_close(&p)) {
+        err(1, "closing PWM channel %u", channel);
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    char tmpdir[] = BENCH_ROOT_TEMPLATE;
+    const char *root = NULL;
+    gpio_pin_t pin = 4;
+    pwm_chip_t chip = 0;
+    pwm_channel_t channel = 0;
+    unsigned long n = DEFAULT_ITERATIONS;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:p:c:n:i:")) != -1) {
+        switch (opt) {
+        case 'r': root = optarg; break;
+        case 'p': pin = atoi(optarg); break;
+        case 'c': chip = atoi(optarg); break;
+        case 'n': channel = atoi(optarg); break;
+        case 'i': n = strtoul(optarg, NULL, 10); break;
+        default:
+            errx(1, "usage: %s [-r root] [-p pin] [-c chip] [-n channel] "
+                "[-i iterations]", argv[0]);
+        }
+    }
+    if (!root) {
+        make_tree(tmpdir, pin, chip, channel);
+        root = tmpdir;
+    }
+    if (rfs_set_root(root)) {
+        err(1, "setting root %s", root);
+    }
+    printf("%-24s %-10s %10s %12s\n", "operation", "mode", "ns/op",
+        "syscalls/op");
+    bench_gpio(pin, 0, "sysfs", n);
+    bench_gpio(pin, RFS_KEEP_OPEN, "keep-open", n);
+    bench_pwm(chip, channel, 0, "sysfs", n);
+    bench_pwm(chip, channel, RFS_KEEP_OPEN, "keep-open", n);
+    if (root == tmpdir) {
+        remove_tree(tmpdir);
+    }
+    return 0;
+}
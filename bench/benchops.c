@@ -0,0 +1,287 @@
+
+/* Measure the throughput and the latency distribution of the public
+   operations of the library.
+
+   For each operation and mode the number of operations per second and the
+   50th, 99th and 99.9th percentiles of the latency are reported, as a table
+   or, with -f csv, as CSV to be stored and compared between releases.
+
+   By default a fake sysfs tree is created in a temporary directory and used as
+   root (see benchutil.h), with a regular file as the register block of
+   RFS_MMIO. In that tree the edge waits return at once, as poll signals
+   regular files as always ready, so they only measure the cost of the
+   syscalls. With the option -r an existing tree is used instead (-r "" for
+   the real sysfs): the pin and channel must already be exported, RFS_MMIO is
+   only measured with -m and RFS_CHARDEV with -g. The option -l out:in
+   measures the real edge round trip between two pins wired together.
+*/
+
+#include "rfsgpio.h"
+#include "benchutil.h"
+
+#include <err.h>        // err
+#include <stdio.h>      // printf
+#include <stdlib.h>     // malloc
+#include <string.h>     // strcmp
+#include <unistd.h>     // getopt
+
+#define DEFAULT_ITERATIONS  10000
+#define PERIOD              1000000
+
+// Measure the expression expr n times, and report it as the operation op in
+// the given mode. The expression must return a negative value on error
+#define BENCH(op, mode, expr) do {                                          \
+    unsigned long i_;                                                       \
+    uint64_t start_, t_;                                                    \
+                                                                            \
+    start_ = now();                                                         \
+    for (i_ = 0; i_ < iterations; i_++) {                                   \
+        t_ = now();                                                         \
+        if ((expr) < 0) {                                                   \
+            err(1, "%s (%s)", op, mode);                                    \
+        }                                                                   \
+        samples[i_] = now() - t_;                                           \
+    }                                                                       \
+    report(op, mode, now() - start_);                                       \
+} while (0)
+
+// Modes in which the GPIO and PWM operations are measured
+struct mode_t {
+    const char *name;
+    int flags;
+};
+
+static const struct mode_t sysfs_modes[] = {
+    {"sysfs", 0},
+    {"keep-open", RFS_KEEP_OPEN},
+    {"cache", RFS_KEEP_OPEN | RFS_CACHE}
+};
+
+#define NUM_SYSFS_MODES (sizeof(sysfs_modes) / sizeof(struct mode_t))
+
+// Number of iterations and latency of each one
+static unsigned long iterations = DEFAULT_ITERATIONS;
+static uint64_t *samples;
+
+// Whether to print CSV instead of a table
+static int csv = 0;
+
+static int
+compare_samples(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+void
+report(const char *op, const char *mode, uint64_t elapsed)
+{
+    double ops;
+
+    qsort(samples, iterations, sizeof(uint64_t), compare_samples);
+    ops = iterations * 1e9 / elapsed;
+    printf(csv ? "%s,%s,%lu,%.0f,%llu,%llu,%llu\n"
+        : "%-30s %-10s %10lu %12.0f %8llu %8llu %8llu\n", op, mode,
+        iterations, ops,
+        (unsigned long long)samples[iterations * 50 / 100],
+        (unsigned long long)samples[iterations * 99 / 100],
+        (unsigned long long)samples[iterations * 999 / 1000]);
+}
+
+void
+bench_gpio(gpio_chip_t chip, gpio_pin_t pin, int flags, const char *mode,
+    int edges)
+{
+    struct gpio_event_t event;
+    struct gpio_t g;
+
+    g.chip = chip;
+    g.pin = pin;
+    g.flags = RFS_DONT_EXPORT | flags;
+    if (rfs_gpio_open(&g, RFS_GPIO_OUT_LOW)) {
+        err(1, "opening GPIO pin %u (%s)", pin, mode);
+    }
+    BENCH("rfs_gpio_set_value", mode, rfs_gpio_set_value(&g, i_ & 1));
+    BENCH("rfs_gpio_get_value", mode, rfs_gpio_get_value(&g));
+    BENCH("rfs_gpio_set_direction", mode,
+        rfs_gpio_set_direction(&g, RFS_GPIO_OUT_LOW));
+    BENCH("rfs_gpio_get_direction", mode, rfs_gpio_get_direction(&g));
+    if (edges) {
+        BENCH("rfs_gpio_set_edge", mode, rfs_gpio_set_edge(&g, RFS_GPIO_NONE));
+        BENCH("rfs_gpio_get_edge", mode, rfs_gpio_get_edge(&g));
+        BENCH("rfs_gpio_wait_edge", mode, rfs_gpio_wait_edge(&g, 0, &event));
+    }
+    if (rfs_gpio_close(&g)) {
+        err(1, "closing GPIO pin %u (%s)", pin, mode);
+    }
+    BENCH("rfs_gpio_open+close", mode,
+        rfs_gpio_open(&g, RFS_GPIO_IN) ? -1 : rfs_gpio_close(&g));
+}
+
+void
+bench_pwm(pwm_chip_t chip, pwm_channel_t channel, int flags, const char *mode)
+{
+    struct pwm_t p;
+
+    p.chip = chip;
+    p.channel = channel;
+    p.flags = RFS_DONT_EXPORT | flags;
+    p.period = PERIOD;
+    if (rfs_pwm_open(&p)) {
+        err(1, "opening PWM channel %u (%s)", channel, mode);
+    }
+    BENCH("rfs_pwm_set_duty_cycle", mode,
+        rfs_pwm_set_duty_cycle(&p, i_ % PERIOD));
+    BENCH("rfs_pwm_get_duty_cycle", mode, rfs_pwm_get_duty_cycle(&p));
+    BENCH("rfs_pwm_set_period", mode, rfs_pwm_set_period(&p, PERIOD));
+    BENCH("rfs_pwm_get_period", mode, rfs_pwm_get_period(&p));
+    BENCH("rfs_pwm_set_enabled", mode,
+        rfs_pwm_set_enabled(&p, RFS_PWM_ENABLED));
+    BENCH("rfs_pwm_get_enabled", mode, rfs_pwm_get_enabled(&p));
+    if (rfs_pwm_close(&p)) {
+        err(1, "closing PWM channel %u (%s)", channel, mode);
+    }
+    BENCH("rfs_pwm_open+close", mode, rfs_pwm_open(&p) ? -1 : rfs_pwm_close(&p));
+}
+
+// A control cycle that writes the value of a pin and the duty cycle of a
+// channel through an I/O batch
+void
+bench_io_batch(gpio_pin_t pin, pwm_chip_t chip, pwm_channel_t channel,
+    int flags, const char *mode)
+{
+    struct io_batch_t b;
+    struct gpio_t g;
+    struct pwm_t p;
+
+    g.pin = pin;
+    g.flags = p.flags = RFS_DONT_EXPORT | RFS_KEEP_OPEN;
+    p.chip = chip;
+    p.channel = channel;
+    p.period = PERIOD;
+    if (rfs_gpio_open(&g, RFS_GPIO_OUT_LOW) || rfs_pwm_open(&p)
+        || rfs_io_batch_open(&b, flags))
+    {
+        err(1, "opening I/O batch (%s)", mode);
+    }
+    BENCH("rfs_io_batch_submit (2 ops)", mode,
+        rfs_io_batch_gpio_set_value(&b, &g, i_ & 1)
+        || rfs_io_batch_pwm_set_duty_cycle(&b, &p, i_ % PERIOD) ? -1
+        : rfs_io_batch_submit(&b));
+    rfs_io_batch_close(&b);
+    rfs_pwm_close(&p);
+    rfs_gpio_close(&g);
+}
+
+void
+bench_event_loop(void)
+{
+    struct event_loop_t loop;
+
+    if (rfs_event_loop_open(&loop)) {
+        err(1, "opening event loop");
+    }
+    BENCH("rfs_event_loop_wakeup+run", "epoll",
+        rfs_event_loop_wakeup(&loop) ? -1 : rfs_event_loop_run(&loop, -1));
+    rfs_event_loop_close(&loop);
+}
+
+// Measure the time from setting an output until the edge is seen in the input
+// wired to it
+void
+bench_loopback(gpio_chip_t chip, gpio_pin_t out, gpio_pin_t in, int flags,
+    const char *mode)
+{
+    struct gpio_event_t event;
+    struct gpio_t o, g;
+
+    o.chip = g.chip = chip;
+    o.pin = out;
+    g.pin = in;
+    o.flags = g.flags = RFS_DONT_EXPORT | flags;
+    if (rfs_gpio_open(&o, RFS_GPIO_OUT_LOW) || rfs_gpio_open(&g, RFS_GPIO_IN)
+        || rfs_gpio_set_edge(&g, RFS_GPIO_BOTH))
+    {
+        err(1, "opening loopback pins %u and %u (%s)", out, in, mode);
+    }
+    BENCH("edge round trip", mode, rfs_gpio_set_value(&o, !(i_ & 1)) ? -1
+        : rfs_gpio_wait_edge(&g, 1000, &event));
+    rfs_gpio_close(&g);
+    rfs_gpio_close(&o);
+}
+
+int
+main(int argc, char **argv)
+{
+    char tmpdir[] = BENCH_ROOT_TEMPLATE;
+    const char *root = NULL;
+    gpio_pin_t pin = 4, out = 0, in = 0;
+    gpio_chip_t gpiochip = 0;
+    pwm_chip_t chip = 0;
+    pwm_channel_t channel = 0;
+    int mmio = 0, chardev = 0, loopback = 0;
+    unsigned int i;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:p:c:n:i:f:g:l:m")) != -1) {
+        switch (opt) {
+        case 'r': root = optarg; break;
+        case 'p': pin = atoi(optarg); break;
+        case 'c': chip = atoi(optarg); break;
+        case 'n': channel = atoi(optarg); break;
+        case 'i': iterations = strtoul(optarg, NULL, 10); break;
+        case 'f': csv = strcmp(optarg, "csv") == 0; break;
+        case 'g': chardev = 1; gpiochip = atoi(optarg); break;
+        case 'm': mmio = 1; break;
+        case 'l':
+            loopback = sscanf(optarg, "%u:%u", &out, &in) == 2;
+            break;
+        default:
+            errx(1, "usage: %s [-r root] [-p pin] [-c chip] [-n channel] "
+                "[-i iterations] [-f table|csv] [-g gpiochip] [-m] "
+                "[-l out:in]", argv[0]);
+        }
+    }
+    if (!iterations || !(samples = malloc(iterations * sizeof(uint64_t)))) {
+        errx(1, "wrong number of iterations");
+    }
+    if (!root) {
+        make_tree(tmpdir, pin, chip, channel);
+        root = tmpdir;
+        mmio = 1;
+    }
+    if (rfs_set_root(root)) {
+        err(1, "setting root %s", root);
+    }
+    printf(csv ? "%s,%s,%s,%s,%s,%s,%s\n"
+        : "%-30s %-10s %10s %12s %8s %8s %8s\n", "operation", "mode",
+        "iterations", "ops_per_sec", "p50_ns", "p99_ns", "p999_ns");
+    for (i = 0; i < NUM_SYSFS_MODES; i++) {
+        bench_gpio(0, pin, sysfs_modes[i].flags, sysfs_modes[i].name,
+            root == tmpdir);
+    }
+    if (mmio) {
+        bench_gpio(0, pin, RFS_MMIO, "mmio", 0);
+    }
+    if (chardev) {
+        bench_gpio(gpiochip, pin, RFS_CHARDEV, "chardev", 0);
+    }
+    for (i = 0; i < NUM_SYSFS_MODES; i++) {
+        bench_pwm(chip, channel, sysfs_modes[i].flags, sysfs_modes[i].name);
+    }
+    bench_io_batch(pin, chip, channel, 0, "io_uring");
+    bench_io_batch(pin, chip, channel, RFS_IO_SYNC, "sync");
+    bench_event_loop();
+    if (loopback) {
+        bench_loopback(0, out, in, RFS_KEEP_OPEN, "keep-open");
+        if (chardev) {
+            bench_loopback(gpiochip, out, in, RFS_CHARDEV, "chardev");
+        }
+    }
+    if (root == tmpdir) {
+        remove_tree(tmpdir);
+    }
+    free(samples);
+    return 0;
+}
@@ -0,0 +1,195 @@
+
+/* Measure how the throughput of the GPIO operations scales with the number of
+   threads, with pins opened with RFS_THREAD_SAFE.
+
+   Each thread writes its own pin, or all of them read the same pin, and the
+   total number of operations per second is reported for 1, 2, 4... threads
+   up to the number of processors (or the one given with -t), along with the
+   speedup over a single thread. There's no lock shared by the threads, so the
+   throughput should grow with the threads until the processors or the kernel
+   run out.
+
+   By default a fake sysfs tree is created in a temporary directory and used as
+   root (see benchutil.h), with a pin per thread. With the option -r an
+   existing tree is used instead (-r "" for the real sysfs): the pins from the
+   one given with -p must already be exported.
+*/
+
+#include "rfsgpio.h"
+#include "benchutil.h"
+
+#include <err.h>        // err
+#include <pthread.h>    // pthread_create
+#include <stdint.h>     // UINT64_MAX
+#include <stdio.h>      // printf
+#include <stdlib.h>     // atoi
+#include <unistd.h>     // getopt, sysconf
+
+#define DEFAULT_ITERATIONS  10000
+#define MAX_THREADS         32
+
+// Modes in which the operations are measured
+struct mode_t {
+    const char *name;
+    int flags;
+};
+
+static const struct mode_t modes[] = {
+    {"sysfs", RFS_THREAD_SAFE},
+    {"keep-open", RFS_THREAD_SAFE | RFS_KEEP_OPEN},
+    {"mmio", RFS_THREAD_SAFE | RFS_MMIO}
+};
+
+#define NUM_MODES   (sizeof(modes) / sizeof(struct mode_t))
+
+// Work of a thread: the pin it writes (or the one read by all of them), and
+// when it started and ended
+struct worker_t {
+    struct gpio_t *gpio;
+    int write;
+    unsigned long iterations;
+    pthread_barrier_t *barrier;
+    pthread_t thread;
+    uint64_t start, end;
+};
+
+static void *
+work(void *arg)
+{
+    struct worker_t *w = arg;
+    unsigned long i;
+
+    pthread_barrier_wait(w->barrier);
+    w->start = now();
+    for (i = 0; i < w->iterations; i++) {
+        if ((w->write ? rfs_gpio_set_value(w->gpio, i & 1)
+            : rfs_gpio_get_value(w->gpio)) < 0)
+        {
+            err(1, "%s pin %u", w->write ? "writing" : "reading",
+                w->gpio->pin);
+        }
+    }
+    w->end = now();
+    return NULL;
+}
+
+/* Run the operation in n threads at once, and return the operations per
+   second of all of them, from the first start to the last end.
+*/
+static double
+run(struct gpio_t *gpios, unsigned int n, int write, unsigned long iterations)
+{
+    struct worker_t workers[MAX_THREADS];
+    pthread_barrier_t barrier;
+    unsigned int i;
+    uint64_t start = UINT64_MAX, end = 0;
+
+    pthread_barrier_init(&barrier, NULL, n + 1);
+    for (i = 0; i < n; i++) {
+        workers[i].gpio = write ? &gpios[i] : &gpios[0];
+        workers[i].write = write;
+        workers[i].iterations = iterations;
+        workers[i].barrier = &barrier;
+        if (pthread_create(&workers[i].thread, NULL, work, &workers[i])) {
+            errx(1, "creating thread");
+        }
+    }
+    pthread_barrier_wait(&barrier);
+    for (i = 0; i < n; i++) {
+        pthread_join(workers[i].thread, NULL);
+        if (workers[i].start < start) {
+            start = workers[i].start;
+        }
+        if (workers[i].end > end) {
+            end = workers[i].end;
+        }
+    }
+    pthread_barrier_destroy(&barrier);
+    return (double)n * iterations * 1e9 / (end - start);
+}
+
+static void
+bench_mode(const struct mode_t *mode, gpio_pin_t first, unsigned int threads,
+    unsigned long iterations)
+{
+    struct gpio_t gpios[MAX_THREADS];
+    double single, rate;
+    unsigned int i, n;
+    int write;
+
+    for (i = 0; i < threads; i++) {
+        gpios[i].pin = first + i;
+        gpios[i].flags = RFS_DONT_EXPORT | mode->flags;
+        if (rfs_gpio_open(&gpios[i], RFS_GPIO_OUT_LOW)) {
+            err(1, "opening GPIO pin %u (%s)", first + i, mode->name);
+        }
+    }
+    for (write = 1; write >= 0; write--) {
+        single = 0;
+        // 1, 2, 4... threads, and the maximum
+        for (n = 1; n <= threads; n = (n * 2 > threads && n < threads) ?
+            threads : n * 2)
+        {
+            rate = run(gpios, n, write, iterations);
+            if (n == 1) {
+                single = rate;
+            }
+            printf("%-20s %-10s %8u %14.0f %8.2f\n", write ?
+                "rfs_gpio_set_value" : "rfs_gpio_get_value", mode->name, n,
+                rate, rate / single);
+        }
+    }
+    for (i = 0; i < threads; i++) {
+        if (rfs_gpio_close(&gpios[i])) {
+            err(1, "closing GPIO pin %u", first + i);
+        }
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    char tmpdir[] = BENCH_ROOT_TEMPLATE;
+    const char *root = NULL;
+    gpio_pin_t first = 4;
+    unsigned long iterations = DEFAULT_ITERATIONS;
+    long threads;
+    unsigned int i;
+    int opt;
+
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+    while ((opt = getopt(argc, argv, "r:p:t:i:")) != -1) {
+        switch (opt) {
+        case 'r': root = optarg; break;
+        case 'p': first = atoi(optarg); break;
+        case 't': threads = atoi(optarg); break;
+        case 'i': iterations = strtoul(optarg, NULL, 10); break;
+        default:
+            errx(1, "usage: %s [-r root] [-p first pin] [-t threads] "
+                "[-i iterations]", argv[0]);
+        }
+    }
+    if (threads < 1 || threads > MAX_THREADS) {
+        threads = MAX_THREADS;
+    }
+    if (!root) {
+        make_tree(tmpdir, first, 0, 0);
+        make_pins(tmpdir, first + 1, threads - 1);
+        root = tmpdir;
+    }
+    if (rfs_set_root(root)) {
+        err(1, "setting root %s", root);
+    }
+    printf("%-20s %-10s %8s %14s %8s\n", "operation", "mode", "threads",
+        "ops/s", "speedup");
+    // The registers are only faked in the temporary tree
+    for (i = 0; i < NUM_MODES; i++) {
+        if (!(modes[i].flags & RFS_MMIO) || root == tmpdir) {
+            bench_mode(&modes[i], first, threads, iterations);
+        }
+    }
+    if (root == tmpdir) {
+        remove_tree(tmpdir);
+    }
+    return 0;
+}
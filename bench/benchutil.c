@@ -0,0 +1,118 @@
+
+#define _XOPEN_SOURCE 700
+
+#include "benchutil.h"
+
+#include <err.h>        // err
+#include <fcntl.h>      // open
+#include <ftw.h>        // nftw
+#include <stdio.h>      // snprintf
+#include <stdlib.h>     // mkdtemp
+#include <string.h>     // memcpy
+#include <sys/stat.h>   // mkdir
+#include <time.h>       // clock_gettime
+#include <unistd.h>     // access
+
+#define PATH_LEN    256
+
+static void
+make_file(const char *dir, const char *name, const char *val)
+{
+    char path[PATH_LEN];
+    FILE *f;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    if (!(f = fopen(path, "w"))) {
+        err(1, "creating %s", path);
+    }
+    fputs(val, f);
+    fclose(f);
+}
+
+static void
+make_dirs(const char *root, const char *path)
+{
+    char dir[PATH_LEN];
+    char *p;
+
+    snprintf(dir, sizeof(dir), "%s/%s", root, path);
+    for (p = dir + strlen(root) + 1; *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            mkdir(dir, 0755);
+            *p = '/';
+        }
+    }
+    if (mkdir(dir, 0755) && access(dir, F_OK)) {
+        err(1, "creating %s", dir);
+    }
+}
+
+void
+make_tree(char *root, gpio_pin_t pin, pwm_chip_t chip, pwm_channel_t channel)
+{
+    char dir[PATH_LEN];
+    int fd;
+
+    if (access("/dev/shm", W_OK)) {
+        memcpy(root, "/tmp/", 5);
+        memmove(root + 5, root + 9, strlen(root + 9) + 1);
+    }
+    if (!mkdtemp(root)) {
+        err(1, "creating temporary directory");
+    }
+    make_pins(root, pin, 1);
+    snprintf(dir, sizeof(dir), "sys/class/pwm/pwmchip%u/pwm%u", chip,
+        channel);
+    make_dirs(root, dir);
+    snprintf(dir, sizeof(dir), "%s/sys/class/pwm/pwmchip%u/pwm%u", root, chip,
+        channel);
+    make_file(dir, "period", "0\n");
+    make_file(dir, "duty_cycle", "0\n");
+    make_file(dir, "enable", "0\n");
+    // A page of zeros stands for the registers of the GPIO controller
+    make_dirs(root, "dev");
+    snprintf(dir, sizeof(dir), "%s/dev/gpiomem", root);
+    if ((fd = open(dir, O_RDWR | O_CREAT, 0644)) < 0 || ftruncate(fd, 4096)) {
+        err(1, "creating %s", dir);
+    }
+    close(fd);
+}
+
+void
+make_pins(const char *root, gpio_pin_t first, unsigned int n)
+{
+    char dir[PATH_LEN];
+    unsigned int i;
+
+    for (i = first; i < first + n; i++) {
+        snprintf(dir, sizeof(dir), "sys/class/gpio/gpio%u", i);
+        make_dirs(root, dir);
+        snprintf(dir, sizeof(dir), "%s/sys/class/gpio/gpio%u", root, i);
+        make_file(dir, "direction", "in\n");
+        make_file(dir, "value", "0\n");
+        make_file(dir, "edge", "none\n");
+    }
+}
+
+static int
+remove_entry(const char *path, const struct stat *st, int type,
+    struct FTW *ftw)
+{
+    return remove(path);
+}
+
+void
+remove_tree(const char *root)
+{
+    nftw(root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+uint64_t
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
@@ -0,0 +1,30 @@
+#ifndef BENCHUTIL_H
+#define BENCHUTIL_H
+
+#include "rfsgpio.h"
+
+#include <stdint.h> // uint64_t
+
+// Template of the temporary directories used as root
+#define BENCH_ROOT_TEMPLATE "/dev/shm/rfsbench.XXXXXX"
+
+// Create a temporary directory from the template root (in /dev/shm if
+// available, to have it in a tmpfs, /tmp otherwise) with a fake sysfs tree
+// that contains a GPIO pin, a PWM channel and a register block for RFS_MMIO
+void
+make_tree(char *root, gpio_pin_t pin, pwm_chip_t chip, pwm_channel_t channel);
+
+// Add to a tree created with make_tree the files of n more GPIO pins,
+// starting at the given one
+void
+make_pins(const char *root, gpio_pin_t first, unsigned int n);
+
+// Remove a tree created with make_tree
+void
+remove_tree(const char *root);
+
+// Return the current time, in nanoseconds (CLOCK_MONOTONIC)
+uint64_t
+now(void);
+
+#endif
@@ -0,0 +1,240 @@
+/* bank.c
+   Functions to read and write banks of GPIO pins at once.
+   
+   Copyright 2018 Antonio Serrano Hernandez
+
+   This file is part of rfsgpio.
+
+   rfsgpio is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   rfsgpio is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with rfsgpio; see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+#include "rfsgpio.h"
+#include "chardev.h"
+#include "mmio.h"
+#include "probes.h"
+#include "writequeue.h"
+
+#include <errno.h>  // errno
+#include <stddef.h> // NULL
+
+// Each public function rfs_gpio_bank_X wraps the static function
+// gpio_bank_X, traced by the probes gpio_bank_X_entry and gpio_bank_X_return.
+
+/* Close the first n pins of a bank opened with the sysfs interface.
+
+   Parameters:
+     * bank: bank descriptor.
+     * n: number of pins to close.
+
+   Return 0 if all the pins were correctly closed, -1 otherwise (and errno is
+   set accordingly).
+*/
+static int
+bank_close_pins(struct gpio_bank_t *bank, unsigned int n)
+{
+    unsigned int i;
+    int res = 0, e = 0;
+
+    for (i = 0; i < n; i++) {
+        bank->gpios[i].bank = NULL;
+        if (rfs_gpio_close(&bank->gpios[i])) {
+            res = -1;
+            e = errno;
+        }
+    }
+    errno = e;
+    return res;
+}
+
+/* Open a bank of GPIO pins.
+
+   Parameters:
+     * bank: information to open the bank.
+     * direction: Initial direction of the pins.
+
+   Return 0 if the bank was successfully opened, -1 otherwise. In case of
+   error, errno is set accordingly and none of the pins is left opened.
+*/
+static int
+gpio_bank_open(struct gpio_bank_t *bank, enum gpio_direction_t direction)
+{
+    unsigned int i;
+    int e;
+
+    // Check the parameters
+    if (bank->n < 1 || bank->n > RFS_GPIO_BANK_MAX_PINS
+        || direction < RFS_GPIO_IN || direction > RFS_GPIO_OUT_HIGH)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (bank->flags & RFS_CHARDEV) {
+        for (i = 0; i < bank->n; i++) {
+            bank->gpios[i].flags = RFS_CHARDEV;
+            bank->gpios[i].poll_ref = 0;
+            bank->gpios[i].busy_poll = 0;
+            bank->gpios[i].direction_fd = -1;
+            bank->gpios[i].edge_fd = -1;
+            bank->gpios[i].callback = NULL;
+            bank->gpios[i].callback_data = NULL;
+            bank->gpios[i].write_queue = NULL;
+        }
+        return chardev_bank_open(bank, direction);
+    }
+    // With sysfs, each pin is opened keeping its files opened. With RFS_MMIO
+    // each pin is opened on its own too, as they share the mapped registers
+    for (i = 0; i < bank->n; i++) {
+        bank->gpios[i].flags = (bank->flags & RFS_MMIO) ? RFS_MMIO
+            : (bank->flags & RFS_DONT_EXPORT) | RFS_KEEP_OPEN;
+        if (rfs_gpio_open(&bank->gpios[i], direction)) {
+            e = errno;
+            bank_close_pins(bank, i);
+            errno = e;
+            return -1;
+        }
+        bank->gpios[i].bank = bank;
+    }
+    return 0;
+}
+
+int
+rfs_gpio_bank_open(struct gpio_bank_t *bank, enum gpio_direction_t direction)
+{
+    int res;
+
+    PROBE2(gpio_bank_open_entry, bank, direction);
+    res = gpio_bank_open(bank, direction);
+    PROBE2(gpio_bank_open_return, bank, res);
+    return res;
+}
+
+/* Read the values of all the pins of a bank.
+
+   Parameters:
+     * bank: bank descriptor.
+     * bits: where to store the values, bit i for the pin bank.gpios[i].
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+static int
+gpio_bank_get(struct gpio_bank_t *bank, uint64_t *bits)
+{
+    unsigned int i;
+    uint64_t b = 0;
+    int v;
+
+    if (bank->flags & RFS_CHARDEV) {
+        return chardev_bank_get(bank, bits);
+    }
+    if (bank->flags & RFS_MMIO) {
+        return mmio_bank_get(bank, bits);
+    }
+    for (i = 0; i < bank->n; i++) {
+        if ((v = rfs_gpio_get_value(&bank->gpios[i])) < 0) {
+            return -1;
+        }
+        b |= (uint64_t)v << i;
+    }
+    *bits = b;
+    return 0;
+}
+
+int
+rfs_gpio_bank_get(struct gpio_bank_t *bank, uint64_t *bits)
+{
+    int res;
+
+    PROBE1(gpio_bank_get_entry, bank);
+    res = gpio_bank_get(bank, bits);
+    PROBE3(gpio_bank_get_return, bank, res ? 0 : *bits, res);
+    return res;
+}
+
+/* Set the values of some pins of a bank.
+
+   Parameters:
+     * bank: bank descriptor.
+     * mask: pins to set, bit i for the pin bank.gpios[i].
+     * bits: values to give to the pins in mask.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+static int
+gpio_bank_set(struct gpio_bank_t *bank, uint64_t mask, uint64_t bits)
+{
+    unsigned int i;
+
+    if (bank->flags & RFS_CHARDEV) {
+        return chardev_bank_set(bank, mask, bits);
+    }
+    if (bank->flags & RFS_MMIO) {
+        return mmio_bank_set(bank, mask, bits);
+    }
+    for (i = 0; i < bank->n; i++) {
+        if (mask & (1ULL << i)
+            && rfs_gpio_set_value(&bank->gpios[i], (bits >> i) & 1))
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int
+rfs_gpio_bank_set(struct gpio_bank_t *bank, uint64_t mask, uint64_t bits)
+{
+    int res;
+
+    PROBE3(gpio_bank_set_entry, bank, mask, bits);
+    res = gpio_bank_set(bank, mask, bits);
+    PROBE4(gpio_bank_set_return, bank, mask, bits, res);
+    return res;
+}
+
+/* Close a bank of GPIO pins.
+
+   Parameters:
+     * bank: bank descriptor.
+
+   Return 0 if all the pins were correctly closed, -1 otherwise. In case of
+   error, errno is set accordingly.
+*/
+static int
+gpio_bank_close(struct gpio_bank_t *bank)
+{
+    unsigned int i;
+
+    if (bank->flags & RFS_CHARDEV) {
+        // No write left in a write queue must use the closed line request
+        for (i = 0; i < bank->n; i++) {
+            if (write_queue_detach(&bank->gpios[i].write_queue)) {
+                return -1;
+            }
+        }
+        return chardev_bank_close(bank);
+    }
+    return bank_close_pins(bank, bank->n);
+}
+
+int
+rfs_gpio_bank_close(struct gpio_bank_t *bank)
+{
+    int res;
+
+    PROBE1(gpio_bank_close_entry, bank);
+    res = gpio_bank_close(bank);
+    PROBE2(gpio_bank_close_return, bank, res);
+    return res;
+}
@@ -0,0 +1,340 @@
+/* busypoll.c
+   Busy polling of the edge events of GPIO pins.
+   
+   Copyright 2018 Antonio Serrano Hernandez
+
+   This file is part of rfsgpio.
+
+   rfsgpio is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   rfsgpio is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with rfsgpio; see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+#include "rfsgpio.h"
+#include "busypoll.h"
+#include "probes.h"
+
+#include <errno.h>          // errno
+#include <stdint.h>         // UINT64_MAX
+#include <string.h>         // memset
+#include <time.h>           // clock_gettime
+
+// The public functions rfs_gpio_X wrap the static functions gpio_X, traced by
+// the probes gpio_X_entry and gpio_X_return.
+
+// Add to a counter of a pin. Only the waiting thread writes the counters, but
+// they can be read by any other
+#define BUSY_POLL_ADD(counter, n) \
+    __atomic_store_n(&(counter), (counter) + (n), __ATOMIC_RELAXED)
+
+/* Return the current time of a clock, in nanoseconds. */
+static uint64_t
+busy_poll_time(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Account a wait in a mode of the busy polling of a GPIO pin.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+     * mode: the mode.
+     * start: time the wait started.
+     * cpu: CPU time of the thread when the wait started.
+*/
+static void
+busy_poll_account(struct gpio_t *gpio, enum busy_poll_mode_t mode,
+    uint64_t start, uint64_t cpu)
+{
+    struct busy_poll_counters_t *counters = &gpio->busy_poll_counters[mode];
+
+    BUSY_POLL_ADD(counters->waits, 1);
+    BUSY_POLL_ADD(counters->wait_time,
+        busy_poll_time(CLOCK_MONOTONIC) - start);
+    BUSY_POLL_ADD(counters->cpu_time,
+        busy_poll_time(CLOCK_THREAD_CPUTIME_ID) - cpu);
+}
+
+/* Account an edge event detected in a mode of the busy polling of a GPIO pin.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+     * mode: the mode.
+     * latency: latency of the detection, in nanoseconds.
+*/
+static void
+busy_poll_event(struct gpio_t *gpio, enum busy_poll_mode_t mode,
+    uint64_t latency)
+{
+    struct busy_poll_counters_t *counters = &gpio->busy_poll_counters[mode];
+
+    BUSY_POLL_ADD(counters->events, 1);
+    BUSY_POLL_ADD(counters->latency, latency);
+    if (latency > counters->max_latency) {
+        __atomic_store_n(&counters->max_latency, latency, __ATOMIC_RELAXED);
+    }
+}
+
+/* Spin reading the value of a GPIO pin, until a transition that matches its
+   edge, the deadline or the end of the idle period. At least one read is
+   done.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+     * edge: the edge of the pin.
+     * deadline: time to give up, in nanoseconds of CLOCK_MONOTONIC.
+     * event: where to store the event.
+
+   Return 1 if an event was detected, 0 otherwise, or -1 in case of error
+   (and errno is set accordingly).
+*/
+static int
+busy_poll_spin(struct gpio_t *gpio, enum gpio_edge_t edge, uint64_t deadline,
+    struct gpio_event_t *event)
+{
+    struct gpio_t *spin = gpio->busy_poll_spin ? gpio->busy_poll_spin : gpio;
+    uint64_t start, cpu, before, now;
+    int value, res = 0;
+
+    start = now = busy_poll_time(CLOCK_MONOTONIC);
+    cpu = busy_poll_time(CLOCK_THREAD_CPUTIME_ID);
+    do {
+        before = now;
+        if ((value = rfs_gpio_get_value(spin)) < 0) {
+            res = -1;
+            break;
+        }
+        now = busy_poll_time(CLOCK_MONOTONIC);
+        if (value == (int)gpio->busy_poll_value) {
+            continue;
+        }
+        gpio->busy_poll_value = value;
+        if (edge == RFS_GPIO_BOTH
+            || edge == (value ? RFS_GPIO_RISING : RFS_GPIO_FALLING))
+        {
+            event->gpio = gpio;
+            event->value = value;
+            event->timestamp = now;
+            busy_poll_event(gpio, RFS_BUSY_POLL_SPIN, now - before);
+            res = 1;
+            break;
+        }
+    } while (now < deadline && now - gpio->busy_poll_last < gpio->busy_poll);
+    busy_poll_account(gpio, RFS_BUSY_POLL_SPIN, start, cpu);
+    return res;
+}
+
+/* Discard the edge events queued for a GPIO pin.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+static int
+busy_poll_drain(struct gpio_t *gpio)
+{
+    struct gpio_event_t events[RFS_GPIO_EVENT_BATCH];
+    struct pollfd pd;
+    int res;
+
+    pd.fd = gpio->fd;
+    pd.events = (gpio->flags & RFS_CHARDEV) ? POLLIN : POLLPRI;
+    for (;;) {
+        if ((res = poll(&pd, 1, 0)) < 0 && errno == EINTR) {
+            continue;
+        }
+        if (res <= 0) {
+            return res;
+        }
+        if (rfs_gpio_read_events(gpio, events, RFS_GPIO_EVENT_BATCH) < 0) {
+            return -1;
+        }
+    }
+}
+
+/* Wait for an edge event of a GPIO pin with busy polling.
+
+   Within the idle period since the last event, the pin is read until a
+   transition. The spinning is left once the period ends, whatever ended the
+   last spin (a transition, the timeout or the period itself): the edges
+   queued while spinning are discarded and the value is read once more (an
+   edge after the last read would be lost otherwise), and then the interrupt
+   is waited for.
+
+   Parameters:
+     * gpio: GPIO pin descriptor, with the busy polling set.
+     * timeout: maximum time to wait, in milliseconds (-1 to wait forever).
+     * event: where to store the event.
+     * wait: function to wait for the interrupt of the pin.
+
+   Return 1 if an event was read, 0 if the timeout expired, or -1 in case of
+   error (and errno is set accordingly).
+*/
+int
+busy_poll_wait_edge(struct gpio_t *gpio, int timeout,
+    struct gpio_event_t *event, busy_poll_wait_t wait)
+{
+    uint64_t now, deadline, cpu;
+    int edge, res = 0;
+
+    now = busy_poll_time(CLOCK_MONOTONIC);
+    deadline = (timeout < 0) ? UINT64_MAX : now + timeout * 1000000ULL;
+    // The time of the last event is cleared when the spinning is left
+    if (gpio->busy_poll_last) {
+        if ((edge = rfs_gpio_get_edge(gpio)) < 0) {
+            return -1;
+        }
+        if (now - gpio->busy_poll_last < gpio->busy_poll) {
+            res = busy_poll_spin(gpio, edge, deadline, event);
+        }
+        if (!res && busy_poll_time(CLOCK_MONOTONIC) - gpio->busy_poll_last
+            >= gpio->busy_poll)
+        {
+            if (busy_poll_drain(gpio)) {
+                return -1;
+            }
+            gpio->busy_poll_last = 0;
+            res = busy_poll_spin(gpio, edge, deadline, event);
+        }
+        if (res > 0) {
+            gpio->busy_poll_last = event->timestamp;
+        }
+        now = busy_poll_time(CLOCK_MONOTONIC);
+        if (res || now >= deadline) {
+            return res;
+        }
+        if (timeout >= 0) {
+            timeout = (deadline - now + 999999) / 1000000;
+        }
+    }
+    cpu = busy_poll_time(CLOCK_THREAD_CPUTIME_ID);
+    res = wait(gpio, timeout, event);
+    busy_poll_account(gpio, RFS_BUSY_POLL_INTERRUPT, now, cpu);
+    if (res > 0) {
+        now = busy_poll_time(CLOCK_MONOTONIC);
+        busy_poll_event(gpio, RFS_BUSY_POLL_INTERRUPT,
+            (now > event->timestamp) ? now - event->timestamp : 0);
+        gpio->busy_poll_value = event->value;
+        gpio->busy_poll_last = now;
+    }
+    return res;
+}
+
+/* Set the busy polling of the edge events of a GPIO pin.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+     * idle: idle period after the last event, in microseconds (0 to disable
+         the busy polling).
+     * spin: pin to read while spinning (the same pin opened with RFS_MMIO),
+         or NULL to read the pin itself.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+static int
+gpio_set_busy_poll(struct gpio_t *gpio, unsigned int idle,
+    struct gpio_t *spin)
+{
+    int value = RFS_GPIO_LOW;
+
+    // The registers give no edge events
+    if (gpio->flags & RFS_MMIO) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    // The interrupt is waited for on the descriptor of the pin, that of a
+    // bank would give the events of the other pins too
+    if (!(gpio->flags & (RFS_KEEP_OPEN | RFS_CHARDEV))
+        || ((gpio->flags & RFS_CHARDEV) && gpio->bank))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    // Only the registers of the same pin are read faster than the pin itself
+    if (spin && (!(spin->flags & RFS_MMIO) || spin->pin != gpio->pin)) {
+        errno = EINVAL;
+        return -1;
+    }
+    // The spinning would skip the loop and the debounce period
+    if (gpio->callback || gpio->debounce) {
+        errno = EBUSY;
+        return -1;
+    }
+    if (idle && (value = rfs_gpio_get_value(spin ? spin : gpio)) < 0) {
+        return -1;
+    }
+    gpio->busy_poll = idle * 1000ULL;
+    gpio->busy_poll_spin = spin;
+    gpio->busy_poll_value = value;
+    gpio->busy_poll_last = 0;
+    memset(gpio->busy_poll_counters, 0, sizeof(gpio->busy_poll_counters));
+    return 0;
+}
+
+int
+rfs_gpio_set_busy_poll(struct gpio_t *gpio, unsigned int idle,
+    struct gpio_t *spin)
+{
+    int res;
+
+    PROBE2(gpio_set_busy_poll_entry, gpio->pin, idle);
+    res = gpio_set_busy_poll(gpio, idle, spin);
+    PROBE3(gpio_set_busy_poll_return, gpio->pin, idle, res);
+    return res;
+}
+
+/* Get the counters of a mode of the busy polling of a GPIO pin.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+     * mode: the mode.
+     * counters: where to store the counters.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+static int
+gpio_get_busy_poll_counters(struct gpio_t *gpio,
+    enum busy_poll_mode_t mode, struct busy_poll_counters_t *counters)
+{
+    struct busy_poll_counters_t *c;
+
+    if (mode < RFS_BUSY_POLL_SPIN || mode > RFS_BUSY_POLL_INTERRUPT) {
+        errno = EINVAL;
+        return -1;
+    }
+    c = &gpio->busy_poll_counters[mode];
+    counters->waits = __atomic_load_n(&c->waits, __ATOMIC_RELAXED);
+    counters->events = __atomic_load_n(&c->events, __ATOMIC_RELAXED);
+    counters->latency = __atomic_load_n(&c->latency, __ATOMIC_RELAXED);
+    counters->max_latency = __atomic_load_n(&c->max_latency,
+        __ATOMIC_RELAXED);
+    counters->wait_time = __atomic_load_n(&c->wait_time, __ATOMIC_RELAXED);
+    counters->cpu_time = __atomic_load_n(&c->cpu_time, __ATOMIC_RELAXED);
+    return 0;
+}
+
+int
+rfs_gpio_get_busy_poll_counters(struct gpio_t *gpio,
+    enum busy_poll_mode_t mode, struct busy_poll_counters_t *counters)
+{
+    int res;
+
+    PROBE2(gpio_get_busy_poll_counters_entry, gpio->pin, mode);
+    res = gpio_get_busy_poll_counters(gpio, mode, counters);
+    PROBE3(gpio_get_busy_poll_counters_return, gpio->pin, mode, res);
+    return res;
+}
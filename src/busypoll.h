@@ -0,0 +1,47 @@
+/* busypoll.h
+   Busy polling of the edge events of GPIO pins.
+   
+   Copyright 2018 Antonio Serrano Hernandez
+
+   This file is part of rfsgpio.
+
+   rfsgpio is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   rfsgpio is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with rfsgpio; see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BUSYPOLL_H
+#define BUSYPOLL_H
+
+#include "rfsgpio.h"
+
+// Function that waits for an edge event of a pin, sleeping on its descriptor
+typedef int (*busy_poll_wait_t)(struct gpio_t *gpio, int timeout,
+    struct gpio_event_t *event);
+
+/* Wait for an edge event of a GPIO pin with busy polling.
+
+   Parameters:
+     * gpio: GPIO pin descriptor, with the busy polling set.
+     * timeout: maximum time to wait, in milliseconds (-1 to wait forever).
+     * event: where to store the event.
+     * wait: function to wait for the interrupt of the pin.
+
+   Return 1 if an event was read, 0 if the timeout expired, or -1 in case of
+   error (and errno is set accordingly).
+*/
+int
+busy_poll_wait_edge(struct gpio_t *gpio, int timeout,
+    struct gpio_event_t *event, busy_poll_wait_t wait);
+
+#endif
@@ -0,0 +1,233 @@
+/* capture.c
+   Functions to capture edge events in a thread owned by the library.
+   
+   Copyright 2018 Antonio Serrano Hernandez
+
+   This file is part of rfsgpio.
+
+   rfsgpio is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   rfsgpio is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with rfsgpio; see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+#include "rfsgpio.h"
+#include "thread.h"
+
+#include <errno.h>  // errno
+#include <stdlib.h> // malloc
+
+/* Store an event in the ring buffer of a capture.
+
+   Called by the capture thread, the only writer of head. If the ring buffer
+   is full, the event is counted as an overflow.
+
+   Parameters:
+     * event: the edge event.
+     * data: the capture descriptor.
+*/
+static void
+capture_push(const struct gpio_event_t *event, void *data)
+{
+    struct event_capture_t *capture = data;
+    unsigned long head, tail;
+
+    head = capture->head;
+    tail = __atomic_load_n(&capture->tail, __ATOMIC_ACQUIRE);
+    if (head - tail == capture->size) {
+        __atomic_fetch_add(&capture->overflows, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    capture->events[head & (capture->size - 1)] = *event;
+    __atomic_store_n(&capture->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* Main function of the capture thread.
+
+   Parameters:
+     * arg: the capture descriptor.
+*/
+static void *
+capture_run(void *arg)
+{
+    struct event_capture_t *capture = arg;
+
+    while (__atomic_load_n(&capture->running, __ATOMIC_ACQUIRE)) {
+        // An error other than an interruption stops the thread
+        if (rfs_event_loop_run(&capture->loop, -1) < 0 && errno != EINTR) {
+            __atomic_store_n(&capture->error, errno, __ATOMIC_RELEASE);
+            break;
+        }
+    }
+    return NULL;
+}
+
+/* Open an edge event capture.
+
+   Parameters:
+     * capture: the capture descriptor.
+     * size: capacity of the ring buffer, in events.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_event_capture_open(struct event_capture_t *capture, unsigned long size)
+{
+    if (size < 1) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (capture->size = 1; capture->size < size; capture->size <<= 1);
+    capture->events = malloc(capture->size * sizeof(struct gpio_event_t));
+    if (!capture->events) {
+        return -1;
+    }
+    if (rfs_event_loop_open(&capture->loop)) {
+        free(capture->events);
+        return -1;
+    }
+    capture->head = 0;
+    capture->tail = 0;
+    capture->overflows = 0;
+    capture->error = 0;
+    capture->running = 0;
+    return 0;
+}
+
+/* Add a GPIO pin to an edge event capture.
+
+   Parameters:
+     * capture: the capture descriptor.
+     * gpio: the GPIO pin.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_event_capture_add(struct event_capture_t *capture, struct gpio_t *gpio)
+{
+    return rfs_event_loop_add(&capture->loop, gpio, capture_push, capture);
+}
+
+/* Start the capture thread.
+
+   Parameters:
+     * capture: the capture descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_event_capture_start(struct event_capture_t *capture)
+{
+    if (capture->running) {
+        errno = EBUSY;
+        return -1;
+    }
+    capture->error = 0;
+    capture->running = 1;
+    if (thread_start(&capture->thread, capture_run, capture)) {
+        capture->running = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/* Read the captured events.
+
+   Parameters:
+     * capture: the capture descriptor.
+     * events: where to store the events.
+     * n: maximum number of events to read.
+
+   Return the number of events read (0 if there was none).
+*/
+unsigned long
+rfs_event_capture_read(struct event_capture_t *capture,
+    struct gpio_event_t *events, unsigned long n)
+{
+    unsigned long head, tail, i;
+
+    tail = capture->tail;
+    head = __atomic_load_n(&capture->head, __ATOMIC_ACQUIRE);
+    if (n > head - tail) {
+        n = head - tail;
+    }
+    for (i = 0; i < n; i++) {
+        events[i] = capture->events[(tail + i) & (capture->size - 1)];
+    }
+    __atomic_store_n(&capture->tail, tail + n, __ATOMIC_RELEASE);
+    return n;
+}
+
+/* Return the number of events lost because the ring buffer was full.
+
+   Parameters:
+     * capture: the capture descriptor.
+*/
+unsigned long
+rfs_event_capture_overflows(struct event_capture_t *capture)
+{
+    return __atomic_load_n(&capture->overflows, __ATOMIC_RELAXED);
+}
+
+/* Return the error that stopped the capture thread.
+
+   Parameters:
+     * capture: the capture descriptor.
+
+   Return the errno value, or 0 if the thread wasn't stopped by an error.
+*/
+int
+rfs_event_capture_error(struct event_capture_t *capture)
+{
+    return __atomic_load_n(&capture->error, __ATOMIC_ACQUIRE);
+}
+
+/* Stop the capture thread.
+
+   Parameters:
+     * capture: the capture descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_event_capture_stop(struct event_capture_t *capture)
+{
+    if (!capture->running) {
+        errno = EINVAL;
+        return -1;
+    }
+    __atomic_store_n(&capture->running, 0, __ATOMIC_RELEASE);
+    if (rfs_event_loop_wakeup(&capture->loop)
+        || thread_join(capture->thread))
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/* Close an edge event capture.
+
+   Parameters:
+     * capture: the capture descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_event_capture_close(struct event_capture_t *capture)
+{
+    if (capture->running && rfs_event_capture_stop(capture)) {
+        return -1;
+    }
+    free(capture->events);
+    capture->events = NULL;
+    return rfs_event_loop_close(&capture->loop);
+}
@@ -0,0 +1,653 @@
+/* chardev.c
+   Helper functions to drive GPIO lines through the GPIO character device.
+   
+   Copyright 2018 Antonio Serrano Hernandez
+
+   This file is part of rfsgpio.
+
+   rfsgpio is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   rfsgpio is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with rfsgpio; see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+#include "chardev.h"
+#include "probes.h"
+#include "stats.h"
+#include "sysfs.h"
+
+#include <errno.h>          // errno
+#include <fcntl.h>          // open
+#include <linux/gpio.h>     // GPIO_V2_GET_LINE_IOCTL
+#include <string.h>         // memset
+#include <sys/ioctl.h>      // ioctl
+#include <unistd.h>         // close
+
+#define RFS_GPIO_CHIP_FILE      "/dev/gpiochip%u"
+#define RFS_GPIO_CONSUMER       "rfsgpio"
+#define RFS_GPIO_CHIP_MAX_LEN   (RFS_ROOT_MAX_LEN + 20)
+
+// Mask of the edge flags of a line
+#define LINE_FLAG_EDGES \
+    (GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_EDGE_FALLING)
+
+// Mask of all the lines of a bank
+#define BANK_MASK(bank) \
+    (((bank)->n >= 64) ? ~0ULL : (1ULL << (bank)->n) - 1)
+
+// Line flags to use for each edge
+static const uint64_t chardev_edge_flags[] = {
+    0,
+    GPIO_V2_LINE_FLAG_EDGE_RISING,
+    GPIO_V2_LINE_FLAG_EDGE_FALLING,
+    LINE_FLAG_EDGES
+};
+
+/* Do an ioctl on a GPIO chip or line request, counting it in the statistics
+   and tracing it.
+
+   Parameters:
+     * fd: the descriptor of the chip or line request.
+     * request: the ioctl request.
+     * arg: the argument of the request.
+
+   Return the result of the ioctl.
+*/
+static int
+chardev_ioctl(int fd, unsigned long request, void *arg)
+{
+    int res;
+
+    PROBE2(ioctl_entry, fd, request);
+    STATS_START(start);
+    res = STATS_END(RFS_STATS_IOCTL, start, ioctl(fd, request, arg));
+    PROBE3(ioctl_return, fd, request, res);
+    return res;
+}
+
+/* Read the edge events of a line request, counting it in the statistics and
+   tracing it.
+
+   Parameters:
+     * fd: the descriptor of the line request.
+     * ev: where to store the events.
+     * n: capacity of ev, in bytes.
+
+   Return the number of bytes read, or -1 in case of error.
+*/
+static ssize_t
+chardev_read(int fd, struct gpio_v2_line_event *ev, size_t n)
+{
+    ssize_t res;
+
+    PROBE2(read_entry, fd, n);
+    STATS_START(start);
+    res = STATS_END_IO(RFS_STATS_READ, start, read(fd, ev, n));
+    PROBE3(read_return, fd, ev, res);
+    return res;
+}
+
+/* Return the lines that share the line request of a GPIO pin.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+     * n: where to store the number of lines.
+
+   Return all the pins of the bank of gpio, or just gpio if it doesn't belong
+   to a bank.
+*/
+static struct gpio_t *
+chardev_lines(struct gpio_t *gpio, unsigned int *n)
+{
+    if (gpio->bank) {
+        *n = gpio->bank->n;
+        return gpio->bank->gpios;
+    }
+    *n = 1;
+    return gpio;
+}
+
+/* Return the line flags for a given direction.
+
+   The edge flags are only kept for inputs, the kernel doesn't allow them for
+   outputs.
+
+   Parameters:
+     * gpio: GPIO pin descriptor, with the current line flags.
+     * direction: direction of the line.
+*/
+static uint64_t
+chardev_direction_flags(struct gpio_t *gpio, enum gpio_direction_t direction)
+{
+    if (direction == RFS_GPIO_IN) {
+        return GPIO_V2_LINE_FLAG_INPUT | (gpio->line_flags & LINE_FLAG_EDGES);
+    }
+    return GPIO_V2_LINE_FLAG_OUTPUT;
+}
+
+/* Fill the configuration of all the lines of a line request.
+
+   The kernel applies a configuration to all the lines of the request, so the
+   flags of each line are taken from its line_flags field (lines with flags
+   different from the first one get a flags attribute), the values of the
+   outputs are given in an output values attribute and the input lines with a
+   debounce period get a debounce attribute (one for each period).
+
+   Parameters:
+     * lines: the lines of the request.
+     * n: number of lines.
+     * values: values of the output lines, bit i for the line i.
+     * config: line configuration to fill.
+
+   Return 0 on success, -1 if the configuration needs too many attributes
+   (and errno is set to E2BIG).
+*/
+static int
+chardev_fill_config(struct gpio_t *lines, unsigned int n, uint64_t values,
+    struct gpio_v2_line_config *config)
+{
+    uint64_t outputs = 0;
+    unsigned int i, j;
+
+    memset(config, 0, sizeof(*config));
+    config->flags = lines[0].line_flags;
+    for (i = 0; i < n; i++) {
+        if (lines[i].line_flags & GPIO_V2_LINE_FLAG_OUTPUT) {
+            outputs |= 1ULL << i;
+        }
+        if (lines[i].line_flags == config->flags) {
+            continue;
+        }
+        // Look for an attribute with the same flags, or add a new one (there
+        // are at most 5 different flag combinations, so they always fit)
+        for (j = 0; j < config->num_attrs
+            && config->attrs[j].attr.flags != lines[i].line_flags; j++);
+        if (j == config->num_attrs) {
+            config->num_attrs++;
+            config->attrs[j].attr.id = GPIO_V2_LINE_ATTR_ID_FLAGS;
+            config->attrs[j].attr.flags = lines[i].line_flags;
+        }
+        config->attrs[j].mask |= 1ULL << i;
+    }
+    if (outputs) {
+        j = config->num_attrs++;
+        config->attrs[j].attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+        config->attrs[j].attr.values = values;
+        config->attrs[j].mask = outputs;
+    }
+    // The debounce periods don't apply to the outputs, and the lines filtered
+    // in software don't have them either
+    for (i = 0; i < n; i++) {
+        if (!lines[i].debounce || lines[i].debounce_fd >= 0
+            || outputs & (1ULL << i))
+        {
+            continue;
+        }
+        for (j = 0; j < config->num_attrs
+            && (config->attrs[j].attr.id != GPIO_V2_LINE_ATTR_ID_DEBOUNCE
+                || config->attrs[j].attr.debounce_period_us
+                    != lines[i].debounce); j++);
+        if (j == GPIO_V2_LINE_NUM_ATTRS_MAX) {
+            errno = E2BIG;
+            return -1;
+        }
+        if (j == config->num_attrs) {
+            config->num_attrs++;
+            config->attrs[j].attr.id = GPIO_V2_LINE_ATTR_ID_DEBOUNCE;
+            config->attrs[j].attr.debounce_period_us = lines[i].debounce;
+        }
+        config->attrs[j].mask |= 1ULL << i;
+    }
+    return 0;
+}
+
+/* Change the flags of a GPIO line.
+
+   The values of the other output lines of the request are read first to keep
+   them, because the new configuration also applies to them.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+     * flags: new flags of the line.
+     * value: output value of the line, if flags is an output.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+static int
+chardev_reconfigure(struct gpio_t *gpio, uint64_t flags, int value)
+{
+    struct gpio_v2_line_config config;
+    struct gpio_v2_line_values values;
+    struct gpio_t *lines;
+    uint64_t old_flags;
+    unsigned int n, i;
+
+    lines = chardev_lines(gpio, &n);
+    values.mask = 0;
+    values.bits = 0;
+    for (i = 0; i < n; i++) {
+        if (i != gpio->line && lines[i].line_flags & GPIO_V2_LINE_FLAG_OUTPUT) {
+            values.mask |= 1ULL << i;
+        }
+    }
+    if (values.mask
+        && chardev_ioctl(gpio->fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0)
+    {
+        return -1;
+    }
+    if (value) {
+        values.bits |= 1ULL << gpio->line;
+    }
+    old_flags = gpio->line_flags;
+    gpio->line_flags = flags;
+    if (chardev_fill_config(lines, n, values.bits, &config)
+        || chardev_ioctl(gpio->fd, GPIO_V2_LINE_SET_CONFIG_IOCTL, &config) < 0)
+    {
+        gpio->line_flags = old_flags;
+        return -1;
+    }
+    return 0;
+}
+
+/* Request some GPIO lines of the same chip in a single line request.
+
+   Parameters:
+     * lines: the lines to request, with the fields chip and pin filled.
+     * n: number of lines.
+     * direction: initial direction of the lines.
+     * bank: bank the lines belong to, or NULL for a single line.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+static int
+chardev_request(struct gpio_t *lines, unsigned int n,
+    enum gpio_direction_t direction, struct gpio_bank_t *bank)
+{
+    char chip_file[RFS_GPIO_CHIP_MAX_LEN];
+    struct gpio_v2_line_request req;
+    int chipfd, res, e;
+    unsigned int i;
+
+    if (sysfs_path(chip_file, RFS_GPIO_CHIP_MAX_LEN, RFS_GPIO_CHIP_FILE,
+        lines[0].chip))
+    {
+        return -1;
+    }
+    chipfd = open(chip_file, O_RDWR | O_CLOEXEC);
+    if (chipfd < 0) {
+        return -1;
+    }
+    memset(&req, 0, sizeof(req));
+    for (i = 0; i < n; i++) {
+        req.offsets[i] = lines[i].pin;
+        lines[i].line = i;
+        lines[i].line_flags = 0;
+        lines[i].line_flags = chardev_direction_flags(&lines[i], direction);
+        lines[i].debounce = 0;
+        lines[i].debounce_fd = -1;
+        lines[i].debounce_timerfd = -1;
+    }
+    req.num_lines = n;
+    strncpy(req.consumer, RFS_GPIO_CONSUMER, GPIO_MAX_NAME_SIZE - 1);
+    if (chardev_fill_config(lines, n,
+        (direction == RFS_GPIO_OUT_HIGH) ? ~0ULL : 0, &req.config))
+    {
+        close(chipfd);
+        return -1;
+    }
+    // Request the lines, the request has its own descriptor and the chip one
+    // is not needed anymore
+    res = chardev_ioctl(chipfd, GPIO_V2_GET_LINE_IOCTL, &req);
+    e = errno;
+    close(chipfd);
+    if (res < 0) {
+        errno = e;
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        lines[i].fd = req.fd;
+        lines[i].bank = bank;
+    }
+    return 0;
+}
+
+/* Request a GPIO line to the GPIO character device.
+
+   Parameters:
+     * gpio: GPIO pin descriptor, with the fields chip and pin filled.
+     * direction: initial direction of the line.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+chardev_open(struct gpio_t *gpio, enum gpio_direction_t direction)
+{
+    return chardev_request(gpio, 1, direction, NULL);
+}
+
+/* Request all the GPIO lines of a bank in a single line request.
+
+   Parameters:
+     * bank: bank descriptor, whose pins must belong to the same chip.
+     * direction: initial direction of the lines.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+chardev_bank_open(struct gpio_bank_t *bank, enum gpio_direction_t direction)
+{
+    unsigned int i;
+
+    for (i = 1; i < bank->n; i++) {
+        if (bank->gpios[i].chip != bank->gpios[0].chip) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    return chardev_request(bank->gpios, bank->n, direction, bank);
+}
+
+/* Return the current direction of a GPIO line.
+
+   The line is requested exclusively, so its direction is the last one set.
+*/
+int
+chardev_get_direction(struct gpio_t *gpio)
+{
+    if (gpio->line_flags & GPIO_V2_LINE_FLAG_OUTPUT) {
+        return RFS_GPIO_OUT;
+    }
+    return RFS_GPIO_IN;
+}
+
+/* Return the current edge of a GPIO line.
+
+   The line is requested exclusively, so its edge is the last one set.
+*/
+int
+chardev_get_edge(struct gpio_t *gpio)
+{
+    switch (gpio->line_flags & LINE_FLAG_EDGES) {
+    case GPIO_V2_LINE_FLAG_EDGE_RISING:
+        return RFS_GPIO_RISING;
+    case GPIO_V2_LINE_FLAG_EDGE_FALLING:
+        return RFS_GPIO_FALLING;
+    case LINE_FLAG_EDGES:
+        return RFS_GPIO_BOTH;
+    }
+    return RFS_GPIO_NONE;
+}
+
+/* Read some edge events of a GPIO line, with the kernel timestamps.
+
+   The kernel gives as many of the queued events as fit in the buffer of a
+   single read, and blocks only if there's none.
+
+   With a bank, the events may belong to any of the pins of the bank, that is
+   given in each event.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+     * events: where to store the events.
+     * n: maximum number of events to read (up to RFS_GPIO_EVENT_BATCH).
+
+   Return the number of events read, or -1 in case of error (and errno is set
+   accordingly).
+*/
+int
+chardev_read_events(struct gpio_t *gpio, struct gpio_event_t *events,
+    unsigned int n)
+{
+    struct gpio_v2_line_event ev[RFS_GPIO_EVENT_BATCH];
+    struct gpio_t *lines;
+    unsigned int nlines, i, j;
+    ssize_t r;
+
+    if (n > RFS_GPIO_EVENT_BATCH) {
+        n = RFS_GPIO_EVENT_BATCH;
+    }
+    r = chardev_read(gpio->fd, ev, n * sizeof(ev[0]));
+    if (r < 0) {
+        return -1;
+    }
+    if (r == 0 || r % sizeof(ev[0])) {
+        errno = EIO;
+        return -1;
+    }
+    n = r / sizeof(ev[0]);
+    // The events of all the lines of a bank come through the same request
+    lines = chardev_lines(gpio, &nlines);
+    for (j = 0; j < n; j++) {
+        for (i = 0; i < nlines && lines[i].pin != ev[j].offset; i++);
+        events[j].gpio = (i < nlines) ? &lines[i] : gpio;
+        events[j].value = (ev[j].id == GPIO_V2_LINE_EVENT_RISING_EDGE) ?
+            RFS_GPIO_HIGH : RFS_GPIO_LOW;
+        events[j].timestamp = ev[j].timestamp_ns;
+    }
+    return n;
+}
+
+/* Read an edge event of a GPIO line, with the kernel timestamp.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+     * event: where to store the event.
+
+   Return 0 if an event was read, -1 otherwise (and errno is set accordingly).
+*/
+int
+chardev_read_event(struct gpio_t *gpio, struct gpio_event_t *event)
+{
+    return (chardev_read_events(gpio, event, 1) < 0) ? -1 : 0;
+}
+
+/* Return the current value of a GPIO line.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+
+   Return a value of the enum gpio_value_t, or -1 in case of error.
+*/
+int
+chardev_get_value(struct gpio_t *gpio)
+{
+    struct gpio_v2_line_values values;
+
+    values.mask = 1ULL << gpio->line;
+    values.bits = 0;
+    if (chardev_ioctl(gpio->fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0) {
+        return -1;
+    }
+    return (values.bits & values.mask) ? RFS_GPIO_HIGH : RFS_GPIO_LOW;
+}
+
+/* Set the direction of a GPIO line.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+     * direction: direction to give to the line.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+chardev_set_direction(struct gpio_t *gpio, enum gpio_direction_t direction)
+{
+    return chardev_reconfigure(gpio, chardev_direction_flags(gpio, direction),
+        direction == RFS_GPIO_OUT_HIGH);
+}
+
+/* Set the edge of a GPIO line.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+     * edge: edge to give to the line.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+chardev_set_edge(struct gpio_t *gpio, enum gpio_edge_t edge)
+{
+    return chardev_reconfigure(gpio,
+        (gpio->line_flags & ~LINE_FLAG_EDGES) | chardev_edge_flags[edge], 0);
+}
+
+/* Set the debounce period of a GPIO line.
+
+   The period is given to the kernel in a debounce attribute, that only
+   applies while the line is an input. On error the previous period is kept.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+     * period: debounce period, in microseconds (0 for none).
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+chardev_set_debounce(struct gpio_t *gpio, unsigned int period)
+{
+    unsigned int old_period = gpio->debounce;
+
+    gpio->debounce = period;
+    if (gpio->line_flags & GPIO_V2_LINE_FLAG_OUTPUT) {
+        return 0;
+    }
+    if (chardev_reconfigure(gpio, gpio->line_flags, 0)) {
+        gpio->debounce = old_period;
+        return -1;
+    }
+    return 0;
+}
+
+/* Set the value of a GPIO line.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+     * value: value to give to the line.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+chardev_set_value(struct gpio_t *gpio, enum gpio_value_t value)
+{
+    struct gpio_v2_line_values values;
+
+    values.mask = 1ULL << gpio->line;
+    values.bits = (uint64_t)value << gpio->line;
+    if (chardev_ioctl(gpio->fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &values) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Release a GPIO line.
+
+   The line is set as an input before releasing it, as it is done with the
+   sysfs interface.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+chardev_close(struct gpio_t *gpio)
+{
+    int res, e;
+
+    res = chardev_set_direction(gpio, RFS_GPIO_IN);
+    e = errno;
+    close(gpio->fd);
+    gpio->fd = -1;
+    errno = e;
+    return res;
+}
+
+/* Read the values of all the lines of a bank, with a single ioctl.
+
+   Parameters:
+     * bank: bank descriptor.
+     * bits: where to store the values.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+chardev_bank_get(struct gpio_bank_t *bank, uint64_t *bits)
+{
+    struct gpio_v2_line_values values;
+
+    values.mask = BANK_MASK(bank);
+    values.bits = 0;
+    if (chardev_ioctl(bank->gpios[0].fd, GPIO_V2_LINE_GET_VALUES_IOCTL,
+        &values) < 0)
+    {
+        return -1;
+    }
+    *bits = values.bits;
+    return 0;
+}
+
+/* Set the values of some lines of a bank, with a single ioctl.
+
+   Parameters:
+     * bank: bank descriptor.
+     * mask: lines to set.
+     * bits: values to give to the lines in mask.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+chardev_bank_set(struct gpio_bank_t *bank, uint64_t mask, uint64_t bits)
+{
+    struct gpio_v2_line_values values;
+
+    values.mask = mask & BANK_MASK(bank);
+    values.bits = bits & values.mask;
+    if (chardev_ioctl(bank->gpios[0].fd, GPIO_V2_LINE_SET_VALUES_IOCTL,
+        &values) < 0)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/* Release all the lines of a bank.
+
+   All the lines are set as inputs (without edges) before releasing them.
+
+   Parameters:
+     * bank: bank descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+chardev_bank_close(struct gpio_bank_t *bank)
+{
+    struct gpio_v2_line_config config;
+    unsigned int i;
+    int res, e;
+
+    for (i = 0; i < bank->n; i++) {
+        bank->gpios[i].line_flags = GPIO_V2_LINE_FLAG_INPUT;
+        bank->gpios[i].debounce = 0;
+    }
+    chardev_fill_config(bank->gpios, bank->n, 0, &config);
+    res = chardev_ioctl(bank->gpios[0].fd, GPIO_V2_LINE_SET_CONFIG_IOCTL,
+        &config);
+    e = errno;
+    close(bank->gpios[0].fd);
+    for (i = 0; i < bank->n; i++) {
+        bank->gpios[i].fd = -1;
+        bank->gpios[i].bank = NULL;
+    }
+    errno = e;
+    return (res < 0) ? -1 : 0;
+}
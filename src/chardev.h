@@ -0,0 +1,97 @@
+/* chardev.h
+   Helper functions to drive GPIO lines through the GPIO character device.
+   
+   Copyright 2018 Antonio Serrano Hernandez
+
+   This file is part of rfsgpio.
+
+   rfsgpio is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   rfsgpio is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with rfsgpio; see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CHARDEV_H
+#define CHARDEV_H
+
+#include "rfsgpio.h"
+
+/* Request a GPIO line to the GPIO character device.
+
+   Parameters:
+     * gpio: GPIO pin descriptor, with the fields chip and pin filled.
+     * direction: initial direction of the line.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+chardev_open(struct gpio_t *gpio, enum gpio_direction_t direction);
+
+/* Return the current direction of a GPIO line. */
+int
+chardev_get_direction(struct gpio_t *gpio);
+
+/* Return the current edge of a GPIO line. */
+int
+chardev_get_edge(struct gpio_t *gpio);
+
+/* Read an edge event of a GPIO line, with the kernel timestamp. */
+int
+chardev_read_event(struct gpio_t *gpio, struct gpio_event_t *event);
+
+/* Read some edge events of a GPIO line with a single read. */
+int
+chardev_read_events(struct gpio_t *gpio, struct gpio_event_t *events,
+    unsigned int n);
+
+/* Return the current value of a GPIO line. */
+int
+chardev_get_value(struct gpio_t *gpio);
+
+/* Set the direction of a GPIO line. */
+int
+chardev_set_direction(struct gpio_t *gpio, enum gpio_direction_t direction);
+
+/* Set the edge of a GPIO line. */
+int
+chardev_set_edge(struct gpio_t *gpio, enum gpio_edge_t edge);
+
+/* Set the debounce period of a GPIO line. */
+int
+chardev_set_debounce(struct gpio_t *gpio, unsigned int period);
+
+/* Set the value of a GPIO line. */
+int
+chardev_set_value(struct gpio_t *gpio, enum gpio_value_t value);
+
+/* Release a GPIO line. */
+int
+chardev_close(struct gpio_t *gpio);
+
+/* Request all the GPIO lines of a bank in a single line request. */
+int
+chardev_bank_open(struct gpio_bank_t *bank, enum gpio_direction_t direction);
+
+/* Read the values of all the lines of a bank, with a single ioctl. */
+int
+chardev_bank_get(struct gpio_bank_t *bank, uint64_t *bits);
+
+/* Set the values of some lines of a bank, with a single ioctl. */
+int
+chardev_bank_set(struct gpio_bank_t *bank, uint64_t mask, uint64_t bits);
+
+/* Release all the lines of a bank. */
+int
+chardev_bank_close(struct gpio_bank_t *bank);
+
+#endif
+
@@ -0,0 +1,279 @@
+/* counter.c
+   Pulse counter and frequency meter of GPIO inputs.
+   
+   Copyright 2018 Antonio Serrano Hernandez
+
+   This file is part of rfsgpio.
+
+   rfsgpio is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   rfsgpio is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with rfsgpio; see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+#include "rfsgpio.h"
+#include "thread.h"
+
+#include <errno.h>          // errno
+#include <time.h>           // clock_gettime
+
+/* Return the current time, in nanoseconds (CLOCK_MONOTONIC). */
+static uint64_t
+counter_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Count an edge event.
+
+   Called by the counter thread, the only writer of the counter. The slots of
+   the window are updated between two increments of the sequence number, so
+   the readers can tell when they read them in the middle of an update.
+
+   Parameters:
+     * event: the edge event.
+     * data: the counter descriptor.
+*/
+static void
+counter_edge(const struct gpio_event_t *event, void *data)
+{
+    struct pulse_counter_t *counter = data;
+    uint64_t slot = event->timestamp / counter->slot_len;
+    unsigned int i = slot % RFS_COUNTER_SLOTS;
+    unsigned int sequence = counter->sequence;
+
+    __atomic_store_n(&counter->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    // A slot of an older lap of the window starts from zero
+    if (counter->slots[i] != slot) {
+        __atomic_store_n(&counter->slots[i], slot, __ATOMIC_RELAXED);
+        __atomic_store_n(&counter->slot_counts[i], 0, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&counter->slot_counts[i], counter->slot_counts[i] + 1,
+        __ATOMIC_RELAXED);
+    __atomic_store_n(&counter->sequence, sequence + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&counter->last_edge, event->timestamp, __ATOMIC_RELEASE);
+    __atomic_store_n(&counter->count, counter->count + 1, __ATOMIC_RELEASE);
+}
+
+/* Main function of the counter thread.
+
+   Parameters:
+     * arg: the counter descriptor.
+*/
+static void *
+counter_run(void *arg)
+{
+    struct pulse_counter_t *counter = arg;
+
+    while (__atomic_load_n(&counter->running, __ATOMIC_ACQUIRE)) {
+        // An error other than an interruption stops the thread
+        if (rfs_event_loop_run(&counter->loop, -1) < 0 && errno != EINTR) {
+            __atomic_store_n(&counter->error, errno, __ATOMIC_RELEASE);
+            break;
+        }
+    }
+    return NULL;
+}
+
+/* Open a pulse counter of a GPIO pin.
+
+   Parameters:
+     * counter: the counter descriptor.
+     * gpio: the GPIO pin, already opened.
+     * window: length of the sliding window (in nanoseconds).
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_pulse_counter_open(struct pulse_counter_t *counter, struct gpio_t *gpio,
+    uint64_t window)
+{
+    unsigned int i;
+    int e;
+
+    if (window < RFS_COUNTER_SLOTS) {
+        errno = EINVAL;
+        return -1;
+    }
+    counter->gpio = gpio;
+    counter->slot_len = window / RFS_COUNTER_SLOTS;
+    counter->start = counter_now();
+    counter->count = 0;
+    counter->last_edge = 0;
+    counter->sequence = 0;
+    for (i = 0; i < RFS_COUNTER_SLOTS; i++) {
+        counter->slots[i] = 0;
+        counter->slot_counts[i] = 0;
+    }
+    counter->error = 0;
+    counter->running = 0;
+    if (rfs_event_loop_open(&counter->loop)) {
+        return -1;
+    }
+    if (rfs_event_loop_add(&counter->loop, gpio, counter_edge, counter)) {
+        e = errno;
+        rfs_event_loop_close(&counter->loop);
+        errno = e;
+        return -1;
+    }
+    return 0;
+}
+
+/* Start the counter thread.
+
+   Parameters:
+     * counter: the counter descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_pulse_counter_start(struct pulse_counter_t *counter)
+{
+    if (counter->running) {
+        errno = EBUSY;
+        return -1;
+    }
+    counter->error = 0;
+    counter->running = 1;
+    if (thread_start(&counter->thread, counter_run, counter)) {
+        counter->running = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/* Return the number of edges counted since the counter was opened.
+
+   Parameters:
+     * counter: the counter descriptor.
+*/
+unsigned long long
+rfs_pulse_counter_count(struct pulse_counter_t *counter)
+{
+    return __atomic_load_n(&counter->count, __ATOMIC_ACQUIRE);
+}
+
+/* Return the timestamp of the last edge counted (0 if none).
+
+   Parameters:
+     * counter: the counter descriptor.
+*/
+uint64_t
+rfs_pulse_counter_last_edge(struct pulse_counter_t *counter)
+{
+    return __atomic_load_n(&counter->last_edge, __ATOMIC_ACQUIRE);
+}
+
+/* Return the rate of the edges over the sliding window, in edges per second.
+
+   The current slot is only partially elapsed, so the time covered by the
+   window is the rest of the slots plus the elapsed part of the current one.
+
+   Parameters:
+     * counter: the counter descriptor.
+*/
+double
+rfs_pulse_counter_rate(struct pulse_counter_t *counter)
+{
+    uint64_t now, slot, first, elapsed, s;
+    unsigned long edges;
+    unsigned int sequence, i;
+
+    now = counter_now();
+    slot = now / counter->slot_len;
+    first = (slot >= RFS_COUNTER_SLOTS - 1) ? slot - (RFS_COUNTER_SLOTS - 1)
+        : 0;
+    elapsed = now - first * counter->slot_len;
+    if (elapsed > now - counter->start) {
+        elapsed = now - counter->start;
+    }
+    // Retry while the counter thread is updating the slots
+    do {
+        sequence = __atomic_load_n(&counter->sequence, __ATOMIC_ACQUIRE);
+        edges = 0;
+        for (i = 0; i < RFS_COUNTER_SLOTS; i++) {
+            s = __atomic_load_n(&counter->slots[i], __ATOMIC_RELAXED);
+            if (s >= first && s <= slot) {
+                edges += __atomic_load_n(&counter->slot_counts[i],
+                    __ATOMIC_RELAXED);
+            }
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (sequence & 1
+        || sequence != __atomic_load_n(&counter->sequence, __ATOMIC_RELAXED));
+    if (!elapsed) {
+        return 0;
+    }
+    return edges * 1e9 / elapsed;
+}
+
+/* Return the error that stopped the counter thread.
+
+   Parameters:
+     * counter: the counter descriptor.
+
+   Return the errno value, or 0 if the thread wasn't stopped by an error.
+*/
+int
+rfs_pulse_counter_error(struct pulse_counter_t *counter)
+{
+    return __atomic_load_n(&counter->error, __ATOMIC_ACQUIRE);
+}
+
+/* Stop the counter thread.
+
+   Parameters:
+     * counter: the counter descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_pulse_counter_stop(struct pulse_counter_t *counter)
+{
+    if (!counter->running) {
+        errno = EINVAL;
+        return -1;
+    }
+    __atomic_store_n(&counter->running, 0, __ATOMIC_RELEASE);
+    if (rfs_event_loop_wakeup(&counter->loop)
+        || thread_join(counter->thread))
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/* Close a pulse counter.
+
+   The pin is removed from the event loop of the counter, so it can be used
+   again by other loops.
+
+   Parameters:
+     * counter: the counter descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_pulse_counter_close(struct pulse_counter_t *counter)
+{
+    if (counter->running && rfs_pulse_counter_stop(counter)) {
+        return -1;
+    }
+    if (rfs_event_loop_remove(&counter->loop, counter->gpio)) {
+        return -1;
+    }
+    return rfs_event_loop_close(&counter->loop);
+}
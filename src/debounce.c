@@ -0,0 +1,188 @@
+/* debounce.c
+   Software filter to debounce the edge events of GPIO pins.
+   
+   Copyright 2018 Antonio Serrano Hernandez
+
+   This file is part of rfsgpio.
+
+   rfsgpio is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   rfsgpio is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with rfsgpio; see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+#include "rfsgpio.h"
+#include "debounce.h"
+
+#include <errno.h>          // errno
+#include <sys/epoll.h>      // epoll_create1
+#include <sys/timerfd.h>    // timerfd_create
+#include <unistd.h>         // read
+
+/* Install the software debounce filter of a GPIO pin.
+
+   The descriptor of the pin and a timer are added to an epoll instance, that
+   becomes the poll descriptor of the pin: it signals both the raw edges and
+   the end of the settle period.
+
+   Parameters:
+     * gpio: GPIO pin descriptor, with its descriptor opened and the field
+         debounce set.
+     * events: epoll events signaled by the descriptor of the pin on an edge.
+     * value: current value of the pin.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+debounce_open(struct gpio_t *gpio, uint32_t events, enum gpio_value_t value)
+{
+    struct epoll_event ev;
+    int e;
+
+    gpio->debounce_fd = epoll_create1(EPOLL_CLOEXEC);
+    gpio->debounce_timerfd = timerfd_create(CLOCK_MONOTONIC,
+        TFD_NONBLOCK | TFD_CLOEXEC);
+    if (gpio->debounce_fd >= 0 && gpio->debounce_timerfd >= 0) {
+        ev.events = events;
+        ev.data.fd = gpio->fd;
+        if (!epoll_ctl(gpio->debounce_fd, EPOLL_CTL_ADD, gpio->fd, &ev)) {
+            ev.events = EPOLLIN;
+            ev.data.fd = gpio->debounce_timerfd;
+            if (!epoll_ctl(gpio->debounce_fd, EPOLL_CTL_ADD,
+                gpio->debounce_timerfd, &ev))
+            {
+                gpio->debounce_value = value;
+                gpio->debounce_delivered = value;
+                gpio->debounce_timestamp = 0;
+                return 0;
+            }
+        }
+    }
+    e = errno;
+    debounce_close(gpio);
+    errno = e;
+    return -1;
+}
+
+/* Record a raw edge of a GPIO pin and (re)arm its settle timer.
+
+   The timer expires the debounce period after the timestamp of the edge, so
+   the time spent before reading the edge doesn't lengthen the period.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+     * event: the raw edge event.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+static int
+debounce_edge(struct gpio_t *gpio, const struct gpio_event_t *event)
+{
+    struct itimerspec its;
+    uint64_t deadline;
+
+    gpio->debounce_value = event->value;
+    if (!gpio->debounce_timestamp) {
+        gpio->debounce_timestamp = event->timestamp;
+    }
+    deadline = event->timestamp + (uint64_t)gpio->debounce * 1000;
+    its.it_interval.tv_sec = 0;
+    its.it_interval.tv_nsec = 0;
+    its.it_value.tv_sec = deadline / 1000000000;
+    its.it_value.tv_nsec = deadline % 1000000000;
+    // Setting the timer also clears an expiration not read yet
+    return timerfd_settime(gpio->debounce_timerfd, TFD_TIMER_ABSTIME, &its,
+        NULL);
+}
+
+/* Read an edge event of a GPIO pin through its debounce filter.
+
+   A raw edge is consumed and restarts the settle period. When the period
+   expires without more edges, the last raw value is delivered if it is a
+   transition: a value different from the last one delivered with
+   RFS_GPIO_BOTH, or the value of the edge set otherwise (the other edges are
+   not seen by the filter).
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+     * event: where to store the event.
+     * read_raw: function to read the raw edge events of the pin.
+
+   Return 0 if a settled transition was read, -1 otherwise (and errno is set
+   accordingly, EAGAIN if the transition is still settling or was a glitch).
+*/
+int
+debounce_read_event(struct gpio_t *gpio, struct gpio_event_t *event,
+    debounce_read_t read_raw)
+{
+    struct epoll_event ready[2];
+    enum gpio_value_t value;
+    uint64_t expirations;
+    int n, i, edge;
+
+    n = epoll_wait(gpio->debounce_fd, ready, 2, 0);
+    if (n < 0) {
+        return -1;
+    }
+    // The raw edges are handled first, they restart the period
+    for (i = 0; i < n; i++) {
+        if (ready[i].data.fd == gpio->fd) {
+            if (read_raw(gpio, event) || debounce_edge(gpio, event)) {
+                return -1;
+            }
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+    // Nothing to deliver unless the timer expired (it's nonblocking)
+    if (read(gpio->debounce_timerfd, &expirations, sizeof(expirations)) < 0) {
+        return -1;
+    }
+    if ((edge = rfs_gpio_get_edge(gpio)) < 0) {
+        return -1;
+    }
+    value = gpio->debounce_value;
+    event->gpio = gpio;
+    event->value = value;
+    event->timestamp = gpio->debounce_timestamp;
+    gpio->debounce_timestamp = 0;
+    if ((edge == RFS_GPIO_RISING && value != RFS_GPIO_HIGH)
+        || (edge == RFS_GPIO_FALLING && value != RFS_GPIO_LOW)
+        || (edge == RFS_GPIO_BOTH && value == gpio->debounce_delivered))
+    {
+        gpio->debounce_delivered = value;
+        errno = EAGAIN;
+        return -1;
+    }
+    gpio->debounce_delivered = value;
+    return 0;
+}
+
+/* Remove the software debounce filter of a GPIO pin, if any.
+
+   The descriptor of the pin is left opened.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+*/
+void
+debounce_close(struct gpio_t *gpio)
+{
+    if (gpio->debounce_fd >= 0) {
+        close(gpio->debounce_fd);
+        gpio->debounce_fd = -1;
+    }
+    if (gpio->debounce_timerfd >= 0) {
+        close(gpio->debounce_timerfd);
+        gpio->debounce_timerfd = -1;
+    }
+}
@@ -0,0 +1,65 @@
+/* debounce.h
+   Software filter to debounce the edge events of GPIO pins.
+   
+   Copyright 2018 Antonio Serrano Hernandez
+
+   This file is part of rfsgpio.
+
+   rfsgpio is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   rfsgpio is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with rfsgpio; see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DEBOUNCE_H
+#define DEBOUNCE_H
+
+#include "rfsgpio.h"
+
+#include <stdint.h> // uint32_t
+
+// Function that reads a raw edge event of a pin, from its own descriptor
+typedef int (*debounce_read_t)(struct gpio_t *gpio,
+    struct gpio_event_t *event);
+
+/* Install the software debounce filter of a GPIO pin.
+
+   Parameters:
+     * gpio: GPIO pin descriptor, with its descriptor opened and the field
+         debounce set.
+     * events: epoll events signaled by the descriptor of the pin on an edge.
+     * value: current value of the pin.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+debounce_open(struct gpio_t *gpio, uint32_t events, enum gpio_value_t value);
+
+/* Read an edge event of a GPIO pin through its debounce filter.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+     * event: where to store the event.
+     * read_raw: function to read the raw edge events of the pin.
+
+   Return 0 if a settled transition was read, -1 otherwise (and errno is set
+   accordingly, EAGAIN if the transition is still settling or was a glitch).
+*/
+int
+debounce_read_event(struct gpio_t *gpio, struct gpio_event_t *event,
+    debounce_read_t read_raw);
+
+/* Remove the software debounce filter of a GPIO pin, if any. */
+void
+debounce_close(struct gpio_t *gpio);
+
+#endif
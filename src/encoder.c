@@ -0,0 +1,334 @@
+/* encoder.c
+   Decoder of quadrature encoders connected to two GPIO inputs.
+   
+   Copyright 2018 Antonio Serrano Hernandez
+
+   This file is part of rfsgpio.
+
+   rfsgpio is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   rfsgpio is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with rfsgpio; see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+#include "rfsgpio.h"
+#include "thread.h"
+
+#include <errno.h>  // errno
+#include <time.h>   // clock_gettime
+
+// Marks an illegal transition in encoder_transitions
+#define ILLEGAL 2
+
+/* Steps of each transition, indexed by the previous state (value of A in bit
+   1, value of B in bit 0) times 4 plus the new state. Forward is the sequence
+   00, 10, 11, 01 (A leading B). An edge that leaves the state as it was means
+   that an edge of that channel was lost (or was a glitch too short to be
+   read), and both channels can't change at once: these are illegal.
+*/
+static const int encoder_transitions[16] = {
+    ILLEGAL, -1, 1, ILLEGAL,
+    1, ILLEGAL, ILLEGAL, -1,
+    -1, ILLEGAL, ILLEGAL, 1,
+    ILLEGAL, 1, -1, ILLEGAL
+};
+
+/* Return the current time, in nanoseconds (CLOCK_MONOTONIC). */
+static uint64_t
+encoder_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Record a step of an encoder and update its velocity.
+
+   The velocity is the displacement over the last RFS_ENCODER_STEPS steps
+   divided by their time span. It is published between two increments of the
+   sequence number, so the readers can tell when they read it in the middle
+   of an update.
+
+   Parameters:
+     * encoder: the encoder descriptor.
+     * position: position after the step.
+     * timestamp: time of the step.
+*/
+static void
+encoder_step(struct encoder_t *encoder, long long position,
+    uint64_t timestamp)
+{
+    unsigned int i = encoder->steps % RFS_ENCODER_STEPS;
+    unsigned int oldest;
+    unsigned int sequence = encoder->sequence;
+    double velocity = 0;
+
+    encoder->step_positions[i] = position;
+    encoder->step_times[i] = timestamp;
+    encoder->steps++;
+    if (encoder->steps > 1) {
+        oldest = (encoder->steps < RFS_ENCODER_STEPS) ? 0
+            : encoder->steps % RFS_ENCODER_STEPS;
+        if (timestamp > encoder->step_times[oldest]) {
+            velocity = (position - encoder->step_positions[oldest]) * 1e9
+                / (timestamp - encoder->step_times[oldest]);
+        }
+    }
+    __atomic_store_n(&encoder->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store(&encoder->velocity, &velocity, __ATOMIC_RELAXED);
+    __atomic_store_n(&encoder->last_step, timestamp, __ATOMIC_RELAXED);
+    __atomic_store_n(&encoder->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+/* Decode an edge event of one of the channels of an encoder.
+
+   Parameters:
+     * event: the edge event.
+     * data: the encoder descriptor.
+*/
+static void
+encoder_edge(const struct gpio_event_t *event, void *data)
+{
+    struct encoder_t *encoder = data;
+    int state, steps;
+
+    state = (event->gpio == encoder->a) ?
+        (encoder->state & 1) | (event->value << 1)
+        : (encoder->state & 2) | event->value;
+    steps = encoder_transitions[encoder->state * 4 + state];
+    encoder->state = state;
+    if (steps == ILLEGAL) {
+        __atomic_store_n(&encoder->illegal, encoder->illegal + 1,
+            __ATOMIC_RELAXED);
+        return;
+    }
+    __atomic_store_n(&encoder->position, encoder->position + steps,
+        __ATOMIC_RELAXED);
+    encoder_step(encoder, encoder->position, event->timestamp);
+}
+
+/* Main function of the decoder thread.
+
+   Parameters:
+     * arg: the encoder descriptor.
+*/
+static void *
+encoder_run(void *arg)
+{
+    struct encoder_t *encoder = arg;
+
+    while (__atomic_load_n(&encoder->running, __ATOMIC_ACQUIRE)) {
+        // An error other than an interruption stops the thread
+        if (rfs_event_loop_run(&encoder->loop, -1) < 0 && errno != EINTR) {
+            __atomic_store_n(&encoder->error, errno, __ATOMIC_RELEASE);
+            break;
+        }
+    }
+    return NULL;
+}
+
+/* Open a quadrature encoder decoder.
+
+   Parameters:
+     * encoder: the encoder descriptor.
+     * a: GPIO pin of the channel A, already opened as input.
+     * b: GPIO pin of the channel B, already opened as input.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_encoder_open(struct encoder_t *encoder, struct gpio_t *a,
+    struct gpio_t *b)
+{
+    int va, vb, e;
+
+    if (rfs_gpio_set_edge(a, RFS_GPIO_BOTH)
+        || rfs_gpio_set_edge(b, RFS_GPIO_BOTH)
+        || (va = rfs_gpio_get_value(a)) < 0
+        || (vb = rfs_gpio_get_value(b)) < 0)
+    {
+        return -1;
+    }
+    encoder->a = a;
+    encoder->b = b;
+    encoder->state = (va << 1) | vb;
+    encoder->steps = 0;
+    encoder->position = 0;
+    encoder->illegal = 0;
+    encoder->sequence = 0;
+    encoder->velocity = 0;
+    encoder->last_step = 0;
+    encoder->error = 0;
+    encoder->running = 0;
+    if (rfs_event_loop_open(&encoder->loop)) {
+        return -1;
+    }
+    if (rfs_event_loop_add(&encoder->loop, a, encoder_edge, encoder)) {
+        e = errno;
+        rfs_event_loop_close(&encoder->loop);
+        errno = e;
+        return -1;
+    }
+    if (rfs_event_loop_add(&encoder->loop, b, encoder_edge, encoder)) {
+        e = errno;
+        rfs_event_loop_remove(&encoder->loop, a);
+        rfs_event_loop_close(&encoder->loop);
+        errno = e;
+        return -1;
+    }
+    return 0;
+}
+
+/* Start the decoder thread.
+
+   Parameters:
+     * encoder: the encoder descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_encoder_start(struct encoder_t *encoder)
+{
+    if (encoder->running) {
+        errno = EBUSY;
+        return -1;
+    }
+    encoder->error = 0;
+    encoder->running = 1;
+    if (thread_start(&encoder->thread, encoder_run, encoder)) {
+        encoder->running = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/* Return the position of an encoder, in steps.
+
+   Parameters:
+     * encoder: the encoder descriptor.
+*/
+long long
+rfs_encoder_position(struct encoder_t *encoder)
+{
+    return __atomic_load_n(&encoder->position, __ATOMIC_RELAXED);
+}
+
+/* Return the velocity of an encoder, in steps per second.
+
+   If the time since the last step is longer than the time per step at the
+   velocity computed, the encoder has slowed down: at most one step was done
+   in that time, so that bound is returned instead.
+
+   Parameters:
+     * encoder: the encoder descriptor.
+*/
+double
+rfs_encoder_velocity(struct encoder_t *encoder)
+{
+    unsigned int sequence;
+    uint64_t last_step, now;
+    double velocity, bound;
+
+    // Retry while the decoder thread is updating the velocity
+    do {
+        sequence = __atomic_load_n(&encoder->sequence, __ATOMIC_ACQUIRE);
+        __atomic_load(&encoder->velocity, &velocity, __ATOMIC_RELAXED);
+        last_step = __atomic_load_n(&encoder->last_step, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (sequence & 1
+        || sequence != __atomic_load_n(&encoder->sequence, __ATOMIC_RELAXED));
+    now = encoder_now();
+    if (!last_step || now <= last_step) {
+        return velocity;
+    }
+    bound = 1e9 / (now - last_step);
+    if (velocity > bound) {
+        return bound;
+    }
+    if (velocity < -bound) {
+        return -bound;
+    }
+    return velocity;
+}
+
+/* Return the number of illegal transitions decoded.
+
+   Parameters:
+     * encoder: the encoder descriptor.
+*/
+unsigned long
+rfs_encoder_illegal(struct encoder_t *encoder)
+{
+    return __atomic_load_n(&encoder->illegal, __ATOMIC_RELAXED);
+}
+
+/* Return the error that stopped the decoder thread.
+
+   Parameters:
+     * encoder: the encoder descriptor.
+
+   Return the errno value, or 0 if the thread wasn't stopped by an error.
+*/
+int
+rfs_encoder_error(struct encoder_t *encoder)
+{
+    return __atomic_load_n(&encoder->error, __ATOMIC_ACQUIRE);
+}
+
+/* Stop the decoder thread.
+
+   Parameters:
+     * encoder: the encoder descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_encoder_stop(struct encoder_t *encoder)
+{
+    if (!encoder->running) {
+        errno = EINVAL;
+        return -1;
+    }
+    __atomic_store_n(&encoder->running, 0, __ATOMIC_RELEASE);
+    if (rfs_event_loop_wakeup(&encoder->loop)
+        || thread_join(encoder->thread))
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/* Close a quadrature encoder decoder.
+
+   The pins are removed from the event loop of the decoder, so they can be
+   used again by other loops.
+
+   Parameters:
+     * encoder: the encoder descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_encoder_close(struct encoder_t *encoder)
+{
+    if (encoder->running && rfs_encoder_stop(encoder)) {
+        return -1;
+    }
+    if (rfs_event_loop_remove(&encoder->loop, encoder->a)
+        || rfs_event_loop_remove(&encoder->loop, encoder->b))
+    {
+        return -1;
+    }
+    return rfs_event_loop_close(&encoder->loop);
+}
@@ -0,0 +1,414 @@
+/* event.c
+   Functions to wait for the edge events of GPIO pins.
+   
+   Copyright 2018 Antonio Serrano Hernandez
+
+   This file is part of rfsgpio.
+
+   rfsgpio is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   rfsgpio is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with rfsgpio; see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+#include "rfsgpio.h"
+#include "busypoll.h"
+#include "probes.h"
+#include "stats.h"
+
+#include <errno.h>          // errno
+#include <sys/epoll.h>      // epoll_create1
+#include <sys/eventfd.h>    // eventfd
+#include <time.h>           // clock_gettime
+#include <unistd.h>         // close
+
+// The public function rfs_gpio_wait_edge wraps the static function
+// gpio_wait_edge: the call is counted in the statistics and traced by the
+// probes gpio_wait_edge_entry and gpio_wait_edge_return.
+
+/* Return whether other pin of the same bank is in an event loop.
+
+   The pins of a bank opened with RFS_CHARDEV share the descriptor of the line
+   request, so it is in the epoll instance while any of them is in the loop.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+*/
+static int
+event_bank_registered(struct gpio_t *gpio)
+{
+    unsigned int i;
+
+    if (!gpio->bank || !(gpio->flags & RFS_CHARDEV)) {
+        return 0;
+    }
+    for (i = 0; i < gpio->bank->n; i++) {
+        if (&gpio->bank->gpios[i] != gpio && gpio->bank->gpios[i].callback) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Poll a descriptor of a GPIO pin until an edge event is read.
+
+   With a software debounce filter, the edges still settling are not events,
+   so the wait goes on for the rest of the timeout.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+     * pd: the poll descriptor of the pin.
+     * timeout: maximum time to wait, in milliseconds (-1 to wait forever).
+     * event: where to store the event.
+
+   Return 1 if an event was read, 0 if the timeout expired, or -1 in case of
+   error (and errno is set accordingly).
+*/
+static int
+event_poll_edge(struct gpio_t *gpio, struct pollfd *pd, int timeout,
+    struct gpio_event_t *event)
+{
+    struct timespec ts;
+    int64_t deadline = 0;
+    int res;
+
+    if (timeout > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        deadline = (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000 + timeout;
+    }
+    for (;;) {
+        do {
+            STATS_START(start);
+            res = STATS_END(RFS_STATS_POLL, start, poll(pd, 1, timeout));
+        } while (res < 0 && errno == EINTR);
+        if (res <= 0) {
+            return res;
+        }
+        if (!rfs_gpio_read_event(gpio, event)) {
+            return 1;
+        }
+        if (errno != EAGAIN) {
+            return -1;
+        }
+        // A filtered edge, wait for the rest of the timeout
+        if (timeout > 0) {
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            timeout = deadline - ((int64_t)ts.tv_sec * 1000
+                + ts.tv_nsec / 1000000);
+            if (timeout < 0) {
+                timeout = 0;
+            }
+        }
+    }
+}
+
+/* Wait for an edge event of a GPIO pin.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+     * timeout: maximum time to wait, in milliseconds (-1 to wait forever).
+     * event: where to store the event.
+
+   Return 1 if an event was read, 0 if the timeout expired, or -1 in case of
+   error (and errno is set accordingly).
+*/
+static int
+gpio_wait_edge(struct gpio_t *gpio, int timeout,
+    struct gpio_event_t *event)
+{
+    struct pollfd pd;
+    int res, e;
+
+    // The descriptor shared by threads is held during the wait, so no other
+    // thread closes it
+    if ((gpio->flags & (RFS_THREAD_SAFE | RFS_KEEP_OPEN | RFS_CHARDEV
+        | RFS_MMIO)) == RFS_THREAD_SAFE)
+    {
+        if (rfs_gpio_get_poll_descriptors(gpio, &pd)) {
+            return -1;
+        }
+        res = event_poll_edge(gpio, &pd, timeout, event);
+        e = errno;
+        rfs_gpio_put_poll_descriptors(gpio);
+        errno = e;
+        return res;
+    }
+    // The descriptor is only obtained if it is not already opened, otherwise
+    // an event happened after the last read would be lost
+    if (gpio->debounce_fd >= 0) {
+        pd.fd = gpio->debounce_fd;
+        pd.events = POLLIN;
+    } else if (gpio->fd < 0
+        || !(gpio->flags & (RFS_KEEP_OPEN | RFS_CHARDEV)))
+    {
+        if (rfs_gpio_get_poll_descriptors(gpio, &pd)) {
+            return -1;
+        }
+    } else {
+        pd.fd = gpio->fd;
+        pd.events = (gpio->flags & RFS_CHARDEV) ?
+            (POLLIN | POLLERR) : (POLLPRI | POLLERR);
+    }
+    return event_poll_edge(gpio, &pd, timeout, event);
+}
+
+int
+rfs_gpio_wait_edge(struct gpio_t *gpio, int timeout,
+    struct gpio_event_t *event)
+{
+    int res;
+
+    PROBE2(gpio_wait_edge_entry, gpio->pin, timeout);
+    STATS_START(start);
+    res = STATS_END(RFS_STATS_GPIO_WAIT_EDGE, start, gpio->busy_poll ?
+        busy_poll_wait_edge(gpio, timeout, event, gpio_wait_edge)
+        : gpio_wait_edge(gpio, timeout, event));
+    PROBE2(gpio_wait_edge_return, gpio->pin, res);
+    return res;
+}
+
+/* Open an event loop.
+
+   Parameters:
+     * loop: the event loop descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_event_loop_open(struct event_loop_t *loop)
+{
+    struct epoll_event ev;
+    int e;
+
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epfd < 0) {
+        return -1;
+    }
+    // The eventfd to wake up the loop is the only descriptor without pin
+    loop->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (loop->wakefd < 0
+        || epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->wakefd, &ev))
+    {
+        e = errno;
+        if (loop->wakefd >= 0) {
+            close(loop->wakefd);
+        }
+        close(loop->epfd);
+        errno = e;
+        return -1;
+    }
+    return 0;
+}
+
+/* Add a GPIO pin to an event loop.
+
+   Parameters:
+     * loop: the event loop descriptor.
+     * gpio: the GPIO pin.
+     * callback: function called for each edge event of the pin.
+     * data: data passed to the callback.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_event_loop_add(struct event_loop_t *loop, struct gpio_t *gpio,
+    gpio_event_callback_t callback, void *data)
+{
+    struct epoll_event ev;
+    struct pollfd pd;
+
+    if (!callback || !(gpio->flags & (RFS_KEEP_OPEN | RFS_CHARDEV))) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (gpio->callback) {
+        errno = EEXIST;
+        return -1;
+    }
+    // The descriptor of a bank is only added once
+    if (!event_bank_registered(gpio)) {
+        // This also clears any pending event of a sysfs pin
+        if (rfs_gpio_get_poll_descriptors(gpio, &pd)) {
+            return -1;
+        }
+        ev.events = ((pd.events & POLLIN) ? EPOLLIN : EPOLLPRI) | EPOLLERR;
+        ev.data.ptr = gpio;
+        // The callback is set first, the loop may be running in other thread
+        gpio->callback_data = data;
+        __atomic_store_n(&gpio->callback, callback, __ATOMIC_RELEASE);
+        if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, pd.fd, &ev)) {
+            gpio->callback = NULL;
+            gpio->callback_data = NULL;
+            return -1;
+        }
+        return 0;
+    }
+    gpio->callback_data = data;
+    __atomic_store_n(&gpio->callback, callback, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* Remove a GPIO pin from an event loop.
+
+   Parameters:
+     * loop: the event loop descriptor.
+     * gpio: the GPIO pin.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_event_loop_remove(struct event_loop_t *loop, struct gpio_t *gpio)
+{
+    if (!gpio->callback) {
+        errno = ENOENT;
+        return -1;
+    }
+    if (!event_bank_registered(gpio)
+        && epoll_ctl(loop->epfd, EPOLL_CTL_DEL,
+            (gpio->debounce_fd >= 0) ? gpio->debounce_fd : gpio->fd, NULL))
+    {
+        return -1;
+    }
+    __atomic_store_n(&gpio->callback, NULL, __ATOMIC_RELEASE);
+    gpio->callback_data = NULL;
+    return 0;
+}
+
+/* Sort the events read in a wakeup of an event loop by their timestamps.
+
+   The events of each pin are already in order, so an insertion sort merges
+   them in a few passes.
+
+   Parameters:
+     * events: the events.
+     * n: number of events.
+*/
+static void
+event_sort(struct gpio_event_t *events, int n)
+{
+    struct gpio_event_t event;
+    int i, j;
+
+    for (i = 1; i < n; i++) {
+        event = events[i];
+        for (j = i; j > 0 && events[j - 1].timestamp > event.timestamp; j--) {
+            events[j] = events[j - 1];
+        }
+        events[j] = event;
+    }
+}
+
+/* Wait for the edge events of the pins of an event loop and dispatch them.
+
+   Parameters:
+     * loop: the event loop descriptor.
+     * timeout: maximum time to wait, in milliseconds (-1 to wait forever).
+
+   Return the number of events dispatched (0 if the timeout expired), or -1 in
+   case of error (and errno is set accordingly).
+*/
+int
+rfs_event_loop_run(struct event_loop_t *loop, int timeout)
+{
+    struct epoll_event events[RFS_EVENT_LOOP_MAX_EVENTS];
+    struct gpio_event_t batch[RFS_EVENT_LOOP_MAX_EVENTS];
+    gpio_event_callback_t callback;
+    struct gpio_t *gpio;
+    uint64_t wakeups;
+    int n, i, m, nread = 0, dispatched = 0, e = 0;
+
+    n = epoll_wait(loop->epfd, events, RFS_EVENT_LOOP_MAX_EVENTS, timeout);
+    if (n < 0) {
+        return (errno == EINTR) ? 0 : -1;
+    }
+    for (i = 0; i < n; i++) {
+        gpio = events[i].data.ptr;
+        // A wake up, just clear it
+        if (!gpio) {
+            if (read(loop->wakefd, &wakeups, sizeof(wakeups)) < 0
+                && errno != EAGAIN)
+            {
+                return -1;
+            }
+            continue;
+        }
+        // Reading the events rearms the descriptor (with RFS_CHARDEV, the
+        // queued ones are read at once, as many as fit in the batch). With a
+        // bank, each event can belong to other pin of the bank. The edges
+        // filtered by a debounce filter give no event
+        m = RFS_EVENT_LOOP_MAX_EVENTS - nread - (n - i - 1);
+        m = rfs_gpio_read_events(gpio, batch + nread,
+            (m < RFS_GPIO_EVENT_BATCH) ? m : RFS_GPIO_EVENT_BATCH);
+        if (m < 0) {
+            if (errno == EAGAIN) {
+                continue;
+            }
+            // The events already read are dispatched anyway
+            e = errno;
+            break;
+        }
+        nread += m;
+    }
+    // The events of different pins are dispatched in the order they happened
+    event_sort(batch, nread);
+    for (i = 0; i < nread; i++) {
+        callback = __atomic_load_n(&batch[i].gpio->callback, __ATOMIC_ACQUIRE);
+        if (callback) {
+            callback(&batch[i], batch[i].gpio->callback_data);
+            dispatched++;
+        }
+    }
+    if (e) {
+        errno = e;
+        return -1;
+    }
+    return dispatched;
+}
+
+/* Wake up an event loop.
+
+   Parameters:
+     * loop: the event loop descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_event_loop_wakeup(struct event_loop_t *loop)
+{
+    uint64_t one = 1;
+
+    if (write(loop->wakefd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Close an event loop.
+
+   Parameters:
+     * loop: the event loop descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_event_loop_close(struct event_loop_t *loop)
+{
+    close(loop->wakefd);
+    loop->wakefd = -1;
+    if (close(loop->epfd)) {
+        return -1;
+    }
+    loop->epfd = -1;
+    return 0;
+}
@@ -22,13 +22,27 @@
 */
 
 #include "rfsgpio.h"
+#include "chardev.h"
+#include "debounce.h"
+#include "mmio.h"
+#include "probes.h"
+#include "stats.h"
 #include "sysfs.h"
+#include "writequeue.h"
 
-#include <errno.h>  // errno
-#include <fcntl.h>  // open
-#include <stdio.h>  // snprintf
-#include <string.h> // strcmp
-#include <unistd.h> // close
+#include <errno.h>     // errno
+#include <fcntl.h>     // open
+#include <stdio.h>     // snprintf
+#include <stdlib.h>    // malloc
+#include <string.h>    // strcmp
+#include <sys/epoll.h> // EPOLLIN
+#include <time.h>      // clock_gettime
+#include <unistd.h>    // close, R_OK
+
+// Each public function rfs_gpio_X wraps the static function gpio_X: the call
+// is traced by the probes gpio_X_entry and gpio_X_return, and the main ones
+// are counted in the statistics too. The edge events read are traced by the
+// probe gpio_edge.
 
 #define RFS_GPIO_BASE_DIR       "/sys/class/gpio/"
 #define RFS_GPIO_EXPORT_FILE    RFS_GPIO_BASE_DIR "export"
@@ -38,6 +52,15 @@
 #define RFS_GPIO_VALUE_FILE     RFS_GPIO_PIN_DIR "value"
 #define RFS_GPIO_EDGE_FILE      RFS_GPIO_PIN_DIR "edge"
 
+// One reference to the shared poll descriptor, and the descriptor stored with
+// its references
+#define GPIO_POLL_REF           (1ULL << 32)
+#define GPIO_POLL_FD(ref)       ((int)((ref) & 0xffffffff) - 1)
+
+// Whether the polled descriptor of a pin is the shared one of RFS_THREAD_SAFE
+#define GPIO_SHARED_POLL(gpio)  (((gpio)->flags & (RFS_THREAD_SAFE \
+    | RFS_KEEP_OPEN | RFS_CHARDEV | RFS_MMIO)) == RFS_THREAD_SAFE)
+
 // Possible values to write to the direction file
 static const char *gpio_direction_str[] = {"in", "out", "low", "high"};
 
@@ -47,6 +70,218 @@ static const char *gpio_value_str[] = {"0", "1"};
 // Possible values to write to the edge file
 static const char *gpio_edge_str[] = {"none", "rising", "falling", "both"};
 
+/* Write the pin number to the export or unexport file.
+
+   Parameters:
+     * file: format of the export or unexport file name.
+     * pin: the GPIO pin number.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+static int
+gpio_write_export(const char *file, gpio_pin_t pin)
+{
+    char path[RFS_GPIO_FILENAME_MAX_LEN];
+    char pinstr[RFS_MAX_SYSFS_STR];
+
+    if (sysfs_path(path, RFS_GPIO_FILENAME_MAX_LEN, "%s", file)) {
+        return -1;
+    }
+    snprintf(pinstr, RFS_MAX_SYSFS_STR, "%hhu", pin);
+    return write_sysfs_file(path, pinstr);
+}
+
+/* Wait until the files of a pin that was just exported are accessible.
+
+   The value file must be readable and the direction file writable, as it is
+   written when opening the pin.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+static int
+gpio_wait_files(struct gpio_t *gpio)
+{
+    long long deadline = sysfs_wait_deadline();
+
+    return wait_sysfs_file(gpio->value_file, R_OK, deadline)
+        || wait_sysfs_file(gpio->direction_file, W_OK, deadline) ? -1 : 0;
+}
+
+/* Open the files of a pin that are kept opened with RFS_KEEP_OPEN.
+
+   The value file must be opened. The direction and edge files may not exist
+   (for pins with a fixed direction or without interrupt support) or may not be
+   accessible, in that case their descriptors stay at -1 and the operations
+   over them use the file name, reporting the errors as usual.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+static int
+gpio_open_files(struct gpio_t *gpio)
+{
+    gpio->fd = open_sysfs_file(gpio->value_file);
+    if (gpio->fd < 0) {
+        return -1;
+    }
+    gpio->direction_fd = open_sysfs_file(gpio->direction_file);
+    gpio->edge_fd = open_sysfs_file(gpio->edge_file);
+    return 0;
+}
+
+/* Close all the opened files of a pin.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+*/
+static void
+gpio_close_files(struct gpio_t *gpio)
+{
+    close_sysfs_fd(&gpio->fd);
+    close_sysfs_fd(&gpio->direction_fd);
+    close_sysfs_fd(&gpio->edge_fd);
+    // The shared poll descriptor is closed even if it was not released
+    if (gpio->poll_ref) {
+        close(GPIO_POLL_FD(gpio->poll_ref));
+        gpio->poll_ref = 0;
+    }
+}
+
+/* Initialize the descriptor of a GPIO pin that is being opened.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+static int
+gpio_init(struct gpio_t *gpio)
+{
+    // The cache can't be shared by threads
+    if (gpio->flags & RFS_THREAD_SAFE && gpio->flags & RFS_CACHE) {
+        errno = EINVAL;
+        return -1;
+    }
+    // Initialize the file names for this pin
+    if (sysfs_path(gpio->direction_file, RFS_GPIO_FILENAME_MAX_LEN,
+            RFS_GPIO_DIRECTION_FILE, gpio->pin)
+        || sysfs_path(gpio->value_file, RFS_GPIO_FILENAME_MAX_LEN,
+            RFS_GPIO_VALUE_FILE, gpio->pin)
+        || sysfs_path(gpio->edge_file, RFS_GPIO_FILENAME_MAX_LEN,
+            RFS_GPIO_EDGE_FILE, gpio->pin))
+    {
+        return -1;
+    }
+
+    // Initialize the file descriptors
+    gpio->fd = -1;
+    gpio->poll_ref = 0;
+    gpio->direction_fd = -1;
+    gpio->edge_fd = -1;
+    gpio->line = 0;
+    gpio->regs = NULL;
+    gpio->cached_direction = -1;
+    gpio->cached_edge = -1;
+    gpio->bank = NULL;
+    gpio->write_queue = NULL;
+    gpio->callback = NULL;
+    gpio->callback_data = NULL;
+    gpio->debounce = 0;
+    gpio->debounce_fd = -1;
+    gpio->debounce_timerfd = -1;
+    gpio->busy_poll = 0;
+    return 0;
+}
+
+/* Set up a pin once exported, or directly open it with the character device
+   or the registers.
+
+   For sysfs, wait for the files of the pin (if it was exported), open them
+   and set the pin mode. In case of error the files are closed, but the pin is
+   not unexported.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+     * direction: initial direction of the pin.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+static int
+gpio_setup(struct gpio_t *gpio, enum gpio_direction_t direction)
+{
+    int e;
+
+    // With the character device there's no export and no sysfs files
+    if (gpio->flags & RFS_CHARDEV) {
+        return chardev_open(gpio, direction);
+    }
+    // The registers are accessed directly, there's no export either
+    if (gpio->flags & RFS_MMIO) {
+        return mmio_open(gpio, direction);
+    }
+    if ((!(gpio->flags & RFS_DONT_EXPORT) && gpio_wait_files(gpio))
+        || (gpio->flags & RFS_KEEP_OPEN && gpio_open_files(gpio))
+        || rfs_gpio_set_direction(gpio, direction))
+    {
+        e = errno;
+        gpio_close_files(gpio);
+        errno = e;
+        return -1;
+    }
+    return 0;
+}
+
+// Defined below with the other setters
+static int gpio_set_direction(struct gpio_t *gpio,
+    enum gpio_direction_t direction);
+
+/* Release a pin before unexporting it.
+
+   The pin is detached from its write queue, once its writes are done. For
+   sysfs, the direction is set to RFS_GPIO_IN and the files are closed.
+   The pins of the character device and the registers are closed.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+static int
+gpio_release(struct gpio_t *gpio)
+{
+    int res;
+
+    // The writes left in a write queue would be done once the pin is closed,
+    // and the release is written right away
+    if (write_queue_detach(&gpio->write_queue)) {
+        return -1;
+    }
+    debounce_close(gpio);
+    if (gpio->flags & RFS_CHARDEV) {
+        return chardev_close(gpio);
+    }
+    if (gpio->flags & RFS_MMIO) {
+        return mmio_close(gpio);
+    }
+    res = gpio_set_direction(gpio, RFS_GPIO_IN);
+    // Close the file descriptors of the pin files, either kept opened or left
+    // opened for polling purposes
+    gpio_close_files(gpio);
+    return res;
+}
+
+/* Return whether a pin was exported by this library. */
+static int
+gpio_exported(const struct gpio_t *gpio)
+{
+    return !(gpio->flags & (RFS_DONT_EXPORT | RFS_CHARDEV | RFS_MMIO));
+}
+
 /* Open a GPIO pin.
 
    The pin is first exported and then the direction set. If the flag
@@ -68,47 +303,69 @@ static const char *gpio_edge_str[] = {"none", "rising", "falling", "both"};
    Return 0 if the pin was successfully opened, -1 otherwise. In case of error,
    errno is set accordingly.
 */
-int
-rfs_gpio_open(struct gpio_t *gpio, enum gpio_direction_t direction)
+static int
+gpio_open(struct gpio_t *gpio, enum gpio_direction_t direction)
 {
-    char pinstr[RFS_MAX_SYSFS_STR];
+    int e;
 
     // Check direction value
     if (direction < RFS_GPIO_IN || direction > RFS_GPIO_OUT_HIGH) {
         errno = EINVAL;
         return -1;
     }
-
-    // Initialize the file names for this pin
-    snprintf(gpio->direction_file, RFS_GPIO_FILENAME_MAX_LEN,
-        RFS_GPIO_DIRECTION_FILE, gpio->pin);
-    snprintf(gpio->value_file, RFS_GPIO_FILENAME_MAX_LEN, RFS_GPIO_VALUE_FILE,
-        gpio->pin);
-    snprintf(gpio->edge_file, RFS_GPIO_FILENAME_MAX_LEN, RFS_GPIO_EDGE_FILE,
-        gpio->pin);
-
-    // Initialize the fd of the value file
-    gpio->fd = -1;
+    if (gpio_init(gpio)) {
+        return -1;
+    }
 
     // Export the pin, if necessary
-    if (!(gpio->flags & RFS_DONT_EXPORT)) {
-        snprintf(pinstr, RFS_MAX_SYSFS_STR, "%hhu", gpio->pin);
-        if (write_sysfs_file(RFS_GPIO_EXPORT_FILE, pinstr)) {
+    if (gpio_exported(gpio)) {
+        if (gpio_write_export(RFS_GPIO_EXPORT_FILE, gpio->pin)) {
             return -1;
         }
     }
 
-    // Set the pin mode
-    if (rfs_gpio_set_direction(gpio, direction)) {
+    if (gpio_setup(gpio, direction)) {
         // In case of error, unexport the pin (if it was actually exported)
-        if (!(gpio->flags & RFS_DONT_EXPORT)) {
-            write_sysfs_file(RFS_GPIO_UNEXPORT_FILE, pinstr);
+        e = errno;
+        if (gpio_exported(gpio)) {
+            gpio_write_export(RFS_GPIO_UNEXPORT_FILE, gpio->pin);
         }
+        errno = e;
         return -1;
     }
     return 0;
 }
 
+int
+rfs_gpio_open(struct gpio_t *gpio, enum gpio_direction_t direction)
+{
+    int res;
+
+    PROBE2(gpio_open_entry, gpio->pin, direction);
+    STATS_START(start);
+    res = STATS_END(RFS_STATS_GPIO_OPEN, start, gpio_open(gpio, direction));
+    PROBE2(gpio_open_return, gpio->pin, res);
+    return res;
+}
+
+/* Store an attribute of a pin in its cache.
+
+   Only done with RFS_CACHE: without it the pin may be shared by threads, that
+   must not write the same fields.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+     * cached: the cached attribute.
+     * value: its value (-1 if unknown).
+*/
+static void
+gpio_cache(const struct gpio_t *gpio, int *cached, int value)
+{
+    if (gpio->flags & RFS_CACHE) {
+        *cached = value;
+    }
+}
+
 /* Return the current direction of a GPIO pin.
 
    Parameters:
@@ -117,18 +374,42 @@ rfs_gpio_open(struct gpio_t *gpio, enum gpio_direction_t direction)
    Return a value of the enum gpio_direction_t, or -1 in case of error. In the
    latter case, errno is set accordingly.
 */
-int
-rfs_gpio_get_direction(struct gpio_t *gpio)
+static int
+gpio_get_direction(struct gpio_t *gpio)
 {
     char dirstr[RFS_MAX_SYSFS_STR];
+    int direction;
 
-    if (read_sysfs_file(gpio->direction_file, dirstr, RFS_MAX_SYSFS_STR)) {
-        return -1;
+    if (gpio->flags & RFS_CHARDEV) {
+        return chardev_get_direction(gpio);
+    }
+    if (gpio->flags & RFS_MMIO) {
+        return mmio_get_direction(gpio);
     }
-    if (strcmp(dirstr, "out\n") == 0) {
-        return RFS_GPIO_OUT;
+    if (gpio->flags & RFS_CACHE && gpio->cached_direction >= 0) {
+        return gpio->cached_direction;
+    }
+    if (read_sysfs_attr(gpio->direction_fd, gpio->direction_file, dirstr,
+        RFS_MAX_SYSFS_STR))
+    {
+        return -1;
     }
-    return RFS_GPIO_IN;
+    direction = (strcmp(dirstr, "out\n") == 0) ? RFS_GPIO_OUT : RFS_GPIO_IN;
+    gpio_cache(gpio, &gpio->cached_direction, direction);
+    return direction;
+}
+
+int
+rfs_gpio_get_direction(struct gpio_t *gpio)
+{
+    int res;
+
+    PROBE1(gpio_get_direction_entry, gpio->pin);
+    STATS_START(start);
+    res = STATS_END(RFS_STATS_GPIO_GET_DIRECTION, start,
+        gpio_get_direction(gpio));
+    PROBE2(gpio_get_direction_return, gpio->pin, res);
+    return res;
 }
 
 /* Return the current edge of a GPIO pin.
@@ -139,22 +420,97 @@ rfs_gpio_get_direction(struct gpio_t *gpio)
    Return a value of the enum gpio_edge_t, or -1 in case of error. In the
    latter case, errno is set accordingly.
 */
-int
-rfs_gpio_get_edge(struct gpio_t *gpio)
+static int
+gpio_get_edge(struct gpio_t *gpio)
 {
     char edgestr[RFS_MAX_SYSFS_STR];
+    int edge;
 
-    if (read_sysfs_file(gpio->edge_file, edgestr, RFS_MAX_SYSFS_STR)) {
+    if (gpio->flags & RFS_CHARDEV) {
+        return chardev_get_edge(gpio);
+    }
+    // The registers give no edge events
+    if (gpio->flags & RFS_MMIO) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    if (gpio->flags & RFS_CACHE && gpio->cached_edge >= 0) {
+        return gpio->cached_edge;
+    }
+    if (read_sysfs_attr(gpio->edge_fd, gpio->edge_file, edgestr,
+        RFS_MAX_SYSFS_STR))
+    {
         return -1;
     }
     if (strcmp(edgestr, "rising\n") == 0) {
-        return RFS_GPIO_RISING;
+        edge = RFS_GPIO_RISING;
     } else if (strcmp(edgestr, "falling\n") == 0) {
-        return RFS_GPIO_FALLING;
+        edge = RFS_GPIO_FALLING;
     } else if (strcmp(edgestr, "both\n") == 0) {
-        return RFS_GPIO_BOTH;
+        edge = RFS_GPIO_BOTH;
+    } else {
+        edge = RFS_GPIO_NONE;
+    }
+    gpio_cache(gpio, &gpio->cached_edge, edge);
+    return edge;
+}
+
+int
+rfs_gpio_get_edge(struct gpio_t *gpio)
+{
+    int res;
+
+    PROBE1(gpio_get_edge_entry, gpio->pin);
+    STATS_START(start);
+    res = STATS_END(RFS_STATS_GPIO_GET_EDGE, start, gpio_get_edge(gpio));
+    PROBE2(gpio_get_edge_return, gpio->pin, res);
+    return res;
+}
+
+/* Take a reference to the poll descriptor shared by the threads, opening it
+   if no thread holds it.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+     * opened: where to store whether the descriptor was opened by this call.
+
+   Return the descriptor, or -1 in case of error (and errno is set
+   accordingly).
+*/
+static int
+gpio_take_poll_fd(struct gpio_t *gpio, int *opened)
+{
+    uint64_t ref;
+    int fd;
+
+    ref = __atomic_load_n(&gpio->poll_ref, __ATOMIC_ACQUIRE);
+    for (;;) {
+        // Opened: the reference is only taken if it wasn't closed meanwhile
+        if (ref) {
+            if (__atomic_compare_exchange_n(&gpio->poll_ref, &ref,
+                ref + GPIO_POLL_REF, 1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            {
+                *opened = 0;
+                return GPIO_POLL_FD(ref);
+            }
+            continue;
+        }
+        STATS_START(start);
+        fd = STATS_END(RFS_STATS_OPEN, start,
+            open(gpio->value_file, O_RDONLY));
+        if (fd < 0) {
+            return -1;
+        }
+        if (__atomic_compare_exchange_n(&gpio->poll_ref, &ref,
+            GPIO_POLL_REF | (uint64_t)(fd + 1), 0, __ATOMIC_ACQ_REL,
+            __ATOMIC_ACQUIRE))
+        {
+            *opened = 1;
+            return fd;
+        }
+        // Another thread opened it first, its descriptor is taken instead
+        close(fd);
     }
-    return RFS_GPIO_NONE;
 }
 
 /* Return the poll descriptors, used to call poll over this pin.
@@ -168,21 +524,60 @@ rfs_gpio_get_edge(struct gpio_t *gpio)
    Return 0 if the pin was successfully opened, -1 otherwise. In case of error,
    errno is set accordingly.
 */
-int
-rfs_gpio_get_poll_descriptors(struct gpio_t *gpio, struct pollfd *descriptors)
+static int
+gpio_get_poll_descriptors(struct gpio_t *gpio, struct pollfd *descriptors)
 {
-    char dummy;
+    char dummy[RFS_MAX_SYSFS_STR];
+    int fd, opened, e;
 
-    if (gpio->fd >= 0) {
-        close(gpio->fd);
+    // The epoll instance of a software debounce filter signals both the edges
+    // and the settle timer as input data
+    if (gpio->debounce_fd >= 0) {
+        descriptors->fd = gpio->debounce_fd;
+        descriptors->events = POLLIN;
+        return 0;
     }
-    gpio->fd = open(gpio->value_file, O_RDONLY);
-    if (gpio->fd < 0) {
+    // The line request of the character device signals the events as input
+    // data
+    if (gpio->flags & RFS_CHARDEV) {
+        descriptors->fd = gpio->fd;
+        descriptors->events = POLLIN | POLLERR;
+        return 0;
+    }
+    // The registers give no edge events
+    if (gpio->flags & RFS_MMIO) {
+        errno = ENOTSUP;
         return -1;
     }
+    // The descriptor shared by threads is only cleared when it is opened,
+    // other threads may be polling it
+    if (GPIO_SHARED_POLL(gpio)) {
+        if ((fd = gpio_take_poll_fd(gpio, &opened)) < 0) {
+            return -1;
+        }
+        if (opened && read_sysfs_fd(fd, dummy, RFS_MAX_SYSFS_STR)) {
+            e = errno;
+            rfs_gpio_put_poll_descriptors(gpio);
+            errno = e;
+            return -1;
+        }
+        descriptors->fd = fd;
+        descriptors->events = POLLPRI | POLLERR;
+        return 0;
+    }
+    // With RFS_KEEP_OPEN the value file is already opened
+    if (!(gpio->flags & RFS_KEEP_OPEN)) {
+        close_sysfs_fd(&gpio->fd);
+        STATS_START(start);
+        gpio->fd = STATS_END(RFS_STATS_OPEN, start,
+            open(gpio->value_file, O_RDONLY));
+        if (gpio->fd < 0) {
+            return -1;
+        }
+    }
     // The next line is necessary because otherwise poll returns allways
-    // immediately, but I don't really understand why...
-    if (read(gpio->fd, &dummy, 1) <= 0) {
+    // immediately: the pending event is cleared when the value is read
+    if (read_sysfs_fd(gpio->fd, dummy, RFS_MAX_SYSFS_STR)) {
         return -1;
     }
     // Fill the poll descriptor struct
@@ -191,6 +586,175 @@ rfs_gpio_get_poll_descriptors(struct gpio_t *gpio, struct pollfd *descriptors)
     return 0;
 }
 
+int
+rfs_gpio_get_poll_descriptors(struct gpio_t *gpio, struct pollfd *descriptors)
+{
+    int res;
+
+    PROBE1(gpio_get_poll_descriptors_entry, gpio->pin);
+    res = gpio_get_poll_descriptors(gpio, descriptors);
+    PROBE2(gpio_get_poll_descriptors_return, gpio->pin, res);
+    return res;
+}
+
+/* Release the poll descriptors taken with rfs_gpio_get_poll_descriptors.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+static int
+gpio_put_poll_descriptors(struct gpio_t *gpio)
+{
+    uint64_t ref, next;
+
+    if (!GPIO_SHARED_POLL(gpio)) {
+        return 0;
+    }
+    ref = __atomic_load_n(&gpio->poll_ref, __ATOMIC_ACQUIRE);
+    do {
+        if (!ref) {
+            errno = EINVAL;
+            return -1;
+        }
+        next = (ref >> 32 == 1) ? 0 : ref - GPIO_POLL_REF;
+    } while (!__atomic_compare_exchange_n(&gpio->poll_ref, &ref, next, 1,
+        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+    // The last reference closes it, once no thread can take it anymore
+    if (!next) {
+        close(GPIO_POLL_FD(ref));
+    }
+    return 0;
+}
+
+int
+rfs_gpio_put_poll_descriptors(struct gpio_t *gpio)
+{
+    int res;
+
+    PROBE1(gpio_put_poll_descriptors_entry, gpio->pin);
+    res = gpio_put_poll_descriptors(gpio);
+    PROBE2(gpio_put_poll_descriptors_return, gpio->pin, res);
+    return res;
+}
+
+/* Read a raw edge event of a GPIO pin, from the descriptor of the pin.
+
+   With RFS_CHARDEV the event is read from the line request, with the
+   timestamp given by the kernel. Otherwise, the value is read from the value
+   file (which rearms the poll descriptor) and the event is timestamped when
+   read.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+     * event: where to store the event.
+
+   Return 0 if an event was read, -1 otherwise. In case of error, errno is set
+   accordingly.
+*/
+static int
+gpio_read_raw_event(struct gpio_t *gpio, struct gpio_event_t *event)
+{
+    char valstr[RFS_MAX_SYSFS_STR];
+    struct timespec ts;
+    int fd;
+
+    if (gpio->flags & RFS_CHARDEV) {
+        return chardev_read_event(gpio, event);
+    }
+    // The registers give no edge events
+    if (gpio->flags & RFS_MMIO) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    // Read through the polled descriptor, to rearm it (the shared one is kept
+    // opened by the reference of the caller)
+    fd = GPIO_SHARED_POLL(gpio) ? GPIO_POLL_FD(__atomic_load_n(
+        &gpio->poll_ref, __ATOMIC_ACQUIRE)) : gpio->fd;
+    if (read_sysfs_attr(fd, gpio->value_file, valstr, RFS_MAX_SYSFS_STR)) {
+        return -1;
+    }
+    event->gpio = gpio;
+    event->value = (strcmp(valstr, "0\n") == 0) ? RFS_GPIO_LOW : RFS_GPIO_HIGH;
+    event->timestamp = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    return 0;
+}
+
+/* Read an edge event of a GPIO pin.
+
+   Call it when the poll descriptors of the pin signal an event. The raw
+   edges go through the software debounce filter of the pin, if any.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+     * event: where to store the event.
+
+   Return 0 if an event was read, -1 otherwise. In case of error, errno is set
+   accordingly.
+*/
+static int
+gpio_read_event(struct gpio_t *gpio, struct gpio_event_t *event)
+{
+    if (gpio->debounce_fd >= 0) {
+        return debounce_read_event(gpio, event, gpio_read_raw_event);
+    }
+    return gpio_read_raw_event(gpio, event);
+}
+
+int
+rfs_gpio_read_event(struct gpio_t *gpio, struct gpio_event_t *event)
+{
+    int res;
+
+    if ((res = gpio_read_event(gpio, event)) == 0) {
+        PROBE3(gpio_edge, event->gpio->pin, event->value, event->timestamp);
+    }
+    return res;
+}
+
+/* Read some edge events of a GPIO pin.
+
+   With RFS_CHARDEV (and no software debounce filter) the events queued in the
+   line request are read with a single read. Otherwise only one event is read.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+     * events: where to store the events.
+     * n: maximum number of events to read.
+
+   Return the number of events read, or -1 in case of error (and errno is set
+   accordingly).
+*/
+static int
+gpio_read_events(struct gpio_t *gpio, struct gpio_event_t *events,
+    unsigned int n)
+{
+    if (n < 1) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (gpio->flags & RFS_CHARDEV && gpio->debounce_fd < 0) {
+        return chardev_read_events(gpio, events, n);
+    }
+    return gpio_read_event(gpio, events) ? -1 : 1;
+}
+
+int
+rfs_gpio_read_events(struct gpio_t *gpio, struct gpio_event_t *events,
+    unsigned int n)
+{
+    int res, i;
+
+    res = gpio_read_events(gpio, events, n);
+    for (i = 0; i < res; i++) {
+        PROBE3(gpio_edge, events[i].gpio->pin, events[i].value,
+            events[i].timestamp);
+    }
+    return res;
+}
+
 /* Return the current value of a GPIO pin.
 
    Parameters:
@@ -199,15 +763,24 @@ rfs_gpio_get_poll_descriptors(struct gpio_t *gpio, struct pollfd *descriptors)
    Return a value of the enum gpio_value_t, or -1 in case of error. In the
    latter case, errno is set accordingly.
 */
-int
-rfs_gpio_get_value(struct gpio_t *gpio)
+static int
+gpio_get_value(struct gpio_t *gpio)
 {
     char valstr[RFS_MAX_SYSFS_STR];
 
-    if (gpio->fd >= 0) {
-        close(gpio->fd);
+    if (gpio->flags & RFS_CHARDEV) {
+        return chardev_get_value(gpio);
     }
-    if (read_sysfs_file(gpio->value_file, valstr, RFS_MAX_SYSFS_STR)) {
+    if (gpio->flags & RFS_MMIO) {
+        return mmio_get_value(gpio);
+    }
+    // Without RFS_KEEP_OPEN, a descriptor left opened for polling is closed.
+    // With RFS_THREAD_SAFE it is never used here, and the file is opened apart
+    if (!(gpio->flags & (RFS_KEEP_OPEN | RFS_THREAD_SAFE))) {
+        close_sysfs_fd(&gpio->fd);
+    }
+    if (read_sysfs_attr(gpio->fd, gpio->value_file, valstr, RFS_MAX_SYSFS_STR))
+    {
         return -1;
     }
     if (strcmp(valstr, "0\n") == 0) {
@@ -216,6 +789,18 @@ rfs_gpio_get_value(struct gpio_t *gpio)
     return RFS_GPIO_HIGH;
 }
 
+int
+rfs_gpio_get_value(struct gpio_t *gpio)
+{
+    int res;
+
+    PROBE1(gpio_get_value_entry, gpio->pin);
+    STATS_START(start);
+    res = STATS_END(RFS_STATS_GPIO_GET_VALUE, start, gpio_get_value(gpio));
+    PROBE2(gpio_get_value_return, gpio->pin, res);
+    return res;
+}
+
 /* Set the direction of a GPIO pin (input or output).
 
    Parameters:
@@ -225,22 +810,56 @@ rfs_gpio_get_value(struct gpio_t *gpio)
    Return 0 if the direction was successfully changed, -1 in case of error. In
    this last case, errno is set accordingly.
 */
-int
-rfs_gpio_set_direction(struct gpio_t *gpio, enum gpio_direction_t direction)
+static int
+gpio_set_direction(struct gpio_t *gpio, enum gpio_direction_t direction)
 {
     // Check direction value
     if (direction < RFS_GPIO_IN || direction > RFS_GPIO_OUT_HIGH) {
         errno = EINVAL;
         return -1;
     }
+    if (gpio->flags & RFS_CHARDEV) {
+        return chardev_set_direction(gpio, direction);
+    }
+    if (gpio->flags & RFS_MMIO) {
+        return mmio_set_direction(gpio, direction);
+    }
+    // The output directions also set the value, so they are always written
+    if (gpio->flags & RFS_CACHE && direction == RFS_GPIO_IN
+        && gpio->cached_direction == RFS_GPIO_IN)
+    {
+        return 0;
+    }
     // Write the direction value
-    if (write_sysfs_file(gpio->direction_file, gpio_direction_str[direction]))
+    if (write_sysfs_attr(gpio->direction_fd, gpio->direction_file,
+        gpio_direction_str[direction]))
     {
+        gpio_cache(gpio, &gpio->cached_direction, -1);
         return -1;
     }
+    gpio_cache(gpio, &gpio->cached_direction,
+        (direction == RFS_GPIO_IN) ? RFS_GPIO_IN : RFS_GPIO_OUT);
     return 0;
 }
 
+int
+rfs_gpio_set_direction(struct gpio_t *gpio, enum gpio_direction_t direction)
+{
+    int res;
+
+    // With a write queue, its thread does the write
+    if (write_queue_deferred(gpio->write_queue)) {
+        return rfs_write_queue_push(gpio->write_queue, gpio,
+            RFS_WRITE_GPIO_DIRECTION, direction);
+    }
+    PROBE2(gpio_set_direction_entry, gpio->pin, direction);
+    STATS_START(start);
+    res = STATS_END(RFS_STATS_GPIO_SET_DIRECTION, start,
+        gpio_set_direction(gpio, direction));
+    PROBE3(gpio_set_direction_return, gpio->pin, direction, res);
+    return res;
+}
+
 /* Set the edge of a GPIO pin (input or output).
 
    Parameters:
@@ -250,22 +869,124 @@ rfs_gpio_set_direction(struct gpio_t *gpio, enum gpio_direction_t direction)
    Return 0 if the edge was successfully changed, -1 in case of error. In
    this last case, errno is set accordingly.
 */
-int
-rfs_gpio_set_edge(struct gpio_t *gpio, enum gpio_edge_t edge)
+static int
+gpio_set_edge(struct gpio_t *gpio, enum gpio_edge_t edge)
 {
     // Check edge value
     if (edge < RFS_GPIO_NONE || edge > RFS_GPIO_BOTH) {
         errno = EINVAL;
         return -1;
     }
-    // Write the direction value
-    if (write_sysfs_file(gpio->edge_file, gpio_edge_str[edge]))
+    if (gpio->flags & RFS_CHARDEV) {
+        return chardev_set_edge(gpio, edge);
+    }
+    // The registers give no edge events
+    if (gpio->flags & RFS_MMIO) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    if (gpio->flags & RFS_CACHE && gpio->cached_edge == (int)edge) {
+        return 0;
+    }
+    // Write the edge value
+    if (write_sysfs_attr(gpio->edge_fd, gpio->edge_file, gpio_edge_str[edge]))
     {
+        gpio_cache(gpio, &gpio->cached_edge, -1);
         return -1;
     }
+    gpio_cache(gpio, &gpio->cached_edge, edge);
     return 0;
 }
 
+int
+rfs_gpio_set_edge(struct gpio_t *gpio, enum gpio_edge_t edge)
+{
+    int res;
+
+    PROBE2(gpio_set_edge_entry, gpio->pin, edge);
+    STATS_START(start);
+    res = STATS_END(RFS_STATS_GPIO_SET_EDGE, start, gpio_set_edge(gpio, edge));
+    PROBE3(gpio_set_edge_return, gpio->pin, edge, res);
+    return res;
+}
+
+/* Set the debounce period of the edge events of a GPIO pin.
+
+   With RFS_CHARDEV the kernel debounces the line, unless it rejects the
+   period. In that case, and with sysfs, the software filter is installed.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+     * period: debounce period, in microseconds (0 to disable debouncing).
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+static int
+gpio_set_debounce(struct gpio_t *gpio, unsigned int period)
+{
+    int value;
+
+    // The registers give no edge events
+    if (gpio->flags & RFS_MMIO) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    // The filter would change the descriptor polled by the loop, and the
+    // busy polling would skip it
+    if (gpio->callback || gpio->busy_poll) {
+        errno = EBUSY;
+        return -1;
+    }
+    // A filter already installed just takes the new period
+    if (gpio->debounce_fd >= 0) {
+        if (period) {
+            gpio->debounce = period;
+            return 0;
+        }
+        debounce_close(gpio);
+        gpio->debounce = 0;
+    }
+    if (gpio->flags & RFS_CHARDEV) {
+        if (!chardev_set_debounce(gpio, period)) {
+            return 0;
+        }
+        // The lines of a bank share the descriptor, it can't be filtered
+        if (errno != EINVAL || gpio->bank) {
+            return -1;
+        }
+    } else if (!(gpio->flags & RFS_KEEP_OPEN)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (!period) {
+        gpio->debounce = 0;
+        return 0;
+    }
+    // Reading the value also clears a pending edge of a sysfs pin
+    if ((value = gpio_get_value(gpio)) < 0) {
+        return -1;
+    }
+    gpio->debounce = period;
+    if (debounce_open(gpio, (gpio->flags & RFS_CHARDEV) ? EPOLLIN : EPOLLPRI,
+        value))
+    {
+        gpio->debounce = 0;
+        return -1;
+    }
+    return 0;
+}
+
+int
+rfs_gpio_set_debounce(struct gpio_t *gpio, unsigned int period)
+{
+    int res;
+
+    PROBE2(gpio_set_debounce_entry, gpio->pin, period);
+    res = gpio_set_debounce(gpio, period);
+    PROBE3(gpio_set_debounce_return, gpio->pin, period, res);
+    return res;
+}
+
 /* Set the value of a GPIO pin (low or high).
 
    Parameters:
@@ -275,25 +996,51 @@ rfs_gpio_set_edge(struct gpio_t *gpio, enum gpio_edge_t edge)
    Return 0 if the value was successfully changed, -1 in case of error. In
    this last case, errno is set accordingly.
 */
-int
-rfs_gpio_set_value(struct gpio_t *gpio, enum gpio_value_t value)
+static int
+gpio_set_value(struct gpio_t *gpio, enum gpio_value_t value)
 {
     // Check value range
     if (value < RFS_GPIO_LOW || value > RFS_GPIO_HIGH) {
         errno = EINVAL;
         return -1;
     }
-    if (gpio->fd >= 0) {
-        close(gpio->fd);
+    if (gpio->flags & RFS_CHARDEV) {
+        return chardev_set_value(gpio, value);
     }
-    // Write the direction value
-    if (write_sysfs_file(gpio->value_file, gpio_value_str[value]))
+    if (gpio->flags & RFS_MMIO) {
+        return mmio_set_value(gpio, value);
+    }
+    // Without RFS_KEEP_OPEN, a descriptor left opened for polling is closed.
+    // With RFS_THREAD_SAFE it is never used here, and the file is opened apart
+    if (!(gpio->flags & (RFS_KEEP_OPEN | RFS_THREAD_SAFE))) {
+        close_sysfs_fd(&gpio->fd);
+    }
+    // Write the value
+    if (write_sysfs_attr(gpio->fd, gpio->value_file, gpio_value_str[value]))
     {
         return -1;
     }
     return 0;
 }
 
+int
+rfs_gpio_set_value(struct gpio_t *gpio, enum gpio_value_t value)
+{
+    int res;
+
+    // With a write queue, its thread does the write
+    if (write_queue_deferred(gpio->write_queue)) {
+        return rfs_write_queue_push(gpio->write_queue, gpio,
+            RFS_WRITE_GPIO_VALUE, value);
+    }
+    PROBE2(gpio_set_value_entry, gpio->pin, value);
+    STATS_START(start);
+    res = STATS_END(RFS_STATS_GPIO_SET_VALUE, start,
+        gpio_set_value(gpio, value));
+    PROBE3(gpio_set_value_return, gpio->pin, value, res);
+    return res;
+}
+
 /* Closes the GPIO pin.
 
    The direction is set to RFS_GPIO_IN. If the pin was exported, is unexported.
@@ -302,28 +1049,249 @@ rfs_gpio_set_value(struct gpio_t *gpio, enum gpio_value_t value)
      * gpio: GPIO pin descriptor.
 
    Return 0 if the pin was correctly closed (direction changed and unexported
-   if necessary), -1 otherwise. In case of error, errno is set accordingly.
+   if necessary), -1 otherwise. In case of error, errno is set accordingly
+   (EBUSY for a pin of a bank, that must be closed with the bank).
 */
+static int
+gpio_close(struct gpio_t *gpio)
+{
+    // The pins of a bank are closed with the bank
+    if (gpio->bank) {
+        errno = EBUSY;
+        return -1;
+    }
+    if (gpio_release(gpio)) {
+        return -1;
+    }
+    // Unexport the file, if it was actually exported
+    if (gpio_exported(gpio)) {
+        if (gpio_write_export(RFS_GPIO_UNEXPORT_FILE, gpio->pin)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
 int
 rfs_gpio_close(struct gpio_t *gpio)
 {
+    int res;
+
+    PROBE1(gpio_close_entry, gpio->pin);
+    STATS_START(start);
+    res = STATS_END(RFS_STATS_GPIO_CLOSE, start, gpio_close(gpio));
+    PROBE2(gpio_close_return, gpio->pin, res);
+    return res;
+}
+
+/* Close some pins of a set, unexporting them through a single descriptor.
+
+   Parameters:
+     * gpios: the pins.
+     * n: number of pins.
+     * skip: pins to skip, those whose entry is not 0 (NULL to close all).
+     * errors: where to store the error of each pin (0 if it was closed), or
+         NULL.
+
+   Return the error of the first pin that couldn't be closed, or 0.
+*/
+static int
+gpio_close_batch(struct gpio_t *gpios, unsigned int n, const int *skip,
+    int *errors)
+{
+    struct sysfs_batch_t unexport;
+    char file[RFS_GPIO_FILENAME_MAX_LEN];
     char pinstr[RFS_MAX_SYSFS_STR];
+    unsigned int i;
+    int e, first = 0;
 
-    // Close the file descriptor of the value file in case was opened for
-    // polling purposes
-    if (gpio->fd >= 0) {
-        close(gpio->fd);
+    sysfs_batch_init(&unexport);
+    if (sysfs_path(file, RFS_GPIO_FILENAME_MAX_LEN, "%s",
+        RFS_GPIO_UNEXPORT_FILE))
+    {
+        return errno;
+    }
+    for (i = 0; i < n; i++) {
+        if (skip && skip[i]) {
+            continue;
+        }
+        e = 0;
+        if (gpios[i].bank) {
+            e = EBUSY;
+        } else if (gpio_release(&gpios[i])) {
+            e = errno;
+        } else if (gpio_exported(&gpios[i])) {
+            snprintf(pinstr, RFS_MAX_SYSFS_STR, "%hhu", gpios[i].pin);
+            if (write_sysfs_batch(&unexport, file, pinstr)) {
+                e = errno;
+            }
+        }
+        if (errors) {
+            errors[i] = e;
+        }
+        if (e && !first) {
+            first = e;
+        }
     }
-    if (rfs_gpio_set_direction(gpio, RFS_GPIO_IN)) {
+    sysfs_batch_close(&unexport);
+    return first;
+}
+
+/* Open a set of GPIO pins.
+
+   Parameters:
+     * gpios: the pins to open.
+     * n: number of pins.
+     * direction: initial direction of the pins.
+     * errors: where to store the error of each pin, or NULL.
+
+   Return 0 if all the pins were opened, -1 otherwise (and errno is set to the
+   error of the first pin that failed).
+*/
+static int
+gpio_open_many(struct gpio_t *gpios, unsigned int n,
+    enum gpio_direction_t direction, int *errors)
+{
+    struct sysfs_batch_t export;
+    char file[RFS_GPIO_FILENAME_MAX_LEN];
+    char pinstr[RFS_MAX_SYSFS_STR];
+    int *status = errors;
+    unsigned int i;
+    int e = 0;
+
+    // Check direction value
+    if (direction < RFS_GPIO_IN || direction > RFS_GPIO_OUT_HIGH) {
+        errno = EINVAL;
         return -1;
     }
-    // Unexport the file, if it was actually exported
-    if (!(gpio->flags & RFS_DONT_EXPORT)) {
-        snprintf(pinstr, RFS_MAX_SYSFS_STR, "%hhu", gpio->pin);
-        if (write_sysfs_file(RFS_GPIO_UNEXPORT_FILE, pinstr)) {
-            return -1;
+    if (sysfs_path(file, RFS_GPIO_FILENAME_MAX_LEN, "%s", RFS_GPIO_EXPORT_FILE)
+        || (!status && !(status = malloc(n * sizeof(int)))))
+    {
+        return -1;
+    }
+    // Export all the pins first, so the kernel and udev prepare their files
+    // while the rest are exported
+    sysfs_batch_init(&export);
+    for (i = 0; i < n; i++) {
+        status[i] = 0;
+        if (gpio_init(&gpios[i])) {
+            status[i] = errno;
+        } else if (gpio_exported(&gpios[i])) {
+            snprintf(pinstr, RFS_MAX_SYSFS_STR, "%hhu", gpios[i].pin);
+            if (write_sysfs_batch(&export, file, pinstr)) {
+                status[i] = errno;
+            }
+        }
+    }
+    sysfs_batch_close(&export);
+    // Then set them up. By now the files of most of them are ready, so the
+    // waits are short
+    for (i = 0; i < n; i++) {
+        if (!status[i] && gpio_setup(&gpios[i], direction)) {
+            status[i] = errno;
+            if (gpio_exported(&gpios[i])) {
+                gpio_write_export(RFS_GPIO_UNEXPORT_FILE, gpios[i].pin);
+            }
         }
+        if (status[i] && !e) {
+            e = status[i];
+        }
+    }
+    // If any pin failed, close the others
+    if (e) {
+        gpio_close_batch(gpios, n, status, NULL);
+    }
+    if (status != errors) {
+        free(status);
+    }
+    if (e) {
+        errno = e;
+        return -1;
+    }
+    return 0;
+}
+
+int
+rfs_gpio_open_many(struct gpio_t *gpios, unsigned int n,
+    enum gpio_direction_t direction, int *errors)
+{
+    int res;
+
+    PROBE2(gpio_open_many_entry, n, direction);
+    res = gpio_open_many(gpios, n, direction, errors);
+    PROBE2(gpio_open_many_return, n, res);
+    return res;
+}
+
+/* Close a set of GPIO pins.
+
+   Parameters:
+     * gpios: the pins to close.
+     * n: number of pins.
+     * errors: where to store the error of each pin, or NULL.
+
+   Return 0 if all the pins were closed, -1 otherwise (and errno is set to the
+   error of the first pin that failed).
+*/
+static int
+gpio_close_many(struct gpio_t *gpios, unsigned int n, int *errors)
+{
+    int e;
+
+    if ((e = gpio_close_batch(gpios, n, NULL, errors))) {
+        errno = e;
+        return -1;
     }
     return 0;
 }
 
+int
+rfs_gpio_close_many(struct gpio_t *gpios, unsigned int n, int *errors)
+{
+    int res;
+
+    PROBE1(gpio_close_many_entry, n);
+    res = gpio_close_many(gpios, n, errors);
+    PROBE2(gpio_close_many_return, n, res);
+    return res;
+}
+
+/* Forget the direction and edge cached for a GPIO pin opened with RFS_CACHE.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+*/
+static void
+gpio_invalidate(struct gpio_t *gpio)
+{
+    gpio->cached_direction = -1;
+    gpio->cached_edge = -1;
+}
+
+void
+rfs_gpio_invalidate(struct gpio_t *gpio)
+{
+    PROBE1(gpio_invalidate_entry, gpio->pin);
+    gpio_invalidate(gpio);
+    PROBE1(gpio_invalidate_return, gpio->pin);
+}
+
+/* Attach a GPIO pin to a write queue, or detach it.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+     * queue: the queue, or NULL.
+*/
+static void
+gpio_set_write_queue(struct gpio_t *gpio, struct write_queue_t *queue)
+{
+    gpio->write_queue = queue;
+}
+
+void
+rfs_gpio_set_write_queue(struct gpio_t *gpio, struct write_queue_t *queue)
+{
+    PROBE2(gpio_set_write_queue_entry, gpio->pin, queue);
+    gpio_set_write_queue(gpio, queue);
+    PROBE1(gpio_set_write_queue_return, gpio->pin);
+}
@@ -0,0 +1,374 @@
+/* iobatch.c
+   Batches of GPIO and PWM operations submitted at once through io_uring.
+   
+   Copyright 2018 Antonio Serrano Hernandez
+
+   This file is part of rfsgpio.
+
+   rfsgpio is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   rfsgpio is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with rfsgpio; see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+#include "rfsgpio.h"
+#include "probes.h"
+#include "stats.h"
+#include "sysfs.h"
+
+#include <errno.h>          // errno
+#include <stdio.h>          // snprintf
+#include <string.h>         // strlen
+
+// The public function rfs_io_batch_submit wraps the static function
+// io_batch_submit: the call is counted in the statistics and traced by the
+// probes io_batch_submit_entry and io_batch_submit_return.
+
+/* Return whether an operation can be done through the io_uring instance of
+   a batch, that is, if it is done on a sysfs file kept opened.
+
+   Parameters:
+     * batch: the batch descriptor.
+     * op: the operation.
+*/
+static int
+io_batch_ring_op(struct io_batch_t *batch, struct io_op_t *op)
+{
+    if (!batch->ring) {
+        return 0;
+    }
+    if (op->gpio) {
+        return op->gpio->flags & RFS_KEEP_OPEN
+            && !(op->gpio->flags & (RFS_CHARDEV | RFS_MMIO))
+            && op->gpio->fd >= 0;
+    }
+    return op->pwm->duty_cycle_fd >= 0;
+}
+
+/* Queue an operation in a batch.
+
+   Parameters:
+     * batch: the batch descriptor.
+
+   Return the operation, cleared, or NULL if the batch is full (and errno is
+   set to ENOSPC).
+*/
+static struct io_op_t *
+io_batch_add(struct io_batch_t *batch)
+{
+    struct io_op_t *op;
+
+    if (batch->n == RFS_IO_BATCH_MAX_OPS) {
+        errno = ENOSPC;
+        return NULL;
+    }
+    op = &batch->ops[batch->n++];
+    memset(op, 0, sizeof(struct io_op_t));
+    return op;
+}
+
+/* Do an operation synchronously, with the usual functions.
+
+   Parameters:
+     * op: the operation.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+static int
+io_batch_sync_op(struct io_op_t *op)
+{
+    int value;
+
+    switch (op->type) {
+    case RFS_IO_GPIO_SET_VALUE:
+        return rfs_gpio_set_value(op->gpio, op->value);
+    case RFS_IO_GPIO_GET_VALUE:
+        if ((value = rfs_gpio_get_value(op->gpio)) < 0) {
+            return -1;
+        }
+        *op->result = value;
+        return 0;
+    case RFS_IO_PWM_SET_DUTY_CYCLE:
+        return rfs_pwm_set_duty_cycle(op->pwm, op->duty_cycle);
+    }
+    errno = EINVAL;
+    return -1;
+}
+
+/* Store the duty cycle written by an operation in the cache of its channel,
+   if it was opened with RFS_CACHE.
+
+   Parameters:
+     * op: the operation.
+     * duty_cycle: the duty cycle (-1 if unknown).
+*/
+static void
+io_batch_cache(struct io_op_t *op, pwm_time_t duty_cycle)
+{
+    if (op->pwm && op->pwm->flags & RFS_CACHE) {
+        op->pwm->cached_duty_cycle = duty_cycle;
+    }
+}
+
+/* Complete an operation done through io_uring.
+
+   Parameters:
+     * batch: the batch descriptor.
+     * i: index of the operation.
+     * res: the result of the operation (bytes read or written, or -errno).
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+static int
+io_batch_complete(struct io_batch_t *batch, unsigned int i, int res)
+{
+    struct io_op_t *op = &batch->ops[i];
+    char *buf = batch->buffers[i];
+
+    if (res < 0) {
+        io_batch_cache(op, -1);
+        errno = -res;
+        return -1;
+    }
+    if (op->type == RFS_IO_GPIO_GET_VALUE) {
+        buf[res] = '\0';
+        *op->result = strcmp(buf, "0\n") == 0 ? RFS_GPIO_LOW : RFS_GPIO_HIGH;
+        return 0;
+    }
+    // Partial writes are errors, as with write_sysfs_fd
+    if ((size_t)res != strlen(buf)) {
+        io_batch_cache(op, -1);
+        errno = EIO;
+        return -1;
+    }
+    io_batch_cache(op, op->duty_cycle);
+    return 0;
+}
+
+/* Open an I/O batch.
+
+   Parameters:
+     * batch: the batch descriptor.
+     * flags: 0 or RFS_IO_SYNC.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_io_batch_open(struct io_batch_t *batch, int flags)
+{
+    if (flags & ~RFS_IO_SYNC) {
+        errno = EINVAL;
+        return -1;
+    }
+    batch->flags = flags;
+    batch->n = 0;
+    batch->enters = 0;
+    batch->ring = NULL;
+    // Without io_uring the batch falls back to synchronous I/O
+    if (!(flags & RFS_IO_SYNC)) {
+        batch->ring = sysfs_ring_open(RFS_IO_BATCH_MAX_OPS, batch->buffers,
+            sizeof(batch->buffers));
+    }
+    return 0;
+}
+
+/* Queue the write of the value of a GPIO pin in an I/O batch.
+
+   Parameters:
+     * batch: the batch descriptor.
+     * gpio: GPIO pin descriptor.
+     * value: value to write.
+
+   Return 0 if the operation was queued, -1 otherwise (and errno is set to
+   EINVAL for a wrong value or ENOSPC if the batch is full).
+*/
+int
+rfs_io_batch_gpio_set_value(struct io_batch_t *batch, struct gpio_t *gpio,
+    enum gpio_value_t value)
+{
+    struct io_op_t *op;
+
+    if (value < RFS_GPIO_LOW || value > RFS_GPIO_HIGH) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (!(op = io_batch_add(batch))) {
+        return -1;
+    }
+    op->type = RFS_IO_GPIO_SET_VALUE;
+    op->gpio = gpio;
+    op->value = value;
+    return 0;
+}
+
+/* Queue the read of the value of a GPIO pin in an I/O batch.
+
+   Parameters:
+     * batch: the batch descriptor.
+     * gpio: GPIO pin descriptor.
+     * value: where to store the value when the batch is submitted.
+
+   Return 0 if the operation was queued, -1 otherwise (and errno is set to
+   ENOSPC if the batch is full).
+*/
+int
+rfs_io_batch_gpio_get_value(struct io_batch_t *batch, struct gpio_t *gpio,
+    int *value)
+{
+    struct io_op_t *op;
+
+    if (!(op = io_batch_add(batch))) {
+        return -1;
+    }
+    op->type = RFS_IO_GPIO_GET_VALUE;
+    op->gpio = gpio;
+    op->result = value;
+    return 0;
+}
+
+/* Queue the write of the duty cycle of a PWM channel in an I/O batch.
+
+   Parameters:
+     * batch: the batch descriptor.
+     * pwm: the PWM channel descriptor.
+     * duty_cycle: duty cycle to write (in nanoseconds).
+
+   Return 0 if the operation was queued, -1 otherwise (and errno is set to
+   EINVAL for a wrong duty cycle or ENOSPC if the batch is full).
+*/
+int
+rfs_io_batch_pwm_set_duty_cycle(struct io_batch_t *batch, struct pwm_t *pwm,
+    pwm_time_t duty_cycle)
+{
+    struct io_op_t *op;
+
+    if (duty_cycle < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (!(op = io_batch_add(batch))) {
+        return -1;
+    }
+    op->type = RFS_IO_PWM_SET_DUTY_CYCLE;
+    op->pwm = pwm;
+    op->duty_cycle = duty_cycle;
+    return 0;
+}
+
+/* Submit the operations queued in an I/O batch and wait for all of them.
+
+   Parameters:
+     * batch: the batch descriptor.
+
+   Return 0 if all the operations succeeded, -1 otherwise (and errno is set to
+   the error of the first one that failed).
+*/
+static int
+io_batch_submit(struct io_batch_t *batch)
+{
+    int results[RFS_IO_BATCH_MAX_OPS];
+    char queued[RFS_IO_BATCH_MAX_OPS];
+    struct io_op_t *op;
+    unsigned int i, n = 0;
+    char *buf;
+    int fd, write, r, e = 0, first = 0;
+
+    // Queue the operations on files kept opened
+    for (i = 0; i < batch->n; i++) {
+        op = &batch->ops[i];
+        queued[i] = 0;
+        if (!io_batch_ring_op(batch, op)) {
+            continue;
+        }
+        buf = batch->buffers[i];
+        write = op->type != RFS_IO_GPIO_GET_VALUE;
+        if (op->gpio) {
+            fd = op->gpio->fd;
+            snprintf(buf, RFS_IO_BUFFER_LEN, "%d", op->value);
+        } else {
+            // The duty cycles already written are skipped as usual
+            if (op->pwm->flags & RFS_CACHE
+                && op->pwm->cached_duty_cycle == op->duty_cycle)
+            {
+                continue;
+            }
+            fd = op->pwm->duty_cycle_fd;
+            snprintf(buf, RFS_IO_BUFFER_LEN, "%d", op->duty_cycle);
+        }
+        if (sysfs_ring_queue(batch->ring, write, fd, buf,
+            write ? strlen(buf) : RFS_IO_BUFFER_LEN - 1, i) == 0)
+        {
+            queued[i] = 1;
+            n++;
+        }
+    }
+    // Submit them at once
+    if (n) {
+        if ((r = sysfs_ring_submit(batch->ring, results)) < 0) {
+            e = errno;
+        } else {
+            batch->enters += r;
+        }
+    }
+    // Complete them, and do the rest of operations synchronously
+    for (i = 0; i < batch->n; i++) {
+        op = &batch->ops[i];
+        if (!queued[i]) {
+            r = io_batch_sync_op(op);
+        } else if (e) {
+            errno = e;
+            r = -1;
+        } else {
+            r = io_batch_complete(batch, i, results[i]);
+        }
+        op->error = r ? errno : 0;
+        if (op->error && !first) {
+            first = op->error;
+        }
+    }
+    batch->n = 0;
+    if (first) {
+        errno = first;
+        return -1;
+    }
+    return 0;
+}
+
+int
+rfs_io_batch_submit(struct io_batch_t *batch)
+{
+    int res;
+
+    PROBE1(io_batch_submit_entry, batch->n);
+    STATS_START(start);
+    res = STATS_END(RFS_STATS_IO_BATCH_SUBMIT, start, io_batch_submit(batch));
+    PROBE1(io_batch_submit_return, res);
+    return res;
+}
+
+/* Close an I/O batch, discarding the operations not submitted.
+
+   Parameters:
+     * batch: the batch descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_io_batch_close(struct io_batch_t *batch)
+{
+    if (batch->ring) {
+        sysfs_ring_close(batch->ring);
+        batch->ring = NULL;
+    }
+    batch->n = 0;
+    return 0;
+}
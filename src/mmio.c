@@ -0,0 +1,356 @@
+/* mmio.c
+   Helper functions to drive GPIO pins through memory mapped registers.
+   
+   Copyright 2018 Antonio Serrano Hernandez
+
+   This file is part of rfsgpio.
+
+   rfsgpio is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   rfsgpio is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with rfsgpio; see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+#include "mmio.h"
+#include "sysfs.h"
+
+#include <errno.h>      // errno
+#include <fcntl.h>      // open
+#include <pthread.h>    // pthread_mutex_lock
+#include <string.h>     // strlen
+#include <sys/mman.h>   // mmap
+#include <unistd.h>     // close
+
+// Maximum number of 32 bit set, clear or level registers of a controller
+#define MMIO_MAX_REGS   8
+
+// i-th register of a group of registers that starts at a byte offset
+#define MMIO_REG(regs, offset, i) ((regs)[(offset) / sizeof(uint32_t) + (i)])
+
+const struct mmio_layout_t rfs_mmio_bcm2835 = {
+    .device = "/dev/gpiomem",
+    .size = 0xb4,
+    .npins = 54,
+    .fsel = 0x00,
+    .fsel_bits = 3,
+    .fsel_input = 0,
+    .fsel_output = 1,
+    .set = 0x1c,
+    .clr = 0x28,
+    .lev = 0x34
+};
+
+// Current layout, and the copy of the last one set (with its device file
+// name)
+static const struct mmio_layout_t *mmio_layout = &rfs_mmio_bcm2835;
+static struct mmio_layout_t mmio_custom;
+static char mmio_device[RFS_GPIO_FILENAME_MAX_LEN];
+
+// The mapped registers, shared by all the pins, and the number of pins that
+// use them
+static volatile uint32_t *mmio_regs = NULL;
+static unsigned int mmio_users = 0;
+static pthread_mutex_t mmio_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Return whether a group of registers of a layout is aligned and inside the
+   mapped block.
+
+   Parameters:
+     * layout: the register layout.
+     * offset: byte offset of the first register of the group.
+     * n: number of registers of the group.
+*/
+static int
+mmio_regs_fit(const struct mmio_layout_t *layout, unsigned long offset,
+    unsigned int n)
+{
+    return offset % sizeof(uint32_t) == 0 && offset <= layout->size
+        && n * sizeof(uint32_t) <= layout->size - offset;
+}
+
+/* Set the register layout of the GPIO controller used with RFS_MMIO.
+
+   Every register the pins can access must be inside the mapped block, so a
+   wrong layout is rejected here instead of faulting at the first access.
+
+   Parameters:
+     * layout: the register layout (it is copied, device included).
+
+   Return 0 if the layout was changed, -1 otherwise (and errno is set
+   accordingly).
+*/
+int
+rfs_mmio_set_layout(const struct mmio_layout_t *layout)
+{
+    unsigned int per_reg, words;
+    int res = 0;
+
+    if (!layout->device || strlen(layout->device) >= RFS_GPIO_FILENAME_MAX_LEN
+        || layout->npins < 1 || layout->npins > MMIO_MAX_REGS * 32
+        || layout->fsel_bits < 1 || layout->fsel_bits > 16
+        || layout->fsel_input >> layout->fsel_bits
+        || layout->fsel_output >> layout->fsel_bits)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    // The function select registers hold the pins that fit whole in 32 bits,
+    // the others one bit per pin
+    per_reg = 32 / layout->fsel_bits;
+    words = (layout->npins + 31) / 32;
+    if (!mmio_regs_fit(layout, layout->fsel,
+            (layout->npins + per_reg - 1) / per_reg)
+        || !mmio_regs_fit(layout, layout->set, words)
+        || !mmio_regs_fit(layout, layout->clr, words)
+        || !mmio_regs_fit(layout, layout->lev, words))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    pthread_mutex_lock(&mmio_lock);
+    if (mmio_users) {
+        errno = EBUSY;
+        res = -1;
+    } else {
+        mmio_custom = *layout;
+        strcpy(mmio_device, layout->device);
+        mmio_custom.device = mmio_device;
+        mmio_layout = &mmio_custom;
+    }
+    pthread_mutex_unlock(&mmio_lock);
+    return res;
+}
+
+/* Map the registers, if they are not already mapped, for a new user.
+
+   Return the mapped registers, or NULL in case of error (and errno is set
+   accordingly).
+*/
+static volatile uint32_t *
+mmio_map(void)
+{
+    char path[RFS_GPIO_FILENAME_MAX_LEN];
+    void *regs;
+    int fd;
+
+    pthread_mutex_lock(&mmio_lock);
+    if (!mmio_users) {
+        if (sysfs_path(path, RFS_GPIO_FILENAME_MAX_LEN, "%s",
+            mmio_layout->device)
+            || (fd = open(path, O_RDWR | O_SYNC | O_CLOEXEC)) < 0)
+        {
+            pthread_mutex_unlock(&mmio_lock);
+            return NULL;
+        }
+        // The mapping stays valid after closing the file
+        regs = mmap(NULL, mmio_layout->size, PROT_READ | PROT_WRITE,
+            MAP_SHARED, fd, 0);
+        close(fd);
+        if (regs == MAP_FAILED) {
+            pthread_mutex_unlock(&mmio_lock);
+            return NULL;
+        }
+        mmio_regs = regs;
+    }
+    mmio_users++;
+    pthread_mutex_unlock(&mmio_lock);
+    return mmio_regs;
+}
+
+/* Release the registers, that are unmapped when the last user releases them.
+*/
+static void
+mmio_unmap(void)
+{
+    pthread_mutex_lock(&mmio_lock);
+    if (!--mmio_users) {
+        munmap((void *)mmio_regs, mmio_layout->size);
+        mmio_regs = NULL;
+    }
+    pthread_mutex_unlock(&mmio_lock);
+}
+
+/* Map the registers (if not already mapped) and set the direction of a pin.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+     * direction: initial direction of the pin.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+mmio_open(struct gpio_t *gpio, enum gpio_direction_t direction)
+{
+    if (gpio->pin >= mmio_layout->npins) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (!(gpio->regs = mmio_map())) {
+        return -1;
+    }
+    return mmio_set_direction(gpio, direction);
+}
+
+/* Return the current direction of a pin.
+
+   The pins with a function other than input or output are reported as
+   inputs.
+*/
+int
+mmio_get_direction(struct gpio_t *gpio)
+{
+    unsigned int per_reg, shift;
+    uint32_t fsel;
+
+    per_reg = 32 / mmio_layout->fsel_bits;
+    shift = (gpio->pin % per_reg) * mmio_layout->fsel_bits;
+    fsel = MMIO_REG(gpio->regs, mmio_layout->fsel, gpio->pin / per_reg);
+    if (((fsel >> shift) & ((1U << mmio_layout->fsel_bits) - 1))
+        == mmio_layout->fsel_output)
+    {
+        return RFS_GPIO_OUT;
+    }
+    return RFS_GPIO_IN;
+}
+
+/* Return the current value of a pin. */
+int
+mmio_get_value(struct gpio_t *gpio)
+{
+    return (MMIO_REG(gpio->regs, mmio_layout->lev, gpio->pin / 32)
+        >> (gpio->pin % 32)) & 1;
+}
+
+/* Set the direction of a pin.
+
+   For the output directions the value is set before changing the function of
+   the pin, so it never outputs a wrong value. With RFS_THREAD_SAFE the
+   register, shared with other pins, is changed holding the lock of the
+   mapping.
+*/
+int
+mmio_set_direction(struct gpio_t *gpio, enum gpio_direction_t direction)
+{
+    unsigned int per_reg, shift, function;
+    volatile uint32_t *fsel;
+    uint32_t mask;
+
+    if (direction != RFS_GPIO_IN) {
+        mmio_set_value(gpio, direction == RFS_GPIO_OUT_HIGH);
+        function = mmio_layout->fsel_output;
+    } else {
+        function = mmio_layout->fsel_input;
+    }
+    per_reg = 32 / mmio_layout->fsel_bits;
+    shift = (gpio->pin % per_reg) * mmio_layout->fsel_bits;
+    mask = ((1U << mmio_layout->fsel_bits) - 1) << shift;
+    fsel = &MMIO_REG(gpio->regs, mmio_layout->fsel, gpio->pin / per_reg);
+    if (gpio->flags & RFS_THREAD_SAFE) {
+        pthread_mutex_lock(&mmio_lock);
+    }
+    *fsel = (*fsel & ~mask) | (function << shift);
+    if (gpio->flags & RFS_THREAD_SAFE) {
+        pthread_mutex_unlock(&mmio_lock);
+    }
+    return 0;
+}
+
+/* Set the value of a pin, writing its bit to the set or clear register. */
+int
+mmio_set_value(struct gpio_t *gpio, enum gpio_value_t value)
+{
+    unsigned long offset;
+
+    offset = value ? mmio_layout->set : mmio_layout->clr;
+    MMIO_REG(gpio->regs, offset, gpio->pin / 32) = 1U << (gpio->pin % 32);
+    return 0;
+}
+
+/* Set a pin as input and unmap the registers if no other pin uses them. */
+int
+mmio_close(struct gpio_t *gpio)
+{
+    mmio_set_direction(gpio, RFS_GPIO_IN);
+    gpio->regs = NULL;
+    mmio_unmap();
+    return 0;
+}
+
+/* Read the values of all the pins of a bank, a register read per 32 pins.
+
+   Parameters:
+     * bank: bank descriptor.
+     * bits: where to store the values.
+
+   Return 0.
+*/
+int
+mmio_bank_get(struct gpio_bank_t *bank, uint64_t *bits)
+{
+    volatile uint32_t *regs;
+    uint32_t values[MMIO_MAX_REGS];
+    uint32_t read = 0;
+    gpio_pin_t pin;
+    unsigned int i;
+    uint64_t b = 0;
+
+    regs = bank->gpios[0].regs;
+    for (i = 0; i < bank->n; i++) {
+        pin = bank->gpios[i].pin;
+        if (!(read & (1U << (pin / 32)))) {
+            values[pin / 32] = MMIO_REG(regs, mmio_layout->lev, pin / 32);
+            read |= 1U << (pin / 32);
+        }
+        b |= (uint64_t)((values[pin / 32] >> (pin % 32)) & 1) << i;
+    }
+    *bits = b;
+    return 0;
+}
+
+/* Set the values of some pins of a bank, a register write per 32 pins.
+
+   Parameters:
+     * bank: bank descriptor.
+     * mask: pins to set.
+     * bits: values to give to the pins in mask.
+
+   Return 0.
+*/
+int
+mmio_bank_set(struct gpio_bank_t *bank, uint64_t mask, uint64_t bits)
+{
+    uint32_t set[MMIO_MAX_REGS] = {0}, clr[MMIO_MAX_REGS] = {0};
+    volatile uint32_t *regs;
+    gpio_pin_t pin;
+    unsigned int i;
+
+    for (i = 0; i < bank->n; i++) {
+        if (mask & (1ULL << i)) {
+            pin = bank->gpios[i].pin;
+            if (bits & (1ULL << i)) {
+                set[pin / 32] |= 1U << (pin % 32);
+            } else {
+                clr[pin / 32] |= 1U << (pin % 32);
+            }
+        }
+    }
+    regs = bank->gpios[0].regs;
+    for (i = 0; i < MMIO_MAX_REGS; i++) {
+        if (set[i]) {
+            MMIO_REG(regs, mmio_layout->set, i) = set[i];
+        }
+        if (clr[i]) {
+            MMIO_REG(regs, mmio_layout->clr, i) = clr[i];
+        }
+    }
+    return 0;
+}
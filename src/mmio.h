@@ -0,0 +1,68 @@
+/* mmio.h
+   Helper functions to drive GPIO pins through memory mapped registers.
+   
+   Copyright 2018 Antonio Serrano Hernandez
+
+   This file is part of rfsgpio.
+
+   rfsgpio is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   rfsgpio is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with rfsgpio; see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MMIO_H
+#define MMIO_H
+
+#include "rfsgpio.h"
+
+/* Map the registers (if not already mapped) and set the direction of a pin.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+     * direction: initial direction of the pin.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+mmio_open(struct gpio_t *gpio, enum gpio_direction_t direction);
+
+/* Return the current direction of a pin. */
+int
+mmio_get_direction(struct gpio_t *gpio);
+
+/* Return the current value of a pin. */
+int
+mmio_get_value(struct gpio_t *gpio);
+
+/* Set the direction of a pin. */
+int
+mmio_set_direction(struct gpio_t *gpio, enum gpio_direction_t direction);
+
+/* Set the value of a pin. */
+int
+mmio_set_value(struct gpio_t *gpio, enum gpio_value_t value);
+
+/* Set a pin as input and unmap the registers if no other pin uses them. */
+int
+mmio_close(struct gpio_t *gpio);
+
+/* Read the values of all the pins of a bank, a register read per 32 pins. */
+int
+mmio_bank_get(struct gpio_bank_t *bank, uint64_t *bits);
+
+/* Set the values of some pins of a bank, a register write per 32 pins. */
+int
+mmio_bank_set(struct gpio_bank_t *bank, uint64_t mask, uint64_t bits);
+
+#endif
+
@@ -0,0 +1,50 @@
+/* probes.h
+   Static tracepoints (USDT) of the library, compiled only if the library is
+   configured with --enable-probes.
+   
+   Copyright 2018 Antonio Serrano Hernandez
+
+   This file is part of rfsgpio.
+
+   rfsgpio is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   rfsgpio is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with rfsgpio; see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PROBES_H
+#define PROBES_H
+
+/* The probes are SystemTap SDT markers of the provider rfsgpio: a nop in the
+   code and a note in the ELF file that perf, bpftrace or SystemTap use to
+   place a breakpoint when the probe is traced. Their arguments are only
+   evaluated into registers, so an untraced probe costs a nop.
+*/
+#ifdef RFS_PROBES
+
+#include <sys/sdt.h>    // DTRACE_PROBE
+
+#define PROBE1(name, a)             DTRACE_PROBE1(rfsgpio, name, a)
+#define PROBE2(name, a, b)          DTRACE_PROBE2(rfsgpio, name, a, b)
+#define PROBE3(name, a, b, c)       DTRACE_PROBE3(rfsgpio, name, a, b, c)
+#define PROBE4(name, a, b, c, d)    DTRACE_PROBE4(rfsgpio, name, a, b, c, d)
+
+#else
+
+#define PROBE1(name, a)
+#define PROBE2(name, a, b)
+#define PROBE3(name, a, b, c)
+#define PROBE4(name, a, b, c, d)
+
+#endif
+
+#endif
@@ -0,0 +1,276 @@
+/* pulse.c
+   Measure the width and the period of the pulses of GPIO inputs.
+   
+   Copyright 2018 Antonio Serrano Hernandez
+
+   This file is part of rfsgpio.
+
+   rfsgpio is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   rfsgpio is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with rfsgpio; see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+#include "rfsgpio.h"
+#include "thread.h"
+
+#include <errno.h>  // errno
+#include <stdlib.h> // malloc
+
+/* Store a pulse in the ring buffer of a capture.
+
+   Called by the capture thread, the only writer of head. If the ring buffer
+   is full, the pulse is counted as an overflow.
+
+   Parameters:
+     * capture: the capture descriptor.
+     * pulse: the pulse measured.
+*/
+static void
+pulse_push(struct pulse_capture_t *capture, const struct pulse_t *pulse)
+{
+    unsigned long head, tail;
+
+    head = capture->head;
+    tail = __atomic_load_n(&capture->tail, __ATOMIC_ACQUIRE);
+    if (head - tail == capture->size) {
+        __atomic_fetch_add(&capture->overflows, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    capture->pulses[head & (capture->size - 1)] = *pulse;
+    __atomic_store_n(&capture->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* Pair an edge event with the previous one.
+
+   A rising edge starts a pulse, and the next falling edge completes it. Two
+   rising edges in a row mean that a falling edge was lost, so the period of
+   the next pulse is unknown.
+
+   Parameters:
+     * event: the edge event.
+     * data: the capture descriptor.
+*/
+static void
+pulse_edge(const struct gpio_event_t *event, void *data)
+{
+    struct pulse_capture_t *capture = data;
+    struct pulse_t pulse;
+
+    if (event->value == RFS_GPIO_HIGH) {
+        if (capture->rise) {
+            capture->last_rise = 0;
+        }
+        capture->rise = event->timestamp;
+        return;
+    }
+    // A falling edge without a rising edge before ends no pulse
+    if (!capture->rise) {
+        return;
+    }
+    pulse.start = capture->rise;
+    pulse.width = event->timestamp - capture->rise;
+    pulse.period = capture->last_rise ? capture->rise - capture->last_rise : 0;
+    capture->last_rise = capture->rise;
+    capture->rise = 0;
+    pulse_push(capture, &pulse);
+}
+
+/* Main function of the capture thread.
+
+   Parameters:
+     * arg: the capture descriptor.
+*/
+static void *
+pulse_run(void *arg)
+{
+    struct pulse_capture_t *capture = arg;
+
+    while (__atomic_load_n(&capture->running, __ATOMIC_ACQUIRE)) {
+        // An error other than an interruption stops the thread
+        if (rfs_event_loop_run(&capture->loop, -1) < 0 && errno != EINTR) {
+            __atomic_store_n(&capture->error, errno, __ATOMIC_RELEASE);
+            break;
+        }
+    }
+    return NULL;
+}
+
+/* Open a pulse capture of a GPIO pin.
+
+   Parameters:
+     * capture: the capture descriptor.
+     * gpio: the GPIO pin, already opened as input.
+     * size: capacity of the ring buffer, in pulses.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_pulse_capture_open(struct pulse_capture_t *capture, struct gpio_t *gpio,
+    unsigned long size)
+{
+    int e;
+
+    if (size < 1) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (rfs_gpio_set_edge(gpio, RFS_GPIO_BOTH)) {
+        return -1;
+    }
+    for (capture->size = 1; capture->size < size; capture->size <<= 1);
+    capture->pulses = malloc(capture->size * sizeof(struct pulse_t));
+    if (!capture->pulses) {
+        return -1;
+    }
+    capture->gpio = gpio;
+    capture->rise = 0;
+    capture->last_rise = 0;
+    capture->head = 0;
+    capture->tail = 0;
+    capture->overflows = 0;
+    capture->error = 0;
+    capture->running = 0;
+    if (rfs_event_loop_open(&capture->loop)) {
+        free(capture->pulses);
+        return -1;
+    }
+    if (rfs_event_loop_add(&capture->loop, gpio, pulse_edge, capture)) {
+        e = errno;
+        rfs_event_loop_close(&capture->loop);
+        free(capture->pulses);
+        errno = e;
+        return -1;
+    }
+    return 0;
+}
+
+/* Start the capture thread.
+
+   Parameters:
+     * capture: the capture descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_pulse_capture_start(struct pulse_capture_t *capture)
+{
+    if (capture->running) {
+        errno = EBUSY;
+        return -1;
+    }
+    capture->error = 0;
+    capture->running = 1;
+    if (thread_start(&capture->thread, pulse_run, capture)) {
+        capture->running = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/* Read the measured pulses.
+
+   Parameters:
+     * capture: the capture descriptor.
+     * pulses: where to store the pulses.
+     * n: maximum number of pulses to read.
+
+   Return the number of pulses read (0 if there was none).
+*/
+unsigned long
+rfs_pulse_capture_read(struct pulse_capture_t *capture, struct pulse_t *pulses,
+    unsigned long n)
+{
+    unsigned long head, tail, i;
+
+    tail = capture->tail;
+    head = __atomic_load_n(&capture->head, __ATOMIC_ACQUIRE);
+    if (n > head - tail) {
+        n = head - tail;
+    }
+    for (i = 0; i < n; i++) {
+        pulses[i] = capture->pulses[(tail + i) & (capture->size - 1)];
+    }
+    __atomic_store_n(&capture->tail, tail + n, __ATOMIC_RELEASE);
+    return n;
+}
+
+/* Return the number of pulses lost because the ring buffer was full.
+
+   Parameters:
+     * capture: the capture descriptor.
+*/
+unsigned long
+rfs_pulse_capture_overflows(struct pulse_capture_t *capture)
+{
+    return __atomic_load_n(&capture->overflows, __ATOMIC_RELAXED);
+}
+
+/* Return the error that stopped the capture thread.
+
+   Parameters:
+     * capture: the capture descriptor.
+
+   Return the errno value, or 0 if the thread wasn't stopped by an error.
+*/
+int
+rfs_pulse_capture_error(struct pulse_capture_t *capture)
+{
+    return __atomic_load_n(&capture->error, __ATOMIC_ACQUIRE);
+}
+
+/* Stop the capture thread.
+
+   Parameters:
+     * capture: the capture descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_pulse_capture_stop(struct pulse_capture_t *capture)
+{
+    if (!capture->running) {
+        errno = EINVAL;
+        return -1;
+    }
+    __atomic_store_n(&capture->running, 0, __ATOMIC_RELEASE);
+    if (rfs_event_loop_wakeup(&capture->loop)
+        || thread_join(capture->thread))
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/* Close a pulse capture.
+
+   The pin is removed from the event loop of the capture, so it can be used
+   again by other loops.
+
+   Parameters:
+     * capture: the capture descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_pulse_capture_close(struct pulse_capture_t *capture)
+{
+    if (capture->running && rfs_pulse_capture_stop(capture)) {
+        return -1;
+    }
+    if (rfs_event_loop_remove(&capture->loop, capture->gpio)) {
+        return -1;
+    }
+    free(capture->pulses);
+    capture->pulses = NULL;
+    return rfs_event_loop_close(&capture->loop);
+}
@@ -22,12 +22,20 @@
 */
 
 #include "rfsgpio.h"
+#include "probes.h"
+#include "stats.h"
 #include "sysfs.h"
+#include "writequeue.h"
 
 #include <errno.h>  // errno
-#include <stdio.h>  // snprintf
-#include <stdlib.h> // atoi
+#include <stdio.h>  // snprintf, sscanf
+#include <stdlib.h> // atoi, malloc
 #include <string.h> // strcmp
+#include <unistd.h> // W_OK
+
+// Each public function rfs_pwm_X wraps the static function pwm_X: the call is
+// traced by the probes pwm_X_entry and pwm_X_return, and the main ones are
+// counted in the statistics too.
 
 #define RFS_PWM_BASE_DIR        "/sys/class/pwm/pwmchip%hhu/"
 #define RFS_PWM_EXPORT_FILE     RFS_PWM_BASE_DIR "export"
@@ -36,6 +44,175 @@
 #define RFS_PWM_PERIOD_FILE     RFS_PWM_CHANNEL_DIR "period"
 #define RFS_PWM_DUTY_CYCLE_FILE RFS_PWM_CHANNEL_DIR "duty_cycle"
 #define RFS_PWM_ENABLE_FILE     RFS_PWM_CHANNEL_DIR "enable"
+#define RFS_PWM_CAPTURE_FILE    RFS_PWM_CHANNEL_DIR "capture"
+
+/* Wait until the files of a channel that was just exported are accessible.
+
+   All of them must be writable, as they are written when opening the channel.
+
+   Parameters:
+     * pwm: the PWM channel descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+static int
+pwm_wait_files(struct pwm_t *pwm)
+{
+    long long deadline = sysfs_wait_deadline();
+
+    return wait_sysfs_file(pwm->period_file, W_OK, deadline)
+        || wait_sysfs_file(pwm->duty_cycle_file, W_OK, deadline)
+        || wait_sysfs_file(pwm->enable_file, W_OK, deadline) ? -1 : 0;
+}
+
+/* Open the files of a PWM channel that are kept opened with RFS_KEEP_OPEN.
+
+   Parameters:
+     * pwm: the PWM channel descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+static int
+pwm_open_files(struct pwm_t *pwm)
+{
+    if ((pwm->period_fd = open_sysfs_file(pwm->period_file)) < 0
+        || (pwm->duty_cycle_fd = open_sysfs_file(pwm->duty_cycle_file)) < 0
+        || (pwm->enable_fd = open_sysfs_file(pwm->enable_file)) < 0)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/* Close all the opened files of a PWM channel.
+
+   Parameters:
+     * pwm: the PWM channel descriptor.
+*/
+static void
+pwm_close_files(struct pwm_t *pwm)
+{
+    close_sysfs_fd(&pwm->period_fd);
+    close_sysfs_fd(&pwm->duty_cycle_fd);
+    close_sysfs_fd(&pwm->enable_fd);
+}
+
+/* Initialize the descriptor of a PWM channel that is being opened.
+
+   Parameters:
+     * pwm: the PWM channel descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+static int
+pwm_init(struct pwm_t *pwm)
+{
+    // The cache can't be shared by threads
+    if (pwm->flags & RFS_THREAD_SAFE && pwm->flags & RFS_CACHE) {
+        errno = EINVAL;
+        return -1;
+    }
+    // Initialize the file names for this chip/channel
+    if (sysfs_path(pwm->export_file, RFS_PWM_FILENAME_MAX_LEN,
+            RFS_PWM_EXPORT_FILE, pwm->chip)
+        || sysfs_path(pwm->unexport_file, RFS_PWM_FILENAME_MAX_LEN,
+            RFS_PWM_UNEXPORT_FILE, pwm->chip)
+        || sysfs_path(pwm->period_file, RFS_PWM_FILENAME_MAX_LEN,
+            RFS_PWM_PERIOD_FILE, pwm->chip, pwm->channel)
+        || sysfs_path(pwm->duty_cycle_file, RFS_PWM_FILENAME_MAX_LEN,
+            RFS_PWM_DUTY_CYCLE_FILE, pwm->chip, pwm->channel)
+        || sysfs_path(pwm->enable_file, RFS_PWM_FILENAME_MAX_LEN,
+            RFS_PWM_ENABLE_FILE, pwm->chip, pwm->channel))
+    {
+        return -1;
+    }
+
+    // Initialize the file descriptors
+    pwm->period_fd = -1;
+    pwm->duty_cycle_fd = -1;
+    pwm->enable_fd = -1;
+    pwm->write_queue = NULL;
+
+    // Nothing is known about the channel attributes yet
+    pwm->cached_period = -1;
+    pwm->cached_duty_cycle = -1;
+    pwm->cached_enabled = -1;
+    return 0;
+}
+
+/* Set up a PWM channel once exported.
+
+   Wait for the files of the channel (if it was exported), open them and
+   configure the channel. In case of error the files are closed, but the
+   channel is not unexported.
+
+   Parameters:
+     * pwm: the PWM channel descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+static int
+pwm_setup(struct pwm_t *pwm)
+{
+    int e;
+
+    if ((!(pwm->flags & RFS_DONT_EXPORT) && pwm_wait_files(pwm))
+        || (pwm->flags & RFS_KEEP_OPEN && pwm_open_files(pwm))
+        || rfs_pwm_set_period(pwm, pwm->period)
+        || rfs_pwm_set_duty_cycle(pwm, 0)
+        || rfs_pwm_set_enabled(pwm, RFS_PWM_ENABLED))
+    {
+        e = errno;
+        pwm_close_files(pwm);
+        errno = e;
+        return -1;
+    }
+    return 0;
+}
+
+// Defined below with the other setters
+static int pwm_set_enabled(struct pwm_t *pwm, enum pwm_enable_t enabled);
+
+/* Release a PWM channel before unexporting it: detach it from its write
+   queue once its writes are done, disable it and close its files.
+
+   Parameters:
+     * pwm: the PWM channel descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+static int
+pwm_release(struct pwm_t *pwm)
+{
+    int res;
+
+    // The writes left in a write queue would be done once the channel is
+    // closed, and the release is written right away
+    if (write_queue_detach(&pwm->write_queue)) {
+        return -1;
+    }
+    res = pwm_set_enabled(pwm, RFS_PWM_DISABLED);
+    pwm_close_files(pwm);
+    return res;
+}
+
+/* Store an attribute of a channel in its cache.
+
+   Only done with RFS_CACHE: without it the channel may be shared by threads,
+   that must not write the same fields.
+
+   Parameters:
+     * pwm: the PWM channel descriptor.
+     * cached: the cached attribute.
+     * value: its value (-1 if unknown).
+*/
+static void
+pwm_cache(const struct pwm_t *pwm, int *cached, int value)
+{
+    if (pwm->flags & RFS_CACHE) {
+        *cached = value;
+    }
+}
 
 /* Open a PWM channel using the linux sysfs interface.
 
@@ -54,43 +231,49 @@
    Return 0 if the pin was successfully opened, -1 otherwise. In case of error,
    errno is set accordingly.
 */
-int
-rfs_pwm_open(struct pwm_t *pwm)
+static int
+pwm_open(struct pwm_t *pwm)
 {
     char channelstr[RFS_MAX_SYSFS_STR];
+    int e;
 
-    // Initialize the file names for this chip/channel
-    snprintf(pwm->export_file, RFS_PWM_FILENAME_MAX_LEN, RFS_PWM_EXPORT_FILE,
-        pwm->chip);
-    snprintf(pwm->unexport_file, RFS_PWM_FILENAME_MAX_LEN,
-        RFS_PWM_UNEXPORT_FILE, pwm->chip);
-    snprintf(pwm->period_file, RFS_PWM_FILENAME_MAX_LEN, RFS_PWM_PERIOD_FILE,
-        pwm->chip, pwm->channel);
-    snprintf(pwm->duty_cycle_file, RFS_PWM_FILENAME_MAX_LEN,
-        RFS_PWM_DUTY_CYCLE_FILE, pwm->chip, pwm->channel);
-    snprintf(pwm->enable_file, RFS_PWM_FILENAME_MAX_LEN,
-        RFS_PWM_ENABLE_FILE, pwm->chip, pwm->channel);
+    if (pwm_init(pwm)) {
+        return -1;
+    }
 
     // Export the pin, if necessary
+    snprintf(channelstr, RFS_MAX_SYSFS_STR, "%hhu", pwm->channel);
     if (!(pwm->flags & RFS_DONT_EXPORT)) {
-        snprintf(channelstr, RFS_MAX_SYSFS_STR, "%hhu", pwm->channel);
         if (write_sysfs_file(pwm->export_file, channelstr)) {
             return -1;
         }
     }
 
-    if (rfs_pwm_set_period(pwm, pwm->period) || rfs_pwm_set_duty_cycle(pwm, 0)
-        || rfs_pwm_set_enabled(pwm, RFS_PWM_ENABLED))
-    {
-        // In case of error, unexport the channel (if it was actually exported)
+    if (pwm_setup(pwm)) {
+        // In case of error, unexport the channel (if it was actually
+        // exported)
+        e = errno;
         if (!(pwm->flags & RFS_DONT_EXPORT)) {
             write_sysfs_file(pwm->unexport_file, channelstr);
         }
+        errno = e;
         return -1;
     }
     return 0;
 }
 
+int
+rfs_pwm_open(struct pwm_t *pwm)
+{
+    int res;
+
+    PROBE2(pwm_open_entry, pwm->chip, pwm->channel);
+    STATS_START(start);
+    res = STATS_END(RFS_STATS_PWM_OPEN, start, pwm_open(pwm));
+    PROBE3(pwm_open_return, pwm->chip, pwm->channel, res);
+    return res;
+}
+
 /* Get the PWM signal's duty cycle
 
    Parameters:
@@ -99,15 +282,36 @@ rfs_pwm_open(struct pwm_t *pwm)
    Return the duty cycle in case of succes, -1 otherwise. In case of error,
    errno is set accordingly.
 */
-int
-rfs_pwm_get_duty_cycle(struct pwm_t *pwm)
+static int
+pwm_get_duty_cycle(struct pwm_t *pwm)
 {
     char dcstr[RFS_MAX_SYSFS_STR];
+    int duty_cycle;
 
-    if (read_sysfs_file(pwm->duty_cycle_file, dcstr, RFS_MAX_SYSFS_STR)) {
+    if (pwm->flags & RFS_CACHE && pwm->cached_duty_cycle >= 0) {
+        return pwm->cached_duty_cycle;
+    }
+    if (read_sysfs_attr(pwm->duty_cycle_fd, pwm->duty_cycle_file, dcstr,
+        RFS_MAX_SYSFS_STR))
+    {
         return -1;
     }
-    return atoi(dcstr);
+    duty_cycle = atoi(dcstr);
+    pwm_cache(pwm, &pwm->cached_duty_cycle, duty_cycle);
+    return duty_cycle;
+}
+
+int
+rfs_pwm_get_duty_cycle(struct pwm_t *pwm)
+{
+    int res;
+
+    PROBE2(pwm_get_duty_cycle_entry, pwm->chip, pwm->channel);
+    STATS_START(start);
+    res = STATS_END(RFS_STATS_PWM_GET_DUTY_CYCLE, start,
+        pwm_get_duty_cycle(pwm));
+    PROBE3(pwm_get_duty_cycle_return, pwm->chip, pwm->channel, res);
+    return res;
 }
 
 /* Get the enabled state of the PWM channel
@@ -118,18 +322,36 @@ rfs_pwm_get_duty_cycle(struct pwm_t *pwm)
    Return the enabled status in case of succes, -1 otherwise. In case of error,
    errno is set accordingly.
 */
-int
-rfs_pwm_get_enabled(struct pwm_t *pwm)
+static int
+pwm_get_enabled(struct pwm_t *pwm)
 {
     char enabledstr[RFS_MAX_SYSFS_STR];
+    int enabled;
 
-    if (read_sysfs_file(pwm->enable_file, enabledstr, RFS_MAX_SYSFS_STR)) {
-        return -1;
+    if (pwm->flags & RFS_CACHE && pwm->cached_enabled >= 0) {
+        return pwm->cached_enabled;
     }
-    if (strcmp(enabledstr, "0\n") == 0) {
-        return RFS_PWM_DISABLED;
+    if (read_sysfs_attr(pwm->enable_fd, pwm->enable_file, enabledstr,
+        RFS_MAX_SYSFS_STR))
+    {
+        return -1;
     }
-    return RFS_PWM_ENABLED;
+    enabled = (strcmp(enabledstr, "0\n") == 0) ?
+        RFS_PWM_DISABLED : RFS_PWM_ENABLED;
+    pwm_cache(pwm, &pwm->cached_enabled, enabled);
+    return enabled;
+}
+
+int
+rfs_pwm_get_enabled(struct pwm_t *pwm)
+{
+    int res;
+
+    PROBE2(pwm_get_enabled_entry, pwm->chip, pwm->channel);
+    STATS_START(start);
+    res = STATS_END(RFS_STATS_PWM_GET_ENABLED, start, pwm_get_enabled(pwm));
+    PROBE3(pwm_get_enabled_return, pwm->chip, pwm->channel, res);
+    return res;
 }
 
 /* Get the PWM signal's period
@@ -140,15 +362,37 @@ rfs_pwm_get_enabled(struct pwm_t *pwm)
    Return the period in case of succes, -1 otherwise. In case of error,
    errno is set accordingly.
 */
-int
-rfs_pwm_get_period(struct pwm_t *pwm)
+static int
+pwm_get_period(struct pwm_t *pwm)
 {
     char periodstr[RFS_MAX_SYSFS_STR];
+    int period;
 
-    if (read_sysfs_file(pwm->period_file, periodstr, RFS_MAX_SYSFS_STR)) {
+    if (pwm->flags & RFS_CACHE && pwm->cached_period >= 0) {
+        return pwm->cached_period;
+    }
+    if (read_sysfs_attr(pwm->period_fd, pwm->period_file, periodstr,
+        RFS_MAX_SYSFS_STR))
+    {
         return -1;
     }
-    return atoi(periodstr);
+    period = atoi(periodstr);
+    // Other threads may read the period while it is updated
+    __atomic_store_n(&pwm->period, period, __ATOMIC_RELAXED);
+    pwm_cache(pwm, &pwm->cached_period, period);
+    return period;
+}
+
+int
+rfs_pwm_get_period(struct pwm_t *pwm)
+{
+    int res;
+
+    PROBE2(pwm_get_period_entry, pwm->chip, pwm->channel);
+    STATS_START(start);
+    res = STATS_END(RFS_STATS_PWM_GET_PERIOD, start, pwm_get_period(pwm));
+    PROBE3(pwm_get_period_return, pwm->chip, pwm->channel, res);
+    return res;
 }
 
 /* Set the duty cycle of the PWM signal.
@@ -160,8 +404,8 @@ rfs_pwm_get_period(struct pwm_t *pwm)
    Return 0 if the duty cycle was correctly set, -1 otherwise (and errno is
    set accordingly).
 */
-int
-rfs_pwm_set_duty_cycle(struct pwm_t *pwm, pwm_time_t duty_cycle)
+static int
+pwm_set_duty_cycle(struct pwm_t *pwm, pwm_time_t duty_cycle)
 {
     char dcstr[RFS_MAX_SYSFS_STR];
 
@@ -170,15 +414,39 @@ rfs_pwm_set_duty_cycle(struct pwm_t *pwm, pwm_time_t duty_cycle)
         errno = EINVAL;
         return -1;
     }
+    if (pwm->flags & RFS_CACHE && pwm->cached_duty_cycle == duty_cycle) {
+        return 0;
+    }
     // Write the duty cycle value
     snprintf(dcstr, RFS_MAX_SYSFS_STR, "%u", duty_cycle);
-    if (write_sysfs_file(pwm->duty_cycle_file, dcstr))
+    if (write_sysfs_attr(pwm->duty_cycle_fd, pwm->duty_cycle_file, dcstr))
     {
+        pwm_cache(pwm, &pwm->cached_duty_cycle, -1);
         return -1;
     }
+    pwm_cache(pwm, &pwm->cached_duty_cycle, duty_cycle);
     return 0;
 }
 
+int
+rfs_pwm_set_duty_cycle(struct pwm_t *pwm, pwm_time_t duty_cycle)
+{
+    int res;
+
+    // With a write queue, its thread does the write
+    if (write_queue_deferred(pwm->write_queue)) {
+        return rfs_write_queue_push(pwm->write_queue, pwm,
+            RFS_WRITE_PWM_DUTY_CYCLE, duty_cycle);
+    }
+    PROBE3(pwm_set_duty_cycle_entry, pwm->chip, pwm->channel, duty_cycle);
+    STATS_START(start);
+    res = STATS_END(RFS_STATS_PWM_SET_DUTY_CYCLE, start,
+        pwm_set_duty_cycle(pwm, duty_cycle));
+    PROBE4(pwm_set_duty_cycle_return, pwm->chip, pwm->channel, duty_cycle,
+        res);
+    return res;
+}
+
 /* Set the enabled state of the PWM channel.
 
    Parameters:
@@ -188,8 +456,8 @@ rfs_pwm_set_duty_cycle(struct pwm_t *pwm, pwm_time_t duty_cycle)
    Return 0 if the pwm channel is correctly enabled/disabled, -1 otherwise (and
    errno is set accordingly).
 */
-int
-rfs_pwm_set_enabled(struct pwm_t *pwm, enum pwm_enable_t enabled)
+static int
+pwm_set_enabled(struct pwm_t *pwm, enum pwm_enable_t enabled)
 {
     int res;
 
@@ -198,17 +466,40 @@ rfs_pwm_set_enabled(struct pwm_t *pwm, enum pwm_enable_t enabled)
         errno = EINVAL;
         return -1;
     }
+    if (pwm->flags & RFS_CACHE && pwm->cached_enabled == (int)enabled) {
+        return 0;
+    }
     if (enabled) {
-        res = write_sysfs_file(pwm->enable_file, "1");
+        res = write_sysfs_attr(pwm->enable_fd, pwm->enable_file, "1");
     } else {
-        res = write_sysfs_file(pwm->enable_file, "0");
+        res = write_sysfs_attr(pwm->enable_fd, pwm->enable_file, "0");
     }
     if (res) {
+        pwm_cache(pwm, &pwm->cached_enabled, -1);
         return -1;
     }
+    pwm_cache(pwm, &pwm->cached_enabled, enabled);
     return 0;
 }
 
+int
+rfs_pwm_set_enabled(struct pwm_t *pwm, enum pwm_enable_t enabled)
+{
+    int res;
+
+    // With a write queue, its thread does the write
+    if (write_queue_deferred(pwm->write_queue)) {
+        return rfs_write_queue_push(pwm->write_queue, pwm,
+            RFS_WRITE_PWM_ENABLED, enabled);
+    }
+    PROBE3(pwm_set_enabled_entry, pwm->chip, pwm->channel, enabled);
+    STATS_START(start);
+    res = STATS_END(RFS_STATS_PWM_SET_ENABLED, start,
+        pwm_set_enabled(pwm, enabled));
+    PROBE4(pwm_set_enabled_return, pwm->chip, pwm->channel, enabled, res);
+    return res;
+}
+
 /* Set the period of the PWM signal.
 
    Parameters:
@@ -218,8 +509,8 @@ rfs_pwm_set_enabled(struct pwm_t *pwm, enum pwm_enable_t enabled)
    Return 0 if the period was correctly set, -1 otherwise (and errno is
    set accordingly).
 */
-int
-rfs_pwm_set_period(struct pwm_t *pwm, pwm_time_t period)
+static int
+pwm_set_period(struct pwm_t *pwm, pwm_time_t period)
 {
     char periodstr[RFS_MAX_SYSFS_STR];
 
@@ -228,15 +519,83 @@ rfs_pwm_set_period(struct pwm_t *pwm, pwm_time_t period)
         errno = EINVAL;
         return -1;
     }
+    if (pwm->flags & RFS_CACHE && pwm->cached_period == period) {
+        return 0;
+    }
     // Write the period value
     snprintf(periodstr, RFS_MAX_SYSFS_STR, "%u", period);
-    if (write_sysfs_file(pwm->period_file, periodstr))
+    if (write_sysfs_attr(pwm->period_fd, pwm->period_file, periodstr))
     {
+        pwm_cache(pwm, &pwm->cached_period, -1);
         return -1;
     }
+    __atomic_store_n(&pwm->period, period, __ATOMIC_RELAXED);
+    pwm_cache(pwm, &pwm->cached_period, period);
     return 0;
 }
 
+int
+rfs_pwm_set_period(struct pwm_t *pwm, pwm_time_t period)
+{
+    int res;
+
+    // With a write queue, its thread does the write
+    if (write_queue_deferred(pwm->write_queue)) {
+        return rfs_write_queue_push(pwm->write_queue, pwm,
+            RFS_WRITE_PWM_PERIOD, period);
+    }
+    PROBE3(pwm_set_period_entry, pwm->chip, pwm->channel, period);
+    STATS_START(start);
+    res = STATS_END(RFS_STATS_PWM_SET_PERIOD, start,
+        pwm_set_period(pwm, period));
+    PROBE4(pwm_set_period_return, pwm->chip, pwm->channel, period, res);
+    return res;
+}
+
+/* Measure the signal at the input of a PWM channel in capture mode.
+
+   The capture file gives the period and the duty cycle, separated by a
+   space.
+
+   Parameters:
+     * pwm: the PWM channel descriptor.
+     * period: where to store the period of the input signal.
+     * duty_cycle: where to store the duty cycle of the input signal.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+static int
+pwm_capture(struct pwm_t *pwm, pwm_time_t *period,
+    pwm_time_t *duty_cycle)
+{
+    char file[RFS_PWM_FILENAME_MAX_LEN];
+    char capturestr[2 * RFS_MAX_SYSFS_STR];
+
+    if (sysfs_path(file, RFS_PWM_FILENAME_MAX_LEN, RFS_PWM_CAPTURE_FILE,
+            pwm->chip, pwm->channel)
+        || read_sysfs_file(file, capturestr, sizeof(capturestr)))
+    {
+        return -1;
+    }
+    if (sscanf(capturestr, "%d %d", period, duty_cycle) != 2) {
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+int
+rfs_pwm_capture(struct pwm_t *pwm, pwm_time_t *period,
+    pwm_time_t *duty_cycle)
+{
+    int res;
+
+    PROBE2(pwm_capture_entry, pwm->chip, pwm->channel);
+    res = pwm_capture(pwm, period, duty_cycle);
+    PROBE3(pwm_capture_return, pwm->chip, pwm->channel, res);
+    return res;
+}
+
 /* Closes the PWM pin.
 
    The PWM channel is disabled. If the pin was exported, is unexported.
@@ -247,12 +606,12 @@ rfs_pwm_set_period(struct pwm_t *pwm, pwm_time_t period)
    Return 0 if the PWM channel was correctly closed (disabled and unexported
    if necessary), -1 otherwise. In case of error, errno is set accordingly.
 */
-int
-rfs_pwm_close(struct pwm_t *pwm)
+static int
+pwm_close(struct pwm_t *pwm)
 {
     char channelstr[RFS_MAX_SYSFS_STR];
 
-    if (rfs_pwm_set_enabled(pwm, RFS_PWM_DISABLED)) {
+    if (pwm_release(pwm)) {
         return -1;
     }
     // Unexport the file, if it was actually exported
@@ -265,3 +624,213 @@ rfs_pwm_close(struct pwm_t *pwm)
     return 0;
 }
 
+int
+rfs_pwm_close(struct pwm_t *pwm)
+{
+    int res;
+
+    PROBE2(pwm_close_entry, pwm->chip, pwm->channel);
+    STATS_START(start);
+    res = STATS_END(RFS_STATS_PWM_CLOSE, start, pwm_close(pwm));
+    PROBE3(pwm_close_return, pwm->chip, pwm->channel, res);
+    return res;
+}
+
+/* Close some channels of a set, unexporting them through a single descriptor
+   per PWM chip.
+
+   Parameters:
+     * pwms: the channels.
+     * n: number of channels.
+     * skip: channels to skip, those whose entry is not 0 (NULL to close all).
+     * errors: where to store the error of each channel (0 if it was closed),
+         or NULL.
+
+   Return the error of the first channel that couldn't be closed, or 0.
+*/
+static int
+pwm_close_batch(struct pwm_t *pwms, unsigned int n, const int *skip,
+    int *errors)
+{
+    struct sysfs_batch_t unexport;
+    char channelstr[RFS_MAX_SYSFS_STR];
+    unsigned int i;
+    int e, first = 0;
+
+    sysfs_batch_init(&unexport);
+    for (i = 0; i < n; i++) {
+        if (skip && skip[i]) {
+            continue;
+        }
+        e = 0;
+        if (pwm_release(&pwms[i])) {
+            e = errno;
+        } else if (!(pwms[i].flags & RFS_DONT_EXPORT)) {
+            snprintf(channelstr, RFS_MAX_SYSFS_STR, "%hhu", pwms[i].channel);
+            if (write_sysfs_batch(&unexport, pwms[i].unexport_file,
+                channelstr))
+            {
+                e = errno;
+            }
+        }
+        if (errors) {
+            errors[i] = e;
+        }
+        if (e && !first) {
+            first = e;
+        }
+    }
+    sysfs_batch_close(&unexport);
+    return first;
+}
+
+/* Open a set of PWM channels.
+
+   Parameters:
+     * pwms: the channels to open.
+     * n: number of channels.
+     * errors: where to store the error of each channel, or NULL.
+
+   Return 0 if all the channels were opened, -1 otherwise (and errno is set to
+   the error of the first channel that failed).
+*/
+static int
+pwm_open_many(struct pwm_t *pwms, unsigned int n, int *errors)
+{
+    struct sysfs_batch_t export;
+    char channelstr[RFS_MAX_SYSFS_STR];
+    int *status = errors;
+    unsigned int i;
+    int e = 0;
+
+    if (!status && !(status = malloc(n * sizeof(int)))) {
+        return -1;
+    }
+    // Export all the channels first, so the kernel and udev prepare their
+    // files while the rest are exported
+    sysfs_batch_init(&export);
+    for (i = 0; i < n; i++) {
+        status[i] = 0;
+        if (pwm_init(&pwms[i])) {
+            status[i] = errno;
+        } else if (!(pwms[i].flags & RFS_DONT_EXPORT)) {
+            snprintf(channelstr, RFS_MAX_SYSFS_STR, "%hhu", pwms[i].channel);
+            if (write_sysfs_batch(&export, pwms[i].export_file, channelstr)) {
+                status[i] = errno;
+            }
+        }
+    }
+    sysfs_batch_close(&export);
+    // Then set them up. By now the files of most of them are ready, so the
+    // waits are short
+    for (i = 0; i < n; i++) {
+        if (!status[i] && pwm_setup(&pwms[i])) {
+            status[i] = errno;
+            if (!(pwms[i].flags & RFS_DONT_EXPORT)) {
+                snprintf(channelstr, RFS_MAX_SYSFS_STR, "%hhu",
+                    pwms[i].channel);
+                write_sysfs_file(pwms[i].unexport_file, channelstr);
+            }
+        }
+        if (status[i] && !e) {
+            e = status[i];
+        }
+    }
+    // If any channel failed, close the others
+    if (e) {
+        pwm_close_batch(pwms, n, status, NULL);
+    }
+    if (status != errors) {
+        free(status);
+    }
+    if (e) {
+        errno = e;
+        return -1;
+    }
+    return 0;
+}
+
+int
+rfs_pwm_open_many(struct pwm_t *pwms, unsigned int n, int *errors)
+{
+    int res;
+
+    PROBE1(pwm_open_many_entry, n);
+    res = pwm_open_many(pwms, n, errors);
+    PROBE2(pwm_open_many_return, n, res);
+    return res;
+}
+
+/* Close a set of PWM channels.
+
+   Parameters:
+     * pwms: the channels to close.
+     * n: number of channels.
+     * errors: where to store the error of each channel, or NULL.
+
+   Return 0 if all the channels were closed, -1 otherwise (and errno is set to
+   the error of the first channel that failed).
+*/
+static int
+pwm_close_many(struct pwm_t *pwms, unsigned int n, int *errors)
+{
+    int e;
+
+    if ((e = pwm_close_batch(pwms, n, NULL, errors))) {
+        errno = e;
+        return -1;
+    }
+    return 0;
+}
+
+int
+rfs_pwm_close_many(struct pwm_t *pwms, unsigned int n, int *errors)
+{
+    int res;
+
+    PROBE1(pwm_close_many_entry, n);
+    res = pwm_close_many(pwms, n, errors);
+    PROBE2(pwm_close_many_return, n, res);
+    return res;
+}
+
+/* Forget the attributes cached for a PWM channel opened with RFS_CACHE.
+
+   Parameters:
+     * pwm: the PWM channel descriptor.
+*/
+static void
+pwm_invalidate(struct pwm_t *pwm)
+{
+    pwm->cached_period = -1;
+    pwm->cached_duty_cycle = -1;
+    pwm->cached_enabled = -1;
+}
+
+void
+rfs_pwm_invalidate(struct pwm_t *pwm)
+{
+    PROBE2(pwm_invalidate_entry, pwm->chip, pwm->channel);
+    pwm_invalidate(pwm);
+    PROBE2(pwm_invalidate_return, pwm->chip, pwm->channel);
+}
+
+/* Attach a PWM channel to a write queue, or detach it.
+
+   Parameters:
+     * pwm: the PWM channel descriptor.
+     * queue: the queue, or NULL.
+*/
+static void
+pwm_set_write_queue(struct pwm_t *pwm, struct write_queue_t *queue)
+{
+    pwm->write_queue = queue;
+}
+
+void
+rfs_pwm_set_write_queue(struct pwm_t *pwm, struct write_queue_t *queue)
+{
+    PROBE3(pwm_set_write_queue_entry, pwm->chip, pwm->channel, queue);
+    pwm_set_write_queue(pwm, queue);
+    PROBE2(pwm_set_write_queue_return, pwm->chip, pwm->channel);
+}
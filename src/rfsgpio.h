@@ -27,15 +27,40 @@
 // For an explanation about the linux sysfs interface for GPIO and PWM, see:
 // https://www.kernel.org/doc/Documentation/gpio/sysfs.txt
 // https://www.kernel.org/doc/Documentation/pwm.txt
+// And for the GPIO character device interface:
+// https://www.kernel.org/doc/html/latest/userspace-api/gpio/chardev.html
 
 #include <poll.h>
-
-#define RFS_GPIO_FILENAME_MAX_LEN   40
-#define RFS_PWM_FILENAME_MAX_LEN    50
+#include <pthread.h>
+#include <stdint.h>
+
+#define RFS_ROOT_MAX_LEN            64
+#define RFS_GPIO_FILENAME_MAX_LEN   (RFS_ROOT_MAX_LEN + 40)
+#define RFS_PWM_FILENAME_MAX_LEN    (RFS_ROOT_MAX_LEN + 50)
+#define RFS_GPIO_BANK_MAX_PINS      64
+#define RFS_EVENT_LOOP_MAX_EVENTS   64
+#define RFS_GPIO_EVENT_BATCH        16
+#define RFS_COUNTER_SLOTS           16
+#define RFS_ENCODER_STEPS           8
+#define RFS_WAVEFORM_PRIORITY       50
+#define RFS_SCHEDULER_PRIORITY      50
+#define RFS_SCHEDULER_BANKS         8
+#define RFS_WHEEL_LEVELS            6
+#define RFS_WHEEL_SLOTS             64
+#define RFS_WRITE_QUEUE_BATCH       64
+#define RFS_CLOCK_SOURCE_MAX_LEN    32
+#define RFS_DEFAULT_WAIT_TIMEOUT    1000
+#define RFS_IO_BATCH_MAX_OPS        64
+#define RFS_IO_BUFFER_LEN           16
+#define RFS_STATS_MAX_ERRNO         134
+#define RFS_STATS_BUCKETS           32
 
 // Type that represents a GPIO pin number
 typedef unsigned int gpio_pin_t;
 
+// Type that represents a GPIO chip number (N in /dev/gpiochipN)
+typedef unsigned int gpio_chip_t;
+
 // Type that represents a PWM chip number
 typedef unsigned int pwm_chip_t;
 
@@ -47,7 +72,12 @@ typedef int pwm_time_t;
 
 // Fags to the opening functions
 enum flags_t {
-    RFS_DONT_EXPORT = 1
+    RFS_DONT_EXPORT = 1,
+    RFS_KEEP_OPEN = 2,
+    RFS_CHARDEV = 4,
+    RFS_MMIO = 8,
+    RFS_CACHE = 16,
+    RFS_THREAD_SAFE = 32
 };
 
 // Possible directions of a pin
@@ -72,26 +102,579 @@ enum gpio_edge_t {
 // Type for the PWM enable possible values
 enum pwm_enable_t {RFS_PWM_DISABLED, RFS_PWM_ENABLED};
 
+struct gpio_bank_t;
+struct gpio_event_t;
+struct write_queue_t;
+
+// Struct that describes the registers of a memory mapped GPIO controller
+struct mmio_layout_t {
+    // Device file that gives access to the registers (for example
+    // "/dev/gpiomem"), relative to the root set with rfs_set_root
+    const char *device;
+
+    // Size of the register block to map, in bytes
+    unsigned long size;
+
+    // Number of pins of the controller
+    unsigned int npins;
+
+    // Offset of the first function select register, bits per pin in these
+    // registers and the values of the input and output functions
+    unsigned long fsel;
+    unsigned int fsel_bits;
+    unsigned int fsel_input;
+    unsigned int fsel_output;
+
+    // Offsets of the first set, clear and level registers (one bit per pin)
+    unsigned long set;
+    unsigned long clr;
+    unsigned long lev;
+};
+
+// Layout of the BCM2835 family of GPIO controllers (Raspberry Pi)
+extern const struct mmio_layout_t rfs_mmio_bcm2835;
+
+// Scheduling policies of the threads owned by the library
+enum thread_policy_t {
+    // Each thread keeps its own: SCHED_FIFO, if allowed, for those with
+    // deadlines (see RFS_WAVEFORM_PRIORITY), SCHED_OTHER for the rest
+    RFS_THREAD_DEFAULT,
+    RFS_THREAD_OTHER,
+    RFS_THREAD_FIFO,
+    RFS_THREAD_DEADLINE
+};
+
+// Real time configuration of the threads owned by the library
+struct thread_config_t {
+    // Scheduling policy, and priority with RFS_THREAD_FIFO (1 to 99)
+    enum thread_policy_t policy;
+    int priority;
+
+    // Runtime, relative deadline and period of each activation with
+    // RFS_THREAD_DEADLINE, in nanoseconds
+    uint64_t runtime;
+    uint64_t deadline;
+    uint64_t period;
+
+    // CPUs the threads can run on, a bit for each of the first 64 (0 for any)
+    uint64_t cpus;
+
+    // Whether to lock all the memory of the process (mlockall), current and
+    // future, so no page fault delays the threads
+    int lock_memory;
+
+    // Stack size of the threads (0 for the default), and bytes of it touched
+    // when they start, so they don't fault later (0 for none)
+    unsigned long stack_size;
+    unsigned long prefault;
+
+    // Timer slack of the threads, in nanoseconds (0 to keep the one of the
+    // process). The kernel gives none to the real time policies
+    unsigned long timer_slack;
+
+    // Clock source of the system to select (for example "tsc"), or NULL to
+    // keep the current one
+    const char *clock_source;
+};
+
+// Configuration of the threads by default: nothing is changed
+extern const struct thread_config_t rfs_thread_default;
+
+// Modes of the busy polling of the edge events of a GPIO pin (see
+// rfs_gpio_set_busy_poll): spinning on its value, or waiting for an interrupt
+enum busy_poll_mode_t {
+    RFS_BUSY_POLL_SPIN,
+    RFS_BUSY_POLL_INTERRUPT
+};
+
+#define RFS_BUSY_POLL_MODES 2
+
+// Counters of a mode of the busy polling of a GPIO pin
+struct busy_poll_counters_t {
+    // Waits (or parts of a wait) done in the mode, and edge events detected
+    // in it
+    unsigned long waits;
+    unsigned long events;
+
+    // Total and maximum latency of the detection of those events, in
+    // nanoseconds
+    uint64_t latency;
+    uint64_t max_latency;
+
+    // Time spent waiting in the mode, and CPU time used meanwhile by the
+    // waiting thread, in nanoseconds
+    uint64_t wait_time;
+    uint64_t cpu_time;
+};
+
+// Type of the functions called for each edge event of a GPIO pin
+typedef void (*gpio_event_callback_t)(const struct gpio_event_t *event,
+    void *data);
+
 // Struct that contains information about a GPIO pin
 struct gpio_t {
-    // GPIO pin number
+    // GPIO pin number (with RFS_CHARDEV, the line offset inside the chip)
     gpio_pin_t pin;
 
+    // GPIO chip number, only used with RFS_CHARDEV
+    gpio_chip_t chip;
+
     /* Opening flags, needed for closing operation. Possible flags are:
-       RFS_GPIO_DONT_EXPORT
+       RFS_GPIO_DONT_EXPORT, RFS_KEEP_OPEN, RFS_CHARDEV, RFS_MMIO, RFS_CACHE,
+       RFS_THREAD_SAFE
     */
     int flags;
 
     // File descriptor of the value sysfs file, in case it is left opened for
-    // polling purposes
+    // polling purposes (or for the whole life of the pin with RFS_KEEP_OPEN).
+    // With RFS_CHARDEV, file descriptor of the line request
     int fd;
 
+    // Descriptor of the value sysfs file shared by the threads that poll the
+    // pin, only used with RFS_THREAD_SAFE (and without RFS_KEEP_OPEN): number
+    // of references in the high 32 bits and the descriptor plus one in the low
+    // ones (0 if not opened), changed atomically as a whole
+    uint64_t poll_ref;
+
+    // Current configuration flags of the line, only used with RFS_CHARDEV
+    uint64_t line_flags;
+
+    // Index of the line inside the line request, only used with RFS_CHARDEV
+    unsigned int line;
+
+    // Registers of the GPIO controller, only used with RFS_MMIO
+    volatile uint32_t *regs;
+
+    // Last direction and edge written or read, only used with RFS_CACHE (-1
+    // if unknown)
+    int cached_direction;
+    int cached_edge;
+
+    // Bank this pin belongs to, if it was opened with rfs_gpio_bank_open
+    struct gpio_bank_t *bank;
+
+    // Write queue that writes the value and the direction of the pin, set
+    // with rfs_gpio_set_write_queue (NULL to write them right away)
+    struct write_queue_t *write_queue;
+
+    // Function (and its data) called for the edge events of the pin, when it
+    // is added to an event loop
+    gpio_event_callback_t callback;
+    void *callback_data;
+
+    // File descriptors of the direction and edge files, only used with
+    // RFS_KEEP_OPEN (-1 otherwise)
+    int direction_fd;
+    int edge_fd;
+
+    // Debounce period of the edge events, in microseconds (0 for none)
+    unsigned int debounce;
+
+    // Software debounce filter, used when the kernel can't debounce the pin:
+    // epoll instance with the pin descriptor and the settle timer (-1 if
+    // there's no filter), last raw value, timestamp of the first edge of the
+    // pending burst (0 if none) and last value delivered
+    int debounce_fd;
+    int debounce_timerfd;
+    enum gpio_value_t debounce_value;
+    uint64_t debounce_timestamp;
+    enum gpio_value_t debounce_delivered;
+
+    // Busy polling of the edge events (see rfs_gpio_set_busy_poll): idle
+    // period in nanoseconds (0 if disabled), pin read while spinning, last
+    // value seen, time of the last event (0 once the spinning is left) and
+    // counters of each mode
+    uint64_t busy_poll;
+    struct gpio_t *busy_poll_spin;
+    enum gpio_value_t busy_poll_value;
+    uint64_t busy_poll_last;
+    struct busy_poll_counters_t busy_poll_counters[RFS_BUSY_POLL_MODES];
+
     // Some file names to avoid compute them at every operation
     char direction_file[RFS_GPIO_FILENAME_MAX_LEN];
     char value_file[RFS_GPIO_FILENAME_MAX_LEN];
     char edge_file[RFS_GPIO_FILENAME_MAX_LEN];
 };
 
+// Struct that contains information about a bank of GPIO pins, that are read
+// and written all at once
+struct gpio_bank_t {
+    // The pins of the bank. Of each one, only the field pin (and chip, with
+    // RFS_CHARDEV) must be filled. Bit i of the bank values is the value of
+    // the pin gpios[i]
+    struct gpio_t *gpios;
+
+    // Number of pins of the bank (up to RFS_GPIO_BANK_MAX_PINS)
+    unsigned int n;
+
+    /* Opening flags, needed for closing operation. Possible flags are:
+       RFS_GPIO_DONT_EXPORT, RFS_CHARDEV, RFS_MMIO
+    */
+    int flags;
+};
+
+// Struct that describes an edge event of a GPIO pin
+struct gpio_event_t {
+    // The GPIO pin where the event happened
+    struct gpio_t *gpio;
+
+    // Value of the pin after the edge
+    enum gpio_value_t value;
+
+    // Time of the event, in nanoseconds of the CLOCK_MONOTONIC clock
+    uint64_t timestamp;
+};
+
+// Struct that contains information about an event loop, that waits for the
+// edge events of many GPIO pins at once
+struct event_loop_t {
+    // Descriptor of the epoll instance
+    int epfd;
+
+    // Descriptor of the eventfd used to wake up the loop
+    int wakefd;
+};
+
+// Struct that contains information about an edge event capture. A capture
+// thread owned by the library waits for the events of some pins and stores
+// them in a ring buffer, that the application drains at its own pace
+struct event_capture_t {
+    // Event loop used by the capture thread
+    struct event_loop_t loop;
+
+    // Ring buffer of events (allocated when the capture is opened)
+    struct gpio_event_t *events;
+
+    // Capacity of the ring buffer (a power of 2)
+    unsigned long size;
+
+    // Number of events written (by the capture thread) and read (by the
+    // application) since the capture was opened. Each one in its own cache
+    // line, to not bounce between the two threads
+    unsigned long head __attribute__((aligned(64)));
+    unsigned long tail __attribute__((aligned(64)));
+
+    // Number of events lost because the ring buffer was full
+    unsigned long overflows __attribute__((aligned(64)));
+
+    // The capture thread, and whether it is running
+    pthread_t thread;
+    int running;
+
+    // Error that stopped the capture thread (0 if none)
+    int error;
+};
+
+// Struct that contains information about a pulse counter. A thread owned by
+// the library counts the edge events of a pin, and the application reads the
+// count and the rate without ever blocking that thread
+struct pulse_counter_t {
+    // Event loop used by the counter thread
+    struct event_loop_t loop;
+
+    // The GPIO pin counted
+    struct gpio_t *gpio;
+
+    // Length of each slot of the sliding window (in nanoseconds), and time
+    // the counter was opened (in nanoseconds, CLOCK_MONOTONIC)
+    uint64_t slot_len;
+    uint64_t start;
+
+    // Number of edges counted and timestamp of the last one (0 if none),
+    // written only by the counter thread, in their own cache line
+    unsigned long long count __attribute__((aligned(64)));
+    uint64_t last_edge;
+
+    // Sliding window: edges counted in each slot, and the slot number (time
+    // divided by slot_len) they belong to. The sequence number is odd while
+    // the counter thread updates them
+    unsigned int sequence;
+    uint64_t slots[RFS_COUNTER_SLOTS];
+    unsigned long slot_counts[RFS_COUNTER_SLOTS];
+
+    // The counter thread, and whether it is running
+    pthread_t thread __attribute__((aligned(64)));
+    int running;
+
+    // Error that stopped the counter thread (0 if none)
+    int error;
+};
+
+// Struct that contains a pulse measured by a pulse capture (all the times in
+// nanoseconds)
+struct pulse_t {
+    // Time of the rising edge that started the pulse (CLOCK_MONOTONIC)
+    uint64_t start;
+
+    // Time the pin was high, from the rising to the falling edge
+    uint64_t width;
+
+    // Time since the rising edge of the previous pulse, 0 if unknown (for the
+    // first pulse, or after a lost edge)
+    uint64_t period;
+};
+
+// Struct that contains information about a pulse capture. A thread owned by
+// the library pairs the rising and falling edges of a pin and stores the
+// pulses measured in a ring buffer, that the application drains at its own
+// pace
+struct pulse_capture_t {
+    // Event loop used by the capture thread
+    struct event_loop_t loop;
+
+    // The GPIO pin measured
+    struct gpio_t *gpio;
+
+    // Ring buffer of pulses (allocated when the capture is opened), and its
+    // capacity (a power of 2)
+    struct pulse_t *pulses;
+    unsigned long size;
+
+    // Time of the rising edge of the pulse being measured and of the
+    // previous pulse (0 if none), only used by the capture thread
+    uint64_t rise;
+    uint64_t last_rise;
+
+    // Number of pulses written (by the capture thread) and read (by the
+    // application) since the capture was opened. Each one in its own cache
+    // line, to not bounce between the two threads
+    unsigned long head __attribute__((aligned(64)));
+    unsigned long tail __attribute__((aligned(64)));
+
+    // Number of pulses lost because the ring buffer was full
+    unsigned long overflows __attribute__((aligned(64)));
+
+    // The capture thread, and whether it is running
+    pthread_t thread;
+    int running;
+
+    // Error that stopped the capture thread (0 if none)
+    int error;
+};
+
+// Struct that contains information about a quadrature encoder decoder. A
+// thread owned by the library decodes the edges of the pins A and B, and the
+// application samples the position and the velocity without locks
+struct encoder_t {
+    // Event loop used by the decoder thread
+    struct event_loop_t loop;
+
+    // The GPIO pins of the channels A and B
+    struct gpio_t *a;
+    struct gpio_t *b;
+
+    // Current state (value of A in bit 1, value of B in bit 0) and the last
+    // RFS_ENCODER_STEPS steps (position and time), used to compute the
+    // velocity. Only used by the decoder thread
+    int state;
+    long long step_positions[RFS_ENCODER_STEPS];
+    uint64_t step_times[RFS_ENCODER_STEPS];
+    unsigned long steps;
+
+    // Position (in steps, 4 per cycle of the encoder) and number of illegal
+    // transitions, in their own cache line
+    long long position __attribute__((aligned(64)));
+    unsigned long illegal;
+
+    // Velocity (in steps per second) and time of the last step, written by
+    // the decoder thread between two increments of the sequence number
+    unsigned int sequence;
+    double velocity;
+    uint64_t last_step;
+
+    // The decoder thread, and whether it is running
+    pthread_t thread __attribute__((aligned(64)));
+    int running;
+
+    // Error that stopped the decoder thread (0 if none)
+    int error;
+};
+
+// Struct that contains information about a waveform player. A thread owned by
+// the library writes the samples of the buffers queued by the application to
+// the pins of a bank at a fixed rate. Two buffers can be queued at once, so
+// one is refilled while the other is played
+struct waveform_t {
+    // The bank of GPIO pins written (bit i of each sample is the pin gpios[i])
+    // and the mask of all its pins
+    struct gpio_bank_t *bank;
+    uint64_t mask;
+
+    // Samples per second, and time (in nanoseconds) before the deadline of a
+    // sample from which the player thread busy-waits instead of sleeping
+    unsigned long rate;
+    uint64_t spin;
+
+    // The two buffers of samples, and their lengths
+    const uint64_t *buffers[2];
+    unsigned long lengths[2];
+
+    // Next sample of the buffer being played, time of the first sample of
+    // the stream and number of samples written since then. Only used by the
+    // player thread
+    unsigned long position;
+    uint64_t start;
+    uint64_t samples;
+
+    // Eventfds that wake up the player thread when a buffer is queued, and
+    // the application when a buffer is played
+    int wakefd;
+    int donefd;
+
+    // Number of buffers queued (by the application) and played (by the player
+    // thread) since the player was opened. Each one in its own cache line, to
+    // not bounce between the two threads
+    unsigned long queued __attribute__((aligned(64)));
+    unsigned long played __attribute__((aligned(64)));
+
+    // Number of samples written after their deadline, number of times the
+    // stream ran out of samples and number of samples that couldn't be
+    // written
+    unsigned long late __attribute__((aligned(64)));
+    unsigned long underruns;
+    unsigned long errors;
+
+    // The player thread, and whether it is running
+    pthread_t thread __attribute__((aligned(64)));
+    int running;
+};
+
+// Type of the functions called for the changes of a scheduler, once written.
+// The lateness is the time since the change was due (0 if on time)
+typedef void (*gpio_schedule_callback_t)(struct gpio_t *gpio,
+    enum gpio_value_t value, uint64_t time, uint64_t lateness, void *data);
+
+// A change of an output scheduled at a given time
+struct gpio_timer_t {
+    // The GPIO pin and the value to write
+    struct gpio_t *gpio;
+    enum gpio_value_t value;
+
+    // Time of the change (in nanoseconds, CLOCK_MONOTONIC), and its tick
+    uint64_t time;
+    uint64_t tick;
+
+    // Next change in the same slot of the wheel, or in the free list
+    struct gpio_timer_t *next;
+};
+
+// Struct that contains information about an output scheduler. A thread owned
+// by the library writes the changes scheduled for GPIO pins when they are
+// due, keeping them in a hierarchical timer wheel: RFS_WHEEL_LEVELS levels of
+// RFS_WHEEL_SLOTS slots, each slot of a level covering a whole turn of the
+// level below
+struct gpio_scheduler_t {
+    // Timer that wakes up the scheduler thread for the next tick with changes
+    int timerfd;
+
+    // Lock that protects the wheel
+    pthread_mutex_t lock;
+
+    // Time of the tick 0, length of a tick (in nanoseconds), next tick to
+    // process and tick the timer is armed for (UINT64_MAX if none)
+    uint64_t origin;
+    uint64_t tick;
+    uint64_t current;
+    uint64_t armed;
+
+    // Lists of changes of each slot (first and last) and bitmaps of the
+    // slots that have changes, per level
+    struct gpio_timer_t *slots[RFS_WHEEL_LEVELS][RFS_WHEEL_SLOTS];
+    struct gpio_timer_t *tails[RFS_WHEEL_LEVELS][RFS_WHEEL_SLOTS];
+    uint64_t occupied[RFS_WHEEL_LEVELS];
+
+    // Changes (allocated when the scheduler is opened), list of the free
+    // ones and number of changes pending
+    struct gpio_timer_t *timers;
+    struct gpio_timer_t *free;
+    unsigned long pending;
+
+    // Function (and its data) called for each change written, may be NULL
+    gpio_schedule_callback_t callback;
+    void *callback_data;
+
+    // Highest lateness of a change, in nanoseconds
+    uint64_t max_lateness;
+
+    // Number of changes that couldn't be written
+    unsigned long errors;
+
+    // The scheduler thread, and whether it is running
+    pthread_t thread;
+    int running;
+};
+
+// Attributes written through a write queue
+enum write_attribute_t {
+    RFS_WRITE_GPIO_VALUE,
+    RFS_WRITE_GPIO_DIRECTION,
+    RFS_WRITE_PWM_PERIOD,
+    RFS_WRITE_PWM_DUTY_CYCLE,
+    RFS_WRITE_PWM_ENABLED
+};
+
+// A write pushed to a write queue
+struct write_command_t {
+    // The pin (struct gpio_t) or channel (struct pwm_t) written
+    void *handle;
+
+    // The attribute written, and its value
+    enum write_attribute_t attribute;
+    long value;
+};
+
+// Type of the functions called for the writes of a write queue, once done.
+// The error is 0 on success, or the errno of the write
+typedef void (*write_callback_t)(const struct write_command_t *command,
+    int error, void *data);
+
+// Cell of the ring buffer of a write queue. Its sequence number tells whether
+// it is free for the producer of a given position or holds a command for the
+// consumer
+struct write_cell_t {
+    unsigned long sequence;
+    struct write_command_t command;
+};
+
+// Struct that contains information about a write queue. The threads that
+// write the pins and channels attached to it push their writes without
+// locks and go on, and a thread owned by the library does them
+struct write_queue_t {
+    // Ring buffer of writes (allocated when the queue is opened), and its
+    // capacity (a power of 2)
+    struct write_cell_t *cells;
+    unsigned long size;
+
+    // Eventfd that wakes up the writer thread, and whether it is sleeping
+    int wakefd;
+    int sleeping;
+
+    // Function (and its data) called for each write done, may be NULL
+    write_callback_t callback;
+    void *callback_data;
+
+    // Lock and condition of the threads waiting in rfs_write_queue_fence,
+    // and number of them
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    int waiters;
+
+    // Positions of the next write to push (shared by the producers) and to
+    // pop (only used by the writer thread), each one in its own cache line
+    unsigned long enqueue __attribute__((aligned(64)));
+    unsigned long dequeue __attribute__((aligned(64)));
+
+    // Number of writes done (or merged with a later one), writes merged and
+    // writes failed
+    unsigned long completed __attribute__((aligned(64)));
+    unsigned long merged;
+    unsigned long errors;
+
+    // The writer thread, and whether it is running
+    pthread_t thread;
+    int running;
+};
+
 // Struct that contains information about a PWM channel.
 struct pwm_t {
     // PWM chip number
@@ -101,13 +684,31 @@ struct pwm_t {
     pwm_channel_t channel;
 
     /* Opening flags, needed for closing operation. Possible flags are:
-       RFS_GPIO_DONT_EXPORT
+       RFS_GPIO_DONT_EXPORT, RFS_KEEP_OPEN, RFS_CACHE, RFS_THREAD_SAFE
     */
     int flags;
 
-    // The PWM signal's period (in nanoseconds)
+    // The PWM signal's period (in nanoseconds), updated each time the period
+    // is set or read
     pwm_time_t period;
 
+    // Last period, duty cycle and enabled state written or read, only used
+    // with RFS_CACHE (-1 if unknown)
+    pwm_time_t cached_period;
+    pwm_time_t cached_duty_cycle;
+    int cached_enabled;
+
+    // File descriptors of the period, duty_cycle and enable files, only used
+    // with RFS_KEEP_OPEN (-1 otherwise)
+    int period_fd;
+    int duty_cycle_fd;
+    int enable_fd;
+
+    // Write queue that writes the period, duty cycle and enabled state of the
+    // channel, set with rfs_pwm_set_write_queue (NULL to write them right
+    // away)
+    struct write_queue_t *write_queue;
+
     // Some file names to avoid compute them at every operation
     char export_file[RFS_PWM_FILENAME_MAX_LEN];
     char unexport_file[RFS_PWM_FILENAME_MAX_LEN];
@@ -116,20 +717,387 @@ struct pwm_t {
     char enable_file[RFS_PWM_FILENAME_MAX_LEN];
 };
 
+struct softpwm_t;
+
+// Struct that contains information about a software PWM scheduler. A thread
+// owned by the library, woken up by a timer, generates the edges of all the
+// software PWM channels of the scheduler
+struct softpwm_scheduler_t {
+    // Timer that wakes up the scheduler thread at the next edge
+    int timerfd;
+
+    // Enabled channels, sorted by the time of their next edge
+    struct softpwm_t *timeline;
+
+    // Protects the timeline and the channels of the scheduler
+    pthread_mutex_t lock;
+
+    // Whether the thread is writing the pins, without the lock, and signaled
+    // when it ends
+    int writing;
+    pthread_cond_t written;
+
+    // Number of edges that couldn't be written
+    unsigned long errors;
+
+    // The scheduler thread, and whether it is running
+    pthread_t thread;
+    int running;
+};
+
+// Struct that contains information about a software PWM channel, generated
+// on a GPIO pin
+struct softpwm_t {
+    // The GPIO pin (the fields pin, chip and flags must be filled)
+    struct gpio_t gpio;
+
+    // Scheduler that generates the signal
+    struct softpwm_scheduler_t *scheduler;
+
+    // The PWM signal's period (in nanoseconds)
+    pwm_time_t period;
+
+    // The PWM signal's duty cycle (in nanoseconds) and enabled state
+    pwm_time_t duty_cycle;
+    enum pwm_enable_t enabled;
+
+    // Period and duty cycle of the current period of the signal, as the
+    // changes are applied at the start of the next period
+    pwm_time_t current_period;
+    pwm_time_t current_duty_cycle;
+
+    // Start of the current period and time of the next edge (in nanoseconds,
+    // CLOCK_MONOTONIC), and whether the next edge starts a new period
+    uint64_t start;
+    uint64_t next_edge;
+    int period_edge;
+
+    // Last value written to the pin
+    enum gpio_value_t value;
+
+    // Value due to be written by the scheduler thread (-1 if none), and next
+    // channel with a value due
+    int due;
+    struct softpwm_t *next_due;
+
+    // Next channel in the timeline of the scheduler
+    struct softpwm_t *next;
+};
+
+// Shapes of the duty cycle profiles of a PWM sequence
+enum pwm_ramp_t {
+    RFS_RAMP_LINEAR,
+    RFS_RAMP_EXPONENTIAL,
+    RFS_RAMP_GAMMA,
+    RFS_RAMP_TABLE
+};
+
+struct pwm_sequence_t;
+
+// Struct that contains information about a PWM sequencer. A thread owned by
+// the library, woken up by a periodic timer, updates the duty cycle of the
+// PWM channels of all the sequences being played
+struct pwm_sequencer_t {
+    // Periodic timer that wakes up the sequencer thread
+    int timerfd;
+
+    // Update interval (in nanoseconds)
+    unsigned long interval;
+
+    // Sequences being played
+    struct pwm_sequence_t *sequences;
+
+    // Number of updates lost because the thread woke up late, number of
+    // duty cycles written and number of writes failed
+    unsigned long overruns;
+    unsigned long writes;
+    unsigned long errors;
+
+    // Protects the sequences and the counters
+    pthread_mutex_t lock;
+
+    // The sequencer thread, and whether it is running
+    pthread_t thread;
+    int running;
+};
+
+// Struct that contains a duty cycle profile to apply to a PWM channel
+struct pwm_sequence_t {
+    // The PWM channel, already opened
+    struct pwm_t *pwm;
+
+    // Shape of the profile
+    enum pwm_ramp_t ramp;
+
+    // Initial and final duty cycles (in nanoseconds), not used by
+    // RFS_RAMP_TABLE
+    pwm_time_t from;
+    pwm_time_t to;
+
+    // Duration of the profile (in nanoseconds)
+    uint64_t duration;
+
+    // Steepness of RFS_RAMP_EXPONENTIAL (for example 5), or exponent of
+    // RFS_RAMP_GAMMA (for example 2.2)
+    double shape;
+
+    // Duty cycles of RFS_RAMP_TABLE, evenly spread over the duration and
+    // linearly interpolated
+    const pwm_time_t *table;
+    unsigned int table_len;
+
+    // Start of the profile (in nanoseconds, CLOCK_MONOTONIC), last duty cycle
+    // written and whether the sequence is being played
+    uint64_t start;
+    pwm_time_t last;
+    int playing;
+
+    // Next sequence of the sequencer
+    struct pwm_sequence_t *next;
+};
+
+// Flags of the I/O batches
+enum io_batch_flags_t {
+    // Do the operations synchronously, even if io_uring is available
+    RFS_IO_SYNC = 1
+};
+
+// Operations that can be queued in an I/O batch
+enum io_op_type_t {
+    RFS_IO_GPIO_SET_VALUE,
+    RFS_IO_GPIO_GET_VALUE,
+    RFS_IO_PWM_SET_DUTY_CYCLE
+};
+
+// An operation queued in an I/O batch
+struct io_op_t {
+    enum io_op_type_t type;
+
+    // The pin or channel of the operation
+    struct gpio_t *gpio;
+    struct pwm_t *pwm;
+
+    // Value or duty cycle to write
+    enum gpio_value_t value;
+    pwm_time_t duty_cycle;
+
+    // Where to store the value read, for RFS_IO_GPIO_GET_VALUE
+    int *result;
+
+    // Error of the operation after the submission (errno value, or 0)
+    int error;
+};
+
+struct sysfs_ring_t;
+
+// Struct that contains information about an I/O batch. The operations of a
+// control cycle are queued in the batch and then submitted at once, with a
+// single io_uring_enter for all the ones done through sysfs files kept opened.
+// The batch must not be moved while opened, as its buffers are registered
+struct io_batch_t {
+    // The io_uring instance, or NULL if the operations are done synchronously
+    struct sysfs_ring_t *ring;
+
+    int flags;
+
+    // Queued operations
+    struct io_op_t ops[RFS_IO_BATCH_MAX_OPS];
+    unsigned int n;
+
+    // Buffers of the operations, registered as fixed buffers
+    char buffers[RFS_IO_BATCH_MAX_OPS][RFS_IO_BUFFER_LEN];
+
+    // Number of io_uring_enter calls done
+    unsigned long enters;
+};
+
+// Operations counted in the statistics: first the syscalls done by the
+// library, then the public functions
+enum stats_op_t {
+    RFS_STATS_OPEN,
+    RFS_STATS_CLOSE,
+    RFS_STATS_READ,
+    RFS_STATS_WRITE,
+    RFS_STATS_IOCTL,
+    RFS_STATS_POLL,
+    RFS_STATS_WAIT_FILE,
+    RFS_STATS_GPIO_OPEN,
+    RFS_STATS_GPIO_CLOSE,
+    RFS_STATS_GPIO_GET_VALUE,
+    RFS_STATS_GPIO_SET_VALUE,
+    RFS_STATS_GPIO_GET_DIRECTION,
+    RFS_STATS_GPIO_SET_DIRECTION,
+    RFS_STATS_GPIO_GET_EDGE,
+    RFS_STATS_GPIO_SET_EDGE,
+    RFS_STATS_GPIO_WAIT_EDGE,
+    RFS_STATS_PWM_OPEN,
+    RFS_STATS_PWM_CLOSE,
+    RFS_STATS_PWM_GET_PERIOD,
+    RFS_STATS_PWM_SET_PERIOD,
+    RFS_STATS_PWM_GET_DUTY_CYCLE,
+    RFS_STATS_PWM_SET_DUTY_CYCLE,
+    RFS_STATS_PWM_GET_ENABLED,
+    RFS_STATS_PWM_SET_ENABLED,
+    RFS_STATS_IO_BATCH_SUBMIT,
+    RFS_STATS_OPS
+};
+
+// Statistics of an operation
+struct op_stats_t {
+    // Number of calls, of failed calls, and bytes read or written (only for
+    // RFS_STATS_READ and RFS_STATS_WRITE)
+    uint64_t calls;
+    uint64_t errors;
+    uint64_t bytes;
+
+    // Total time spent in the operation (in nanoseconds)
+    uint64_t time;
+
+    // Failed calls by errno (the errno values from RFS_STATS_MAX_ERRNO on
+    // are counted in errnos[0])
+    uint64_t errnos[RFS_STATS_MAX_ERRNO];
+
+    // Latency histogram: histogram[i] counts the calls that took from 2^i to
+    // 2^(i+1) - 1 nanoseconds (the last one, longer; the first one, from 0)
+    uint64_t histogram[RFS_STATS_BUCKETS];
+};
+
+// Statistics of all the operations, indexed by enum stats_op_t
+struct stats_t {
+    struct op_stats_t ops[RFS_STATS_OPS];
+};
+
+/* Set the root directory under which the sysfs (and device) files are
+   looked for.
+
+   By default the files are accessed at their usual locations (/sys/class/gpio,
+   /sys/class/pwm, ...). With a root, for example "/tmp/fake", the library uses
+   /tmp/fake/sys/class/gpio and so on instead. This is mainly useful to test
+   and benchmark the library against a fake sysfs tree. It only affects the
+   pins and channels opened after the call.
+
+   Parameters:
+     * root: the new root directory, or NULL or "" to use the real one.
+
+   Return 0 if the root was changed, -1 otherwise (errno is set to
+   ENAMETOOLONG if root is longer than RFS_ROOT_MAX_LEN - 1 characters).
+*/
+int
+rfs_set_root(const char *root);
+
+/* Set the maximum time to wait for the files of a pin or channel after
+   exporting it.
+
+   After the export, the kernel creates the files of the pin or channel and
+   udev may change their permissions a bit later. The opening functions wait
+   until the files they need are accessible, using inotify, and return as
+   soon as they are. If they aren't after this time, the opening fails with
+   the error of the last access (usually ENOENT or EACCES). The default is
+   RFS_DEFAULT_WAIT_TIMEOUT milliseconds.
+
+   Parameters:
+     * timeout: the maximum time to wait, in milliseconds (0 not to wait).
+
+   Return 0 if the timeout was changed, -1 otherwise (and errno is set to
+   EINVAL for a negative timeout).
+*/
+int
+rfs_set_wait_timeout(int timeout);
+
+/* Set the register layout of the GPIO controller used with RFS_MMIO.
+
+   By default the layout is rfs_mmio_bcm2835. It only affects the pins opened
+   after the call, and can't be changed while there are pins opened with
+   RFS_MMIO.
+
+   Parameters:
+     * layout: the register layout (it is copied, device included).
+
+   Return 0 if the layout was changed, -1 otherwise (and errno is set to EBUSY
+   if there are pins opened with RFS_MMIO, or EINVAL for a wrong layout: one
+   with registers of its pins not aligned to 4 bytes or out of its size, or
+   function values that don't fit in fsel_bits).
+*/
+int
+rfs_mmio_set_layout(const struct mmio_layout_t *layout);
+
+/* Set the real time configuration of the threads owned by the library.
+
+   The policy, priority, CPUs, stack and timer slack are applied to each
+   thread when it is started, so the configuration only affects the threads
+   started after the call (by rfs_event_capture_start, rfs_waveform_start,
+   rfs_gpio_scheduler_open...). If a thread can't get them, it isn't started
+   and the function that starts it fails (with EPERM without the privileges
+   to use a real time policy). With RFS_THREAD_DEADLINE the kernel doesn't
+   allow to restrict the CPUs.
+
+   The memory lock and the clock source affect the whole system or process,
+   and are applied right away: the clock source is written to
+   /sys/devices/system/clocksource/clocksource0/current_clocksource, under
+   the root set with rfs_set_root.
+
+   Parameters:
+     * config: the configuration (it is copied, clock source included).
+
+   Return 0 if the configuration was changed, -1 otherwise (and errno is set
+   to EINVAL for a wrong configuration, or the error of mlockall or of the
+   write of the clock source).
+*/
+int
+rfs_thread_set_config(const struct thread_config_t *config);
+
 /* Open a GPIO pin using the linux sysfs interface.
 
    The pin is first exported and then the direction set. If the flag
    RFS_GPIO_DONT_EXPORT is set, the pin is not exported by the library and must
    be externally exported to use it.
 
+   If the flag RFS_KEEP_OPEN is set, the value, direction and edge files are
+   opened once here and kept opened until rfs_gpio_close. Then each operation
+   over the pin is a single pread or pwrite, instead of an open, a read or
+   write and a close.
+
+   If the flag RFS_CHARDEV is set, the sysfs interface is not used. The line
+   gpio.pin of the chip /dev/gpiochipN (N being gpio.chip) is requested
+   through the GPIO character device instead, and each operation over the pin
+   is a single ioctl. There's no export in this case.
+
+   If the flag RFS_MMIO is set, the registers of the GPIO controller are mapped
+   in memory (see rfs_mmio_set_layout) and the pin is driven writing to them
+   directly, without any syscall. There's no export and no edge support in
+   this case. Note that the direction of a pin shares its register with other
+   pins, so the direction of pins of the same register must not be changed
+   concurrently (unless they are opened with RFS_THREAD_SAFE).
+
+   If the flag RFS_CACHE is set with the sysfs interface, the last direction
+   and edge written or read are kept in memory: the getters don't read the
+   sysfs files when the value is known, and setting the direction to
+   RFS_GPIO_IN or an edge that are already set does nothing. Use
+   rfs_gpio_invalidate if other processes may change the pin.
+
+   If the flag RFS_THREAD_SAFE is set, the pin can be used from many threads
+   at once, without locks: reading and writing the value and waiting for its
+   edges never close a descriptor that other thread may be using. With sysfs
+   (and without RFS_KEEP_OPEN) each read or write uses its own descriptor and
+   the polled one is reference counted (see rfs_gpio_get_poll_descriptors).
+   With RFS_MMIO the direction changes are serialized with the other pins. The
+   configuration of the pin (direction, edge, debounce period) must still be
+   changed from a single thread at a time, and the flag can't be used with
+   RFS_CACHE (EINVAL).
+
    Parameters:
      * gpio: information to open the GPIO pin. Of this structure, only the
          fields pin and flags must be filled. the others are for internal use
          only.
          gpio.pin must contain the number of the pin to open.
+         gpio.chip must contain the GPIO chip number if RFS_CHARDEV is used.
          gpio.flags contains modifying flags.
          If flag RFS_GPIO_DONT_EXPORT is set, the pin is not exported by this
-         library.
+         library. If flag RFS_KEEP_OPEN is set, the pin files are kept opened.
+         If flag RFS_CHARDEV is set, the GPIO character device is used.
+         If flag RFS_MMIO is set, the registers are accessed directly.
+         If flag RFS_CACHE is set, the direction and edge are cached.
+         If flag RFS_THREAD_SAFE is set, the pin can be shared by threads.
      * direction: Initial direction of the pin. May be one of RFS_GPIO_IN,
          RFS_GPIO_OUT, RFS_GPIO_OUT_LOW and RFS_GPIO_OUT_HIGH. The last two
          set the direction of the pin and the value in an atomic fashion.
@@ -164,7 +1132,17 @@ rfs_gpio_get_edge(struct gpio_t *gpio);
 
 /* Return the poll descriptors, used to call poll over this pin.
 
-   The pin is leaved opened, of course, to be able to poll it.
+   The pin is leaved opened, of course, to be able to poll it. With the flag
+   RFS_KEEP_OPEN the descriptor is the one opened by rfs_gpio_open and it stays
+   valid after rfs_gpio_get_value, so there's no need to call this function
+   again after each event.
+
+   With RFS_THREAD_SAFE (and without RFS_KEEP_OPEN) the descriptor is shared
+   by all the threads that poll the pin, and each call takes a reference to
+   it: it stays opened, whatever the other threads do with the pin, until
+   released with rfs_gpio_put_poll_descriptors (the events must be read while
+   holding it). The pending event is only cleared when the descriptor is
+   opened, not when it is already polled.
 
    Parameters:
      * gpio: GPIO pin descriptor.
@@ -176,6 +1154,84 @@ rfs_gpio_get_edge(struct gpio_t *gpio);
 int
 rfs_gpio_get_poll_descriptors(struct gpio_t *gpio, struct pollfd *descriptors);
 
+/* Release the poll descriptors taken with rfs_gpio_get_poll_descriptors.
+
+   Only needed with RFS_THREAD_SAFE: the shared descriptor is closed when its
+   last reference is released. Otherwise it does nothing.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+
+   Return 0 on success, -1 otherwise (EINVAL if no reference is held).
+*/
+int
+rfs_gpio_put_poll_descriptors(struct gpio_t *gpio);
+
+/* Read an edge event of a GPIO pin.
+
+   Call it when the poll descriptors of the pin signal an event. With
+   RFS_CHARDEV the event is read from the line request, with the timestamp
+   given by the kernel. Otherwise, the value is read from the value file (which
+   rearms the poll descriptor) and the event is timestamped when read.
+
+   Note that with RFS_CHARDEV rfs_gpio_get_value doesn't consume the pending
+   events, so this function must be used to rearm the poll descriptor.
+
+   With a software debounce filter (see rfs_gpio_set_debounce), the raw edges
+   are consumed by the filter and only the settled transitions are returned:
+   the function fails with EAGAIN when the descriptor signaled an edge that is
+   still settling, and the event has the timestamp of the first edge of the
+   burst.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+     * event: where to store the event.
+
+   Return 0 if an event was read, -1 otherwise. In case of error, errno is set
+   accordingly.
+*/
+int
+rfs_gpio_read_event(struct gpio_t *gpio, struct gpio_event_t *event);
+
+/* Read some edge events of a GPIO pin.
+
+   Like rfs_gpio_read_event, but with RFS_CHARDEV all the events queued in the
+   line request (up to n, and up to RFS_GPIO_EVENT_BATCH) are read with a
+   single read. With the other interfaces, or with a software debounce filter,
+   one event is read.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+     * events: where to store the events.
+     * n: maximum number of events to read (at least 1).
+
+   Return the number of events read, or -1 in case of error (and errno is set
+   accordingly).
+*/
+int
+rfs_gpio_read_events(struct gpio_t *gpio, struct gpio_event_t *events,
+    unsigned int n);
+
+/* Wait for an edge event of a GPIO pin.
+
+   The edge of the pin must have been set before with rfs_gpio_set_edge. The
+   pin is polled through its opened descriptor, and the event is read with
+   rfs_gpio_read_event, which rearms the descriptor for the next wait. Use
+   RFS_KEEP_OPEN or RFS_CHARDEV to avoid reopening the value file at each
+   wait.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+     * timeout: maximum time to wait, in milliseconds (-1 to wait forever).
+     * event: where to store the event.
+
+   Return 1 if an event was read, 0 if the timeout expired, or -1 in case of
+   error (and errno is set accordingly).
+*/
+int
+rfs_gpio_wait_edge(struct gpio_t *gpio, int timeout,
+    struct gpio_event_t *event);
+
 /* Return the current value of a GPIO pin.
 
    Parameters:
@@ -226,6 +1282,8 @@ rfs_gpio_set_value(struct gpio_t *gpio, enum gpio_value_t value);
 /* Closes the GPIO pin.
 
    The direction is set to RFS_GPIO_IN. If the pin was exported, is unexported.
+   The pins of a bank can't be closed individually (errno is set to EBUSY),
+   use rfs_gpio_bank_close instead.
 
    Parameters:
      * gpio: GPIO pin descriptor.
@@ -236,88 +1294,1113 @@ rfs_gpio_set_value(struct gpio_t *gpio, enum gpio_value_t value);
 int
 rfs_gpio_close(struct gpio_t *gpio);
 
-/* Open a PWM channel using the linux sysfs interface.
+/* Open a set of GPIO pins.
 
-   The pin is first exported and then the period of the PWM signal is set. If
-   the flag RFS_GPIO_DONT_EXPORT is set, the pin is not exported by the library
-   and must be externally exported to use it.
+   Works like rfs_gpio_open over each pin, but all the pins are exported first,
+   through a single descriptor of the export file, and then set up, so the
+   waits for the files of the pins overlap. If any pin can't be opened, the
+   ones that were opened are closed again, so either all or none of the pins
+   are left opened.
 
    Parameters:
-     * pwm: information to open the PWM channel.
-         pwm.channel must contain the number of the PWM channel to open.
-         pwm.flags contains modifying flags.
-         pwm.period contains the period of the PWM signal.
-         If flag RFS_GPIO_DONT_EXPORT is set, the pin is not exported by this
-         library.
-
-   Return 0 if the pin was successfully opened, -1 otherwise. In case of error,
-   errno is set accordingly.
+     * gpios: the pins to open (the fields to fill are the same as in
+         rfs_gpio_open). Each pin may have its own flags.
+     * n: number of pins.
+     * direction: initial direction of the pins.
+     * errors: if not NULL, array of n elements where the error of each pin is
+         stored (the errno value, or 0 if the pin was opened before the
+         rollback).
+
+   Return 0 if all the pins were opened, -1 otherwise (and errno is set to the
+   error of the first pin that failed).
 */
 int
-rfs_pwm_open(struct pwm_t *pwm);
+rfs_gpio_open_many(struct gpio_t *gpios, unsigned int n,
+    enum gpio_direction_t direction, int *errors);
 
-/* Get the PWM signal's duty cycle
+/* Close a set of GPIO pins.
+
+   Works like rfs_gpio_close over each pin, but all the pins are unexported
+   through a single descriptor of the unexport file. All the pins are closed
+   even if some of them fail.
 
    Parameters:
-     * pwm: the PWM channel descriptor.
+     * gpios: the pins to close.
+     * n: number of pins.
+     * errors: if not NULL, array of n elements where the error of each pin is
+         stored (the errno value, or 0 if the pin was closed).
 
-   Return the duty cycle in case of succes, -1 otherwise. In case of error,
-   errno is set accordingly.
+   Return 0 if all the pins were closed, -1 otherwise (and errno is set to the
+   error of the first pin that failed).
 */
 int
-rfs_pwm_get_duty_cycle(struct pwm_t *pwm);
+rfs_gpio_close_many(struct gpio_t *gpios, unsigned int n, int *errors);
 
-/* Get the enabled state of the PWM channel
+/* Set the debounce period of the edge events of a GPIO pin.
 
-   Parameters:
-     * pwm: the PWM channel descriptor.
+   Edges followed by another edge before the period elapses are considered
+   bounces, so only the transitions that stay stable for the whole period
+   are reported by rfs_gpio_read_event, rfs_gpio_wait_edge and the event
+   loops.
 
-   Return the enabled status in case of succes, -1 otherwise. In case of error,
-   errno is set accordingly.
-*/
-int
-rfs_pwm_get_enabled(struct pwm_t *pwm);
+   With RFS_CHARDEV the debounce attribute of the line is set, so the kernel
+   filters the edges (in hardware when the controller supports it) and the
+   pin is polled as usual. Otherwise, or if the kernel rejects the attribute,
+   a software filter is installed: the poll descriptor of the pin becomes an
+   epoll instance with the pin descriptor and a timer, armed at each raw edge
+   to its timestamp plus the period, and the event is delivered when the
+   timer expires. This filter needs RFS_KEEP_OPEN with sysfs, and isn't
+   available for the pins of a bank opened with RFS_CHARDEV. With RFS_MMIO
+   there are no edges, so this function fails with ENOTSUP.
 
-/* Get the PWM signal's period
+   The pin must not be in an event loop nor have the busy polling set (see
+   rfs_gpio_set_busy_poll) when the period is changed, and with a software
+   filter its poll descriptors must be taken again.
 
    Parameters:
-     * pwm: the PWM channel descriptor.
+     * gpio: GPIO pin descriptor.
+     * period: debounce period, in microseconds (0 to disable debouncing).
 
-   Return the period in case of succes, -1 otherwise. In case of error,
-   errno is set accordingly.
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
 */
 int
-rfs_pwm_get_period(struct pwm_t *pwm);
-
-/* Set the duty cycle of the PWM signal.
+rfs_gpio_set_debounce(struct gpio_t *gpio, unsigned int period);
+
+/* Set the busy polling of the edge events of a GPIO pin.
+
+   While the events are frequent, rfs_gpio_wait_edge doesn't sleep on the poll
+   descriptor of the pin, which costs a scheduler wakeup for each event: it
+   spins reading the value of the pin instead, and reports the transitions
+   that match its edge. Once no event is seen for the idle period, it drops
+   back to waiting for the interrupt, and spins again from the next event. The
+   edges queued while spinning were already seen, so they are discarded.
+
+   The pin needs a persistent descriptor to wait for the interrupts, so it
+   must be opened with RFS_KEEP_OPEN or RFS_CHARDEV (and not in a bank). With
+   RFS_MMIO there are no edges, so this function fails with ENOTSUP, but the
+   same pin opened with RFS_MMIO can be given to spin on its registers, the
+   fastest value path. Otherwise the pin itself is read through its
+   descriptor. Any other spin pin is rejected with EINVAL.
+
+   Spinning takes a whole CPU, so the waiting thread should run alone on an
+   isolated core. Pulses shorter than a read of the value can be missed, and
+   the debounce period (see rfs_gpio_set_debounce) can't be used at the same
+   time. Only one thread can wait for the events of the pin, and it must not
+   be in an event loop.
+
+   Setting the busy polling clears its counters (see
+   rfs_gpio_get_busy_poll_counters), and the pin starts waiting for the
+   interrupt.
 
    Parameters:
-     * pwm: the PWM channel descriptor.
-     * duty_cycle: the new duty cycle.
+     * gpio: GPIO pin descriptor.
+     * idle: idle period after the last event, in microseconds (0 to disable
+         the busy polling).
+     * spin: pin to read while spinning (the same pin opened with RFS_MMIO),
+         or NULL to read the pin itself.
 
-   Return 0 if the duty cycle was correctly set, -1 otherwise (and errno is
-   set accordingly).
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
 */
 int
-rfs_pwm_set_duty_cycle(struct pwm_t *pwm, pwm_time_t duty_cycle);
+rfs_gpio_set_busy_poll(struct gpio_t *gpio, unsigned int idle,
+    struct gpio_t *spin);
 
-/* Set the enabled state of the PWM channel.
+/* Get the counters of a mode of the busy polling of a GPIO pin.
+
+   In the spin mode the latency of an event is the time from the previous read
+   of the value to the end of the read that saw the transition. In the
+   interrupt mode it's the time from the timestamp of the event to its return
+   by rfs_gpio_wait_edge, so with sysfs, where the events are timestamped when
+   read, it doesn't include the wakeup. The CPU time against the time waiting
+   gives the cost of each mode. The counters can be read from any thread.
 
    Parameters:
-     * pwm: the PWM channel descriptor.
-     * enable: RFS_PWM_DISABLED to disable, RFS_PWM_ENABLED to enable.
+     * gpio: GPIO pin descriptor.
+     * mode: the mode.
+     * counters: where to store the counters.
 
-   Return 0 if the pwm channel is correctly enabled/disabled, -1 otherwise (and
-   errno is set accordingly).
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
 */
 int
-rfs_pwm_set_enabled(struct pwm_t *pwm, enum pwm_enable_t enabled);
+rfs_gpio_get_busy_poll_counters(struct gpio_t *gpio,
+    enum busy_poll_mode_t mode, struct busy_poll_counters_t *counters);
 
-/* Set the period of the PWM signal.
+/* Forget the direction and edge cached for a GPIO pin opened with RFS_CACHE.
 
-   Parameters:
-     * pwm: the PWM channel descriptor.
-     * period: period of the PWM signal.
+   The next getters read them again from the sysfs files, so use this function
+   when the pin may have been changed by another process.
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+*/
+void
+rfs_gpio_invalidate(struct gpio_t *gpio);
+
+/* Attach a GPIO pin to a write queue, or detach it.
+
+   While attached, rfs_gpio_set_value and rfs_gpio_set_direction push the
+   write to the queue and return at once, so a slow controller doesn't stall
+   the caller. Their errors are reported to the callback of the queue. The
+   rest of the functions of the pin must not be called until the writes are
+   done (see rfs_write_queue_fence).
+
+   Parameters:
+     * gpio: GPIO pin descriptor.
+     * queue: the queue, or NULL to write right away again.
+*/
+void
+rfs_gpio_set_write_queue(struct gpio_t *gpio, struct write_queue_t *queue);
+
+/* Open a bank of GPIO pins.
+
+   All the pins are opened with the same direction. With RFS_CHARDEV all the
+   pins must belong to the same chip, and they are requested in a single line
+   request, so the whole bank is read or written with a single ioctl. With
+   RFS_MMIO the bank is read or written with a register access per 32 pins.
+   With the sysfs interface the pins are opened with RFS_KEEP_OPEN, and the
+   bank is read or written with a pread or pwrite per pin.
+
+   Once opened, the pins of the bank can also be used individually with the
+   rest of rfs_gpio_* functions, except rfs_gpio_close.
+
+   Parameters:
+     * bank: information to open the bank.
+         bank.gpios must contain the pins to open.
+         bank.n must contain the number of pins.
+         bank.flags contains modifying flags (RFS_GPIO_DONT_EXPORT,
+         RFS_CHARDEV and RFS_MMIO, with the same meaning as in
+         rfs_gpio_open).
+     * direction: Initial direction of the pins.
+
+   Return 0 if the bank was successfully opened, -1 otherwise. In case of
+   error, errno is set accordingly and none of the pins is left opened.
+*/
+int
+rfs_gpio_bank_open(struct gpio_bank_t *bank, enum gpio_direction_t direction);
+
+/* Read the values of all the pins of a bank.
+
+   Parameters:
+     * bank: bank descriptor.
+     * bits: where to store the values, bit i for the pin bank.gpios[i].
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_gpio_bank_get(struct gpio_bank_t *bank, uint64_t *bits);
+
+/* Set the values of some pins of a bank.
+
+   Parameters:
+     * bank: bank descriptor.
+     * mask: pins to set, bit i for the pin bank.gpios[i].
+     * bits: values to give to the pins in mask.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_gpio_bank_set(struct gpio_bank_t *bank, uint64_t mask, uint64_t bits);
+
+/* Close a bank of GPIO pins.
+
+   All the pins are closed as with rfs_gpio_close.
+
+   Parameters:
+     * bank: bank descriptor.
+
+   Return 0 if all the pins were correctly closed, -1 otherwise. In case of
+   error, errno is set accordingly.
+*/
+int
+rfs_gpio_bank_close(struct gpio_bank_t *bank);
+
+/* Open an event loop.
+
+   An event loop uses a single epoll instance to wait for the edge events of
+   any number of GPIO pins, and calls a function for each event.
+
+   Parameters:
+     * loop: the event loop descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_event_loop_open(struct event_loop_t *loop);
+
+/* Add a GPIO pin to an event loop.
+
+   The edge of the pin must have been set before with rfs_gpio_set_edge. With
+   the sysfs interface, the pin must have been opened with RFS_KEEP_OPEN,
+   because its value file is read through the same descriptor after each event
+   to rearm it. A pin can only be in one event loop at a time.
+
+   Parameters:
+     * loop: the event loop descriptor.
+     * gpio: the GPIO pin.
+     * callback: function called for each edge event of the pin.
+     * data: data passed to the callback.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly, EINVAL
+   for sysfs pins opened without RFS_KEEP_OPEN).
+*/
+int
+rfs_event_loop_add(struct event_loop_t *loop, struct gpio_t *gpio,
+    gpio_event_callback_t callback, void *data);
+
+/* Remove a GPIO pin from an event loop.
+
+   Parameters:
+     * loop: the event loop descriptor.
+     * gpio: the GPIO pin.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_event_loop_remove(struct event_loop_t *loop, struct gpio_t *gpio);
+
+/* Wait for the edge events of the pins of an event loop and dispatch them.
+
+   Waits once for events and calls the callback of each pin that has one. Call
+   it in a loop to keep processing events. The events queued for a pin opened
+   with RFS_CHARDEV are read in batches, with a single read per wakeup, and
+   the events read in a wakeup are dispatched in the order of their
+   timestamps.
+
+   Parameters:
+     * loop: the event loop descriptor.
+     * timeout: maximum time to wait, in milliseconds (-1 to wait forever).
+
+   Return the number of events dispatched (0 if the timeout expired), or -1 in
+   case of error (and errno is set accordingly).
+*/
+int
+rfs_event_loop_run(struct event_loop_t *loop, int timeout);
+
+/* Wake up an event loop.
+
+   Makes the current (or next) call to rfs_event_loop_run return, even if no
+   event has happened. It can be called from any thread.
+
+   Parameters:
+     * loop: the event loop descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_event_loop_wakeup(struct event_loop_t *loop);
+
+/* Close an event loop.
+
+   The pins of the loop are not closed, only the loop itself.
+
+   Parameters:
+     * loop: the event loop descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_event_loop_close(struct event_loop_t *loop);
+
+/* Open an edge event capture.
+
+   The ring buffer of events is allocated here, so the capture thread never
+   allocates memory.
+
+   Parameters:
+     * capture: the capture descriptor.
+     * size: capacity of the ring buffer, in events. It is rounded up to a
+         power of 2.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_event_capture_open(struct event_capture_t *capture, unsigned long size);
+
+/* Add a GPIO pin to an edge event capture.
+
+   The same conditions as in rfs_event_loop_add apply. The pins can be added
+   before or after the capture is started.
+
+   Parameters:
+     * capture: the capture descriptor.
+     * gpio: the GPIO pin.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_event_capture_add(struct event_capture_t *capture, struct gpio_t *gpio);
+
+/* Start the capture thread.
+
+   The thread waits for the events of the pins of the capture and stores them
+   in the ring buffer. Each event is timestamped by the kernel with
+   RFS_CHARDEV, or by the capture thread when read otherwise. If the ring
+   buffer is full the event is counted as an overflow and discarded.
+
+   Parameters:
+     * capture: the capture descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_event_capture_start(struct event_capture_t *capture);
+
+/* Read the captured events.
+
+   Only one thread may read the events of a capture. It never blocks.
+
+   Parameters:
+     * capture: the capture descriptor.
+     * events: where to store the events.
+     * n: maximum number of events to read.
+
+   Return the number of events read (0 if there was none).
+*/
+unsigned long
+rfs_event_capture_read(struct event_capture_t *capture,
+    struct gpio_event_t *events, unsigned long n);
+
+/* Return the number of events lost because the ring buffer was full.
+
+   Parameters:
+     * capture: the capture descriptor.
+*/
+unsigned long
+rfs_event_capture_overflows(struct event_capture_t *capture);
+
+/* Return the error that stopped the capture thread.
+
+   An error waiting for the events, other than an interruption, stops the
+   thread, as it would be given again at once. rfs_event_capture_stop must
+   still be called.
+
+   Parameters:
+     * capture: the capture descriptor.
+
+   Return the errno value, or 0 if the thread wasn't stopped by an error.
+*/
+int
+rfs_event_capture_error(struct event_capture_t *capture);
+
+/* Stop the capture thread.
+
+   The events already captured can still be read.
+
+   Parameters:
+     * capture: the capture descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_event_capture_stop(struct event_capture_t *capture);
+
+/* Close an edge event capture.
+
+   The capture thread is stopped if it is running. The pins are not closed.
+
+   Parameters:
+     * capture: the capture descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_event_capture_close(struct event_capture_t *capture);
+
+/* Open a pulse counter of a GPIO pin.
+
+   The counter counts all the edge events of the pin, so set the edge of the
+   pin (with rfs_gpio_set_edge) to the edges to count. The pin must be opened
+   with RFS_KEEP_OPEN or RFS_CHARDEV, and with RFS_CHARDEV the edges are
+   timestamped by the kernel and read in batches, so the counter thread wakes
+   up once for all the edges queued.
+
+   Parameters:
+     * counter: the counter descriptor.
+     * gpio: the GPIO pin, already opened.
+     * window: length of the sliding window used to compute the rate (in
+         nanoseconds), split in RFS_COUNTER_SLOTS slots.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_pulse_counter_open(struct pulse_counter_t *counter, struct gpio_t *gpio,
+    uint64_t window);
+
+/* Start the counter thread.
+
+   Parameters:
+     * counter: the counter descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_pulse_counter_start(struct pulse_counter_t *counter);
+
+/* Return the number of edges counted since the counter was opened.
+
+   It never blocks, and may be called from any thread.
+
+   Parameters:
+     * counter: the counter descriptor.
+*/
+unsigned long long
+rfs_pulse_counter_count(struct pulse_counter_t *counter);
+
+/* Return the timestamp of the last edge counted.
+
+   It never blocks, and may be called from any thread.
+
+   Parameters:
+     * counter: the counter descriptor.
+
+   Return the timestamp (in nanoseconds of the CLOCK_MONOTONIC clock), or 0 if
+   no edge was counted yet.
+*/
+uint64_t
+rfs_pulse_counter_last_edge(struct pulse_counter_t *counter);
+
+/* Return the rate of the edges over the sliding window.
+
+   The edges of the slots of the window are added and divided by the time
+   they cover, up to now (or since the counter was opened, if that's
+   shorter). It never blocks the counter thread: if it updates the window
+   while it is read, the reading is just retried.
+
+   Parameters:
+     * counter: the counter descriptor.
+
+   Return the rate, in edges per second.
+*/
+double
+rfs_pulse_counter_rate(struct pulse_counter_t *counter);
+
+/* Return the error that stopped the counter thread.
+
+   An error waiting for the edges, other than an interruption, stops the
+   thread. rfs_pulse_counter_stop must still be called.
+
+   Parameters:
+     * counter: the counter descriptor.
+
+   Return the errno value, or 0 if the thread wasn't stopped by an error.
+*/
+int
+rfs_pulse_counter_error(struct pulse_counter_t *counter);
+
+/* Stop the counter thread.
+
+   The count and the rate can still be read.
+
+   Parameters:
+     * counter: the counter descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_pulse_counter_stop(struct pulse_counter_t *counter);
+
+/* Close a pulse counter.
+
+   The counter thread is stopped if it is running. The pin is not closed.
+
+   Parameters:
+     * counter: the counter descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_pulse_counter_close(struct pulse_counter_t *counter);
+
+/* Open a pulse capture of a GPIO pin.
+
+   The edge of the pin is set to RFS_GPIO_BOTH. The pin must be opened with
+   RFS_KEEP_OPEN or RFS_CHARDEV; with RFS_CHARDEV the pulses are measured with
+   the timestamps given by the kernel, so the wakeup latency of the capture
+   thread doesn't affect them.
+
+   Parameters:
+     * capture: the capture descriptor.
+     * gpio: the GPIO pin, already opened as input.
+     * size: capacity of the ring buffer, in pulses (rounded up to a power of
+         2).
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_pulse_capture_open(struct pulse_capture_t *capture, struct gpio_t *gpio,
+    unsigned long size);
+
+/* Start the capture thread.
+
+   Each falling edge that follows a rising edge completes a pulse, that is
+   stored in the ring buffer. If the ring buffer is full, the pulse is lost
+   and counted as an overflow.
+
+   Parameters:
+     * capture: the capture descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_pulse_capture_start(struct pulse_capture_t *capture);
+
+/* Read the measured pulses.
+
+   Only one thread may read the pulses of a capture. It never blocks.
+
+   Parameters:
+     * capture: the capture descriptor.
+     * pulses: where to store the pulses.
+     * n: maximum number of pulses to read.
+
+   Return the number of pulses read (0 if there was none).
+*/
+unsigned long
+rfs_pulse_capture_read(struct pulse_capture_t *capture, struct pulse_t *pulses,
+    unsigned long n);
+
+/* Return the number of pulses lost because the ring buffer was full.
+
+   Parameters:
+     * capture: the capture descriptor.
+*/
+unsigned long
+rfs_pulse_capture_overflows(struct pulse_capture_t *capture);
+
+/* Return the error that stopped the capture thread.
+
+   An error waiting for the edges, other than an interruption, stops the
+   thread. The pulses measured before can still be read, and
+   rfs_pulse_capture_stop must still be called.
+
+   Parameters:
+     * capture: the capture descriptor.
+
+   Return the errno value, or 0 if the thread wasn't stopped by an error.
+*/
+int
+rfs_pulse_capture_error(struct pulse_capture_t *capture);
+
+/* Stop the capture thread.
+
+   The pulses already measured can still be read.
+
+   Parameters:
+     * capture: the capture descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_pulse_capture_stop(struct pulse_capture_t *capture);
+
+/* Close a pulse capture.
+
+   The capture thread is stopped if it is running. The pin is not closed.
+
+   Parameters:
+     * capture: the capture descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_pulse_capture_close(struct pulse_capture_t *capture);
+
+/* Open a quadrature encoder decoder.
+
+   The edges of both pins are set to RFS_GPIO_BOTH, and the initial state is
+   read from them. The pins must be opened with RFS_KEEP_OPEN or RFS_CHARDEV;
+   with RFS_CHARDEV the velocity is computed from the timestamps given by the
+   kernel, so the wakeup latency of the decoder thread doesn't affect it. Open
+   them as a bank with RFS_CHARDEV: the edges of both channels then come in
+   order through a single line request, while the edges of different line
+   requests (or sysfs files) are only ordered inside each wakeup.
+
+   Parameters:
+     * encoder: the encoder descriptor.
+     * a: GPIO pin of the channel A, already opened as input.
+     * b: GPIO pin of the channel B, already opened as input.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_encoder_open(struct encoder_t *encoder, struct gpio_t *a,
+    struct gpio_t *b);
+
+/* Start the decoder thread.
+
+   Each transition is decoded with a state-transition table: a step forward
+   (A leading B), a step backward, or an illegal transition (an edge that
+   doesn't change the value of its channel, because the opposite edge was
+   lost), that is counted and doesn't change the position.
+
+   Parameters:
+     * encoder: the encoder descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_encoder_start(struct encoder_t *encoder);
+
+/* Return the position of an encoder, in steps (4 per cycle).
+
+   It never blocks, and may be called from any thread.
+
+   Parameters:
+     * encoder: the encoder descriptor.
+*/
+long long
+rfs_encoder_position(struct encoder_t *encoder);
+
+/* Return the velocity of an encoder, in steps per second.
+
+   It is computed from the times of the last RFS_ENCODER_STEPS steps. When the
+   encoder stops, it decays as the time since the last step grows. It never
+   blocks the decoder thread: if it updates the velocity while it is read, the
+   reading is just retried.
+
+   Parameters:
+     * encoder: the encoder descriptor.
+*/
+double
+rfs_encoder_velocity(struct encoder_t *encoder);
+
+/* Return the number of illegal transitions decoded.
+
+   Illegal transitions come from noise or from edges lost because the encoder
+   turns too fast.
+
+   Parameters:
+     * encoder: the encoder descriptor.
+*/
+unsigned long
+rfs_encoder_illegal(struct encoder_t *encoder);
+
+/* Return the error that stopped the decoder thread.
+
+   An error waiting for the edges of A or B, other than an interruption,
+   stops the thread, and the position stays at its last value.
+   rfs_encoder_stop must still be called.
+
+   Parameters:
+     * encoder: the encoder descriptor.
+
+   Return the errno value, or 0 if the thread wasn't stopped by an error.
+*/
+int
+rfs_encoder_error(struct encoder_t *encoder);
+
+/* Stop the decoder thread.
+
+   Parameters:
+     * encoder: the encoder descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_encoder_stop(struct encoder_t *encoder);
+
+/* Close a quadrature encoder decoder.
+
+   The decoder thread is stopped if it is running. The pins are not closed.
+
+   Parameters:
+     * encoder: the encoder descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_encoder_close(struct encoder_t *encoder);
+
+/* Open a waveform player.
+
+   The pins of the bank must be outputs, and the bank is written as a whole
+   for each sample, with rfs_gpio_bank_set: open it with RFS_MMIO or
+   RFS_CHARDEV, so each sample is a register write or a single ioctl.
+
+   Parameters:
+     * waveform: the player descriptor.
+     * bank: the bank of GPIO pins, already opened.
+     * rate: samples per second.
+     * spin: time before the deadline of each sample (in nanoseconds) that the
+       player thread busy-waits instead of sleeping, to absorb its wakeup
+       latency. 0 to only sleep.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_waveform_open(struct waveform_t *waveform, struct gpio_bank_t *bank,
+    unsigned long rate, uint64_t spin);
+
+/* Queue a buffer of samples to be played.
+
+   The buffers are played in the order they are queued, and the stream goes
+   on without a gap from one to the next. The buffer must not be changed
+   until it is played (see rfs_waveform_played). Only one thread may queue
+   buffers. It never blocks.
+
+   Parameters:
+     * waveform: the player descriptor.
+     * samples: the samples (bit i of each sample is the value of the pin
+       gpios[i] of the bank).
+     * n: number of samples.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly). If two
+   buffers are already queued and not played, it fails with EAGAIN.
+*/
+int
+rfs_waveform_queue(struct waveform_t *waveform, const uint64_t *samples,
+    unsigned long n);
+
+/* Wait until a buffer can be queued.
+
+   Parameters:
+     * waveform: the player descriptor.
+     * timeout: maximum time to wait, in milliseconds (-1 to wait forever).
+
+   Return 1 if a buffer can be queued, 0 if the timeout expired, or -1 in
+   case of error (and errno is set accordingly).
+*/
+int
+rfs_waveform_wait(struct waveform_t *waveform, int timeout);
+
+/* Return the number of buffers completely played since the player was
+   opened. The buffers queued before that number can be reused.
+
+   Parameters:
+     * waveform: the player descriptor.
+*/
+unsigned long
+rfs_waveform_played(struct waveform_t *waveform);
+
+/* Start the player thread.
+
+   If the process is allowed to (CAP_SYS_NICE or RLIMIT_RTPRIO), the player
+   thread runs with the real time policy SCHED_FIFO and the priority
+   RFS_WAVEFORM_PRIORITY, unless rfs_thread_set_config gives another policy.
+   The deadline of each sample is absolute, counted from the first sample of
+   the stream, so the rate doesn't drift. The thread sleeps until the spin
+   time before the deadline and then busy-waits until it.
+
+   Parameters:
+     * waveform: the player descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_waveform_start(struct waveform_t *waveform);
+
+/* Return the number of samples written after their deadline.
+
+   The player thread was late (preempted, or the writes are slower than the
+   rate) and wrote them right away, to catch up with the stream.
+
+   Parameters:
+     * waveform: the player descriptor.
+*/
+unsigned long
+rfs_waveform_late(struct waveform_t *waveform);
+
+/* Return the number of times the stream ran out of samples.
+
+   The player thread waits for the next buffer queued, that starts a new
+   stream.
+
+   Parameters:
+     * waveform: the player descriptor.
+*/
+unsigned long
+rfs_waveform_underruns(struct waveform_t *waveform);
+
+/* Return the number of samples that couldn't be written.
+
+   Each one is lost, but the samples after it keep their deadlines.
+
+   Parameters:
+     * waveform: the player descriptor.
+*/
+unsigned long
+rfs_waveform_errors(struct waveform_t *waveform);
+
+/* Stop the player thread.
+
+   Playing goes on from the next sample when started again.
+
+   Parameters:
+     * waveform: the player descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_waveform_stop(struct waveform_t *waveform);
+
+/* Close a waveform player.
+
+   The player thread is stopped if it is running. The bank is not closed.
+
+   Parameters:
+     * waveform: the player descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_waveform_close(struct waveform_t *waveform);
+
+/* Open an output scheduler.
+
+   The changes due in the same tick are written together: those of pins of
+   the same bank with a single rfs_gpio_bank_set (up to RFS_SCHEDULER_BANKS
+   banks per tick), the rest one by one. If the process is allowed to
+   (CAP_SYS_NICE or RLIMIT_RTPRIO), the scheduler thread runs with the real
+   time policy SCHED_FIFO and the priority RFS_SCHEDULER_PRIORITY, unless
+   rfs_thread_set_config gives another policy.
+
+   Parameters:
+     * scheduler: the scheduler descriptor.
+     * tick: length of a tick of the wheel, in nanoseconds. The changes are
+       never written before their time, and at most a tick after it when the
+       thread isn't late.
+     * size: maximum number of changes pending.
+     * callback: function called from the scheduler thread for each change
+       written, with its lateness, or NULL. It must not schedule changes.
+     * data: data passed to the callback.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_gpio_scheduler_open(struct gpio_scheduler_t *scheduler, uint64_t tick,
+    unsigned long size, gpio_schedule_callback_t callback, void *data);
+
+/* Schedule a change of an output.
+
+   It takes constant time, whatever the number of changes pending. The
+   changes of a pin due in the same tick are written in the order they were
+   scheduled. A time already passed is written in the next tick.
+
+   Parameters:
+     * scheduler: the scheduler descriptor.
+     * gpio: the GPIO pin, already opened as output.
+     * value: the value to write.
+     * time: when to write it, in nanoseconds (CLOCK_MONOTONIC).
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly). If
+   the value is wrong, it fails with EINVAL, and if there are already size
+   changes pending, with EAGAIN.
+*/
+int
+rfs_gpio_schedule(struct gpio_scheduler_t *scheduler, struct gpio_t *gpio,
+    enum gpio_value_t value, uint64_t time);
+
+/* Return the number of changes pending.
+
+   Parameters:
+     * scheduler: the scheduler descriptor.
+*/
+unsigned long
+rfs_gpio_scheduler_pending(struct gpio_scheduler_t *scheduler);
+
+/* Return the highest lateness of a change written, in nanoseconds.
+
+   Parameters:
+     * scheduler: the scheduler descriptor.
+*/
+uint64_t
+rfs_gpio_scheduler_max_lateness(struct gpio_scheduler_t *scheduler);
+
+/* Return the number of changes that couldn't be written. They are still
+   passed to the callback.
+
+   Parameters:
+     * scheduler: the scheduler descriptor.
+*/
+unsigned long
+rfs_gpio_scheduler_errors(struct gpio_scheduler_t *scheduler);
+
+/* Close an output scheduler.
+
+   The changes pending are discarded. The pins are not closed.
+
+   Parameters:
+     * scheduler: the scheduler descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_gpio_scheduler_close(struct gpio_scheduler_t *scheduler);
+
+/* Open a write queue, and start its writer thread.
+
+   The writer thread pops the writes in batches of up to
+   RFS_WRITE_QUEUE_BATCH. In each batch, only the last write of each attribute
+   of a pin or channel is done, and the writes are done in the order of the
+   ones that remain.
+
+   Parameters:
+     * queue: the queue descriptor.
+     * size: maximum number of writes pending.
+     * callback: function called from the writer thread for each write done,
+       with its error, or NULL. The writes merged with a later one are not
+       done, so they don't get it.
+     * data: data passed to the callback.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_write_queue_open(struct write_queue_t *queue, unsigned long size,
+    write_callback_t callback, void *data);
+
+/* Push a write to a write queue.
+
+   The setters of the pins and channels attached to the queue call it. It
+   doesn't block, and may be called from any thread: the threads compete for
+   the positions of the ring buffer with an atomic compare and swap, and only
+   wake up the writer thread with a syscall when it is sleeping.
+
+   Parameters:
+     * queue: the queue descriptor.
+     * handle: the pin (struct gpio_t) or channel (struct pwm_t).
+     * attribute: the attribute to write.
+     * value: the value to write.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly). If the
+   ring buffer is full, it fails with EAGAIN.
+*/
+int
+rfs_write_queue_push(struct write_queue_t *queue, void *handle,
+    enum write_attribute_t attribute, long value);
+
+/* Wait until the writes pushed before are done.
+
+   Parameters:
+     * queue: the queue descriptor.
+     * timeout: maximum time to wait, in milliseconds (-1 to wait forever).
+
+   Return 1 if the writes were done, 0 if the timeout expired, or -1 in case
+   of error (and errno is set accordingly).
+*/
+int
+rfs_write_queue_fence(struct write_queue_t *queue, int timeout);
+
+/* Return the number of writes merged with a later write of the same
+   attribute, and so not done.
+
+   Parameters:
+     * queue: the queue descriptor.
+*/
+unsigned long
+rfs_write_queue_merged(struct write_queue_t *queue);
+
+/* Return the number of writes failed.
+
+   Parameters:
+     * queue: the queue descriptor.
+*/
+unsigned long
+rfs_write_queue_errors(struct write_queue_t *queue);
+
+/* Close a write queue.
+
+   The writes pending are done before the writer thread is stopped. Detach the
+   pins and channels from the queue before closing it.
+
+   Parameters:
+     * queue: the queue descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_write_queue_close(struct write_queue_t *queue);
+
+/* Open a PWM channel using the linux sysfs interface.
+
+   The pin is first exported and then the period of the PWM signal is set. If
+   the flag RFS_GPIO_DONT_EXPORT is set, the pin is not exported by the library
+   and must be externally exported to use it. If the flag RFS_KEEP_OPEN is set,
+   the period, duty_cycle and enable files are kept opened until rfs_pwm_close.
+   If the flag RFS_CACHE is set, the last period, duty cycle and enabled state
+   written or read are kept in memory: the getters don't read the sysfs files
+   when the value is known, and the setters do nothing when the value is
+   already set. Use rfs_pwm_invalidate if other processes may change the
+   channel. If the flag RFS_THREAD_SAFE is set, the channel can be used from
+   many threads at once (it can't be used with RFS_CACHE).
+
+   Parameters:
+     * pwm: information to open the PWM channel.
+         pwm.channel must contain the number of the PWM channel to open.
+         pwm.flags contains modifying flags.
+         pwm.period contains the period of the PWM signal.
+         If flag RFS_GPIO_DONT_EXPORT is set, the pin is not exported by this
+         library. If flag RFS_KEEP_OPEN is set, the channel files are kept
+         opened. If flag RFS_CACHE is set, the channel attributes are cached.
+         If flag RFS_THREAD_SAFE is set, the channel can be shared by threads.
+
+   Return 0 if the pin was successfully opened, -1 otherwise. In case of error,
+   errno is set accordingly.
+*/
+int
+rfs_pwm_open(struct pwm_t *pwm);
+
+/* Get the PWM signal's duty cycle
+
+   Parameters:
+     * pwm: the PWM channel descriptor.
+
+   Return the duty cycle in case of succes, -1 otherwise. In case of error,
+   errno is set accordingly.
+*/
+int
+rfs_pwm_get_duty_cycle(struct pwm_t *pwm);
+
+/* Get the enabled state of the PWM channel
+
+   Parameters:
+     * pwm: the PWM channel descriptor.
+
+   Return the enabled status in case of succes, -1 otherwise. In case of error,
+   errno is set accordingly.
+*/
+int
+rfs_pwm_get_enabled(struct pwm_t *pwm);
+
+/* Get the PWM signal's period
+
+   Parameters:
+     * pwm: the PWM channel descriptor.
+
+   Return the period in case of succes, -1 otherwise. In case of error,
+   errno is set accordingly.
+*/
+int
+rfs_pwm_get_period(struct pwm_t *pwm);
+
+/* Set the duty cycle of the PWM signal.
+
+   Parameters:
+     * pwm: the PWM channel descriptor.
+     * duty_cycle: the new duty cycle.
+
+   Return 0 if the duty cycle was correctly set, -1 otherwise (and errno is
+   set accordingly).
+*/
+int
+rfs_pwm_set_duty_cycle(struct pwm_t *pwm, pwm_time_t duty_cycle);
+
+/* Set the enabled state of the PWM channel.
+
+   Parameters:
+     * pwm: the PWM channel descriptor.
+     * enable: RFS_PWM_DISABLED to disable, RFS_PWM_ENABLED to enable.
+
+   Return 0 if the pwm channel is correctly enabled/disabled, -1 otherwise (and
+   errno is set accordingly).
+*/
+int
+rfs_pwm_set_enabled(struct pwm_t *pwm, enum pwm_enable_t enabled);
+
+/* Set the period of the PWM signal.
+
+   Parameters:
+     * pwm: the PWM channel descriptor.
+     * period: period of the PWM signal.
 
    Return 0 if the period was correctly set, -1 otherwise (and errno is
    set accordingly).
@@ -325,6 +2408,26 @@ rfs_pwm_set_enabled(struct pwm_t *pwm, enum pwm_enable_t enabled);
 int
 rfs_pwm_set_period(struct pwm_t *pwm, pwm_time_t period);
 
+/* Measure the signal at the input of a PWM channel in capture mode.
+
+   Reads the capture file of the channel, so the PWM hardware measures the
+   period and the duty cycle of the input signal. Only some PWM controllers
+   support it (the others fail with ENOSYS), and the read blocks until the
+   measure is done. The file is opened for each capture, even with
+   RFS_KEEP_OPEN.
+
+   Parameters:
+     * pwm: the PWM channel descriptor.
+     * period: where to store the period of the input signal (nanoseconds).
+     * duty_cycle: where to store the duty cycle of the input signal
+         (nanoseconds).
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_pwm_capture(struct pwm_t *pwm, pwm_time_t *period,
+    pwm_time_t *duty_cycle);
+
 /* Closes the PWM pin.
 
    The PWM channel is disabled. If the pin was exported, is unexported.
@@ -338,5 +2441,429 @@ rfs_pwm_set_period(struct pwm_t *pwm, pwm_time_t period);
 int
 rfs_pwm_close(struct pwm_t *pwm);
 
+/* Open a set of PWM channels.
+
+   Works like rfs_pwm_open over each channel, but all the channels are
+   exported first, through a single descriptor of the export file of each PWM
+   chip, and then set up, so the waits for the files of the channels overlap.
+   If any channel can't be opened, the ones that were opened are closed again.
+
+   Parameters:
+     * pwms: the channels to open (the fields to fill are the same as in
+         rfs_pwm_open). The channels of the same chip should be consecutive.
+     * n: number of channels.
+     * errors: if not NULL, array of n elements where the error of each
+         channel is stored (the errno value, or 0 if the channel was opened
+         before the rollback).
+
+   Return 0 if all the channels were opened, -1 otherwise (and errno is set to
+   the error of the first channel that failed).
+*/
+int
+rfs_pwm_open_many(struct pwm_t *pwms, unsigned int n, int *errors);
+
+/* Close a set of PWM channels.
+
+   Works like rfs_pwm_close over each channel, but all the channels are
+   unexported through a single descriptor of the unexport file of each PWM
+   chip. All the channels are closed even if some of them fail.
+
+   Parameters:
+     * pwms: the channels to close.
+     * n: number of channels.
+     * errors: if not NULL, array of n elements where the error of each
+         channel is stored (the errno value, or 0 if the channel was closed).
+
+   Return 0 if all the channels were closed, -1 otherwise (and errno is set to
+   the error of the first channel that failed).
+*/
+int
+rfs_pwm_close_many(struct pwm_t *pwms, unsigned int n, int *errors);
+
+/* Forget the attributes cached for a PWM channel opened with RFS_CACHE.
+
+   The next getters read them again from the sysfs files, so use this function
+   when the channel may have been changed by another process.
+
+   Parameters:
+     * pwm: the PWM channel descriptor.
+*/
+void
+rfs_pwm_invalidate(struct pwm_t *pwm);
+
+/* Attach a PWM channel to a write queue, or detach it.
+
+   While attached, rfs_pwm_set_period, rfs_pwm_set_duty_cycle and
+   rfs_pwm_set_enabled push the write to the queue and return at once. Their
+   errors are reported to the callback of the queue. The rest of the
+   functions of the channel must not be called until the writes are done
+   (see rfs_write_queue_fence).
+
+   Parameters:
+     * pwm: the PWM channel descriptor.
+     * queue: the queue, or NULL to write right away again.
+*/
+void
+rfs_pwm_set_write_queue(struct pwm_t *pwm, struct write_queue_t *queue);
+
+/* Open a software PWM scheduler.
+
+   The scheduler thread generates the edges of all its channels, sorted in a
+   single timeline, so it wakes up once per edge (or once for all the edges
+   that happen at the same time) whatever the number of channels.
+
+   Parameters:
+     * scheduler: the scheduler descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_softpwm_scheduler_open(struct softpwm_scheduler_t *scheduler);
+
+/* Close a software PWM scheduler.
+
+   The scheduler thread is stopped. The channels must be closed before.
+
+   Parameters:
+     * scheduler: the scheduler descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_softpwm_scheduler_close(struct softpwm_scheduler_t *scheduler);
+
+/* Return the number of edges that couldn't be written. A failed edge is
+   written again at the next edge of its channel.
+
+   Parameters:
+     * scheduler: the scheduler descriptor.
+*/
+unsigned long
+rfs_softpwm_scheduler_errors(struct softpwm_scheduler_t *scheduler);
+
+/* Open a software PWM channel.
+
+   The GPIO pin is opened as output low, and the channel is enabled with a
+   duty cycle of 0, like rfs_pwm_open does. The pin is written from the
+   scheduler thread, so it should be opened with RFS_KEEP_OPEN, RFS_CHARDEV or
+   RFS_MMIO to make each edge as cheap as possible.
+
+   Parameters:
+     * pwm: information to open the software PWM channel.
+         pwm.gpio must contain the pin to use (pin, chip and flags, as in
+         rfs_gpio_open).
+         pwm.scheduler must point to an opened scheduler.
+         pwm.period contains the period of the PWM signal.
+
+   Return 0 if the channel was successfully opened, -1 otherwise. In case of
+   error, errno is set accordingly.
+*/
+int
+rfs_softpwm_open(struct softpwm_t *pwm);
+
+/* Get the software PWM signal's duty cycle
+
+   Parameters:
+     * pwm: the software PWM channel descriptor.
+
+   Return the duty cycle.
+*/
+int
+rfs_softpwm_get_duty_cycle(struct softpwm_t *pwm);
+
+/* Get the enabled state of the software PWM channel
+
+   Parameters:
+     * pwm: the software PWM channel descriptor.
+
+   Return the enabled status.
+*/
+int
+rfs_softpwm_get_enabled(struct softpwm_t *pwm);
+
+/* Get the software PWM signal's period
+
+   Parameters:
+     * pwm: the software PWM channel descriptor.
+
+   Return the period.
+*/
+int
+rfs_softpwm_get_period(struct softpwm_t *pwm);
+
+/* Set the duty cycle of the software PWM signal.
+
+   As with the hardware channels, the change is applied at the start of the
+   next period.
+
+   Parameters:
+     * pwm: the software PWM channel descriptor.
+     * duty_cycle: the new duty cycle, not greater than the period.
+
+   Return 0 if the duty cycle was correctly set, -1 otherwise (and errno is
+   set accordingly).
+*/
+int
+rfs_softpwm_set_duty_cycle(struct softpwm_t *pwm, pwm_time_t duty_cycle);
+
+/* Set the enabled state of the software PWM channel.
+
+   A disabled channel leaves its pin low.
+
+   Parameters:
+     * pwm: the software PWM channel descriptor.
+     * enable: RFS_PWM_DISABLED to disable, RFS_PWM_ENABLED to enable.
+
+   Return 0 if the channel is correctly enabled/disabled, -1 otherwise (and
+   errno is set accordingly).
+*/
+int
+rfs_softpwm_set_enabled(struct softpwm_t *pwm, enum pwm_enable_t enabled);
+
+/* Set the period of the software PWM signal.
+
+   As with the hardware channels, the change is applied at the start of the
+   next period.
+
+   Parameters:
+     * pwm: the software PWM channel descriptor.
+     * period: period of the PWM signal, not less than the duty cycle.
+
+   Return 0 if the period was correctly set, -1 otherwise (and errno is
+   set accordingly).
+*/
+int
+rfs_softpwm_set_period(struct softpwm_t *pwm, pwm_time_t period);
+
+/* Close the software PWM channel.
+
+   The channel is disabled and the GPIO pin closed.
+
+   Parameters:
+     * pwm: the software PWM channel descriptor.
+
+   Return 0 if the channel was correctly closed, -1 otherwise. In case of
+   error, errno is set accordingly.
+*/
+int
+rfs_softpwm_close(struct softpwm_t *pwm);
+
+/* Open a PWM sequencer.
+
+   The sequencer thread applies the profiles of all the sequences being played
+   at the given update interval, writing the duty cycles with
+   rfs_pwm_set_duty_cycle. The channels may belong to several PWM chips. A
+   duty cycle equal to the last one written is not written again, so the
+   channels should be opened with RFS_KEEP_OPEN to make each actual write a
+   single syscall.
+
+   Parameters:
+     * sequencer: the sequencer descriptor.
+     * interval: update interval, in nanoseconds.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_pwm_sequencer_open(struct pwm_sequencer_t *sequencer,
+    unsigned long interval);
+
+/* Start playing a sequence.
+
+   The profile starts right now. When it ends, the final duty cycle is kept
+   and the sequence is removed from the sequencer, even if its write failed
+   (see rfs_pwm_sequencer_errors).
+
+   Parameters:
+     * sequencer: the sequencer descriptor.
+     * sequence: the sequence to play. The fields pwm, ramp, duration and the
+         ones of the ramp (from, to, shape, table and table_len) must be
+         filled.
+
+   Return 0 on success, -1 otherwise (and errno is set to EINVAL for a wrong
+   profile, one with duty cycles out of the period of the channel, or EBUSY
+   if the sequence is already being played).
+*/
+int
+rfs_pwm_sequencer_play(struct pwm_sequencer_t *sequencer,
+    struct pwm_sequence_t *sequence);
+
+/* Stop playing a sequence before it ends.
+
+   The duty cycle of the channel is left as it is.
+
+   Parameters:
+     * sequencer: the sequencer descriptor.
+     * sequence: the sequence to stop.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_pwm_sequencer_stop(struct pwm_sequencer_t *sequencer,
+    struct pwm_sequence_t *sequence);
+
+/* Return whether a sequence is still being played.
+
+   Parameters:
+     * sequence: the sequence descriptor.
+
+   Return 1 if the sequence is being played, 0 otherwise.
+*/
+int
+rfs_pwm_sequence_playing(struct pwm_sequence_t *sequence);
+
+/* Return the number of updates lost because the sequencer thread woke up
+   late.
+
+   Parameters:
+     * sequencer: the sequencer descriptor.
+*/
+unsigned long
+rfs_pwm_sequencer_overruns(struct pwm_sequencer_t *sequencer);
+
+/* Return the number of duty cycles that couldn't be written.
+
+   Parameters:
+     * sequencer: the sequencer descriptor.
+*/
+unsigned long
+rfs_pwm_sequencer_errors(struct pwm_sequencer_t *sequencer);
+
+/* Close a PWM sequencer.
+
+   The sequencer thread is stopped, and the sequences being played are left
+   as they are.
+
+   Parameters:
+     * sequencer: the sequencer descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_pwm_sequencer_close(struct pwm_sequencer_t *sequencer);
+
+/* Open an I/O batch.
+
+   If the kernel supports io_uring, an instance is created for the batch,
+   with its buffers and the descriptors of the queued attributes registered
+   on it. Otherwise (or with RFS_IO_SYNC) the batch falls back to synchronous
+   I/O, with the same result.
+
+   Only the operations on sysfs pins and channels opened with RFS_KEEP_OPEN go
+   through io_uring, the rest are done with the usual functions when the
+   batch is submitted. The descriptors of these pins and channels stay
+   registered until the batch is closed, so they must not be closed before.
+
+   Parameters:
+     * batch: the batch descriptor.
+     * flags: 0 or RFS_IO_SYNC.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_io_batch_open(struct io_batch_t *batch, int flags);
+
+/* Queue the write of the value of a GPIO pin in an I/O batch.
+
+   Parameters:
+     * batch: the batch descriptor.
+     * gpio: GPIO pin descriptor.
+     * value: value to write.
+
+   Return 0 if the operation was queued, -1 otherwise (and errno is set to
+   EINVAL for a wrong value or ENOSPC if the batch is full).
+*/
+int
+rfs_io_batch_gpio_set_value(struct io_batch_t *batch, struct gpio_t *gpio,
+    enum gpio_value_t value);
+
+/* Queue the read of the value of a GPIO pin in an I/O batch.
+
+   Parameters:
+     * batch: the batch descriptor.
+     * gpio: GPIO pin descriptor.
+     * value: where to store the value (RFS_GPIO_LOW or RFS_GPIO_HIGH) when
+         the batch is submitted.
+
+   Return 0 if the operation was queued, -1 otherwise (and errno is set to
+   ENOSPC if the batch is full).
+*/
+int
+rfs_io_batch_gpio_get_value(struct io_batch_t *batch, struct gpio_t *gpio,
+    int *value);
+
+/* Queue the write of the duty cycle of a PWM channel in an I/O batch.
+
+   Parameters:
+     * batch: the batch descriptor.
+     * pwm: the PWM channel descriptor.
+     * duty_cycle: duty cycle to write (in nanoseconds).
+
+   Return 0 if the operation was queued, -1 otherwise (and errno is set to
+   EINVAL for a wrong duty cycle or ENOSPC if the batch is full).
+*/
+int
+rfs_io_batch_pwm_set_duty_cycle(struct io_batch_t *batch, struct pwm_t *pwm,
+    pwm_time_t duty_cycle);
+
+/* Submit the operations queued in an I/O batch and wait for all of them.
+
+   The error of each operation is left in the field error of batch->ops until
+   another operation is queued. The batch is empty afterwards.
+
+   Parameters:
+     * batch: the batch descriptor.
+
+   Return 0 if all the operations succeeded, -1 otherwise (and errno is set to
+   the error of the first one that failed).
+*/
+int
+rfs_io_batch_submit(struct io_batch_t *batch);
+
+/* Close an I/O batch, discarding the operations not submitted.
+
+   Parameters:
+     * batch: the batch descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_io_batch_close(struct io_batch_t *batch);
+
+/* Get the statistics of the operations done since the start of the program
+   (or the last rfs_stats_reset), added up for all the threads.
+
+   The statistics are only kept if the library was configured with
+   --enable-stats. Each thread counts in its own block of counters, so the
+   threads don't contend, and the snapshot adds up the blocks.
+
+   Parameters:
+     * stats: where to store the statistics.
+
+   Return 0 on success, -1 otherwise (and errno is set to ENOTSUP if the
+   library was built without statistics).
+*/
+int
+rfs_stats_snapshot(struct stats_t *stats);
+
+/* Reset the statistics to zero.
+
+   The counts done by other threads at the same time may be lost, or survive
+   the reset.
+
+   Return 0 on success, -1 otherwise (and errno is set to ENOTSUP if the
+   library was built without statistics).
+*/
+int
+rfs_stats_reset(void);
+
+/* Return the name of an operation of the statistics (for example
+   "rfs_gpio_set_value" or "write"), or NULL if op is not valid.
+
+   Parameters:
+     * op: the operation.
+*/
+const char *
+rfs_stats_op_name(enum stats_op_t op);
+
 #endif
 
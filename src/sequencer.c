@@ -0,0 +1,478 @@
+/* sequencer.c
+   Functions to apply duty cycle profiles to PWM channels.
+   
+   Copyright 2018 Antonio Serrano Hernandez
+
+   This file is part of rfsgpio.
+
+   rfsgpio is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   rfsgpio is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with rfsgpio; see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+#include "rfsgpio.h"
+#include "probes.h"
+#include "thread.h"
+
+#include <errno.h>          // errno
+#include <math.h>           // exp
+#include <stddef.h>         // NULL
+#include <sys/timerfd.h>    // timerfd_create
+#include <time.h>           // clock_gettime
+#include <unistd.h>         // read
+
+// Each public function rfs_pwm_X wraps the static function pwm_X, traced by
+// the probes pwm_X_entry and pwm_X_return.
+
+/* Return the current time, in nanoseconds (CLOCK_MONOTONIC). */
+static uint64_t
+sequencer_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Arm the periodic timer of a sequencer, or disarm it.
+
+   Parameters:
+     * sequencer: the sequencer descriptor.
+     * armed: whether to arm or disarm the timer.
+*/
+static void
+sequencer_arm(struct pwm_sequencer_t *sequencer, int armed)
+{
+    struct itimerspec its = {{0, 0}, {0, 0}};
+
+    if (armed) {
+        its.it_interval.tv_sec = sequencer->interval / 1000000000;
+        its.it_interval.tv_nsec = sequencer->interval % 1000000000;
+        its.it_value = its.it_interval;
+    }
+    timerfd_settime(sequencer->timerfd, 0, &its, NULL);
+}
+
+/* Return the duty cycle of a sequence at a point of its profile.
+
+   Parameters:
+     * sequence: the sequence descriptor.
+     * x: point of the profile, from 0 (start) to 1 (end).
+*/
+static pwm_time_t
+sequencer_duty_cycle(const struct pwm_sequence_t *sequence, double x)
+{
+    double f, pos;
+    unsigned int i;
+
+    switch (sequence->ramp) {
+    case RFS_RAMP_EXPONENTIAL:
+        f = sequence->shape ?
+            (exp(sequence->shape * x) - 1) / (exp(sequence->shape) - 1) : x;
+        break;
+    case RFS_RAMP_GAMMA:
+        f = pow(x, sequence->shape);
+        break;
+    case RFS_RAMP_TABLE:
+        // Interpolate between the two closest values of the table
+        if (sequence->table_len == 1) {
+            return sequence->table[0];
+        }
+        pos = x * (sequence->table_len - 1);
+        i = (unsigned int)pos;
+        if (i >= sequence->table_len - 1) {
+            return sequence->table[sequence->table_len - 1];
+        }
+        return lround(sequence->table[i]
+            + (sequence->table[i + 1] - sequence->table[i]) * (pos - i));
+    default:
+        f = x;
+    }
+    return lround(sequence->from + (sequence->to - sequence->from) * f);
+}
+
+/* Apply the profiles of the sequences of a sequencer at the current time.
+
+   The finished sequences are removed. Called with the lock of the sequencer
+   held.
+*/
+static void
+sequencer_update(struct pwm_sequencer_t *sequencer)
+{
+    struct pwm_sequence_t **p = &sequencer->sequences;
+    struct pwm_sequence_t *sequence;
+    uint64_t now, elapsed;
+    pwm_time_t duty_cycle;
+
+    now = sequencer_now();
+    while ((sequence = *p)) {
+        elapsed = now - sequence->start;
+        if (elapsed >= sequence->duration) {
+            duty_cycle = sequencer_duty_cycle(sequence, 1);
+        } else {
+            duty_cycle = sequencer_duty_cycle(sequence,
+                (double)elapsed / sequence->duration);
+        }
+        // Only the duty cycles that change are written. If the write fails
+        // it is tried again at the next update, unless the profile ended
+        if (duty_cycle != sequence->last) {
+            if (!rfs_pwm_set_duty_cycle(sequence->pwm, duty_cycle)) {
+                sequence->last = duty_cycle;
+                sequencer->writes++;
+            } else {
+                sequencer->errors++;
+            }
+        }
+        if (elapsed >= sequence->duration) {
+            *p = sequence->next;
+            __atomic_store_n(&sequence->playing, 0, __ATOMIC_RELEASE);
+        } else {
+            p = &sequence->next;
+        }
+    }
+}
+
+/* Find a sequence in a sequencer.
+
+   Called with the lock of the sequencer held.
+
+   Return the link that points to the sequence, or NULL if it isn't being
+   played.
+*/
+static struct pwm_sequence_t **
+sequencer_find(struct pwm_sequencer_t *sequencer,
+    struct pwm_sequence_t *sequence)
+{
+    struct pwm_sequence_t **p;
+
+    for (p = &sequencer->sequences; *p && *p != sequence; p = &(*p)->next);
+    return *p ? p : NULL;
+}
+
+/* Main function of the sequencer thread.
+
+   Parameters:
+     * arg: the sequencer descriptor.
+*/
+static void *
+sequencer_run(void *arg)
+{
+    struct pwm_sequencer_t *sequencer = arg;
+    uint64_t expirations;
+
+    pthread_mutex_lock(&sequencer->lock);
+    while (sequencer->running) {
+        pthread_mutex_unlock(&sequencer->lock);
+        if (read(sequencer->timerfd, &expirations, sizeof(expirations))
+            != sizeof(expirations))
+        {
+            expirations = 1;
+        }
+        pthread_mutex_lock(&sequencer->lock);
+        sequencer->overruns += expirations - 1;
+        sequencer_update(sequencer);
+        // Don't wake up while there's nothing to play
+        if (!sequencer->sequences) {
+            sequencer_arm(sequencer, 0);
+        }
+    }
+    pthread_mutex_unlock(&sequencer->lock);
+    return NULL;
+}
+
+/* Open a PWM sequencer.
+
+   Parameters:
+     * sequencer: the sequencer descriptor.
+     * interval: update interval, in nanoseconds.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+static int
+pwm_sequencer_open(struct pwm_sequencer_t *sequencer,
+    unsigned long interval)
+{
+    int e;
+
+    if (!interval) {
+        errno = EINVAL;
+        return -1;
+    }
+    sequencer->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (sequencer->timerfd < 0) {
+        return -1;
+    }
+    pthread_mutex_init(&sequencer->lock, NULL);
+    sequencer->interval = interval;
+    sequencer->sequences = NULL;
+    sequencer->overruns = 0;
+    sequencer->writes = 0;
+    sequencer->errors = 0;
+    sequencer->running = 1;
+    if (thread_start(&sequencer->thread, sequencer_run, sequencer)) {
+        e = errno;
+        pthread_mutex_destroy(&sequencer->lock);
+        close(sequencer->timerfd);
+        errno = e;
+        return -1;
+    }
+    return 0;
+}
+
+int
+rfs_pwm_sequencer_open(struct pwm_sequencer_t *sequencer,
+    unsigned long interval)
+{
+    int res;
+
+    PROBE2(pwm_sequencer_open_entry, sequencer, interval);
+    res = pwm_sequencer_open(sequencer, interval);
+    PROBE2(pwm_sequencer_open_return, sequencer, res);
+    return res;
+}
+
+/* Return whether the duty cycles of the profile of a sequence are within the
+   period of its channel.
+
+   Parameters:
+     * sequence: the sequence descriptor.
+*/
+static int
+sequencer_in_period(const struct pwm_sequence_t *sequence)
+{
+    pwm_time_t period = __atomic_load_n(&sequence->pwm->period,
+        __ATOMIC_RELAXED);
+    unsigned int i;
+
+    // The other profiles stay between their initial and final duty cycles
+    if (sequence->ramp != RFS_RAMP_TABLE) {
+        return sequence->from >= 0 && sequence->from <= period
+            && sequence->to >= 0 && sequence->to <= period;
+    }
+    for (i = 0; i < sequence->table_len; i++) {
+        if (sequence->table[i] < 0 || sequence->table[i] > period) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Start playing a sequence.
+
+   Parameters:
+     * sequencer: the sequencer descriptor.
+     * sequence: the sequence to play.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+static int
+pwm_sequencer_play(struct pwm_sequencer_t *sequencer,
+    struct pwm_sequence_t *sequence)
+{
+    // Check the profile
+    if (sequence->ramp < RFS_RAMP_LINEAR || sequence->ramp > RFS_RAMP_TABLE
+        || (sequence->ramp == RFS_RAMP_GAMMA && sequence->shape <= 0)
+        || (sequence->ramp == RFS_RAMP_TABLE
+            && (!sequence->table || !sequence->table_len))
+        || !sequencer_in_period(sequence))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    pthread_mutex_lock(&sequencer->lock);
+    if (sequencer_find(sequencer, sequence)) {
+        pthread_mutex_unlock(&sequencer->lock);
+        errno = EBUSY;
+        return -1;
+    }
+    sequence->start = sequencer_now();
+    sequence->last = -1;
+    sequence->playing = 1;
+    sequence->next = sequencer->sequences;
+    if (!sequencer->sequences) {
+        sequencer_arm(sequencer, 1);
+    }
+    sequencer->sequences = sequence;
+    // The initial duty cycle is written right now
+    sequencer_update(sequencer);
+    pthread_mutex_unlock(&sequencer->lock);
+    return 0;
+}
+
+int
+rfs_pwm_sequencer_play(struct pwm_sequencer_t *sequencer,
+    struct pwm_sequence_t *sequence)
+{
+    int res;
+
+    PROBE3(pwm_sequencer_play_entry, sequencer, sequence->pwm->chip,
+        sequence->pwm->channel);
+    res = pwm_sequencer_play(sequencer, sequence);
+    PROBE4(pwm_sequencer_play_return, sequencer, sequence->pwm->chip,
+        sequence->pwm->channel, res);
+    return res;
+}
+
+/* Stop playing a sequence before it ends.
+
+   Parameters:
+     * sequencer: the sequencer descriptor.
+     * sequence: the sequence to stop.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+static int
+pwm_sequencer_stop(struct pwm_sequencer_t *sequencer,
+    struct pwm_sequence_t *sequence)
+{
+    struct pwm_sequence_t **p;
+
+    pthread_mutex_lock(&sequencer->lock);
+    if ((p = sequencer_find(sequencer, sequence))) {
+        *p = sequence->next;
+        __atomic_store_n(&sequence->playing, 0, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&sequencer->lock);
+    return 0;
+}
+
+int
+rfs_pwm_sequencer_stop(struct pwm_sequencer_t *sequencer,
+    struct pwm_sequence_t *sequence)
+{
+    int res;
+
+    PROBE2(pwm_sequencer_stop_entry, sequencer, sequence);
+    res = pwm_sequencer_stop(sequencer, sequence);
+    PROBE3(pwm_sequencer_stop_return, sequencer, sequence, res);
+    return res;
+}
+
+/* Return whether a sequence is still being played.
+
+   Parameters:
+     * sequence: the sequence descriptor.
+
+   Return 1 if the sequence is being played, 0 otherwise.
+*/
+static int
+pwm_sequence_playing(struct pwm_sequence_t *sequence)
+{
+    return __atomic_load_n(&sequence->playing, __ATOMIC_ACQUIRE);
+}
+
+int
+rfs_pwm_sequence_playing(struct pwm_sequence_t *sequence)
+{
+    int res;
+
+    PROBE1(pwm_sequence_playing_entry, sequence);
+    res = pwm_sequence_playing(sequence);
+    PROBE2(pwm_sequence_playing_return, sequence, res);
+    return res;
+}
+
+/* Return the number of updates lost because the sequencer thread woke up
+   late.
+
+   Parameters:
+     * sequencer: the sequencer descriptor.
+*/
+static unsigned long
+pwm_sequencer_overruns(struct pwm_sequencer_t *sequencer)
+{
+    unsigned long overruns;
+
+    pthread_mutex_lock(&sequencer->lock);
+    overruns = sequencer->overruns;
+    pthread_mutex_unlock(&sequencer->lock);
+    return overruns;
+}
+
+unsigned long
+rfs_pwm_sequencer_overruns(struct pwm_sequencer_t *sequencer)
+{
+    unsigned long res;
+
+    PROBE1(pwm_sequencer_overruns_entry, sequencer);
+    res = pwm_sequencer_overruns(sequencer);
+    PROBE2(pwm_sequencer_overruns_return, sequencer, res);
+    return res;
+}
+
+/* Return the number of duty cycles that couldn't be written.
+
+   Parameters:
+     * sequencer: the sequencer descriptor.
+*/
+static unsigned long
+pwm_sequencer_errors(struct pwm_sequencer_t *sequencer)
+{
+    unsigned long errors;
+
+    pthread_mutex_lock(&sequencer->lock);
+    errors = sequencer->errors;
+    pthread_mutex_unlock(&sequencer->lock);
+    return errors;
+}
+
+unsigned long
+rfs_pwm_sequencer_errors(struct pwm_sequencer_t *sequencer)
+{
+    unsigned long res;
+
+    PROBE1(pwm_sequencer_errors_entry, sequencer);
+    res = pwm_sequencer_errors(sequencer);
+    PROBE2(pwm_sequencer_errors_return, sequencer, res);
+    return res;
+}
+
+/* Close a PWM sequencer.
+
+   Parameters:
+     * sequencer: the sequencer descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+static int
+pwm_sequencer_close(struct pwm_sequencer_t *sequencer)
+{
+    struct itimerspec its = {{0, 0}, {0, 1}};
+
+    // Make the timer expire right now to wake up the thread
+    pthread_mutex_lock(&sequencer->lock);
+    sequencer->running = 0;
+    timerfd_settime(sequencer->timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+    pthread_mutex_unlock(&sequencer->lock);
+    if (thread_join(sequencer->thread)) {
+        return -1;
+    }
+    for (; sequencer->sequences;
+        sequencer->sequences = sequencer->sequences->next)
+    {
+        sequencer->sequences->playing = 0;
+    }
+    pthread_mutex_destroy(&sequencer->lock);
+    return close(sequencer->timerfd);
+}
+
+int
+rfs_pwm_sequencer_close(struct pwm_sequencer_t *sequencer)
+{
+    int res;
+
+    PROBE1(pwm_sequencer_close_entry, sequencer);
+    res = pwm_sequencer_close(sequencer);
+    PROBE2(pwm_sequencer_close_return, sequencer, res);
+    return res;
+}
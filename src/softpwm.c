@@ -0,0 +1,491 @@
+/* softpwm.c
+   Functions to generate PWM signals on GPIO pins.
+   
+   Copyright 2018 Antonio Serrano Hernandez
+
+   This file is part of rfsgpio.
+
+   rfsgpio is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   rfsgpio is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with rfsgpio; see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+#include "rfsgpio.h"
+#include "thread.h"
+
+#include <errno.h>          // errno
+#include <stddef.h>         // NULL
+#include <sys/timerfd.h>    // timerfd_create
+#include <time.h>           // clock_gettime
+#include <unistd.h>         // read
+
+/* Return the current time, in nanoseconds (CLOCK_MONOTONIC). */
+static uint64_t
+softpwm_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Arm the timer of a scheduler to expire at the first edge of its timeline,
+   or disarm it if the timeline is empty.
+
+   Called with the lock of the scheduler held.
+*/
+static void
+softpwm_arm(struct softpwm_scheduler_t *scheduler)
+{
+    struct itimerspec its = {{0, 0}, {0, 0}};
+
+    if (scheduler->timeline) {
+        its.it_value.tv_sec = scheduler->timeline->next_edge / 1000000000;
+        its.it_value.tv_nsec = scheduler->timeline->next_edge % 1000000000;
+    }
+    timerfd_settime(scheduler->timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/* Insert a channel in the timeline of its scheduler, sorted by the time of
+   its next edge. Channels with edges at the same time keep their order.
+
+   Called with the lock of the scheduler held.
+*/
+static void
+softpwm_insert(struct softpwm_t *pwm)
+{
+    struct softpwm_t **p = &pwm->scheduler->timeline;
+
+    while (*p && (*p)->next_edge <= pwm->next_edge) {
+        p = &(*p)->next;
+    }
+    pwm->next = *p;
+    *p = pwm;
+}
+
+/* Remove a channel from the timeline of its scheduler.
+
+   Called with the lock of the scheduler held.
+*/
+static void
+softpwm_remove(struct softpwm_t *pwm)
+{
+    struct softpwm_t **p = &pwm->scheduler->timeline;
+
+    while (*p && *p != pwm) {
+        p = &(*p)->next;
+    }
+    if (*p) {
+        *p = pwm->next;
+    }
+    pwm->next = NULL;
+}
+
+/* Write a value to the pin of a channel. The last value written is only
+   updated if the write succeeds, so a failed one is retried at the next edge.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+static int
+softpwm_write(struct softpwm_t *pwm, enum gpio_value_t value)
+{
+    if (rfs_gpio_set_value(&pwm->gpio, value)) {
+        return -1;
+    }
+    pwm->value = value;
+    return 0;
+}
+
+/* Generate the next edge of a channel and compute the time of the following
+   one.
+
+   At the start of each period the last period and duty cycle set are applied.
+   If the scheduler is so late that a whole period was lost, the signal starts
+   again from now instead of generating the lost edges.
+
+   Called with the lock of the scheduler held.
+
+   Return the value of the pin after the edge.
+*/
+static enum gpio_value_t
+softpwm_edge(struct softpwm_t *pwm, uint64_t now)
+{
+    enum gpio_value_t value = RFS_GPIO_LOW;
+
+    if (pwm->period_edge) {
+        pwm->start = pwm->next_edge;
+        pwm->current_period = pwm->period;
+        pwm->current_duty_cycle = pwm->duty_cycle;
+        if (pwm->start + pwm->current_period <= now) {
+            pwm->start = now;
+        }
+        value = pwm->current_duty_cycle > 0;
+        if (pwm->current_duty_cycle > 0
+            && pwm->current_duty_cycle < pwm->current_period)
+        {
+            pwm->next_edge = pwm->start + pwm->current_duty_cycle;
+            pwm->period_edge = 0;
+            return value;
+        }
+    }
+    pwm->next_edge = pwm->start + pwm->current_period;
+    pwm->period_edge = 1;
+    return value;
+}
+
+/* Write the values due to the pins of their channels.
+
+   Called without the lock of the scheduler, while the channels can't be
+   disabled.
+
+   Parameters:
+     * due: the list of channels with a value due.
+
+   Return the number of writes that failed.
+*/
+static unsigned long
+softpwm_write_due(struct softpwm_t *due)
+{
+    struct softpwm_t *pwm;
+    unsigned long errors = 0;
+
+    for (pwm = due; pwm; pwm = pwm->next_due) {
+        if (softpwm_write(pwm, pwm->due)) {
+            errors++;
+        }
+    }
+    return errors;
+}
+
+/* Main function of the scheduler thread.
+
+   Generates the edges of the timeline that are due, writes the pins without
+   the lock and sleeps until the next edge. A channel with two edges due
+   before the writes is left for the next round, so both are written.
+
+   Parameters:
+     * arg: the scheduler descriptor.
+*/
+static void *
+softpwm_run(void *arg)
+{
+    struct softpwm_scheduler_t *scheduler = arg;
+    struct softpwm_t *pwm, *due, **last;
+    enum gpio_value_t value;
+    uint64_t expirations, now;
+    unsigned long errors;
+
+    pthread_mutex_lock(&scheduler->lock);
+    while (scheduler->running) {
+        now = softpwm_now();
+        due = NULL;
+        last = &due;
+        while ((pwm = scheduler->timeline) && pwm->next_edge <= now
+            && pwm->due < 0)
+        {
+            scheduler->timeline = pwm->next;
+            value = softpwm_edge(pwm, now);
+            softpwm_insert(pwm);
+            if (value != pwm->value) {
+                pwm->due = value;
+                pwm->next_due = NULL;
+                *last = pwm;
+                last = &pwm->next_due;
+            }
+        }
+        softpwm_arm(scheduler);
+        if (due) {
+            // The channels being written can't be disabled meanwhile
+            scheduler->writing = 1;
+            pthread_mutex_unlock(&scheduler->lock);
+            errors = softpwm_write_due(due);
+            pthread_mutex_lock(&scheduler->lock);
+            for (pwm = due; pwm; pwm = pwm->next_due) {
+                pwm->due = -1;
+            }
+            scheduler->errors += errors;
+            scheduler->writing = 0;
+            pthread_cond_broadcast(&scheduler->written);
+            // An edge left for the next round is already due
+            continue;
+        }
+        pthread_mutex_unlock(&scheduler->lock);
+        // Interrupted or not, the timeline is checked again
+        read(scheduler->timerfd, &expirations, sizeof(expirations));
+        pthread_mutex_lock(&scheduler->lock);
+    }
+    pthread_mutex_unlock(&scheduler->lock);
+    return NULL;
+}
+
+/* Open a software PWM scheduler.
+
+   Parameters:
+     * scheduler: the scheduler descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_softpwm_scheduler_open(struct softpwm_scheduler_t *scheduler)
+{
+    int e;
+
+    scheduler->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (scheduler->timerfd < 0) {
+        return -1;
+    }
+    pthread_mutex_init(&scheduler->lock, NULL);
+    pthread_cond_init(&scheduler->written, NULL);
+    scheduler->timeline = NULL;
+    scheduler->writing = 0;
+    scheduler->errors = 0;
+    scheduler->running = 1;
+    if (thread_start(&scheduler->thread, softpwm_run, scheduler)) {
+        e = errno;
+        pthread_cond_destroy(&scheduler->written);
+        pthread_mutex_destroy(&scheduler->lock);
+        close(scheduler->timerfd);
+        errno = e;
+        return -1;
+    }
+    return 0;
+}
+
+/* Close a software PWM scheduler.
+
+   Parameters:
+     * scheduler: the scheduler descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_softpwm_scheduler_close(struct softpwm_scheduler_t *scheduler)
+{
+    struct itimerspec its = {{0, 0}, {0, 1}};
+
+    // Make the timer expire right now to wake up the thread
+    pthread_mutex_lock(&scheduler->lock);
+    scheduler->running = 0;
+    timerfd_settime(scheduler->timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+    pthread_mutex_unlock(&scheduler->lock);
+    if (thread_join(scheduler->thread)) {
+        return -1;
+    }
+    pthread_cond_destroy(&scheduler->written);
+    pthread_mutex_destroy(&scheduler->lock);
+    return close(scheduler->timerfd);
+}
+
+/* Return the number of edges that couldn't be written.
+
+   Parameters:
+     * scheduler: the scheduler descriptor.
+*/
+unsigned long
+rfs_softpwm_scheduler_errors(struct softpwm_scheduler_t *scheduler)
+{
+    unsigned long errors;
+
+    pthread_mutex_lock(&scheduler->lock);
+    errors = scheduler->errors;
+    pthread_mutex_unlock(&scheduler->lock);
+    return errors;
+}
+
+/* Open a software PWM channel.
+
+   Parameters:
+     * pwm: information to open the software PWM channel.
+
+   Return 0 if the channel was successfully opened, -1 otherwise. In case of
+   error, errno is set accordingly.
+*/
+int
+rfs_softpwm_open(struct softpwm_t *pwm)
+{
+    if (pwm->period <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (rfs_gpio_open(&pwm->gpio, RFS_GPIO_OUT_LOW)) {
+        return -1;
+    }
+    pwm->value = RFS_GPIO_LOW;
+    pwm->due = -1;
+    pwm->duty_cycle = 0;
+    pwm->enabled = RFS_PWM_DISABLED;
+    pwm->next = NULL;
+    return rfs_softpwm_set_enabled(pwm, RFS_PWM_ENABLED);
+}
+
+/* Get the software PWM signal's duty cycle
+
+   Parameters:
+     * pwm: the software PWM channel descriptor.
+
+   Return the duty cycle.
+*/
+int
+rfs_softpwm_get_duty_cycle(struct softpwm_t *pwm)
+{
+    pwm_time_t duty_cycle;
+
+    pthread_mutex_lock(&pwm->scheduler->lock);
+    duty_cycle = pwm->duty_cycle;
+    pthread_mutex_unlock(&pwm->scheduler->lock);
+    return duty_cycle;
+}
+
+/* Get the enabled state of the software PWM channel
+
+   Parameters:
+     * pwm: the software PWM channel descriptor.
+
+   Return the enabled status.
+*/
+int
+rfs_softpwm_get_enabled(struct softpwm_t *pwm)
+{
+    enum pwm_enable_t enabled;
+
+    pthread_mutex_lock(&pwm->scheduler->lock);
+    enabled = pwm->enabled;
+    pthread_mutex_unlock(&pwm->scheduler->lock);
+    return enabled;
+}
+
+/* Get the software PWM signal's period
+
+   Parameters:
+     * pwm: the software PWM channel descriptor.
+
+   Return the period.
+*/
+int
+rfs_softpwm_get_period(struct softpwm_t *pwm)
+{
+    pwm_time_t period;
+
+    pthread_mutex_lock(&pwm->scheduler->lock);
+    period = pwm->period;
+    pthread_mutex_unlock(&pwm->scheduler->lock);
+    return period;
+}
+
+/* Set the duty cycle of the software PWM signal.
+
+   Parameters:
+     * pwm: the software PWM channel descriptor.
+     * duty_cycle: the new duty cycle, not greater than the period.
+
+   Return 0 if the duty cycle was correctly set, -1 otherwise (and errno is
+   set accordingly).
+*/
+int
+rfs_softpwm_set_duty_cycle(struct softpwm_t *pwm, pwm_time_t duty_cycle)
+{
+    int res = 0;
+
+    pthread_mutex_lock(&pwm->scheduler->lock);
+    if (duty_cycle < 0 || duty_cycle > pwm->period) {
+        errno = EINVAL;
+        res = -1;
+    } else {
+        pwm->duty_cycle = duty_cycle;
+    }
+    pthread_mutex_unlock(&pwm->scheduler->lock);
+    return res;
+}
+
+/* Set the enabled state of the software PWM channel.
+
+   Parameters:
+     * pwm: the software PWM channel descriptor.
+     * enable: RFS_PWM_DISABLED to disable, RFS_PWM_ENABLED to enable.
+
+   Return 0 if the channel is correctly enabled/disabled, -1 otherwise (and
+   errno is set accordingly).
+*/
+int
+rfs_softpwm_set_enabled(struct softpwm_t *pwm, enum pwm_enable_t enabled)
+{
+    struct softpwm_scheduler_t *scheduler = pwm->scheduler;
+
+    if (enabled != RFS_PWM_DISABLED && enabled != RFS_PWM_ENABLED) {
+        errno = EINVAL;
+        return -1;
+    }
+    pthread_mutex_lock(&scheduler->lock);
+    if (enabled && !pwm->enabled) {
+        // The first period starts right now
+        pwm->next_edge = softpwm_now();
+        pwm->period_edge = 1;
+        softpwm_insert(pwm);
+        if (scheduler->timeline == pwm) {
+            softpwm_arm(scheduler);
+        }
+    } else if (!enabled && pwm->enabled) {
+        // Wait for the scheduler thread to write the pin, if it does
+        while (scheduler->writing) {
+            pthread_cond_wait(&scheduler->written, &scheduler->lock);
+        }
+        softpwm_remove(pwm);
+        if (pwm->value != RFS_GPIO_LOW && softpwm_write(pwm, RFS_GPIO_LOW)) {
+            scheduler->errors++;
+        }
+        softpwm_arm(scheduler);
+    }
+    pwm->enabled = enabled;
+    pthread_mutex_unlock(&scheduler->lock);
+    return 0;
+}
+
+/* Set the period of the software PWM signal.
+
+   Parameters:
+     * pwm: the software PWM channel descriptor.
+     * period: period of the PWM signal, not less than the duty cycle.
+
+   Return 0 if the period was correctly set, -1 otherwise (and errno is
+   set accordingly).
+*/
+int
+rfs_softpwm_set_period(struct softpwm_t *pwm, pwm_time_t period)
+{
+    int res = 0;
+
+    pthread_mutex_lock(&pwm->scheduler->lock);
+    if (period <= 0 || period < pwm->duty_cycle) {
+        errno = EINVAL;
+        res = -1;
+    } else {
+        pwm->period = period;
+    }
+    pthread_mutex_unlock(&pwm->scheduler->lock);
+    return res;
+}
+
+/* Close the software PWM channel.
+
+   Parameters:
+     * pwm: the software PWM channel descriptor.
+
+   Return 0 if the channel was correctly closed, -1 otherwise. In case of
+   error, errno is set accordingly.
+*/
+int
+rfs_softpwm_close(struct softpwm_t *pwm)
+{
+    rfs_softpwm_set_enabled(pwm, RFS_PWM_DISABLED);
+    return rfs_gpio_close(&pwm->gpio);
+}
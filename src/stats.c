@@ -0,0 +1,236 @@
+/* stats.c
+   Counters and latency histograms of the operations.
+   
+   Copyright 2018 Antonio Serrano Hernandez
+
+   This file is part of rfsgpio.
+
+   rfsgpio is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   rfsgpio is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with rfsgpio; see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+#include "rfsgpio.h"
+#include "stats.h"
+
+#include <errno.h>          // errno
+#include <string.h>         // memset
+
+// Names of the operations, indexed by enum stats_op_t
+static const char *stats_op_names[] = {
+    "open", "close", "read", "write", "ioctl", "poll", "wait file",
+    "rfs_gpio_open", "rfs_gpio_close", "rfs_gpio_get_value",
+    "rfs_gpio_set_value", "rfs_gpio_get_direction", "rfs_gpio_set_direction",
+    "rfs_gpio_get_edge", "rfs_gpio_set_edge", "rfs_gpio_wait_edge",
+    "rfs_pwm_open", "rfs_pwm_close", "rfs_pwm_get_period",
+    "rfs_pwm_set_period", "rfs_pwm_get_duty_cycle", "rfs_pwm_set_duty_cycle",
+    "rfs_pwm_get_enabled", "rfs_pwm_set_enabled", "rfs_io_batch_submit"
+};
+
+#ifdef RFS_STATS
+
+#include <pthread.h>        // pthread_key_t
+#include <stdlib.h>         // calloc
+
+// Counters of a thread. The blocks are never freed: when a thread ends its
+// block is left for the next thread, keeping its counts
+struct stats_block_t {
+    struct stats_t stats;
+    int used;
+    struct stats_block_t *next;
+};
+
+// All the blocks, protected by stats_lock
+static struct stats_block_t *stats_blocks = NULL;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Key to release the block of a thread when it ends
+static pthread_key_t stats_key;
+static pthread_once_t stats_once = PTHREAD_ONCE_INIT;
+
+// Block of the current thread
+static __thread struct stats_block_t *stats_block = NULL;
+
+/* Release the block of a thread that ends.
+
+   Parameters:
+     * block: the block of the thread.
+*/
+static void
+stats_release(void *block)
+{
+    pthread_mutex_lock(&stats_lock);
+    ((struct stats_block_t *)block)->used = 0;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+/* Create the key to release the blocks. */
+static void
+stats_init(void)
+{
+    pthread_key_create(&stats_key, stats_release);
+}
+
+/* Return the counters of the current thread, taking a block for it the first
+   time, or NULL if there is no memory for them.
+*/
+static struct stats_t *
+stats_thread(void)
+{
+    struct stats_block_t *block;
+
+    if (stats_block) {
+        return &stats_block->stats;
+    }
+    pthread_once(&stats_once, stats_init);
+    pthread_mutex_lock(&stats_lock);
+    for (block = stats_blocks; block && block->used; block = block->next);
+    if (!block && (block = calloc(1, sizeof(struct stats_block_t)))) {
+        block->next = stats_blocks;
+        stats_blocks = block;
+    }
+    if (block) {
+        block->used = 1;
+    }
+    pthread_mutex_unlock(&stats_lock);
+    if (!block) {
+        return NULL;
+    }
+    pthread_setspecific(stats_key, block);
+    stats_block = block;
+    return &block->stats;
+}
+
+// Add to a counter. Only the owner thread writes its counters, so a plain
+// load and store are enough, atomic to be read at the same time by others
+#define STATS_ADD(counter, n) __atomic_store_n(&(counter),                  \
+    __atomic_load_n(&(counter), __ATOMIC_RELAXED) + (n), __ATOMIC_RELAXED)
+
+/* Count a call to an operation in the statistics of the current thread.
+
+   Parameters:
+     * op: the operation.
+     * start: time at which the operation started, from stats_now.
+     * res: the result of the operation.
+     * io: whether res is the number of bytes read or written.
+
+   Return res.
+*/
+long
+stats_end(enum stats_op_t op, uint64_t start, long res, int io)
+{
+    uint64_t elapsed = stats_now() - start;
+    struct op_stats_t *o;
+    struct stats_t *stats;
+    int e = errno, bucket;
+
+    if (!(stats = stats_thread())) {
+        errno = e;
+        return res;
+    }
+    o = &stats->ops[op];
+    STATS_ADD(o->calls, 1);
+    STATS_ADD(o->time, elapsed);
+    bucket = elapsed ? 63 - __builtin_clzll(elapsed) : 0;
+    if (bucket >= RFS_STATS_BUCKETS) {
+        bucket = RFS_STATS_BUCKETS - 1;
+    }
+    STATS_ADD(o->histogram[bucket], 1);
+    if (res < 0) {
+        STATS_ADD(o->errors, 1);
+        STATS_ADD(o->errnos[e > 0 && e < RFS_STATS_MAX_ERRNO ? e : 0], 1);
+    } else if (io) {
+        STATS_ADD(o->bytes, res);
+    }
+    errno = e;
+    return res;
+}
+
+#endif
+
+/* Get the statistics of the operations, added up for all the threads.
+
+   Parameters:
+     * stats: where to store the statistics.
+
+   Return 0 on success, -1 otherwise (and errno is set to ENOTSUP if the
+   library was built without statistics).
+*/
+int
+rfs_stats_snapshot(struct stats_t *stats)
+{
+#ifdef RFS_STATS
+    struct stats_block_t *block;
+    uint64_t *total, *counters;
+    size_t i;
+
+    memset(stats, 0, sizeof(struct stats_t));
+    total = (uint64_t *)stats;
+    pthread_mutex_lock(&stats_lock);
+    for (block = stats_blocks; block; block = block->next) {
+        counters = (uint64_t *)&block->stats;
+        for (i = 0; i < sizeof(struct stats_t) / sizeof(uint64_t); i++) {
+            total[i] += __atomic_load_n(&counters[i], __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&stats_lock);
+    return 0;
+#else
+    memset(stats, 0, sizeof(struct stats_t));
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+/* Reset the statistics to zero.
+
+   Return 0 on success, -1 otherwise (and errno is set to ENOTSUP if the
+   library was built without statistics).
+*/
+int
+rfs_stats_reset(void)
+{
+#ifdef RFS_STATS
+    struct stats_block_t *block;
+    uint64_t *counters;
+    size_t i;
+
+    pthread_mutex_lock(&stats_lock);
+    for (block = stats_blocks; block; block = block->next) {
+        counters = (uint64_t *)&block->stats;
+        for (i = 0; i < sizeof(struct stats_t) / sizeof(uint64_t); i++) {
+            __atomic_store_n(&counters[i], 0, __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&stats_lock);
+    return 0;
+#else
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+/* Return the name of an operation of the statistics, or NULL if op is not
+   valid.
+
+   Parameters:
+     * op: the operation.
+*/
+const char *
+rfs_stats_op_name(enum stats_op_t op)
+{
+    if (op < 0 || op >= RFS_STATS_OPS) {
+        return NULL;
+    }
+    return stats_op_names[op];
+}
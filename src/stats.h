@@ -0,0 +1,75 @@
+/* stats.h
+   Counters and latency histograms of the operations, kept only if the
+   library is configured with --enable-stats.
+   
+   Copyright 2018 Antonio Serrano Hernandez
+
+   This file is part of rfsgpio.
+
+   rfsgpio is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   rfsgpio is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with rfsgpio; see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef STATS_H
+#define STATS_H
+
+#include "rfsgpio.h"
+
+#ifdef RFS_STATS
+
+#include <time.h>   // clock_gettime
+
+/* Return the current time, in nanoseconds (CLOCK_MONOTONIC). */
+static inline uint64_t
+stats_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Count a call to an operation in the statistics of the current thread.
+
+   errno is left untouched.
+
+   Parameters:
+     * op: the operation.
+     * start: time at which the operation started, from stats_now.
+     * res: the result of the operation (negative if it failed, with the
+         error in errno).
+     * io: whether res is the number of bytes read or written.
+
+   Return res.
+*/
+long
+stats_end(enum stats_op_t op, uint64_t start, long res, int io);
+
+// Take the time at which an operation starts
+#define STATS_START(t)              uint64_t t = stats_now()
+
+// Count the result of an operation (of a syscall that reads or writes bytes
+// with STATS_END_IO), and evaluate to it
+#define STATS_END(op, t, res)       stats_end(op, t, res, 0)
+#define STATS_END_IO(op, t, res)    stats_end(op, t, res, 1)
+
+#else
+
+#define STATS_START(t)
+#define STATS_END(op, t, res)       (res)
+#define STATS_END_IO(op, t, res)    (res)
+
+#endif
+
+#endif
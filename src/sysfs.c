@@ -21,14 +21,401 @@
    <http://www.gnu.org/licenses/>.
 */
 
-#include <errno.h>      // errno
-#include <fcntl.h>      // open
-#include <string.h>     // strlen
-#include <unistd.h>     // write
+#include "rfsgpio.h"
+#include "probes.h"
+#include "stats.h"
+#include "sysfs.h"
+
+#include <errno.h>          // errno
+#include <fcntl.h>          // open
+#include <libgen.h>         // dirname
+#include <linux/io_uring.h> // io_uring_params
+#include <stdarg.h>         // va_list
+#include <stdio.h>          // vsnprintf
+#include <stdlib.h>         // malloc
+#include <string.h>         // strlen
+#include <sys/inotify.h>    // inotify_init1
+#include <sys/mman.h>       // mmap
+#include <sys/syscall.h>    // SYS_io_uring_setup
+#include <sys/uio.h>        // iovec
+#include <time.h>           // clock_gettime
+#include <unistd.h>         // write
+
+// Maximum interval between checks while waiting for a file, in milliseconds
+#define SYSFS_WAIT_MAX_INTERVAL 32
+
+// Changes of the files and directories that may make a file accessible
+#define SYSFS_WAIT_EVENTS   (IN_CREATE | IN_ATTRIB | IN_MOVED_TO)
+
+// An io_uring instance, with the rings shared with the kernel mapped
+struct sysfs_ring_t {
+    int fd;
+
+    // Submission queue ring and entries
+    void *sq;
+    size_t sq_len;
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_entries;
+    unsigned int *sq_array;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+
+    // Completion queue ring
+    void *cq;
+    size_t cq_len;
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    // Operations queued and not submitted yet
+    unsigned int queued;
+
+    // The registered fixed buffer
+    char *buffers;
+
+    // Whether the operations in flight couldn't be waited for after a
+    // failed submission. They may still use the buffer, so nothing else is
+    // queued
+    int failed;
+};
+
+// Root directory prepended to the sysfs paths (empty for the real one)
+static char sysfs_root[RFS_ROOT_MAX_LEN] = "";
+
+// Maximum time to wait for the files of a pin or channel, in milliseconds
+static int sysfs_wait_timeout = RFS_DEFAULT_WAIT_TIMEOUT;
+
+/* Set the root directory under which the sysfs (and device) files are
+   looked for.
+
+   Parameters:
+     * root: the new root directory, or NULL or "" to use the real one.
+
+   Return 0 if the root was changed, -1 otherwise (errno is set to
+   ENAMETOOLONG if root is longer than RFS_ROOT_MAX_LEN - 1 characters).
+*/
+int
+rfs_set_root(const char *root)
+{
+    if (!root) {
+        root = "";
+    }
+    if (strlen(root) >= RFS_ROOT_MAX_LEN) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(sysfs_root, root);
+    return 0;
+}
+
+/* Set the maximum time to wait for the files of a pin or channel after
+   exporting it.
+
+   Parameters:
+     * timeout: the maximum time to wait, in milliseconds (0 not to wait).
+
+   Return 0 if the timeout was changed, -1 otherwise (and errno is set to
+   EINVAL for a negative timeout).
+*/
+int
+rfs_set_wait_timeout(int timeout)
+{
+    if (timeout < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    sysfs_wait_timeout = timeout;
+    return 0;
+}
+
+/* Return the current time, in milliseconds (CLOCK_MONOTONIC). */
+static long long
+sysfs_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Return the deadline of the waits for the files of a pin or channel that is
+   being exported right now, in milliseconds (CLOCK_MONOTONIC).
+*/
+long long
+sysfs_wait_deadline(void)
+{
+    return sysfs_now() + sysfs_wait_timeout;
+}
+
+/* Watch a file and the two directories above it with inotify, ignoring the
+   ones that don't exist yet.
+
+   Parameters:
+     * fd: the inotify descriptor.
+     * file: name of the file.
+*/
+static void
+sysfs_watch(int fd, const char *file)
+{
+    char path[RFS_PWM_FILENAME_MAX_LEN];
+    char *dir;
+
+    inotify_add_watch(fd, file, IN_ATTRIB);
+    strncpy(path, file, RFS_PWM_FILENAME_MAX_LEN - 1);
+    path[RFS_PWM_FILENAME_MAX_LEN - 1] = '\0';
+    dir = dirname(path);
+    inotify_add_watch(fd, dir, SYSFS_WAIT_EVENTS);
+    inotify_add_watch(fd, dirname(dir), SYSFS_WAIT_EVENTS);
+}
+
+/* Wait for the events of an inotify instance and discard them, tracing the
+   wait. Without the instance, just sleep.
+
+   Parameters:
+     * pd: the inotify descriptor to poll (-1 if there's none).
+     * timeout: maximum time to wait, in milliseconds.
+
+   Return the result of poll.
+*/
+static int
+sysfs_inotify_wait(struct pollfd *pd, int timeout)
+{
+    char events[sizeof(struct inotify_event) + RFS_PWM_FILENAME_MAX_LEN];
+    int res;
+
+    PROBE2(inotify_wait_entry, pd->fd, timeout);
+    if ((res = poll(pd, 1, timeout)) > 0) {
+        while (read(pd->fd, events, sizeof(events)) > 0);
+    }
+    PROBE3(inotify_wait_return, pd->fd, timeout, res);
+    return res;
+}
+
+/* Wait until a sysfs file is accessible, after exporting its pin or channel.
+
+   Parameters:
+     * file: name of the file.
+     * mode: accessibility to wait for (R_OK, W_OK or both).
+     * deadline: time after which to give up, from sysfs_wait_deadline.
+
+   Return 0 when the file is accessible, -1 otherwise (and errno is set to the
+   error of the last access, or to the error that stopped the wait).
+*/
+static int
+sysfs_wait_file(const char *file, int mode, long long deadline)
+{
+    long long remaining;
+    struct pollfd pd;
+    int interval = 1, res, e;
+
+    pd.fd = -1;
+    pd.events = POLLIN;
+    while ((res = access(file, mode))) {
+        // Only the files not created yet or without permissions are waited
+        remaining = deadline - sysfs_now();
+        if ((errno != ENOENT && errno != EACCES) || remaining <= 0) {
+            break;
+        }
+        // Without inotify, poll just sleeps until the next check
+        if (pd.fd < 0) {
+            e = errno;
+            pd.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            errno = e;
+        }
+        // The watches are renewed, as the directories may be new
+        if (pd.fd >= 0) {
+            sysfs_watch(pd.fd, file);
+        }
+        sysfs_inotify_wait(&pd, remaining < interval ? remaining : interval);
+        if (interval < SYSFS_WAIT_MAX_INTERVAL) {
+            interval *= 2;
+        }
+    }
+    if (pd.fd >= 0) {
+        e = errno;
+        close(pd.fd);
+        errno = e;
+    }
+    return res ? -1 : 0;
+}
+
+/* Wait until a sysfs file is accessible, counting the wait in the
+   statistics.
+
+   Parameters:
+     * file: name of the file.
+     * mode: accessibility to wait for (R_OK, W_OK or both).
+     * deadline: time after which to give up, from sysfs_wait_deadline.
+
+   Return 0 when the file is accessible, -1 otherwise (and errno is set
+   accordingly).
+*/
+int
+wait_sysfs_file(const char *file, int mode, long long deadline)
+{
+    STATS_START(start);
+    return STATS_END(RFS_STATS_WAIT_FILE, start,
+        sysfs_wait_file(file, mode, deadline));
+}
+
+/* Open a file, counting it in the statistics and tracing it.
+
+   Parameters:
+     * file: name of the file.
+     * flags: flags of open.
+
+   Return the file descriptor, or -1 in case of error.
+*/
+static int
+sysfs_open(const char *file, int flags)
+{
+    int fd;
+
+    PROBE2(open_entry, file, flags);
+    STATS_START(start);
+    fd = STATS_END(RFS_STATS_OPEN, start, open(file, flags));
+    PROBE2(open_return, file, fd);
+    return fd;
+}
+
+/* Close a file, counting it in the statistics and tracing it.
+
+   Parameters:
+     * fd: the file descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+static int
+sysfs_close(int fd)
+{
+    int res;
+
+    PROBE1(close_entry, fd);
+    STATS_START(start);
+    res = STATS_END(RFS_STATS_CLOSE, start, close(fd));
+    PROBE2(close_return, fd, res);
+    return res;
+}
+
+/* Read a file at offset 0, counting it in the statistics and tracing it.
+
+   Parameters:
+     * fd: the file descriptor.
+     * val: buffer where to store the read value.
+     * n: number of bytes to read.
+
+   Return the number of bytes read, or -1 in case of error.
+*/
+static ssize_t
+sysfs_read(int fd, char *val, size_t n)
+{
+    ssize_t res;
+
+    PROBE2(read_entry, fd, n);
+    STATS_START(start);
+    res = STATS_END_IO(RFS_STATS_READ, start, pread(fd, val, n, 0));
+    PROBE3(read_return, fd, val, res);
+    return res;
+}
+
+/* Write a file at offset 0, counting it in the statistics and tracing it.
+
+   Parameters:
+     * fd: the file descriptor.
+     * val: value to write.
+     * len: length of the value.
+
+   Return the number of bytes written, or -1 in case of error.
+*/
+static ssize_t
+sysfs_write(int fd, const char *val, size_t len)
+{
+    ssize_t res;
+
+    PROBE2(write_entry, fd, val);
+    STATS_START(start);
+    res = STATS_END_IO(RFS_STATS_WRITE, start, pwrite(fd, val, len, 0));
+    PROBE3(write_return, fd, val, res);
+    return res;
+}
+
+/* Build the path of a sysfs (or device) file, prefixed by the root set with
+   rfs_set_root.
+
+   Parameters:
+     * path: buffer where to store the path.
+     * n: capacity of the path buffer.
+     * fmt: printf like format of the path, starting with '/'.
+
+   Return 0 if the path fits in the buffer, -1 otherwise (and errno is set to
+   ENAMETOOLONG).
+*/
+int
+sysfs_path(char *path, size_t n, const char *fmt, ...)
+{
+    va_list ap;
+    size_t rootlen;
+    int len;
+
+    rootlen = strlen(sysfs_root);
+    if (rootlen >= n) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memcpy(path, sysfs_root, rootlen);
+    va_start(ap, fmt);
+    len = vsnprintf(path + rootlen, n - rootlen, fmt, ap);
+    va_end(ap);
+    if (len < 0 || (size_t)len >= n - rootlen) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
+/* Open a sysfs file to keep it opened.
+
+   The file is opened for reading and writing if possible, or just for reading
+   otherwise.
+
+   Parameters:
+     * file: name of the file to open.
+
+   Return the file descriptor, or -1 in case of error.
+*/
+int
+open_sysfs_file(const char *file)
+{
+    int fd;
+
+    fd = sysfs_open(file, O_RDWR | O_CLOEXEC);
+    if (fd < 0 && errno == EACCES) {
+        fd = sysfs_open(file, O_RDONLY | O_CLOEXEC);
+    }
+    return fd;
+}
+
+/* Close a sysfs file descriptor, if it is opened, and set it to -1.
+
+   Parameters:
+     * fd: pointer to the file descriptor.
+*/
+void
+close_sysfs_fd(int *fd)
+{
+    if (*fd >= 0) {
+        sysfs_close(*fd);
+        *fd = -1;
+    }
+}
 
 /* Write a value to a sysfs (actually any) file.
 
-   The file is opened, value written and then closed again.
+   The file is opened, value written (with a pwrite at offset 0, as the
+   files kept opened) and then closed again.
 
    Parameters:
      * file: name of the file to write to.
@@ -40,19 +427,19 @@ write_sysfs_file(const char *file, const char *val)
     int fd, e;
     size_t len;
 
-    fd = open(file, O_WRONLY);
+    fd = sysfs_open(file, O_WRONLY);
     if (fd < 0) {
         return -1;
     }
     len = strlen(val);
-    if (write(fd, val, len) != len) {
+    if (sysfs_write(fd, val, len) != len) {
         // Save errno to avoid polute it with the close syscall
         e = errno;
-        close(fd);
+        sysfs_close(fd);
         errno = e;
         return -1;
     }
-    close(fd);
+    sysfs_close(fd);
     return 0;
 }
 
@@ -72,17 +459,429 @@ read_sysfs_file(const char *file, char *val, size_t n)
 {
     int fd, e, r;
 
-    fd = open(file, O_RDONLY);
+    fd = sysfs_open(file, O_RDONLY);
     if (fd < 0) {
         return -1;
     }
-    if ((r = read(fd, val, n - 1)) < 0) {
+    if ((r = sysfs_read(fd, val, n - 1)) < 0) {
         e = errno;
-        close(fd);
+        sysfs_close(fd);
         errno = e;
         return -1;
     }
     val[r] = '\0';
-    close(fd);
+    sysfs_close(fd);
+    return 0;
 }
 
+/* Write a value to an already opened sysfs file.
+
+   The value is written with a single pwrite at offset 0.
+
+   Parameters:
+     * fd: descriptor of the file to write to.
+     * val: value to write to the file.
+*/
+int
+write_sysfs_fd(int fd, const char *val)
+{
+    size_t len;
+
+    len = strlen(val);
+    if (sysfs_write(fd, val, len) != len) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Read a value from an already opened sysfs file.
+
+   The value is read with a single pread at offset 0 (up to n - 1 bytes).
+
+   Parameters:
+     * fd: descriptor of the file to read from.
+     * val: buffer where to store the read value.
+     * n: capacity that val must have.
+*/
+int
+read_sysfs_fd(int fd, char *val, size_t n)
+{
+    ssize_t r;
+
+    if ((r = sysfs_read(fd, val, n - 1)) < 0) {
+        return -1;
+    }
+    val[r] = '\0';
+    return 0;
+}
+
+/* Write a value to a sysfs attribute.
+
+   If fd is a valid descriptor the value is written through it, otherwise the
+   file is opened, written and closed.
+
+   Parameters:
+     * fd: descriptor of the file, or -1 if it is not kept opened.
+     * file: name of the file to write to.
+     * val: value to write to the file.
+*/
+int
+write_sysfs_attr(int fd, const char *file, const char *val)
+{
+    if (fd >= 0) {
+        return write_sysfs_fd(fd, val);
+    }
+    return write_sysfs_file(file, val);
+}
+
+/* Read a value from a sysfs attribute.
+
+   If fd is a valid descriptor the value is read through it, otherwise the
+   file is opened, read and closed.
+
+   Parameters:
+     * fd: descriptor of the file, or -1 if it is not kept opened.
+     * file: name of the file to read from.
+     * val: buffer where to store the read value.
+     * n: capacity that val must have.
+*/
+int
+read_sysfs_attr(int fd, const char *file, char *val, size_t n)
+{
+    if (fd >= 0) {
+        return read_sysfs_fd(fd, val, n);
+    }
+    return read_sysfs_file(file, val, n);
+}
+
+/* Initialize a batch of writes to export or unexport files.
+
+   Parameters:
+     * batch: the batch descriptor.
+*/
+void
+sysfs_batch_init(struct sysfs_batch_t *batch)
+{
+    batch->fd = -1;
+    batch->file[0] = '\0';
+}
+
+/* Write a value to an export or unexport file, as part of a batch.
+
+   Parameters:
+     * batch: the batch descriptor.
+     * file: name of the file to write to.
+     * val: value to write to the file.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+write_sysfs_batch(struct sysfs_batch_t *batch, const char *file,
+    const char *val)
+{
+    if (batch->fd < 0 || strcmp(batch->file, file) != 0) {
+        sysfs_batch_close(batch);
+        if ((batch->fd = sysfs_open(file, O_WRONLY | O_CLOEXEC)) < 0) {
+            return -1;
+        }
+        strncpy(batch->file, file, RFS_PWM_FILENAME_MAX_LEN - 1);
+        batch->file[RFS_PWM_FILENAME_MAX_LEN - 1] = '\0';
+    }
+    return write_sysfs_fd(batch->fd, val);
+}
+
+/* Close the file kept opened by a batch.
+
+   Parameters:
+     * batch: the batch descriptor.
+*/
+void
+sysfs_batch_close(struct sysfs_batch_t *batch)
+{
+    close_sysfs_fd(&batch->fd);
+    batch->file[0] = '\0';
+}
+
+/* Unmap the rings of an io_uring instance and close it.
+
+   Parameters:
+     * ring: the io_uring instance.
+*/
+static void
+sysfs_ring_free(struct sysfs_ring_t *ring)
+{
+    int e = errno;
+
+    if (ring->sqes != MAP_FAILED) {
+        munmap(ring->sqes, ring->sqes_len);
+    }
+    if (ring->cq != MAP_FAILED) {
+        munmap(ring->cq, ring->cq_len);
+    }
+    if (ring->sq != MAP_FAILED) {
+        munmap(ring->sq, ring->sq_len);
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+    free(ring);
+    errno = e;
+}
+
+/* Create an io_uring instance to read and write sysfs files.
+
+   Parameters:
+     * entries: maximum number of operations queued at once.
+     * buffers: buffer where the values read or written must be.
+     * len: length of the buffer.
+
+   Return the instance, or NULL if io_uring is not available (and errno is set
+   accordingly).
+*/
+struct sysfs_ring_t *
+sysfs_ring_open(unsigned int entries, void *buffers, size_t len)
+{
+    struct sysfs_ring_t *ring;
+    struct io_uring_params params;
+    struct iovec iov;
+
+    if (!(ring = malloc(sizeof(struct sysfs_ring_t)))) {
+        return NULL;
+    }
+    ring->sq = ring->cq = ring->sqes = MAP_FAILED;
+    memset(&params, 0, sizeof(params));
+    if ((ring->fd = syscall(SYS_io_uring_setup, entries, &params)) < 0) {
+        sysfs_ring_free(ring);
+        return NULL;
+    }
+    // Map the rings and the submission queue entries
+    ring->sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_len = params.cq_off.cqes
+        + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sq = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->cq = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sq == MAP_FAILED || ring->cq == MAP_FAILED
+        || ring->sqes == MAP_FAILED)
+    {
+        sysfs_ring_free(ring);
+        return NULL;
+    }
+    ring->sq_head = (unsigned int *)((char *)ring->sq + params.sq_off.head);
+    ring->sq_tail = (unsigned int *)((char *)ring->sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned int *)((char *)ring->sq
+        + params.sq_off.ring_mask);
+    ring->sq_entries = (unsigned int *)((char *)ring->sq
+        + params.sq_off.ring_entries);
+    ring->sq_array = (unsigned int *)((char *)ring->sq + params.sq_off.array);
+    ring->cq_head = (unsigned int *)((char *)ring->cq + params.cq_off.head);
+    ring->cq_tail = (unsigned int *)((char *)ring->cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned int *)((char *)ring->cq
+        + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)((char *)ring->cq
+        + params.cq_off.cqes);
+    ring->queued = 0;
+    ring->failed = 0;
+    // The files aren't registered: a descriptor closed and reused by another
+    // file would keep the old one, and updating the table for each
+    // submission costs more than looking the descriptors up
+    iov.iov_base = buffers;
+    iov.iov_len = len;
+    if (syscall(SYS_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS,
+        &iov, 1))
+    {
+        sysfs_ring_free(ring);
+        return NULL;
+    }
+    ring->buffers = buffers;
+    return ring;
+}
+
+/* Queue the read or write of a sysfs file kept opened, at offset 0.
+
+   Parameters:
+     * ring: the io_uring instance.
+     * write: whether to write (or read) the file.
+     * fd: descriptor of the file.
+     * buf: the value to write or where to read it (inside the buffer given
+         to sysfs_ring_open).
+     * len: length of the value to write, or capacity of buf.
+     * id: identifier of the operation, index of its result.
+
+   Return 0 if the operation was queued, -1 otherwise (and errno is set to
+   ENOSPC if the queue is full, or EIO if the instance failed).
+*/
+int
+sysfs_ring_queue(struct sysfs_ring_t *ring, int write, int fd, char *buf,
+    size_t len, uint64_t id)
+{
+    struct io_uring_sqe *sqe;
+    unsigned int tail, index;
+
+    if (ring->failed) {
+        errno = EIO;
+        return -1;
+    }
+    if (ring->queued == *ring->sq_entries) {
+        errno = ENOSPC;
+        return -1;
+    }
+    tail = *ring->sq_tail + ring->queued;
+    index = tail & *ring->sq_mask;
+    sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = 0;
+    sqe->buf_index = 0;
+    sqe->user_data = id;
+    ring->sq_array[index] = index;
+    ring->queued++;
+    return 0;
+}
+
+/* Submit operations to an io_uring instance and wait for completions,
+   tracing the call.
+
+   Parameters:
+     * ring: the io_uring instance.
+     * submit: number of operations to submit.
+     * wait: number of completions to wait for.
+
+   Return the number of operations submitted, or -1 in case of error (and
+   errno is set accordingly).
+*/
+static int
+sysfs_ring_enter(struct sysfs_ring_t *ring, unsigned int submit,
+    unsigned int wait)
+{
+    int res;
+
+    PROBE3(io_uring_enter_entry, ring->fd, submit, wait);
+    res = syscall(SYS_io_uring_enter, ring->fd, submit, wait,
+        IORING_ENTER_GETEVENTS, NULL, 0);
+    PROBE3(io_uring_enter_return, ring->fd, submit, res);
+    return res;
+}
+
+/* Store the results of the completions available in an io_uring instance.
+
+   Parameters:
+     * ring: the io_uring instance.
+     * results: where to store the result of each operation, indexed by its
+         id.
+
+   Return the number of completions reaped.
+*/
+static unsigned int
+sysfs_ring_reap(struct sysfs_ring_t *ring, int *results)
+{
+    struct io_uring_cqe *cqe;
+    unsigned int head, tail, n = 0;
+
+    head = *ring->cq_head;
+    tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        cqe = &ring->cqes[head & *ring->cq_mask];
+        results[cqe->user_data] = cqe->res;
+        head++;
+        n++;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    return n;
+}
+
+/* Drop the operations not taken by the kernel after a failed submission,
+   and wait for the ones in flight, so that none of them completes into a
+   later submission or uses the buffer while it is reused.
+
+   There's no polling thread, so the kernel only takes the entries in
+   io_uring_enter and the ones left are taken back by moving the tail back
+   to the head. If the wait fails too, the instance is marked as failed.
+
+   Parameters:
+     * ring: the io_uring instance.
+     * results: where to store the result of each operation, indexed by its
+         id. The dropped ones get the error of the submission.
+     * pending: number of operations not completed yet.
+*/
+static void
+sysfs_ring_drain(struct sysfs_ring_t *ring, int *results,
+    unsigned int pending)
+{
+    unsigned int head, i;
+    int e = errno;
+
+    head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    for (i = head; i != *ring->sq_tail; i++) {
+        results[ring->sqes[ring->sq_array[i & *ring->sq_mask]].user_data] =
+            -e;
+        pending--;
+    }
+    __atomic_store_n(ring->sq_tail, head, __ATOMIC_RELEASE);
+    while (pending) {
+        if (sysfs_ring_enter(ring, 0, pending) < 0 && errno != EINTR) {
+            ring->failed = 1;
+            break;
+        }
+        pending -= sysfs_ring_reap(ring, results);
+    }
+    errno = e;
+}
+
+/* Submit the queued operations and wait for all of them.
+
+   If the submission fails, the operations not submitted yet are dropped and
+   the rest are waited for, so none is left in flight.
+
+   Parameters:
+     * ring: the io_uring instance.
+     * results: where to store the result of each operation (the number of
+         bytes read or written, or -errno), indexed by its id.
+
+   Return the number of io_uring_enter calls done, or -1 in case of error
+   (and errno is set accordingly).
+*/
+int
+sysfs_ring_submit(struct sysfs_ring_t *ring, int *results)
+{
+    unsigned int pending, submit;
+    int enters = 0, r;
+
+    // The kernel must see the entries before the new tail
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail + ring->queued,
+        __ATOMIC_RELEASE);
+    submit = pending = ring->queued;
+    ring->queued = 0;
+    while (pending) {
+        r = sysfs_ring_enter(ring, submit, pending);
+        if (r < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            sysfs_ring_drain(ring, results, pending);
+            return -1;
+        }
+        enters++;
+        submit -= r;
+        pending -= sysfs_ring_reap(ring, results);
+    }
+    return enters;
+}
+
+/* Destroy an io_uring instance.
+
+   Parameters:
+     * ring: the io_uring instance.
+*/
+void
+sysfs_ring_close(struct sysfs_ring_t *ring)
+{
+    sysfs_ring_free(ring);
+}
@@ -24,10 +24,114 @@
 #ifndef SYSFS_H
 #define SYSFS_H
 
+#include "rfsgpio.h"
+
+#include <stdint.h>     // uint64_t
 #include <sys/types.h>  // size_t
 
 #define RFS_MAX_SYSFS_STR    16
 
+// An export or unexport file kept opened while exporting or unexporting a
+// batch of pins or channels
+struct sysfs_batch_t {
+    int fd;
+    char file[RFS_PWM_FILENAME_MAX_LEN];
+};
+
+/* Build the path of a sysfs (or device) file, prefixed by the root set with
+   rfs_set_root.
+
+   Parameters:
+     * path: buffer where to store the path.
+     * n: capacity of the path buffer.
+     * fmt: printf like format of the path, starting with '/'.
+
+   Return 0 if the path fits in the buffer, -1 otherwise (and errno is set to
+   ENAMETOOLONG).
+*/
+int
+sysfs_path(char *path, size_t n, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+/* Return the deadline of the waits for the files of a pin or channel that is
+   being exported right now, in milliseconds (CLOCK_MONOTONIC).
+*/
+long long
+sysfs_wait_deadline(void);
+
+/* Wait until a sysfs file is accessible, after exporting its pin or channel.
+
+   The accessibility of the file is checked again each time inotify reports a
+   change in the file, its directory or the parent of its directory. As
+   sysfs doesn't report all the changes, it is also checked at growing
+   intervals (up to a few tens of milliseconds).
+
+   Parameters:
+     * file: name of the file.
+     * mode: accessibility to wait for (R_OK, W_OK or both).
+     * deadline: time after which to give up, from sysfs_wait_deadline.
+
+   Return 0 when the file is accessible, -1 otherwise (and errno is set to the
+   error of the last access, or to the error that stopped the wait).
+*/
+int
+wait_sysfs_file(const char *file, int mode, long long deadline);
+
+/* Initialize a batch of writes to export or unexport files.
+
+   Parameters:
+     * batch: the batch descriptor.
+*/
+void
+sysfs_batch_init(struct sysfs_batch_t *batch);
+
+/* Write a value to an export or unexport file, as part of a batch.
+
+   The file is kept opened for the next writes of the batch, and only opened
+   again if they are for another file (for example, the export file of
+   another PWM chip).
+
+   Parameters:
+     * batch: the batch descriptor.
+     * file: name of the file to write to.
+     * val: value to write to the file.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+write_sysfs_batch(struct sysfs_batch_t *batch, const char *file,
+    const char *val);
+
+/* Close the file kept opened by a batch.
+
+   Parameters:
+     * batch: the batch descriptor.
+*/
+void
+sysfs_batch_close(struct sysfs_batch_t *batch);
+
+/* Open a sysfs file to keep it opened.
+
+   The file is opened for reading and writing if possible, or just for reading
+   otherwise (for example, a value file whose write permission was not given
+   to this user).
+
+   Parameters:
+     * file: name of the file to open.
+
+   Return the file descriptor, or -1 in case of error.
+*/
+int
+open_sysfs_file(const char *file);
+
+/* Close a sysfs file descriptor, if it is opened, and set it to -1.
+
+   Parameters:
+     * fd: pointer to the file descriptor.
+*/
+void
+close_sysfs_fd(int *fd);
+
 /* Write a value to a sysfs (actually any) file.
 
    The file is opened, value written and then closed again.
@@ -53,5 +157,113 @@ write_sysfs_file(const char *file, const char *val);
 int
 read_sysfs_file(const char *file, char *val, size_t n);
 
+/* Write a value to an already opened sysfs file.
+
+   The value is written with a single pwrite at offset 0.
+
+   Parameters:
+     * fd: descriptor of the file to write to.
+     * val: value to write to the file.
+*/
+int
+write_sysfs_fd(int fd, const char *val);
+
+/* Read a value from an already opened sysfs file.
+
+   The value is read with a single pread at offset 0 (up to n - 1 bytes).
+
+   Parameters:
+     * fd: descriptor of the file to read from.
+     * val: buffer where to store the read value.
+     * n: capacity that val must have.
+*/
+int
+read_sysfs_fd(int fd, char *val, size_t n);
+
+/* Write a value to a sysfs attribute.
+
+   If fd is a valid descriptor the value is written through it, otherwise the
+   file is opened, written and closed.
+
+   Parameters:
+     * fd: descriptor of the file, or -1 if it is not kept opened.
+     * file: name of the file to write to.
+     * val: value to write to the file.
+*/
+int
+write_sysfs_attr(int fd, const char *file, const char *val);
+
+/* Read a value from a sysfs attribute.
+
+   If fd is a valid descriptor the value is read through it, otherwise the
+   file is opened, read and closed.
+
+   Parameters:
+     * fd: descriptor of the file, or -1 if it is not kept opened.
+     * file: name of the file to read from.
+     * val: buffer where to store the read value.
+     * n: capacity that val must have.
+*/
+int
+read_sysfs_attr(int fd, const char *file, char *val, size_t n);
+
+/* Create an io_uring instance to read and write sysfs files.
+
+   The buffer is registered as a fixed buffer, so its pages are only mapped
+   once by the kernel.
+
+   Parameters:
+     * entries: maximum number of operations queued at once.
+     * buffers: buffer where the values read or written must be.
+     * len: length of the buffer.
+
+   Return the instance, or NULL if io_uring is not available (and errno is set
+   accordingly).
+*/
+struct sysfs_ring_t *
+sysfs_ring_open(unsigned int entries, void *buffers, size_t len);
+
+/* Queue the read or write of a sysfs file kept opened, at offset 0.
+
+   Parameters:
+     * ring: the io_uring instance.
+     * write: whether to write (or read) the file.
+     * fd: descriptor of the file.
+     * buf: the value to write or where to read it (inside the buffer given
+         to sysfs_ring_open).
+     * len: length of the value to write, or capacity of buf.
+     * id: identifier of the operation, index of its result.
+
+   Return 0 if the operation was queued, -1 otherwise (and errno is set to
+   ENOSPC if the queue is full, or EIO if the instance failed).
+*/
+int
+sysfs_ring_queue(struct sysfs_ring_t *ring, int write, int fd, char *buf,
+    size_t len, uint64_t id);
+
+/* Submit the queued operations and wait for all of them.
+
+   If the submission fails, the operations not submitted yet are dropped and
+   the rest are waited for, so none is left in flight.
+
+   Parameters:
+     * ring: the io_uring instance.
+     * results: where to store the result of each operation (the number of
+         bytes read or written, or -errno), indexed by its id.
+
+   Return the number of io_uring_enter calls done, or -1 in case of error
+   (and errno is set accordingly).
+*/
+int
+sysfs_ring_submit(struct sysfs_ring_t *ring, int *results);
+
+/* Destroy an io_uring instance.
+
+   Parameters:
+     * ring: the io_uring instance.
+*/
+void
+sysfs_ring_close(struct sysfs_ring_t *ring);
+
 #endif
 
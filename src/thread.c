@@ -0,0 +1,377 @@
+/* thread.c
+   Helper functions to manage the threads owned by the library.
+   
+   Copyright 2018 Antonio Serrano Hernandez
+
+   This file is part of rfsgpio.
+
+   rfsgpio is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   rfsgpio is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with rfsgpio; see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include "rfsgpio.h"
+#include "sysfs.h"
+#include "thread.h"
+
+#include <alloca.h>         // alloca
+#include <errno.h>          // errno
+#include <sched.h>          // SCHED_FIFO, CPU_SET
+#include <stddef.h>         // NULL
+#include <string.h>         // strlen
+#include <sys/mman.h>       // mlockall
+#include <sys/prctl.h>      // prctl
+#include <sys/syscall.h>    // SYS_sched_setattr
+#include <unistd.h>         // syscall, sysconf
+
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE  6
+#endif
+
+#define THREAD_CLOCK_SOURCE_FILE \
+    "/sys/devices/system/clocksource/clocksource0/current_clocksource"
+
+// Stack kept untouched by the prefault, for the frames of the thread
+#define THREAD_STACK_MARGIN     (64 * 1024)
+
+// Minimum runtime accepted by the kernel with SCHED_DEADLINE, in nanoseconds
+#define THREAD_MIN_RUNTIME      1024
+
+// Parameters of sched_setattr, not always declared by the C library
+struct thread_sched_attr_t {
+    uint32_t size;
+    uint32_t sched_policy;
+    uint64_t sched_flags;
+    int32_t sched_nice;
+    uint32_t sched_priority;
+    uint64_t sched_runtime;
+    uint64_t sched_deadline;
+    uint64_t sched_period;
+};
+
+// A thread being started: its routine and configuration, and the result of
+// applying it, given back to the starting thread
+struct thread_launch_t {
+    void *(*routine)(void *);
+    void *arg;
+    struct thread_config_t config;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int done;
+    int error;
+};
+
+const struct thread_config_t rfs_thread_default = {
+    .policy = RFS_THREAD_DEFAULT,
+    .priority = 0,
+    .runtime = 0,
+    .deadline = 0,
+    .period = 0,
+    .cpus = 0,
+    .lock_memory = 0,
+    .stack_size = 0,
+    .prefault = 0,
+    .timer_slack = 0,
+    .clock_source = NULL
+};
+
+// Current configuration, and a copy of its clock source
+static struct thread_config_t thread_config = {
+    .policy = RFS_THREAD_DEFAULT,
+    .clock_source = NULL
+};
+static char thread_clock_source[RFS_CLOCK_SOURCE_MAX_LEN];
+static pthread_mutex_t thread_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Whether the calling thread got its policy from the configuration
+static __thread int thread_configured = 0;
+
+/* Check a configuration of the threads.
+
+   Parameters:
+     * config: the configuration.
+
+   Return 0 if it is right, -1 otherwise (and errno is set to EINVAL).
+*/
+static int
+thread_check_config(const struct thread_config_t *config)
+{
+    pthread_attr_t attr;
+    size_t stack_size = config->stack_size;
+
+    // Without a size, the prefault must fit in the default stack
+    if (!stack_size) {
+        pthread_attr_init(&attr);
+        pthread_attr_getstacksize(&attr, &stack_size);
+        pthread_attr_destroy(&attr);
+    }
+    if (config->policy < RFS_THREAD_DEFAULT
+        || config->policy > RFS_THREAD_DEADLINE
+        || (config->policy == RFS_THREAD_FIFO
+            && (config->priority < sched_get_priority_min(SCHED_FIFO)
+                || config->priority > sched_get_priority_max(SCHED_FIFO)))
+        || (config->policy == RFS_THREAD_DEADLINE
+            && (config->runtime < THREAD_MIN_RUNTIME
+                || config->runtime > config->deadline
+                || config->deadline > config->period))
+        || (config->prefault
+            && config->prefault + THREAD_STACK_MARGIN > stack_size)
+        || (config->clock_source
+            && (!*config->clock_source
+                || strlen(config->clock_source) >= RFS_CLOCK_SOURCE_MAX_LEN)))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+/* Set the real time configuration of the threads owned by the library.
+
+   Parameters:
+     * config: the configuration.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_thread_set_config(const struct thread_config_t *config)
+{
+    char path[RFS_ROOT_MAX_LEN + sizeof(THREAD_CLOCK_SOURCE_FILE)];
+    int e;
+
+    if (thread_check_config(config)) {
+        return -1;
+    }
+    pthread_mutex_lock(&thread_lock);
+    // The memory is locked first, it is the only change that can be undone
+    if (config->lock_memory && !thread_config.lock_memory
+        && mlockall(MCL_CURRENT | MCL_FUTURE))
+    {
+        pthread_mutex_unlock(&thread_lock);
+        return -1;
+    }
+    if (config->clock_source
+        && (sysfs_path(path, sizeof(path), THREAD_CLOCK_SOURCE_FILE)
+            || write_sysfs_file(path, config->clock_source)))
+    {
+        e = errno;
+        if (config->lock_memory && !thread_config.lock_memory) {
+            munlockall();
+        }
+        pthread_mutex_unlock(&thread_lock);
+        errno = e;
+        return -1;
+    }
+    if (!config->lock_memory && thread_config.lock_memory) {
+        munlockall();
+    }
+    thread_config = *config;
+    if (config->clock_source) {
+        strcpy(thread_clock_source, config->clock_source);
+        thread_config.clock_source = thread_clock_source;
+    }
+    pthread_mutex_unlock(&thread_lock);
+    return 0;
+}
+
+/* Touch the first bytes of the stack of the calling thread, so they are
+   already mapped when used.
+
+   Parameters:
+     * size: number of bytes to touch.
+*/
+static void
+thread_prefault(unsigned long size)
+{
+    volatile char *stack;
+    unsigned long i, page;
+
+    // The pages stay mapped once the frame is gone
+    stack = alloca(size);
+    page = sysconf(_SC_PAGESIZE);
+    for (i = 0; i < size; i += page) {
+        stack[i] = 0;
+    }
+}
+
+/* Apply the configuration to the calling thread.
+
+   Parameters:
+     * config: the configuration.
+
+   Return 0 on success, or the error number.
+*/
+static int
+thread_apply(const struct thread_config_t *config)
+{
+    struct thread_sched_attr_t attr;
+    struct sched_param param;
+    int res;
+
+    if (config->timer_slack
+        && prctl(PR_SET_TIMERSLACK, config->timer_slack, 0, 0, 0))
+    {
+        return errno;
+    }
+    if (config->policy == RFS_THREAD_FIFO) {
+        param.sched_priority = config->priority;
+        if ((res = pthread_setschedparam(pthread_self(), SCHED_FIFO,
+            &param)))
+        {
+            return res;
+        }
+    } else if (config->policy == RFS_THREAD_DEADLINE) {
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.sched_policy = SCHED_DEADLINE;
+        attr.sched_runtime = config->runtime;
+        attr.sched_deadline = config->deadline;
+        attr.sched_period = config->period;
+        if (syscall(SYS_sched_setattr, 0, &attr, 0)) {
+            return errno;
+        }
+    }
+    thread_configured = config->policy != RFS_THREAD_DEFAULT;
+    if (config->prefault) {
+        thread_prefault(config->prefault);
+    }
+    return 0;
+}
+
+/* Apply the configuration to a thread just started and, if it was applied,
+   run its routine.
+
+   Parameters:
+     * arg: the thread being started.
+*/
+static void *
+thread_run(void *arg)
+{
+    struct thread_launch_t *launch = arg;
+    void *(*routine)(void *) = launch->routine;
+    void *routine_arg = launch->arg;
+    int error;
+
+    error = thread_apply(&launch->config);
+    // The launch is on the stack of the starting thread, it can't be used
+    // once it is done
+    pthread_mutex_lock(&launch->lock);
+    launch->error = error;
+    launch->done = 1;
+    pthread_cond_signal(&launch->cond);
+    pthread_mutex_unlock(&launch->lock);
+    if (error) {
+        return NULL;
+    }
+    return routine(routine_arg);
+}
+
+/* Start a thread owned by the library, with the current configuration.
+
+   Parameters:
+     * thread: where to store the thread identifier.
+     * routine: function run by the thread.
+     * arg: argument of the function.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+thread_start(pthread_t *thread, void *(*routine)(void *), void *arg)
+{
+    struct thread_launch_t launch;
+    pthread_attr_t attr;
+    cpu_set_t cpus;
+    int res = 0, i;
+
+    pthread_mutex_lock(&thread_lock);
+    launch.config = thread_config;
+    pthread_mutex_unlock(&thread_lock);
+    launch.routine = routine;
+    launch.arg = arg;
+    launch.done = 0;
+    launch.error = 0;
+    // The stack size and the CPUs are given at the creation
+    pthread_attr_init(&attr);
+    if (launch.config.stack_size) {
+        res = pthread_attr_setstacksize(&attr, launch.config.stack_size);
+    }
+    if (!res && launch.config.cpus) {
+        CPU_ZERO(&cpus);
+        for (i = 0; i < 64; i++) {
+            if (launch.config.cpus & (1ULL << i)) {
+                CPU_SET(i, &cpus);
+            }
+        }
+        res = pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    }
+    pthread_mutex_init(&launch.lock, NULL);
+    pthread_cond_init(&launch.cond, NULL);
+    if (!res && !(res = pthread_create(thread, &attr, thread_run, &launch))) {
+        pthread_mutex_lock(&launch.lock);
+        while (!launch.done) {
+            pthread_cond_wait(&launch.cond, &launch.lock);
+        }
+        pthread_mutex_unlock(&launch.lock);
+        // A thread that couldn't be configured has already ended
+        if ((res = launch.error)) {
+            pthread_join(*thread, NULL);
+        }
+    }
+    pthread_cond_destroy(&launch.cond);
+    pthread_mutex_destroy(&launch.lock);
+    pthread_attr_destroy(&attr);
+    if (res) {
+        errno = res;
+        return -1;
+    }
+    return 0;
+}
+
+/* Wait for a thread owned by the library to finish.
+
+   Parameters:
+     * thread: the thread identifier.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+thread_join(pthread_t thread)
+{
+    int res;
+
+    if ((res = pthread_join(thread, NULL))) {
+        errno = res;
+        return -1;
+    }
+    return 0;
+}
+
+/* Run the calling thread with the real time policy SCHED_FIFO, if allowed
+   and if no policy was given by the configuration.
+
+   Parameters:
+     * priority: the real time priority.
+*/
+void
+thread_set_realtime(int priority)
+{
+    struct sched_param param;
+
+    if (thread_configured) {
+        return;
+    }
+    param.sched_priority = priority;
+    pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+}
@@ -0,0 +1,66 @@
+/* thread.h
+   Helper functions to manage the threads owned by the library.
+   
+   Copyright 2018 Antonio Serrano Hernandez
+
+   This file is part of rfsgpio.
+
+   rfsgpio is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   rfsgpio is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with rfsgpio; see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef THREAD_H
+#define THREAD_H
+
+#include <pthread.h>    // pthread_t
+
+/* Start a thread owned by the library.
+
+   All the threads of the library are started with this function, that
+   applies them the configuration set with rfs_thread_set_config. The thread
+   is not started if it can't be applied.
+
+   Parameters:
+     * thread: where to store the thread identifier.
+     * routine: function run by the thread.
+     * arg: argument of the function.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+thread_start(pthread_t *thread, void *(*routine)(void *), void *arg);
+
+/* Wait for a thread owned by the library to finish.
+
+   Parameters:
+     * thread: the thread identifier.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+thread_join(pthread_t thread);
+
+/* Run the calling thread with the real time policy SCHED_FIFO, if the
+   process is allowed to (CAP_SYS_NICE or RLIMIT_RTPRIO). Otherwise the
+   default policy is kept. Nothing is done if the configuration set with
+   rfs_thread_set_config gives the policy.
+
+   Parameters:
+     * priority: the real time priority.
+*/
+void
+thread_set_realtime(int priority);
+
+#endif
+
@@ -0,0 +1,398 @@
+/* waveform.c
+   Functions to play sampled waveforms on banks of GPIO pins.
+   
+   Copyright 2018 Antonio Serrano Hernandez
+
+   This file is part of rfsgpio.
+
+   rfsgpio is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   rfsgpio is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with rfsgpio; see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+#include "rfsgpio.h"
+#include "thread.h"
+
+#include <errno.h>          // errno
+#include <sys/eventfd.h>    // eventfd
+#include <time.h>           // clock_nanosleep
+#include <unistd.h>         // read
+
+/* Return the current time, in nanoseconds (CLOCK_MONOTONIC). */
+static uint64_t
+waveform_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Return the deadline of a sample of the stream, split in whole seconds and
+   the rest so the product doesn't overflow in long streams.
+
+   Parameters:
+     * waveform: the player descriptor.
+     * sample: number of the sample since the start of the stream.
+*/
+static uint64_t
+waveform_deadline(const struct waveform_t *waveform, uint64_t sample)
+{
+    return waveform->start + sample / waveform->rate * 1000000000
+        + sample % waveform->rate * 1000000000 / waveform->rate;
+}
+
+/* Wait until the deadline of a sample: sleep until the spin time before it,
+   then busy-wait.
+
+   Parameters:
+     * waveform: the player descriptor.
+     * now: the current time.
+     * deadline: the deadline of the sample.
+*/
+static void
+waveform_sleep(const struct waveform_t *waveform, uint64_t now,
+    uint64_t deadline)
+{
+    struct timespec ts;
+    uint64_t wake;
+
+    if (deadline - now > waveform->spin) {
+        wake = deadline - waveform->spin;
+        ts.tv_sec = wake / 1000000000;
+        ts.tv_nsec = wake % 1000000000;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)
+            == EINTR);
+    }
+    while (waveform_now() < deadline);
+}
+
+/* Play a buffer from its next sample, until its end or until the player is
+   stopped.
+
+   Parameters:
+     * waveform: the player descriptor.
+     * buffer: index of the buffer.
+
+   Return 1 if the buffer was played to its end, 0 if the player was stopped
+   before.
+*/
+static int
+waveform_play(struct waveform_t *waveform, int buffer)
+{
+    const uint64_t *samples = waveform->buffers[buffer];
+    unsigned long n = waveform->lengths[buffer];
+    uint64_t now, deadline;
+
+    for (; waveform->position < n; waveform->position++) {
+        if (!__atomic_load_n(&waveform->running, __ATOMIC_ACQUIRE)) {
+            return 0;
+        }
+        now = waveform_now();
+        if (!waveform->samples) {
+            waveform->start = now;
+        }
+        deadline = waveform_deadline(waveform, waveform->samples);
+        if (now > deadline) {
+            __atomic_fetch_add(&waveform->late, 1, __ATOMIC_RELAXED);
+        } else {
+            waveform_sleep(waveform, now, deadline);
+        }
+        // A failed write loses its sample, but not the timing of the rest
+        if (rfs_gpio_bank_set(waveform->bank, waveform->mask,
+            samples[waveform->position]))
+        {
+            __atomic_fetch_add(&waveform->errors, 1, __ATOMIC_RELAXED);
+        }
+        waveform->samples++;
+    }
+    return 1;
+}
+
+/* Main function of the player thread.
+
+   Plays the buffers queued, and waits for the next one when it runs out of
+   samples.
+
+   Parameters:
+     * arg: the player descriptor.
+*/
+static void *
+waveform_run(void *arg)
+{
+    struct waveform_t *waveform = arg;
+    unsigned long played;
+    uint64_t one = 1, wakeups;
+
+    // Without the privileges to do it the default policy is kept, and the
+    // busy-wait absorbs the longer wakeup latency
+    thread_set_realtime(RFS_WAVEFORM_PRIORITY);
+    waveform->samples = 0;
+    while (__atomic_load_n(&waveform->running, __ATOMIC_ACQUIRE)) {
+        played = waveform->played;
+        if (played == __atomic_load_n(&waveform->queued, __ATOMIC_ACQUIRE)) {
+            // Out of samples: the next buffer starts a new stream
+            if (waveform->samples) {
+                __atomic_fetch_add(&waveform->underruns, 1,
+                    __ATOMIC_RELAXED);
+                waveform->samples = 0;
+            }
+            // Interrupted or not, the buffers are checked again
+            read(waveform->wakefd, &wakeups, sizeof(wakeups));
+            continue;
+        }
+        if (waveform_play(waveform, played & 1)) {
+            waveform->position = 0;
+            __atomic_store_n(&waveform->played, played + 1, __ATOMIC_RELEASE);
+            write(waveform->donefd, &one, sizeof(one));
+        }
+    }
+    return NULL;
+}
+
+/* Open a waveform player.
+
+   Parameters:
+     * waveform: the player descriptor.
+     * bank: the bank of GPIO pins, already opened.
+     * rate: samples per second.
+     * spin: busy-wait time before each sample, in nanoseconds.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_waveform_open(struct waveform_t *waveform, struct gpio_bank_t *bank,
+    unsigned long rate, uint64_t spin)
+{
+    if (!rate || !bank->n || bank->n > RFS_GPIO_BANK_MAX_PINS) {
+        errno = EINVAL;
+        return -1;
+    }
+    if ((waveform->wakefd = eventfd(0, EFD_CLOEXEC)) < 0) {
+        return -1;
+    }
+    waveform->donefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (waveform->donefd < 0) {
+        close(waveform->wakefd);
+        return -1;
+    }
+    waveform->bank = bank;
+    waveform->mask = (bank->n == 64) ? ~0ULL : (1ULL << bank->n) - 1;
+    waveform->rate = rate;
+    waveform->spin = spin;
+    waveform->position = 0;
+    waveform->start = 0;
+    waveform->samples = 0;
+    waveform->queued = 0;
+    waveform->played = 0;
+    waveform->late = 0;
+    waveform->underruns = 0;
+    waveform->errors = 0;
+    waveform->running = 0;
+    return 0;
+}
+
+/* Queue a buffer of samples to be played.
+
+   Parameters:
+     * waveform: the player descriptor.
+     * samples: the samples.
+     * n: number of samples.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_waveform_queue(struct waveform_t *waveform, const uint64_t *samples,
+    unsigned long n)
+{
+    unsigned long queued = waveform->queued;
+    uint64_t one = 1;
+
+    if (!n) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (queued - __atomic_load_n(&waveform->played, __ATOMIC_ACQUIRE) == 2) {
+        errno = EAGAIN;
+        return -1;
+    }
+    waveform->buffers[queued & 1] = samples;
+    waveform->lengths[queued & 1] = n;
+    __atomic_store_n(&waveform->queued, queued + 1, __ATOMIC_RELEASE);
+    // Wake up the player thread, in case it ran out of samples
+    if (write(waveform->wakefd, &one, sizeof(one)) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Wait until a buffer can be queued.
+
+   Parameters:
+     * waveform: the player descriptor.
+     * timeout: maximum time to wait, in milliseconds (-1 to wait forever).
+
+   Return 1 if a buffer can be queued, 0 if the timeout expired, or -1 in
+   case of error (and errno is set accordingly).
+*/
+int
+rfs_waveform_wait(struct waveform_t *waveform, int timeout)
+{
+    struct pollfd pd;
+    struct timespec ts;
+    int64_t deadline = 0;
+    uint64_t done;
+    int res;
+
+    pd.fd = waveform->donefd;
+    pd.events = POLLIN;
+    if (timeout > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        deadline = (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000 + timeout;
+    }
+    for (;;) {
+        if (waveform->queued
+            - __atomic_load_n(&waveform->played, __ATOMIC_ACQUIRE) < 2)
+        {
+            return 1;
+        }
+        do {
+            res = poll(&pd, 1, timeout);
+        } while (res < 0 && errno == EINTR);
+        if (res <= 0) {
+            return res;
+        }
+        // Clear the notification, the buffers are checked again
+        if (read(waveform->donefd, &done, sizeof(done)) < 0
+            && errno != EAGAIN)
+        {
+            return -1;
+        }
+        if (timeout > 0) {
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            timeout = deadline - ((int64_t)ts.tv_sec * 1000
+                + ts.tv_nsec / 1000000);
+            if (timeout < 0) {
+                timeout = 0;
+            }
+        }
+    }
+}
+
+/* Return the number of buffers completely played.
+
+   Parameters:
+     * waveform: the player descriptor.
+*/
+unsigned long
+rfs_waveform_played(struct waveform_t *waveform)
+{
+    return __atomic_load_n(&waveform->played, __ATOMIC_ACQUIRE);
+}
+
+/* Start the player thread.
+
+   Parameters:
+     * waveform: the player descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_waveform_start(struct waveform_t *waveform)
+{
+    if (waveform->running) {
+        errno = EBUSY;
+        return -1;
+    }
+    waveform->running = 1;
+    if (thread_start(&waveform->thread, waveform_run, waveform)) {
+        waveform->running = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/* Return the number of samples written after their deadline.
+
+   Parameters:
+     * waveform: the player descriptor.
+*/
+unsigned long
+rfs_waveform_late(struct waveform_t *waveform)
+{
+    return __atomic_load_n(&waveform->late, __ATOMIC_RELAXED);
+}
+
+/* Return the number of times the stream ran out of samples.
+
+   Parameters:
+     * waveform: the player descriptor.
+*/
+unsigned long
+rfs_waveform_underruns(struct waveform_t *waveform)
+{
+    return __atomic_load_n(&waveform->underruns, __ATOMIC_RELAXED);
+}
+
+/* Return the number of samples that couldn't be written.
+
+   Parameters:
+     * waveform: the player descriptor.
+*/
+unsigned long
+rfs_waveform_errors(struct waveform_t *waveform)
+{
+    return __atomic_load_n(&waveform->errors, __ATOMIC_RELAXED);
+}
+
+/* Stop the player thread.
+
+   Parameters:
+     * waveform: the player descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_waveform_stop(struct waveform_t *waveform)
+{
+    uint64_t one = 1;
+
+    if (!waveform->running) {
+        errno = EINVAL;
+        return -1;
+    }
+    __atomic_store_n(&waveform->running, 0, __ATOMIC_RELEASE);
+    if (write(waveform->wakefd, &one, sizeof(one)) < 0
+        || thread_join(waveform->thread))
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/* Close a waveform player.
+
+   Parameters:
+     * waveform: the player descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_waveform_close(struct waveform_t *waveform)
+{
+    if (waveform->running && rfs_waveform_stop(waveform)) {
+        return -1;
+    }
+    close(waveform->donefd);
+    return close(waveform->wakefd);
+}
@@ -0,0 +1,555 @@
+/* wheel.c
+   Functions to write GPIO outputs at given times, with a timer wheel.
+   
+   Copyright 2018 Antonio Serrano Hernandez
+
+   This file is part of rfsgpio.
+
+   rfsgpio is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   rfsgpio is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with rfsgpio; see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+#include "rfsgpio.h"
+#include "probes.h"
+#include "thread.h"
+
+#include <errno.h>          // errno
+#include <stdlib.h>         // malloc
+#include <sys/timerfd.h>    // timerfd_create
+#include <time.h>           // clock_gettime
+#include <unistd.h>         // read
+
+// Each public function rfs_gpio_X wraps the static function gpio_X, traced by
+// the probes gpio_X_entry and gpio_X_return.
+
+// Bits of the tick given by each level (log2 of RFS_WHEEL_SLOTS)
+#define WHEEL_BITS  6
+#define WHEEL_MASK  (RFS_WHEEL_SLOTS - 1)
+
+// Ticks covered by the wheel. Later changes wait in the last level, and go
+// down when they get in range
+#define WHEEL_RANGE (1ULL << (WHEEL_BITS * RFS_WHEEL_LEVELS))
+
+/* Return the current time, in nanoseconds (CLOCK_MONOTONIC). */
+static uint64_t
+wheel_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Rotate a bitmap of slots right, so the slot n becomes the bit 0. */
+static uint64_t
+wheel_rotate(uint64_t bits, unsigned int n)
+{
+    n &= WHEEL_MASK;
+    return n ? (bits >> n) | (bits << (64 - n)) : bits;
+}
+
+/* Insert a change in the wheel.
+
+   The level is the lowest one whose turn covers the ticks until the change,
+   and the slot is given by the bits of its tick for that level. A change
+   already due goes to the slot of the current tick.
+
+   Called with the lock of the scheduler held.
+*/
+static void
+wheel_insert(struct gpio_scheduler_t *scheduler, struct gpio_timer_t *timer)
+{
+    uint64_t tick = timer->tick, delta;
+    unsigned int level = 0, slot;
+
+    if (tick < scheduler->current) {
+        tick = scheduler->current;
+    }
+    delta = tick - scheduler->current;
+    if (delta >= WHEEL_RANGE) {
+        delta = WHEEL_RANGE - 1;
+        tick = scheduler->current + delta;
+    }
+    while (delta >> (WHEEL_BITS * (level + 1))) {
+        level++;
+    }
+    slot = (tick >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    timer->next = NULL;
+    if (scheduler->slots[level][slot]) {
+        scheduler->tails[level][slot]->next = timer;
+    } else {
+        scheduler->slots[level][slot] = timer;
+    }
+    scheduler->tails[level][slot] = timer;
+    scheduler->occupied[level] |= 1ULL << slot;
+}
+
+/* Return the next tick with changes to write or to move down a level
+   (UINT64_MAX if the wheel is empty).
+
+   For each level, it's the first occupied slot from the current one. The
+   slot of the current tick in a higher level was already moved down, unless
+   the current tick starts its turn.
+
+   Called with the lock of the scheduler held.
+*/
+static uint64_t
+wheel_next(const struct gpio_scheduler_t *scheduler)
+{
+    uint64_t next = UINT64_MAX, t, index;
+    unsigned int level, shift, first;
+
+    for (level = 0; level < RFS_WHEEL_LEVELS; level++) {
+        if (!scheduler->occupied[level]) {
+            continue;
+        }
+        shift = WHEEL_BITS * level;
+        index = scheduler->current >> shift;
+        first = (scheduler->current & ((1ULL << shift) - 1)) ? 1 : 0;
+        t = (index + first + __builtin_ctzll(wheel_rotate(
+            scheduler->occupied[level], index + first))) << shift;
+        if (t < next) {
+            next = t;
+        }
+    }
+    return next;
+}
+
+/* Move the changes of a slot to the lower levels.
+
+   Called with the lock of the scheduler held.
+*/
+static void
+wheel_cascade(struct gpio_scheduler_t *scheduler, unsigned int level,
+    unsigned int slot)
+{
+    struct gpio_timer_t *timer, *next;
+
+    timer = scheduler->slots[level][slot];
+    scheduler->slots[level][slot] = NULL;
+    scheduler->occupied[level] &= ~(1ULL << slot);
+    for (; timer; timer = next) {
+        next = timer->next;
+        wheel_insert(scheduler, timer);
+    }
+}
+
+/* Process the current tick: move down the changes of the turns of the higher
+   levels that start in it, and take the changes due.
+
+   Called with the lock of the scheduler held.
+
+   Return the list of changes due in the tick.
+*/
+static struct gpio_timer_t *
+wheel_expire(struct gpio_scheduler_t *scheduler)
+{
+    uint64_t t = scheduler->current;
+    struct gpio_timer_t *expired;
+    unsigned int level, slot;
+
+    for (level = 1; level < RFS_WHEEL_LEVELS
+        && !(t & ((1ULL << (WHEEL_BITS * level)) - 1)); level++)
+    {
+        wheel_cascade(scheduler, level,
+            (t >> (WHEEL_BITS * level)) & WHEEL_MASK);
+    }
+    slot = t & WHEEL_MASK;
+    expired = scheduler->slots[0][slot];
+    scheduler->slots[0][slot] = NULL;
+    scheduler->occupied[0] &= ~(1ULL << slot);
+    scheduler->current = t + 1;
+    return expired;
+}
+
+/* Arm the timer of a scheduler to expire at the start of a tick, or disarm
+   it.
+
+   Called with the lock of the scheduler held.
+
+   Parameters:
+     * scheduler: the scheduler descriptor.
+     * tick: the tick, or UINT64_MAX to disarm the timer.
+*/
+static void
+scheduler_arm(struct gpio_scheduler_t *scheduler, uint64_t tick)
+{
+    struct itimerspec its = {{0, 0}, {0, 0}};
+    uint64_t time;
+
+    if (tick != UINT64_MAX) {
+        time = scheduler->origin + tick * scheduler->tick;
+        its.it_value.tv_sec = time / 1000000000;
+        its.it_value.tv_nsec = time % 1000000000;
+    }
+    timerfd_settime(scheduler->timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+    scheduler->armed = tick;
+}
+
+/* Write the changes due in a tick.
+
+   The changes of pins of the same bank are merged in a single bank write,
+   where the last change of each pin wins. The changes that couldn't be
+   written are counted, all those of a bank if its write fails. Then the
+   callback is called for each change, with the time since it was due.
+
+   Parameters:
+     * scheduler: the scheduler descriptor.
+     * expired: the list of changes.
+*/
+static void
+scheduler_write(struct gpio_scheduler_t *scheduler,
+    struct gpio_timer_t *expired)
+{
+    struct gpio_bank_t *banks[RFS_SCHEDULER_BANKS], *bank;
+    uint64_t masks[RFS_SCHEDULER_BANKS], bits[RFS_SCHEDULER_BANKS];
+    unsigned long changes[RFS_SCHEDULER_BANKS], errors = 0;
+    uint64_t bit, now, lateness;
+    struct gpio_timer_t *timer;
+    unsigned int n = 0, i;
+
+    for (timer = expired; timer; timer = timer->next) {
+        bank = timer->gpio->bank;
+        for (i = 0; i < n && banks[i] != bank; i++);
+        if (bank && i == n && n < RFS_SCHEDULER_BANKS) {
+            banks[n] = bank;
+            masks[n] = bits[n] = 0;
+            changes[n] = 0;
+            n++;
+        }
+        // Pins out of a bank, or of too many banks, are written one by one
+        if (!bank || i == n) {
+            if (rfs_gpio_set_value(timer->gpio, timer->value)) {
+                errors++;
+            }
+            continue;
+        }
+        bit = 1ULL << (timer->gpio - bank->gpios);
+        masks[i] |= bit;
+        changes[i]++;
+        if (timer->value == RFS_GPIO_HIGH) {
+            bits[i] |= bit;
+        } else {
+            bits[i] &= ~bit;
+        }
+    }
+    for (i = 0; i < n; i++) {
+        if (rfs_gpio_bank_set(banks[i], masks[i], bits[i])) {
+            errors += changes[i];
+        }
+    }
+    if (errors) {
+        __atomic_add_fetch(&scheduler->errors, errors, __ATOMIC_RELAXED);
+    }
+    now = wheel_now();
+    for (timer = expired; timer; timer = timer->next) {
+        lateness = (now > timer->time) ? now - timer->time : 0;
+        if (lateness > scheduler->max_lateness) {
+            __atomic_store_n(&scheduler->max_lateness, lateness,
+                __ATOMIC_RELAXED);
+        }
+        if (scheduler->callback) {
+            scheduler->callback(timer->gpio, timer->value, timer->time,
+                lateness, scheduler->callback_data);
+        }
+    }
+}
+
+/* Main function of the scheduler thread.
+
+   Processes the ticks with changes up to the current time, without the lock
+   while writing, and sleeps until the next one.
+
+   Parameters:
+     * arg: the scheduler descriptor.
+*/
+static void *
+scheduler_run(void *arg)
+{
+    struct gpio_scheduler_t *scheduler = arg;
+    struct gpio_timer_t *expired, *last;
+    uint64_t now, next, expirations;
+    unsigned long n;
+
+    thread_set_realtime(RFS_SCHEDULER_PRIORITY);
+    pthread_mutex_lock(&scheduler->lock);
+    while (scheduler->running) {
+        now = (wheel_now() - scheduler->origin) / scheduler->tick;
+        while ((next = wheel_next(scheduler)) <= now) {
+            // The ticks in between have nothing to do
+            scheduler->current = next;
+            if (!(expired = wheel_expire(scheduler))) {
+                continue;
+            }
+            pthread_mutex_unlock(&scheduler->lock);
+            scheduler_write(scheduler, expired);
+            pthread_mutex_lock(&scheduler->lock);
+            for (last = expired, n = 1; last->next; last = last->next, n++);
+            last->next = scheduler->free;
+            scheduler->free = expired;
+            scheduler->pending -= n;
+        }
+        if (scheduler->current <= now) {
+            scheduler->current = now + 1;
+        }
+        scheduler_arm(scheduler, next);
+        pthread_mutex_unlock(&scheduler->lock);
+        // Interrupted or not, the wheel is checked again
+        read(scheduler->timerfd, &expirations, sizeof(expirations));
+        pthread_mutex_lock(&scheduler->lock);
+    }
+    pthread_mutex_unlock(&scheduler->lock);
+    return NULL;
+}
+
+/* Open an output scheduler.
+
+   Parameters:
+     * scheduler: the scheduler descriptor.
+     * tick: length of a tick, in nanoseconds.
+     * size: maximum number of changes pending.
+     * callback: function called for each change written, or NULL.
+     * data: data passed to the callback.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+static int
+gpio_scheduler_open(struct gpio_scheduler_t *scheduler, uint64_t tick,
+    unsigned long size, gpio_schedule_callback_t callback, void *data)
+{
+    unsigned int level, slot;
+    unsigned long i;
+    int e;
+
+    if (!tick || !size) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (!(scheduler->timers = malloc(size * sizeof(struct gpio_timer_t)))) {
+        return -1;
+    }
+    scheduler->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (scheduler->timerfd < 0) {
+        e = errno;
+        free(scheduler->timers);
+        errno = e;
+        return -1;
+    }
+    for (i = 0; i < size - 1; i++) {
+        scheduler->timers[i].next = &scheduler->timers[i + 1];
+    }
+    scheduler->timers[size - 1].next = NULL;
+    scheduler->free = scheduler->timers;
+    for (level = 0; level < RFS_WHEEL_LEVELS; level++) {
+        for (slot = 0; slot < RFS_WHEEL_SLOTS; slot++) {
+            scheduler->slots[level][slot] = NULL;
+        }
+        scheduler->occupied[level] = 0;
+    }
+    pthread_mutex_init(&scheduler->lock, NULL);
+    scheduler->origin = wheel_now();
+    scheduler->tick = tick;
+    scheduler->current = 0;
+    scheduler->armed = UINT64_MAX;
+    scheduler->pending = 0;
+    scheduler->callback = callback;
+    scheduler->callback_data = data;
+    scheduler->max_lateness = 0;
+    scheduler->errors = 0;
+    scheduler->running = 1;
+    if (thread_start(&scheduler->thread, scheduler_run, scheduler)) {
+        e = errno;
+        pthread_mutex_destroy(&scheduler->lock);
+        close(scheduler->timerfd);
+        free(scheduler->timers);
+        errno = e;
+        return -1;
+    }
+    return 0;
+}
+
+int
+rfs_gpio_scheduler_open(struct gpio_scheduler_t *scheduler, uint64_t tick,
+    unsigned long size, gpio_schedule_callback_t callback, void *data)
+{
+    int res;
+
+    PROBE3(gpio_scheduler_open_entry, scheduler, tick, size);
+    res = gpio_scheduler_open(scheduler, tick, size, callback, data);
+    PROBE2(gpio_scheduler_open_return, scheduler, res);
+    return res;
+}
+
+/* Schedule a change of an output.
+
+   Parameters:
+     * scheduler: the scheduler descriptor.
+     * gpio: the GPIO pin.
+     * value: the value to write.
+     * time: when to write it, in nanoseconds (CLOCK_MONOTONIC).
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+static int
+gpio_schedule(struct gpio_scheduler_t *scheduler, struct gpio_t *gpio,
+    enum gpio_value_t value, uint64_t time)
+{
+    struct gpio_timer_t *timer;
+    uint64_t next;
+
+    if (value != RFS_GPIO_LOW && value != RFS_GPIO_HIGH) {
+        errno = EINVAL;
+        return -1;
+    }
+    pthread_mutex_lock(&scheduler->lock);
+    if (!(timer = scheduler->free)) {
+        pthread_mutex_unlock(&scheduler->lock);
+        errno = EAGAIN;
+        return -1;
+    }
+    scheduler->free = timer->next;
+    timer->gpio = gpio;
+    timer->value = value;
+    timer->time = time;
+    // The first tick that doesn't start before the time, so the change is
+    // never written early
+    timer->tick = (time <= scheduler->origin) ? 0 : (time - scheduler->origin
+        + scheduler->tick - 1) / scheduler->tick;
+    wheel_insert(scheduler, timer);
+    scheduler->pending++;
+    if ((next = wheel_next(scheduler)) < scheduler->armed) {
+        scheduler_arm(scheduler, next);
+    }
+    pthread_mutex_unlock(&scheduler->lock);
+    return 0;
+}
+
+int
+rfs_gpio_schedule(struct gpio_scheduler_t *scheduler, struct gpio_t *gpio,
+    enum gpio_value_t value, uint64_t time)
+{
+    int res;
+
+    PROBE3(gpio_schedule_entry, gpio->pin, value, time);
+    res = gpio_schedule(scheduler, gpio, value, time);
+    PROBE4(gpio_schedule_return, gpio->pin, value, time, res);
+    return res;
+}
+
+/* Return the number of changes pending.
+
+   Parameters:
+     * scheduler: the scheduler descriptor.
+*/
+static unsigned long
+gpio_scheduler_pending(struct gpio_scheduler_t *scheduler)
+{
+    unsigned long pending;
+
+    pthread_mutex_lock(&scheduler->lock);
+    pending = scheduler->pending;
+    pthread_mutex_unlock(&scheduler->lock);
+    return pending;
+}
+
+unsigned long
+rfs_gpio_scheduler_pending(struct gpio_scheduler_t *scheduler)
+{
+    unsigned long res;
+
+    PROBE1(gpio_scheduler_pending_entry, scheduler);
+    res = gpio_scheduler_pending(scheduler);
+    PROBE2(gpio_scheduler_pending_return, scheduler, res);
+    return res;
+}
+
+/* Return the highest lateness of a change written.
+
+   Parameters:
+     * scheduler: the scheduler descriptor.
+*/
+static uint64_t
+gpio_scheduler_max_lateness(struct gpio_scheduler_t *scheduler)
+{
+    return __atomic_load_n(&scheduler->max_lateness, __ATOMIC_RELAXED);
+}
+
+uint64_t
+rfs_gpio_scheduler_max_lateness(struct gpio_scheduler_t *scheduler)
+{
+    uint64_t res;
+
+    PROBE1(gpio_scheduler_max_lateness_entry, scheduler);
+    res = gpio_scheduler_max_lateness(scheduler);
+    PROBE2(gpio_scheduler_max_lateness_return, scheduler, res);
+    return res;
+}
+
+/* Return the number of changes that couldn't be written.
+
+   Parameters:
+     * scheduler: the scheduler descriptor.
+*/
+static unsigned long
+gpio_scheduler_errors(struct gpio_scheduler_t *scheduler)
+{
+    return __atomic_load_n(&scheduler->errors, __ATOMIC_RELAXED);
+}
+
+unsigned long
+rfs_gpio_scheduler_errors(struct gpio_scheduler_t *scheduler)
+{
+    unsigned long res;
+
+    PROBE1(gpio_scheduler_errors_entry, scheduler);
+    res = gpio_scheduler_errors(scheduler);
+    PROBE2(gpio_scheduler_errors_return, scheduler, res);
+    return res;
+}
+
+/* Close an output scheduler.
+
+   Parameters:
+     * scheduler: the scheduler descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+static int
+gpio_scheduler_close(struct gpio_scheduler_t *scheduler)
+{
+    struct itimerspec its = {{0, 0}, {0, 1}};
+
+    // Make the timer expire right now to wake up the thread
+    pthread_mutex_lock(&scheduler->lock);
+    scheduler->running = 0;
+    timerfd_settime(scheduler->timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+    pthread_mutex_unlock(&scheduler->lock);
+    if (thread_join(scheduler->thread)) {
+        return -1;
+    }
+    pthread_mutex_destroy(&scheduler->lock);
+    free(scheduler->timers);
+    return close(scheduler->timerfd);
+}
+
+int
+rfs_gpio_scheduler_close(struct gpio_scheduler_t *scheduler)
+{
+    int res;
+
+    PROBE1(gpio_scheduler_close_entry, scheduler);
+    res = gpio_scheduler_close(scheduler);
+    PROBE2(gpio_scheduler_close_return, scheduler, res);
+    return res;
+}
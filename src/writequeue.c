@@ -0,0 +1,413 @@
+/* writequeue.c
+   Functions to write pins and channels from a thread of the library.
+   
+   Copyright 2018 Antonio Serrano Hernandez
+
+   This file is part of rfsgpio.
+
+   rfsgpio is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   rfsgpio is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with rfsgpio; see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+#include "rfsgpio.h"
+#include "thread.h"
+#include "writequeue.h"
+
+#include <errno.h>          // errno
+#include <stdlib.h>         // malloc
+#include <sys/eventfd.h>    // eventfd
+#include <time.h>           // clock_gettime
+#include <unistd.h>         // read
+
+// The queue of the writer thread running, in that thread (NULL in the rest)
+static __thread struct write_queue_t *write_queue_self = NULL;
+
+/* Return whether a write must be pushed to a write queue.
+
+   Parameters:
+     * queue: the queue the handle is attached to, or NULL.
+*/
+int
+write_queue_deferred(struct write_queue_t *queue)
+{
+    return queue && queue != write_queue_self;
+}
+
+/* Detach a pin or channel from its write queue, and wait for its writes.
+
+   Parameters:
+     * queue: the field with the queue the handle is attached to, set to
+         NULL.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+write_queue_detach(struct write_queue_t **queue)
+{
+    struct write_queue_t *q = *queue;
+
+    *queue = NULL;
+    // The writer thread itself can't wait for its own writes
+    if (!write_queue_deferred(q)) {
+        return 0;
+    }
+    return (rfs_write_queue_fence(q, -1) < 0) ? -1 : 0;
+}
+
+/* Pop the next write of a write queue.
+
+   Called by the writer thread, the only consumer. A position taken by a
+   producer that is still writing its command looks empty.
+
+   Parameters:
+     * queue: the queue descriptor.
+     * command: where to store the write.
+
+   Return 1 if a write was popped, 0 if the queue is empty.
+*/
+static int
+write_queue_pop(struct write_queue_t *queue, struct write_command_t *command)
+{
+    struct write_cell_t *cell;
+    unsigned long pos = queue->dequeue;
+
+    cell = &queue->cells[pos & (queue->size - 1)];
+    if (__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) != pos + 1) {
+        return 0;
+    }
+    *command = cell->command;
+    // The cell is free again for the producer of the next turn
+    __atomic_store_n(&cell->sequence, pos + queue->size, __ATOMIC_RELEASE);
+    queue->dequeue = pos + 1;
+    return 1;
+}
+
+/* Do a write with the setter of its attribute.
+
+   The writer thread is the only one that calls the setters of the attached
+   handles, so they write right away instead of pushing the write again.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+static int
+write_queue_apply(const struct write_command_t *command)
+{
+    switch (command->attribute) {
+    case RFS_WRITE_GPIO_VALUE:
+        return rfs_gpio_set_value(command->handle, command->value);
+    case RFS_WRITE_GPIO_DIRECTION:
+        return rfs_gpio_set_direction(command->handle, command->value);
+    case RFS_WRITE_PWM_PERIOD:
+        return rfs_pwm_set_period(command->handle, command->value);
+    case RFS_WRITE_PWM_DUTY_CYCLE:
+        return rfs_pwm_set_duty_cycle(command->handle, command->value);
+    case RFS_WRITE_PWM_ENABLED:
+        return rfs_pwm_set_enabled(command->handle, command->value);
+    }
+    errno = EINVAL;
+    return -1;
+}
+
+/* Do a batch of writes.
+
+   A write followed in the batch by another one of the same attribute of the
+   same handle is merged with it: only the last value is written, in the
+   place of the last write, so the order of the writes of different
+   attributes is kept.
+
+   Parameters:
+     * queue: the queue descriptor.
+     * batch: the writes.
+     * n: number of writes.
+*/
+static void
+write_queue_batch(struct write_queue_t *queue,
+    const struct write_command_t *batch, int n)
+{
+    int i, j, error;
+
+    for (i = 0; i < n; i++) {
+        for (j = i + 1; j < n && (batch[j].handle != batch[i].handle
+            || batch[j].attribute != batch[i].attribute); j++);
+        if (j < n) {
+            __atomic_fetch_add(&queue->merged, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        error = write_queue_apply(&batch[i]) ? errno : 0;
+        if (error) {
+            __atomic_fetch_add(&queue->errors, 1, __ATOMIC_RELAXED);
+        }
+        if (queue->callback) {
+            queue->callback(&batch[i], error, queue->callback_data);
+        }
+    }
+    // Wake up the threads waiting for these writes
+    __atomic_fetch_add(&queue->completed, n, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&queue->waiters, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&queue->lock);
+        pthread_cond_broadcast(&queue->done);
+        pthread_mutex_unlock(&queue->lock);
+    }
+}
+
+/* Main function of the writer thread.
+
+   Does the writes in batches, and sleeps when the queue is empty. Once
+   stopped, it still does the writes pending.
+
+   Parameters:
+     * arg: the queue descriptor.
+*/
+static void *
+write_queue_run(void *arg)
+{
+    struct write_queue_t *queue = arg;
+    struct write_command_t batch[RFS_WRITE_QUEUE_BATCH];
+    struct write_cell_t *cell;
+    uint64_t wakeups;
+    int n;
+
+    write_queue_self = queue;
+    for (;;) {
+        for (n = 0; n < RFS_WRITE_QUEUE_BATCH
+            && write_queue_pop(queue, &batch[n]); n++);
+        if (n) {
+            write_queue_batch(queue, batch, n);
+            continue;
+        }
+        if (!__atomic_load_n(&queue->running, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        // Tell the producers to wake up the thread, and check again for a
+        // write pushed before they could see it
+        __atomic_store_n(&queue->sleeping, 1, __ATOMIC_SEQ_CST);
+        cell = &queue->cells[queue->dequeue & (queue->size - 1)];
+        if (__atomic_load_n(&cell->sequence, __ATOMIC_SEQ_CST)
+            == queue->dequeue + 1)
+        {
+            __atomic_store_n(&queue->sleeping, 0, __ATOMIC_SEQ_CST);
+            continue;
+        }
+        // Interrupted or not, the queue is checked again
+        read(queue->wakefd, &wakeups, sizeof(wakeups));
+    }
+    return NULL;
+}
+
+/* Open a write queue, and start its writer thread.
+
+   Parameters:
+     * queue: the queue descriptor.
+     * size: maximum number of writes pending, rounded up to a power of 2.
+     * callback: function called for each write done, or NULL.
+     * data: data passed to the callback.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_write_queue_open(struct write_queue_t *queue, unsigned long size,
+    write_callback_t callback, void *data)
+{
+    pthread_condattr_t attr;
+    unsigned long i;
+    int e;
+
+    if (!size) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (queue->size = 1; queue->size < size; queue->size <<= 1);
+    queue->cells = malloc(queue->size * sizeof(struct write_cell_t));
+    if (!queue->cells) {
+        return -1;
+    }
+    if ((queue->wakefd = eventfd(0, EFD_CLOEXEC)) < 0) {
+        e = errno;
+        free(queue->cells);
+        errno = e;
+        return -1;
+    }
+    for (i = 0; i < queue->size; i++) {
+        queue->cells[i].sequence = i;
+    }
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&queue->done, &attr);
+    pthread_condattr_destroy(&attr);
+    queue->sleeping = 0;
+    queue->callback = callback;
+    queue->callback_data = data;
+    queue->waiters = 0;
+    queue->enqueue = 0;
+    queue->dequeue = 0;
+    queue->completed = 0;
+    queue->merged = 0;
+    queue->errors = 0;
+    queue->running = 1;
+    if (thread_start(&queue->thread, write_queue_run, queue)) {
+        e = errno;
+        pthread_cond_destroy(&queue->done);
+        pthread_mutex_destroy(&queue->lock);
+        close(queue->wakefd);
+        free(queue->cells);
+        errno = e;
+        return -1;
+    }
+    return 0;
+}
+
+/* Push a write to a write queue.
+
+   Parameters:
+     * queue: the queue descriptor.
+     * handle: the pin or channel.
+     * attribute: the attribute to write.
+     * value: the value to write.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_write_queue_push(struct write_queue_t *queue, void *handle,
+    enum write_attribute_t attribute, long value)
+{
+    struct write_cell_t *cell;
+    unsigned long pos, sequence;
+    uint64_t one = 1;
+
+    pos = __atomic_load_n(&queue->enqueue, __ATOMIC_RELAXED);
+    for (;;) {
+        cell = &queue->cells[pos & (queue->size - 1)];
+        sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        if (sequence == pos) {
+            // The cell is free, take its position (or retry from the
+            // position taken by another producer)
+            if (__atomic_compare_exchange_n(&queue->enqueue, &pos, pos + 1,
+                1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                break;
+            }
+        } else if ((long)(sequence - pos) < 0) {
+            // The writer thread hasn't popped the write of the last turn
+            errno = EAGAIN;
+            return -1;
+        } else {
+            pos = __atomic_load_n(&queue->enqueue, __ATOMIC_RELAXED);
+        }
+    }
+    cell->command.handle = handle;
+    cell->command.attribute = attribute;
+    cell->command.value = value;
+    __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&queue->sleeping, __ATOMIC_SEQ_CST)
+        && __atomic_exchange_n(&queue->sleeping, 0, __ATOMIC_SEQ_CST)
+        && write(queue->wakefd, &one, sizeof(one)) < 0)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/* Wait until the writes pushed before are done.
+
+   Parameters:
+     * queue: the queue descriptor.
+     * timeout: maximum time to wait, in milliseconds (-1 to wait forever).
+
+   Return 1 if the writes were done, 0 if the timeout expired, or -1 in case
+   of error (and errno is set accordingly).
+*/
+int
+rfs_write_queue_fence(struct write_queue_t *queue, int timeout)
+{
+    unsigned long target;
+    struct timespec ts;
+    int res = 0;
+
+    target = __atomic_load_n(&queue->enqueue, __ATOMIC_SEQ_CST);
+    if (timeout > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        ts.tv_sec += timeout / 1000;
+        ts.tv_nsec += (long)(timeout % 1000) * 1000000;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+    }
+    pthread_mutex_lock(&queue->lock);
+    __atomic_fetch_add(&queue->waiters, 1, __ATOMIC_SEQ_CST);
+    while ((long)(__atomic_load_n(&queue->completed, __ATOMIC_SEQ_CST)
+        - target) < 0 && !res && timeout)
+    {
+        if (timeout < 0) {
+            res = pthread_cond_wait(&queue->done, &queue->lock);
+        } else {
+            res = pthread_cond_timedwait(&queue->done, &queue->lock, &ts);
+        }
+    }
+    __atomic_fetch_sub(&queue->waiters, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&queue->lock);
+    if (res && res != ETIMEDOUT) {
+        errno = res;
+        return -1;
+    }
+    return (long)(__atomic_load_n(&queue->completed, __ATOMIC_ACQUIRE)
+        - target) >= 0;
+}
+
+/* Return the number of writes merged with a later one.
+
+   Parameters:
+     * queue: the queue descriptor.
+*/
+unsigned long
+rfs_write_queue_merged(struct write_queue_t *queue)
+{
+    return __atomic_load_n(&queue->merged, __ATOMIC_RELAXED);
+}
+
+/* Return the number of writes failed.
+
+   Parameters:
+     * queue: the queue descriptor.
+*/
+unsigned long
+rfs_write_queue_errors(struct write_queue_t *queue)
+{
+    return __atomic_load_n(&queue->errors, __ATOMIC_RELAXED);
+}
+
+/* Close a write queue.
+
+   Parameters:
+     * queue: the queue descriptor.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+rfs_write_queue_close(struct write_queue_t *queue)
+{
+    uint64_t one = 1;
+
+    __atomic_store_n(&queue->running, 0, __ATOMIC_SEQ_CST);
+    if (write(queue->wakefd, &one, sizeof(one)) < 0
+        || thread_join(queue->thread))
+    {
+        return -1;
+    }
+    pthread_cond_destroy(&queue->done);
+    pthread_mutex_destroy(&queue->lock);
+    free(queue->cells);
+    return close(queue->wakefd);
+}
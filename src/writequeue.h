@@ -0,0 +1,51 @@
+/* writequeue.h
+   Internal functions of the write queues.
+   
+   Copyright 2018 Antonio Serrano Hernandez
+
+   This file is part of rfsgpio.
+
+   rfsgpio is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   rfsgpio is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with rfsgpio; see the file COPYING.  If not, see
+   <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef WRITEQUEUE_H
+#define WRITEQUEUE_H
+
+#include "rfsgpio.h"
+
+/* Return whether a write must be pushed to a write queue: the handle is
+   attached to one, and the caller isn't its writer thread (that does the
+   writes right away).
+
+   Parameters:
+     * queue: the queue the handle is attached to, or NULL.
+*/
+int
+write_queue_deferred(struct write_queue_t *queue);
+
+/* Detach a pin or channel from its write queue, if any, and wait until the
+   writes pushed to the queue are done, so none is left for the handle when it
+   is closed.
+
+   Parameters:
+     * queue: the field with the queue the handle is attached to, set to
+         NULL.
+
+   Return 0 on success, -1 otherwise (and errno is set accordingly).
+*/
+int
+write_queue_detach(struct write_queue_t **queue);
+
+#endif
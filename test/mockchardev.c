@@ -0,0 +1,166 @@
+
+#include "mockchardev.h"
+
+#include <err.h>        // err
+#include <errno.h>      // errno
+#include <stdarg.h>     // va_list
+#include <string.h>     // memset
+#include <unistd.h>     // pipe
+
+#define EDGE_FLAGS \
+    (GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_EDGE_FALLING)
+
+struct mock_request_t mock_requests[MOCK_MAX_REQUESTS];
+unsigned long mock_ioctls = 0;
+uint64_t mock_writes[MOCK_MAX_WRITES];
+unsigned long mock_nwrites = 0;
+int mock_no_debounce = 0;
+
+struct mock_request_t *
+mock_request(int fd)
+{
+    int i;
+
+    for (i = 0; i < MOCK_MAX_REQUESTS; i++) {
+        if (mock_requests[i].n && mock_requests[i].fd == fd) {
+            return &mock_requests[i];
+        }
+    }
+    return NULL;
+}
+
+void
+mock_event(struct mock_request_t *req, unsigned int offset, uint32_t id,
+    uint64_t timestamp)
+{
+    struct gpio_v2_line_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.id = id;
+    ev.offset = offset;
+    ev.timestamp_ns = timestamp;
+    if (write(req->event_fd, &ev, sizeof(ev)) != sizeof(ev)) {
+        err(1, "injecting event");
+    }
+}
+
+// Apply a line configuration as the kernel does: the outputs not given in
+// the output values attribute are set low
+static int
+mock_config(struct mock_request_t *req, struct gpio_v2_line_config *config)
+{
+    uint64_t flags[GPIO_V2_LINES_MAX];
+    uint32_t debounce[GPIO_V2_LINES_MAX];
+    uint64_t bits = 0;
+    unsigned int i, j;
+
+    for (i = 0; i < req->n; i++) {
+        flags[i] = config->flags;
+        debounce[i] = 0;
+        for (j = 0; j < config->num_attrs; j++) {
+            if (config->attrs[j].attr.id == GPIO_V2_LINE_ATTR_ID_FLAGS
+                && config->attrs[j].mask & (1ULL << i))
+            {
+                flags[i] = config->attrs[j].attr.flags;
+            }
+            if (config->attrs[j].attr.id == GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES
+                && config->attrs[j].mask & (1ULL << i))
+            {
+                bits |= config->attrs[j].attr.values & (1ULL << i);
+            }
+            if (config->attrs[j].attr.id == GPIO_V2_LINE_ATTR_ID_DEBOUNCE
+                && config->attrs[j].mask & (1ULL << i))
+            {
+                if (mock_no_debounce) {
+                    errno = EINVAL;
+                    return -1;
+                }
+                debounce[i] = config->attrs[j].attr.debounce_period_us;
+            }
+        }
+        if (flags[i] & GPIO_V2_LINE_FLAG_OUTPUT && flags[i] & EDGE_FLAGS) {
+            errno = EINVAL;
+            return -1;
+        }
+        if (!(flags[i] & GPIO_V2_LINE_FLAG_OUTPUT)) {
+            bits |= req->bits & (1ULL << i);
+        }
+    }
+    memcpy(req->flags, flags, sizeof(flags));
+    memcpy(req->debounce, debounce, sizeof(debounce));
+    req->bits = bits;
+    return 0;
+}
+
+int
+ioctl(int fd, unsigned long request, ...)
+{
+    struct gpio_v2_line_request *lreq;
+    struct gpio_v2_line_values *values;
+    struct mock_request_t *req;
+    uint64_t outputs;
+    unsigned int i;
+    int p[2];
+    va_list ap;
+    void *arg;
+
+    va_start(ap, request);
+    arg = va_arg(ap, void *);
+    va_end(ap);
+    mock_ioctls++;
+    if (request == GPIO_V2_GET_LINE_IOCTL) {
+        lreq = arg;
+        if (lreq->num_lines < 1 || lreq->num_lines > GPIO_V2_LINES_MAX
+            || pipe(p))
+        {
+            errno = EINVAL;
+            return -1;
+        }
+        // Reuse the slot of a closed request with the same descriptor
+        for (i = 0; i < MOCK_MAX_REQUESTS && mock_requests[i].n
+            && mock_requests[i].fd != p[0]; i++);
+        if (i == MOCK_MAX_REQUESTS) {
+            errno = EBUSY;
+            return -1;
+        }
+        req = &mock_requests[i];
+        req->fd = lreq->fd = p[0];
+        req->event_fd = p[1];
+        req->n = lreq->num_lines;
+        memcpy(req->offsets, lreq->offsets, sizeof(req->offsets));
+        req->bits = 0;
+        return mock_config(req, &lreq->config);
+    }
+    if (!(req = mock_request(fd))) {
+        errno = ENOTTY;
+        return -1;
+    }
+    switch (request) {
+    case GPIO_V2_LINE_SET_CONFIG_IOCTL:
+        return mock_config(req, arg);
+    case GPIO_V2_LINE_GET_VALUES_IOCTL:
+        values = arg;
+        values->bits = req->bits & values->mask;
+        return 0;
+    case GPIO_V2_LINE_SET_VALUES_IOCTL:
+        values = arg;
+        for (i = 0, outputs = 0; i < req->n; i++) {
+            if (req->flags[i] & GPIO_V2_LINE_FLAG_OUTPUT) {
+                outputs |= 1ULL << i;
+            }
+        }
+        if (values->mask & ~outputs) {
+            errno = EPERM;
+            return -1;
+        }
+        req->bits = (req->bits & ~values->mask)
+            | (values->bits & values->mask);
+        if (mock_nwrites < MOCK_MAX_WRITES) {
+            mock_writes[mock_nwrites] = req->bits;
+        }
+        mock_nwrites++;
+        return 0;
+    }
+    errno = ENOTTY;
+    return -1;
+}
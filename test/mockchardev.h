@@ -0,0 +1,51 @@
+
+#ifndef MOCKCHARDEV_H
+#define MOCKCHARDEV_H
+
+#include <linux/gpio.h> // GPIO_V2_LINES_MAX
+#include <stdint.h>     // uint64_t
+
+#define MOCK_MAX_REQUESTS   8
+#define MOCK_MAX_WRITES     64
+
+/* State of a mocked line request.
+
+   The line request descriptor is the read end of a pipe, so the tests can
+   inject edge events writing into the other end.
+*/
+struct mock_request_t {
+    int fd;
+    int event_fd;
+    unsigned int n;
+    unsigned int offsets[GPIO_V2_LINES_MAX];
+    uint64_t flags[GPIO_V2_LINES_MAX];
+    uint32_t debounce[GPIO_V2_LINES_MAX];
+    uint64_t bits;
+};
+
+// The mocked line requests
+extern struct mock_request_t mock_requests[MOCK_MAX_REQUESTS];
+
+// Number of ioctl calls done
+extern unsigned long mock_ioctls;
+
+// Values written to the lines (the first MOCK_MAX_WRITES), and number of
+// writes done
+extern uint64_t mock_writes[MOCK_MAX_WRITES];
+extern unsigned long mock_nwrites;
+
+// Whether the debounce attributes are rejected, as a driver that can't
+// debounce would do
+extern int mock_no_debounce;
+
+// Return the line request of a descriptor
+struct mock_request_t *
+mock_request(int fd);
+
+// Inject an edge event in a line request
+void
+mock_event(struct mock_request_t *req, unsigned int offset, uint32_t id,
+    uint64_t timestamp);
+
+#endif
+
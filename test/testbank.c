@@ -0,0 +1,172 @@
+
+#include "rfsgpio.h"
+#include "mockchardev.h"
+#include "testutil.h"
+
+#include <err.h>    // err
+#include <errno.h>  // errno
+#include <stdio.h>  // snprintf
+
+#define NPINS   16
+
+void
+bank_open(struct gpio_bank_t *b, struct gpio_t *g, int flags,
+    enum gpio_direction_t d)
+{
+    int i;
+
+    for (i = 0; i < NPINS; i++) {
+        g[i].chip = 0;
+        g[i].pin = 10 + i;
+    }
+    b->gpios = g;
+    b->n = NPINS;
+    b->flags = flags;
+    if (rfs_gpio_bank_open(b, d)) {
+        err(1, "opening bank");
+    }
+}
+
+void
+check_bank(struct gpio_bank_t *b, uint64_t expected)
+{
+    uint64_t bits;
+
+    if (rfs_gpio_bank_get(b, &bits)) {
+        err(1, "reading bank");
+    }
+    if (bits != expected) {
+        errx(1, "bank values are %#llx instead of %#llx",
+            (unsigned long long)bits, (unsigned long long)expected);
+    }
+}
+
+void
+bank_set(struct gpio_bank_t *b, uint64_t mask, uint64_t bits)
+{
+    if (rfs_gpio_bank_set(b, mask, bits)) {
+        err(1, "setting bank");
+    }
+}
+
+void
+bank_close(struct gpio_bank_t *b)
+{
+    if (rfs_gpio_bank_close(b)) {
+        err(1, "closing bank");
+    }
+}
+
+void
+test_sysfs(const char *root)
+{
+    struct gpio_t g[NPINS];
+    struct gpio_bank_t b;
+    char path[64], val[8];
+    int i;
+
+    for (i = 0; i < NPINS; i++) {
+        make_gpio(root, 10 + i);
+    }
+    bank_open(&b, g, RFS_DONT_EXPORT, RFS_GPIO_OUT_LOW);
+    check_bank(&b, 0);
+    bank_set(&b, 0xffff, 0xa5a5);
+    check_bank(&b, 0xa5a5);
+    bank_set(&b, 0x00ff, 0x0000);
+    check_bank(&b, 0xa500);
+    // The values are written to the value files of each pin
+    snprintf(path, sizeof(path), "sys/class/gpio/gpio%u/value", 10 + 15);
+    read_file(root, path, val, sizeof(val));
+    if (val[0] != '1') {
+        errx(1, "value of the last pin not written");
+    }
+    // The pins of a bank can't be closed alone
+    if (rfs_gpio_close(&g[0]) != -1 || errno != EBUSY) {
+        errx(1, "closing a pin of a bank must give EBUSY but does not");
+    }
+    bank_close(&b);
+    // A pin that doesn't exist makes the whole open fail
+    g[NPINS - 1].pin = 99;
+    b.gpios = g;
+    if (rfs_gpio_bank_open(&b, RFS_GPIO_IN) != -1) {
+        errx(1, "opening a bank with a missing pin must fail but does not");
+    }
+}
+
+void
+test_chardev(const char *root)
+{
+    struct gpio_t g[NPINS];
+    struct gpio_bank_t b;
+    struct gpio_event_t ev;
+    struct mock_request_t *req;
+    unsigned long n;
+
+    make_chip(root, 0);
+    bank_open(&b, g, RFS_CHARDEV, RFS_GPIO_OUT_HIGH);
+    req = mock_request(g[0].fd);
+    if (req->n != NPINS || req->offsets[NPINS - 1] != 10 + NPINS - 1) {
+        errx(1, "bank lines not requested at once");
+    }
+    check_bank(&b, 0xffff);
+    // Each bank operation is a single ioctl
+    n = mock_ioctls;
+    bank_set(&b, 0xff00, 0x1234);
+    check_bank(&b, 0x12ff);
+    if (mock_ioctls - n != 2) {
+        errx(1, "%lu ioctls instead of 2", mock_ioctls - n);
+    }
+    // The pins can be used individually
+    if (rfs_gpio_set_value(&g[0], RFS_GPIO_LOW)) {
+        err(1, "setting value of a pin");
+    }
+    if (rfs_gpio_get_value(&g[1]) != RFS_GPIO_HIGH) {
+        errx(1, "wrong value of a pin");
+    }
+    check_bank(&b, 0x12fe);
+    // Changing the direction of a pin keeps the other outputs
+    if (rfs_gpio_set_direction(&g[2], RFS_GPIO_IN)
+        || rfs_gpio_set_edge(&g[2], RFS_GPIO_RISING))
+    {
+        err(1, "reconfiguring a pin");
+    }
+    if (rfs_gpio_get_direction(&g[2]) != RFS_GPIO_IN
+        || rfs_gpio_get_direction(&g[3]) != RFS_GPIO_OUT)
+    {
+        errx(1, "wrong directions");
+    }
+    check_bank(&b, 0x12fe);
+    // The events of any pin come through the bank request
+    mock_event(req, 12, GPIO_V2_LINE_EVENT_RISING_EDGE, 10);
+    if (rfs_gpio_read_event(&g[0], &ev) || ev.gpio != &g[2]
+        || ev.value != RFS_GPIO_HIGH)
+    {
+        errx(1, "wrong bank event");
+    }
+    bank_close(&b);
+    // All the pins must belong to the same chip
+    g[3].chip = 1;
+    b.gpios = g;
+    if (rfs_gpio_bank_open(&b, RFS_GPIO_IN) != -1 || errno != EINVAL) {
+        errx(1, "opening a bank of several chips must fail but does not");
+    }
+}
+
+int
+main()
+{
+    char root[] = "/tmp/rfstest.XXXXXX";
+    struct gpio_bank_t b;
+
+    make_root(root);
+    test_sysfs(root);
+    test_chardev(root);
+    // Wrong number of pins
+    b.n = RFS_GPIO_BANK_MAX_PINS + 1;
+    b.flags = 0;
+    if (rfs_gpio_bank_open(&b, RFS_GPIO_IN) != -1 || errno != EINVAL) {
+        errx(1, "opening a too big bank must fail but does not");
+    }
+    remove_root(root);
+    return 0;
+}
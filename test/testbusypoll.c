@@ -0,0 +1,316 @@
+
+#include "rfsgpio.h"
+#include "mockchardev.h"
+#include "testutil.h"
+
+#include <err.h>        // err
+#include <errno.h>      // errno
+#include <fcntl.h>      // open
+#include <stdio.h>      // snprintf
+#include <time.h>       // clock_gettime, nanosleep
+#include <unistd.h>     // pwrite
+
+#define IDLE    50000
+#define BCM_LEV 0x34
+
+// Registers of the fake controller, a regular file mapped by the library
+int regs_fd;
+
+uint64_t
+now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void
+make_regs(const char *root)
+{
+    char path[64];
+
+    write_file(root, "dev/gpiomem", "");
+    snprintf(path, sizeof(path), "%s/dev/gpiomem", root);
+    if ((regs_fd = open(path, O_RDWR)) < 0 || ftruncate(regs_fd, 4096)) {
+        err(1, "creating registers file");
+    }
+}
+
+// Change the level of a pin in the fake registers
+void
+set_level(gpio_pin_t pin, enum gpio_value_t value)
+{
+    uint32_t r = value << pin;
+
+    if (pwrite(regs_fd, &r, sizeof(r), BCM_LEV) != sizeof(r)) {
+        err(1, "writing level register");
+    }
+}
+
+// Change the value of the line, and queue its edge as the kernel would
+void
+change(struct gpio_t *g, enum gpio_value_t value)
+{
+    struct mock_request_t *req = mock_request(g->fd);
+
+    req->bits = value;
+    mock_event(req, g->pin, value ? GPIO_V2_LINE_EVENT_RISING_EDGE
+        : GPIO_V2_LINE_EVENT_FALLING_EDGE, now());
+}
+
+void
+check_wait(struct gpio_t *g, int timeout, int expected,
+    enum gpio_value_t value)
+{
+    struct gpio_event_t ev;
+    int res;
+
+    if ((res = rfs_gpio_wait_edge(g, timeout, &ev)) < 0) {
+        err(1, "waiting for an edge");
+    }
+    if (res != expected) {
+        errx(1, "wait gave %d instead of %d", res, expected);
+    }
+    if (res && (ev.gpio != g || ev.value != value)) {
+        errx(1, "wrong event (value %d)", ev.value);
+    }
+}
+
+// Check the events detected in each mode
+void
+check_events(struct gpio_t *g, unsigned long spin, unsigned long interrupt)
+{
+    struct busy_poll_counters_t s, i;
+
+    if (rfs_gpio_get_busy_poll_counters(g, RFS_BUSY_POLL_SPIN, &s)
+        || rfs_gpio_get_busy_poll_counters(g, RFS_BUSY_POLL_INTERRUPT, &i))
+    {
+        err(1, "getting counters");
+    }
+    if (s.events != spin || i.events != interrupt) {
+        errx(1, "%lu events spinning and %lu waiting for the interrupt "
+            "instead of %lu and %lu", s.events, i.events, spin, interrupt);
+    }
+    if ((s.events && (!s.latency || s.max_latency > s.latency))
+        || (i.events && (!i.latency || i.max_latency > i.latency)))
+    {
+        errx(1, "latency not counted");
+    }
+}
+
+void
+test_errors(const char *root)
+{
+    struct busy_poll_counters_t counters;
+    struct gpio_t g;
+
+    // The registers have no edges
+    g.pin = 4;
+    g.flags = RFS_MMIO;
+    if (rfs_gpio_open(&g, RFS_GPIO_IN)) {
+        err(1, "opening pin");
+    }
+    if (rfs_gpio_set_busy_poll(&g, IDLE, NULL) != -1 || errno != ENOTSUP) {
+        errx(1, "busy polling the registers must give ENOTSUP but does not");
+    }
+    if (rfs_gpio_close(&g)) {
+        err(1, "closing pin");
+    }
+    // The value file isn't kept opened
+    make_gpio(root, 5);
+    g.pin = 5;
+    g.flags = RFS_DONT_EXPORT;
+    if (rfs_gpio_open(&g, RFS_GPIO_IN)) {
+        err(1, "opening pin");
+    }
+    if (rfs_gpio_set_busy_poll(&g, IDLE, NULL) != -1 || errno != EINVAL) {
+        errx(1, "busy polling without a descriptor must give EINVAL but "
+            "does not");
+    }
+    if (rfs_gpio_get_busy_poll_counters(&g, RFS_BUSY_POLL_MODES, &counters)
+        != -1 || errno != EINVAL)
+    {
+        errx(1, "a wrong mode must give EINVAL but does not");
+    }
+    if (rfs_gpio_close(&g)) {
+        err(1, "closing pin");
+    }
+    // Debouncing can't be combined with it
+    g.chip = 0;
+    g.pin = 4;
+    g.flags = RFS_CHARDEV;
+    if (rfs_gpio_open(&g, RFS_GPIO_IN) || rfs_gpio_set_debounce(&g, 1000)) {
+        err(1, "opening line");
+    }
+    if (rfs_gpio_set_busy_poll(&g, IDLE, NULL) != -1 || errno != EBUSY) {
+        errx(1, "busy polling a debounced pin must give EBUSY but does not");
+    }
+    if (rfs_gpio_set_debounce(&g, 0)
+        || rfs_gpio_set_busy_poll(&g, IDLE, NULL))
+    {
+        err(1, "setting busy polling");
+    }
+    if (rfs_gpio_set_debounce(&g, 1000) != -1 || errno != EBUSY) {
+        errx(1, "debouncing a busy polled pin must give EBUSY but does not");
+    }
+    close(mock_request(g.fd)->event_fd);
+    if (rfs_gpio_close(&g)) {
+        err(1, "closing line");
+    }
+}
+
+void
+test_line(void)
+{
+    struct busy_poll_counters_t spin, interrupt;
+    struct timespec idle = {0, 2 * IDLE * 1000};
+    struct gpio_t g;
+
+    g.chip = 0;
+    g.pin = 4;
+    g.flags = RFS_CHARDEV;
+    if (rfs_gpio_open(&g, RFS_GPIO_IN) || rfs_gpio_set_edge(&g, RFS_GPIO_BOTH)
+        || rfs_gpio_set_busy_poll(&g, IDLE, NULL))
+    {
+        err(1, "opening line");
+    }
+    // The first event comes from the interrupt
+    change(&g, RFS_GPIO_HIGH);
+    check_wait(&g, 100, 1, RFS_GPIO_HIGH);
+    check_events(&g, 0, 1);
+    // The next one, right after, is seen spinning
+    change(&g, RFS_GPIO_LOW);
+    check_wait(&g, 100, 1, RFS_GPIO_LOW);
+    check_events(&g, 1, 1);
+    // A short wait keeps spinning until the timeout
+    check_wait(&g, 10, 0, 0);
+    // Once idle, the edge queued while spinning is discarded instead of being
+    // reported again, and the interrupt is waited for
+    check_wait(&g, 200, 0, 0);
+    check_events(&g, 1, 1);
+    if (rfs_gpio_get_busy_poll_counters(&g, RFS_BUSY_POLL_SPIN, &spin)
+        || rfs_gpio_get_busy_poll_counters(&g, RFS_BUSY_POLL_INTERRUPT,
+            &interrupt))
+    {
+        err(1, "getting counters");
+    }
+    if (spin.wait_time < IDLE * 1000ULL * 9 / 10 || !spin.cpu_time
+        || interrupt.waits < 2 || !interrupt.wait_time)
+    {
+        errx(1, "time spent in each mode not counted");
+    }
+    // Coming back after the idle period, the edge seen spinning is discarded
+    // too, even if the last spin ended with it
+    change(&g, RFS_GPIO_HIGH);
+    check_wait(&g, 100, 1, RFS_GPIO_HIGH);
+    change(&g, RFS_GPIO_LOW);
+    check_wait(&g, 100, 1, RFS_GPIO_LOW);
+    nanosleep(&idle, NULL);
+    check_wait(&g, 10, 0, 0);
+    check_events(&g, 2, 2);
+    // Spinning only reports the edges set for the pin
+    change(&g, RFS_GPIO_HIGH);
+    check_wait(&g, 100, 1, RFS_GPIO_HIGH);
+    if (rfs_gpio_set_edge(&g, RFS_GPIO_RISING)) {
+        err(1, "setting edge");
+    }
+    change(&g, RFS_GPIO_LOW);
+    check_wait(&g, 10, 0, 0);
+    change(&g, RFS_GPIO_HIGH);
+    check_wait(&g, 100, 1, RFS_GPIO_HIGH);
+    check_events(&g, 3, 3);
+    // Disabled, the events come again from the queue, even the old ones
+    if (rfs_gpio_set_busy_poll(&g, 0, NULL)) {
+        err(1, "disabling busy polling");
+    }
+    check_wait(&g, 100, 1, RFS_GPIO_LOW);
+    check_events(&g, 0, 0);
+    close(mock_request(g.fd)->event_fd);
+    if (rfs_gpio_close(&g)) {
+        err(1, "closing line");
+    }
+}
+
+void
+test_registers(void)
+{
+    struct gpio_t g, m;
+
+    g.chip = 0;
+    g.pin = 4;
+    g.flags = RFS_CHARDEV;
+    m.pin = 4;
+    m.flags = RFS_MMIO;
+    if (rfs_gpio_open(&g, RFS_GPIO_IN) || rfs_gpio_set_edge(&g, RFS_GPIO_BOTH)
+        || rfs_gpio_open(&m, RFS_GPIO_IN))
+    {
+        err(1, "opening pin");
+    }
+    // Only the registers of the same pin can be read while spinning
+    if (rfs_gpio_set_busy_poll(&g, IDLE, &g) != -1 || errno != EINVAL) {
+        errx(1, "spinning on the line must give EINVAL but does not");
+    }
+    m.pin = 5;
+    if (rfs_gpio_set_busy_poll(&g, IDLE, &m) != -1 || errno != EINVAL) {
+        errx(1, "spinning on other pin must give EINVAL but does not");
+    }
+    m.pin = 4;
+    set_level(4, RFS_GPIO_LOW);
+    if (rfs_gpio_set_busy_poll(&g, IDLE, &m)) {
+        err(1, "setting busy polling");
+    }
+    set_level(4, RFS_GPIO_HIGH);
+    change(&g, RFS_GPIO_HIGH);
+    check_wait(&g, 100, 1, RFS_GPIO_HIGH);
+    // The registers are read while spinning, not the line
+    set_level(4, RFS_GPIO_LOW);
+    check_wait(&g, 100, 1, RFS_GPIO_LOW);
+    check_events(&g, 1, 1);
+    close(mock_request(g.fd)->event_fd);
+    if (rfs_gpio_close(&g) || rfs_gpio_close(&m)) {
+        err(1, "closing pin");
+    }
+}
+
+void
+test_sysfs(void)
+{
+    struct busy_poll_counters_t counters;
+    struct gpio_t g;
+
+    g.pin = 5;
+    g.flags = RFS_DONT_EXPORT | RFS_KEEP_OPEN;
+    if (rfs_gpio_open(&g, RFS_GPIO_IN) || rfs_gpio_set_edge(&g, RFS_GPIO_BOTH)
+        || rfs_gpio_set_busy_poll(&g, IDLE, NULL))
+    {
+        err(1, "opening pin");
+    }
+    // A regular file never signals an edge
+    check_wait(&g, 10, 0, 0);
+    if (rfs_gpio_get_busy_poll_counters(&g, RFS_BUSY_POLL_INTERRUPT,
+        &counters) || counters.waits != 1 || counters.events)
+    {
+        errx(1, "wrong counters for the interrupt");
+    }
+    if (rfs_gpio_close(&g)) {
+        err(1, "closing pin");
+    }
+}
+
+int
+main()
+{
+    char root[] = "/tmp/rfstest.XXXXXX";
+
+    make_root(root);
+    make_chip(root, 0);
+    make_regs(root);
+    test_errors(root);
+    test_line();
+    test_registers();
+    test_sysfs();
+    close(regs_fd);
+    remove_root(root);
+    return 0;
+}
@@ -0,0 +1,131 @@
+
+#include "rfsgpio.h"
+#include "testutil.h"
+
+#include <err.h>    // err
+#include <stdio.h>  // snprintf
+#include <string.h> // strcmp
+
+#define PIN     7
+
+// The files are changed behind the library to check whether it reads them
+
+void
+test_gpio(const char *root)
+{
+    struct gpio_t g;
+    char path[64], val[8];
+
+    make_gpio(root, PIN);
+    snprintf(path, sizeof(path), "sys/class/gpio/gpio%u/edge", PIN);
+    g.pin = PIN;
+    g.flags = RFS_DONT_EXPORT | RFS_CACHE;
+    if (rfs_gpio_open(&g, RFS_GPIO_IN) || rfs_gpio_set_edge(&g, RFS_GPIO_BOTH)) {
+        err(1, "opening pin");
+    }
+    // The getters are served from the cache
+    write_file(root, path, "none\n");
+    if (rfs_gpio_get_edge(&g) != RFS_GPIO_BOTH
+        || rfs_gpio_get_direction(&g) != RFS_GPIO_IN)
+    {
+        errx(1, "cached values not used");
+    }
+    // Setting the cached value doesn't write it
+    if (rfs_gpio_set_edge(&g, RFS_GPIO_BOTH)) {
+        err(1, "setting edge");
+    }
+    read_file(root, path, val, sizeof(val));
+    if (strcmp(val, "none\n") != 0) {
+        errx(1, "cached edge written");
+    }
+    // After invalidating, the values are read again
+    rfs_gpio_invalidate(&g);
+    if (rfs_gpio_get_edge(&g) != RFS_GPIO_NONE) {
+        errx(1, "edge not read after invalidating");
+    }
+    if (rfs_gpio_set_edge(&g, RFS_GPIO_RISING)) {
+        err(1, "setting edge");
+    }
+    read_file(root, path, val, sizeof(val));
+    if (strcmp(val, "rising") != 0) {
+        errx(1, "new edge not written");
+    }
+    if (rfs_gpio_close(&g)) {
+        err(1, "closing pin");
+    }
+    // Without the flag the files are always read
+    g.flags = RFS_DONT_EXPORT;
+    if (rfs_gpio_open(&g, RFS_GPIO_IN) || rfs_gpio_set_edge(&g, RFS_GPIO_BOTH)) {
+        err(1, "opening pin");
+    }
+    write_file(root, path, "none\n");
+    if (rfs_gpio_get_edge(&g) != RFS_GPIO_NONE) {
+        errx(1, "edge not read without cache");
+    }
+    // Nor is the cache written, the pin may be shared by threads
+    if (rfs_gpio_set_direction(&g, RFS_GPIO_OUT) || g.cached_direction != -1
+        || g.cached_edge != -1)
+    {
+        errx(1, "cache written without the flag");
+    }
+    if (rfs_gpio_close(&g)) {
+        err(1, "closing pin");
+    }
+}
+
+void
+test_pwm(const char *root)
+{
+    const char *path = "sys/class/pwm/pwmchip0/pwm0/duty_cycle";
+    struct pwm_t p;
+    char val[16];
+
+    make_pwm(root, 0, 0);
+    p.chip = 0;
+    p.channel = 0;
+    p.flags = RFS_DONT_EXPORT | RFS_CACHE;
+    p.period = 1000;
+    if (rfs_pwm_open(&p) || rfs_pwm_set_duty_cycle(&p, 500)) {
+        err(1, "opening PWM channel");
+    }
+    write_file(root, path, "100\n");
+    if (rfs_pwm_get_duty_cycle(&p) != 500 || rfs_pwm_get_period(&p) != 1000
+        || rfs_pwm_get_enabled(&p) != RFS_PWM_ENABLED)
+    {
+        errx(1, "cached values not used");
+    }
+    if (rfs_pwm_set_duty_cycle(&p, 500)) {
+        err(1, "setting duty cycle");
+    }
+    read_file(root, path, val, sizeof(val));
+    if (strcmp(val, "100\n") != 0) {
+        errx(1, "cached duty cycle written");
+    }
+    rfs_pwm_invalidate(&p);
+    if (rfs_pwm_get_duty_cycle(&p) != 100) {
+        errx(1, "duty cycle not read after invalidating");
+    }
+    // The period field follows the period set or read
+    write_file(root, "sys/class/pwm/pwmchip0/pwm0/period", "2000\n");
+    if (rfs_pwm_get_period(&p) != 2000 || p.period != 2000) {
+        errx(1, "period field not updated");
+    }
+    if (rfs_pwm_set_period(&p, 3000) || p.period != 3000) {
+        errx(1, "period field not updated");
+    }
+    if (rfs_pwm_close(&p)) {
+        err(1, "closing PWM channel");
+    }
+}
+
+int
+main()
+{
+    char root[] = "/tmp/rfstest.XXXXXX";
+
+    make_root(root);
+    test_gpio(root);
+    test_pwm(root);
+    remove_root(root);
+    return 0;
+}
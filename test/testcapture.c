@@ -0,0 +1,146 @@
+
+#include "rfsgpio.h"
+#include "mockchardev.h"
+#include "testutil.h"
+
+#include <err.h>    // err
+#include <errno.h>  // errno
+#include <time.h>   // nanosleep
+#include <unistd.h> // write
+
+#define NPINS   2
+
+void
+gpio_open(struct gpio_t *g, gpio_pin_t pin)
+{
+    g->chip = 0;
+    g->pin = pin;
+    g->flags = RFS_CHARDEV;
+    if (rfs_gpio_open(g, RFS_GPIO_IN) || rfs_gpio_set_edge(g, RFS_GPIO_BOTH)) {
+        err(1, "opening line %u", pin);
+    }
+}
+
+// Wait until the capture thread has processed n events
+void
+wait_events(struct event_capture_t *c, unsigned long n)
+{
+    struct timespec ts = {0, 1000000};
+    int i;
+
+    for (i = 0; i < 1000; i++) {
+        if (__atomic_load_n(&c->head, __ATOMIC_ACQUIRE)
+            + rfs_event_capture_overflows(c) >= n)
+        {
+            return;
+        }
+        nanosleep(&ts, NULL);
+    }
+    errx(1, "events not captured");
+}
+
+// Wait until the capture thread is stopped by an error
+void
+wait_error(struct event_capture_t *c, int error)
+{
+    struct timespec ts = {0, 1000000};
+    int i;
+
+    for (i = 0; i < 1000; i++) {
+        if (rfs_event_capture_error(c) == error) {
+            return;
+        }
+        nanosleep(&ts, NULL);
+    }
+    errx(1, "capture not stopped by the error");
+}
+
+int
+main()
+{
+    char root[] = "/tmp/rfstest.XXXXXX";
+    struct gpio_event_t events[8];
+    struct event_capture_t c;
+    struct gpio_t g[NPINS];
+    unsigned long n;
+    int i;
+
+    make_root(root);
+    make_chip(root, 0);
+    for (i = 0; i < NPINS; i++) {
+        gpio_open(&g[i], i);
+    }
+    // The size is rounded up to a power of 2
+    if (rfs_event_capture_open(&c, 3)) {
+        err(1, "opening capture");
+    }
+    if (c.size != 4) {
+        errx(1, "capture size is %lu instead of 4", c.size);
+    }
+    if (rfs_event_capture_add(&c, &g[0]) || rfs_event_capture_start(&c)) {
+        err(1, "starting capture");
+    }
+    // Pins can be added while capturing
+    if (rfs_event_capture_add(&c, &g[1])) {
+        err(1, "adding pin to a running capture");
+    }
+    if (rfs_event_capture_start(&c) != -1 || errno != EBUSY) {
+        errx(1, "starting a capture twice must give EBUSY but does not");
+    }
+    // The events are read in batches, in order
+    if (rfs_event_capture_read(&c, events, 8) != 0) {
+        errx(1, "events read from an empty capture");
+    }
+    mock_event(mock_request(g[0].fd), 0, GPIO_V2_LINE_EVENT_RISING_EDGE, 10);
+    mock_event(mock_request(g[1].fd), 1, GPIO_V2_LINE_EVENT_RISING_EDGE, 20);
+    mock_event(mock_request(g[0].fd), 0, GPIO_V2_LINE_EVENT_FALLING_EDGE, 30);
+    wait_events(&c, 3);
+    if ((n = rfs_event_capture_read(&c, events, 2)) != 2) {
+        errx(1, "%lu events read instead of 2", n);
+    }
+    if ((n = rfs_event_capture_read(&c, events + 2, 8)) != 1) {
+        errx(1, "%lu events read instead of 1", n);
+    }
+    for (i = 0; i < 3; i++) {
+        if (events[i].timestamp != (i + 1) * 10) {
+            errx(1, "events out of order");
+        }
+    }
+    if (events[1].gpio != &g[1] || events[2].value != RFS_GPIO_LOW) {
+        errx(1, "wrong events");
+    }
+    // Overflows are counted
+    for (i = 0; i < 6; i++) {
+        mock_event(mock_request(g[0].fd), 0, GPIO_V2_LINE_EVENT_RISING_EDGE,
+            100 + i);
+    }
+    wait_events(&c, 9);
+    if (rfs_event_capture_overflows(&c) != 2) {
+        errx(1, "%lu overflows instead of 2", rfs_event_capture_overflows(&c));
+    }
+    if (rfs_event_capture_stop(&c)) {
+        err(1, "stopping capture");
+    }
+    // The captured events can be read after stopping
+    if ((n = rfs_event_capture_read(&c, events, 8)) != 4
+        || events[0].timestamp != 100 || events[3].timestamp != 103)
+    {
+        errx(1, "wrong events after overflow");
+    }
+    // A read error stops the thread, that is still stopped as usual
+    if (rfs_event_capture_error(&c) || rfs_event_capture_start(&c)) {
+        err(1, "restarting capture");
+    }
+    if (write(mock_request(g[0].fd)->event_fd, "", 1) != 1) {
+        err(1, "writing a truncated event");
+    }
+    wait_error(&c, EIO);
+    if (rfs_event_capture_stop(&c)) {
+        err(1, "stopping capture");
+    }
+    if (rfs_event_capture_close(&c)) {
+        err(1, "closing capture");
+    }
+    remove_root(root);
+    return 0;
+}
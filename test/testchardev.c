@@ -0,0 +1,144 @@
+
+#include "rfsgpio.h"
+#include "mockchardev.h"
+#include "testutil.h"
+
+#include <err.h>            // err
+#include <errno.h>          // errno
+#include <unistd.h>         // close
+
+void
+gpio_open(struct gpio_t *g, gpio_pin_t pin, enum gpio_direction_t d)
+{
+    g->chip = 0;
+    g->pin = pin;
+    g->flags = RFS_CHARDEV;
+    if (rfs_gpio_open(g, d)) {
+        err(1, "open line %u", pin);
+    }
+    if (mock_request(g->fd)->offsets[0] != pin) {
+        errx(1, "requested line %u instead of %u",
+            mock_request(g->fd)->offsets[0], pin);
+    }
+}
+
+void
+check_direction(struct gpio_t *g, enum gpio_direction_t d)
+{
+    int dir = rfs_gpio_get_direction(g);
+    if (dir != d) {
+        errx(1, "direction of line %u is not %d (%d)", g->pin, d, dir);
+    }
+}
+
+void
+check_value(struct gpio_t *g, enum gpio_value_t v)
+{
+    int val = rfs_gpio_get_value(g);
+    if (val != v) {
+        errx(1, "value of line %u is not %d (%d)", g->pin, v, val);
+    }
+}
+
+void
+check_edge(struct gpio_t *g, enum gpio_edge_t e)
+{
+    int edge = rfs_gpio_get_edge(g);
+    if (edge != e) {
+        errx(1, "edge of line %u is not %d (%d)", g->pin, e, edge);
+    }
+}
+
+void
+check_event(struct gpio_t *g, uint32_t id, uint64_t timestamp,
+    enum gpio_value_t v)
+{
+    struct gpio_event_t event;
+    struct pollfd pd;
+
+    mock_event(mock_request(g->fd), g->pin, id, timestamp);
+    if (rfs_gpio_get_poll_descriptors(g, &pd)) {
+        err(1, "getting poll descriptors");
+    }
+    if (poll(&pd, 1, 1000) != 1 || !(pd.revents & POLLIN)) {
+        errx(1, "event not signaled by poll");
+    }
+    if (rfs_gpio_read_event(g, &event)) {
+        err(1, "reading event");
+    }
+    if (event.gpio != g || event.value != v || event.timestamp != timestamp) {
+        errx(1, "wrong event (value %d, timestamp %llu)", event.value,
+            (unsigned long long)event.timestamp);
+    }
+}
+
+int
+main()
+{
+    char root[] = "/tmp/rfstest.XXXXXX";
+    struct gpio_t g, g1;
+
+    make_root(root);
+    make_chip(root, 0);
+    // Open a line as input
+    gpio_open(&g, 4, RFS_GPIO_IN);
+    check_direction(&g, RFS_GPIO_IN);
+    check_edge(&g, RFS_GPIO_NONE);
+    // Input lines can't be written
+    if (rfs_gpio_set_value(&g, RFS_GPIO_HIGH) != -1) {
+        errx(1, "setting value of an input must give an error but does not");
+    }
+    // Set direction and value
+    if (rfs_gpio_set_direction(&g, RFS_GPIO_OUT_HIGH)) {
+        err(1, "setting direction");
+    }
+    check_direction(&g, RFS_GPIO_OUT);
+    check_value(&g, RFS_GPIO_HIGH);
+    if (rfs_gpio_set_value(&g, RFS_GPIO_LOW)) {
+        err(1, "setting value");
+    }
+    check_value(&g, RFS_GPIO_LOW);
+    if (rfs_gpio_set_value(&g, 10) != -1) {
+        errx(1, "setting wrong value must give an error but does not");
+    }
+    // Edges need an input
+    if (rfs_gpio_set_edge(&g, RFS_GPIO_BOTH) != -1) {
+        errx(1, "setting edge of an output must give an error but does not");
+    }
+    if (rfs_gpio_set_direction(&g, RFS_GPIO_IN)) {
+        err(1, "setting direction");
+    }
+    if (rfs_gpio_set_edge(&g, RFS_GPIO_BOTH)) {
+        err(1, "setting edge");
+    }
+    check_edge(&g, RFS_GPIO_BOTH);
+    // Changing the direction of an input keeps its edges
+    if (rfs_gpio_set_direction(&g, RFS_GPIO_IN)) {
+        err(1, "setting direction");
+    }
+    check_edge(&g, RFS_GPIO_BOTH);
+    // Edge events
+    check_event(&g, GPIO_V2_LINE_EVENT_RISING_EDGE, 1000, RFS_GPIO_HIGH);
+    check_event(&g, GPIO_V2_LINE_EVENT_FALLING_EDGE, 2000, RFS_GPIO_LOW);
+    close(mock_request(g.fd)->event_fd);
+    if (rfs_gpio_close(&g)) {
+        err(1, "closing line");
+    }
+    // Open the line as output
+    gpio_open(&g, 5, RFS_GPIO_OUT_HIGH);
+    check_direction(&g, RFS_GPIO_OUT);
+    check_value(&g, RFS_GPIO_HIGH);
+    close(mock_request(g.fd)->event_fd);
+    if (rfs_gpio_close(&g)) {
+        err(1, "closing line");
+    }
+    // Open a line of a chip that doesn't exist
+    g1.chip = 1;
+    g1.pin = 0;
+    g1.flags = RFS_CHARDEV;
+    if (rfs_gpio_open(&g1, RFS_GPIO_IN) != -1 || errno != ENOENT) {
+        errx(1, "opening a missing chip must give ENOENT but does not");
+    }
+    remove_root(root);
+    return 0;
+}
@@ -0,0 +1,148 @@
+
+#include "rfsgpio.h"
+#include "mockchardev.h"
+#include "testutil.h"
+
+#include <err.h>    // err
+#include <errno.h>  // errno
+#include <time.h>   // nanosleep
+#include <unistd.h> // close
+
+#define WINDOW  1000000000ULL
+
+uint64_t
+now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Wait until the counter thread has counted n edges
+void
+wait_count(struct pulse_counter_t *c, unsigned long long n)
+{
+    struct timespec ts = {0, 1000000};
+    int i;
+
+    for (i = 0; i < 1000; i++) {
+        if (rfs_pulse_counter_count(c) >= n) {
+            return;
+        }
+        nanosleep(&ts, NULL);
+    }
+    errx(1, "edges not counted");
+}
+
+void
+ignore_event(const struct gpio_event_t *event, void *data)
+{
+}
+
+void
+test_batch(struct gpio_t *g)
+{
+    struct gpio_event_t events[RFS_GPIO_EVENT_BATCH];
+    int i, n;
+
+    // All the queued events are read at once
+    for (i = 0; i < 5; i++) {
+        mock_event(mock_request(g->fd), g->pin,
+            GPIO_V2_LINE_EVENT_RISING_EDGE, 1000 + i);
+    }
+    if ((n = rfs_gpio_read_events(g, events, RFS_GPIO_EVENT_BATCH)) != 5) {
+        errx(1, "%d events read instead of 5", n);
+    }
+    for (i = 0; i < 5; i++) {
+        if (events[i].gpio != g || events[i].value != RFS_GPIO_HIGH
+            || events[i].timestamp != 1000 + i)
+        {
+            errx(1, "wrong event %d", i);
+        }
+    }
+    if (rfs_gpio_read_events(g, events, 0) != -1 || errno != EINVAL) {
+        errx(1, "reading 0 events must give EINVAL but does not");
+    }
+}
+
+int
+main()
+{
+    char root[] = "/tmp/rfstest.XXXXXX";
+    struct pulse_counter_t c;
+    struct event_loop_t loop;
+    struct gpio_t g;
+    uint64_t t;
+    double rate, rate2;
+    int i;
+
+    make_root(root);
+    make_chip(root, 0);
+    g.chip = 0;
+    g.pin = 3;
+    g.flags = RFS_CHARDEV;
+    if (rfs_gpio_open(&g, RFS_GPIO_IN)
+        || rfs_gpio_set_edge(&g, RFS_GPIO_RISING))
+    {
+        err(1, "opening line");
+    }
+    test_batch(&g);
+    if (rfs_pulse_counter_open(&c, &g, 1) != -1 || errno != EINVAL) {
+        errx(1, "opening a counter with a too short window must fail");
+    }
+    if (rfs_pulse_counter_open(&c, &g, WINDOW)
+        || rfs_pulse_counter_start(&c))
+    {
+        err(1, "starting counter");
+    }
+    if (rfs_pulse_counter_count(&c) || rfs_pulse_counter_last_edge(&c)
+        || rfs_pulse_counter_rate(&c) != 0)
+    {
+        errx(1, "the counter must start from zero");
+    }
+    // Edges of the last 10 ms
+    t = now();
+    for (i = 9; i >= 0; i--) {
+        mock_event(mock_request(g.fd), g.pin, GPIO_V2_LINE_EVENT_RISING_EDGE,
+            t - i * 1000000);
+    }
+    wait_count(&c, 10);
+    if (rfs_pulse_counter_last_edge(&c) != t) {
+        errx(1, "wrong timestamp of the last edge");
+    }
+    // The counter was opened less than a window ago, so the rate is over the
+    // time since then
+    rate = rfs_pulse_counter_rate(&c);
+    if (rate < 10.0) {
+        errx(1, "rate of %f edges per second, too low", rate);
+    }
+    // An edge older than the window is counted, but not in the rate
+    mock_event(mock_request(g.fd), g.pin, GPIO_V2_LINE_EVENT_RISING_EDGE,
+        t - 5 * WINDOW);
+    wait_count(&c, 11);
+    rate2 = rfs_pulse_counter_rate(&c);
+    if (rate2 > rate) {
+        errx(1, "an edge older than the window is in the rate");
+    }
+    if (rfs_pulse_counter_stop(&c) || rfs_pulse_counter_close(&c)) {
+        err(1, "closing counter");
+    }
+    if (rfs_pulse_counter_count(&c) != 11) {
+        errx(1, "%llu edges counted instead of 11",
+            rfs_pulse_counter_count(&c));
+    }
+    // The pin can be used again by other loops
+    if (rfs_event_loop_open(&loop)
+        || rfs_event_loop_add(&loop, &g, ignore_event, NULL)
+        || rfs_event_loop_remove(&loop, &g) || rfs_event_loop_close(&loop))
+    {
+        err(1, "adding the pin to other loop");
+    }
+    close(mock_request(g.fd)->event_fd);
+    if (rfs_gpio_close(&g)) {
+        err(1, "closing line");
+    }
+    remove_root(root);
+    return 0;
+}
@@ -0,0 +1,257 @@
+
+#include "rfsgpio.h"
+#include "mockchardev.h"
+#include "testutil.h"
+
+#include <err.h>    // err
+#include <errno.h>  // errno
+#include <time.h>   // clock_gettime
+#include <unistd.h> // close
+
+#define PERIOD  2000
+
+uint64_t
+now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void
+line_open(struct gpio_t *g, gpio_pin_t pin, enum gpio_edge_t edge)
+{
+    g->chip = 0;
+    g->pin = pin;
+    g->flags = RFS_CHARDEV;
+    if (rfs_gpio_open(g, RFS_GPIO_IN) || rfs_gpio_set_edge(g, edge)) {
+        err(1, "opening line %u", pin);
+    }
+}
+
+void
+line_close(struct gpio_t *g)
+{
+    close(mock_request(g->fd)->event_fd);
+    if (rfs_gpio_close(g)) {
+        err(1, "closing line");
+    }
+}
+
+void
+set_debounce(struct gpio_t *g, unsigned int period)
+{
+    if (rfs_gpio_set_debounce(g, period)) {
+        err(1, "setting debounce period %u", period);
+    }
+}
+
+// Inject raw edges 100 ns apart, starting at the given value
+void
+bounce(struct gpio_t *g, enum gpio_value_t value, int n, uint64_t start)
+{
+    int i;
+
+    for (i = 0; i < n; i++, value = !value) {
+        mock_event(mock_request(g->fd), g->pin, (value == RFS_GPIO_HIGH) ?
+            GPIO_V2_LINE_EVENT_RISING_EDGE : GPIO_V2_LINE_EVENT_FALLING_EDGE,
+            start + i * 100);
+    }
+}
+
+void
+check_wait(struct gpio_t *g, int expected, enum gpio_value_t value,
+    uint64_t timestamp)
+{
+    struct gpio_event_t ev;
+    int res;
+
+    if ((res = rfs_gpio_wait_edge(g, 100, &ev)) < 0) {
+        err(1, "waiting for an edge");
+    }
+    if (res != expected) {
+        errx(1, "wait gave %d instead of %d", res, expected);
+    }
+    if (res && (ev.gpio != g || ev.value != value
+        || ev.timestamp != timestamp))
+    {
+        errx(1, "wrong event (value %d, timestamp %llu)", ev.value,
+            (unsigned long long)ev.timestamp);
+    }
+}
+
+void
+count_event(const struct gpio_event_t *event, void *data)
+{
+    (*(int *)data)++;
+}
+
+void
+test_kernel(const char *root)
+{
+    struct gpio_t g, b[3];
+    struct gpio_bank_t bank;
+    struct mock_request_t *req;
+    struct pollfd pd;
+    int i;
+
+    // The period is given to the kernel, and the line is polled as usual
+    line_open(&g, 4, RFS_GPIO_BOTH);
+    set_debounce(&g, PERIOD);
+    req = mock_request(g.fd);
+    if (req->debounce[0] != PERIOD) {
+        errx(1, "debounce attribute not set (%u)", req->debounce[0]);
+    }
+    if (rfs_gpio_get_poll_descriptors(&g, &pd) || pd.fd != g.fd) {
+        errx(1, "the line must be polled directly");
+    }
+    // The period only applies to the inputs, but it's kept for them
+    if (rfs_gpio_set_direction(&g, RFS_GPIO_OUT_LOW)) {
+        err(1, "setting direction");
+    }
+    if (req->debounce[0]) {
+        errx(1, "debounce attribute set for an output");
+    }
+    if (rfs_gpio_set_direction(&g, RFS_GPIO_IN)) {
+        err(1, "setting direction");
+    }
+    if (req->debounce[0] != PERIOD) {
+        errx(1, "debounce attribute lost");
+    }
+    set_debounce(&g, 0);
+    if (req->debounce[0]) {
+        errx(1, "debounce attribute not cleared");
+    }
+    line_close(&g);
+    // Each line of a bank gets its own period
+    for (i = 0; i < 3; i++) {
+        b[i].chip = 0;
+        b[i].pin = 10 + i;
+    }
+    bank.gpios = b;
+    bank.n = 3;
+    bank.flags = RFS_CHARDEV;
+    if (rfs_gpio_bank_open(&bank, RFS_GPIO_IN)) {
+        err(1, "opening bank");
+    }
+    set_debounce(&b[1], 100);
+    set_debounce(&b[2], 200);
+    req = mock_request(b[0].fd);
+    if (req->debounce[0] || req->debounce[1] != 100
+        || req->debounce[2] != 200)
+    {
+        errx(1, "wrong debounce attributes of the bank");
+    }
+    // Without kernel support, the lines of a bank can't be debounced
+    mock_no_debounce = 1;
+    if (rfs_gpio_set_debounce(&b[0], 100) != -1 || errno != EINVAL) {
+        errx(1, "debouncing a bank line in software must fail but does not");
+    }
+    mock_no_debounce = 0;
+    close(req->event_fd);
+    if (rfs_gpio_bank_close(&bank)) {
+        err(1, "closing bank");
+    }
+}
+
+void
+test_software(const char *root)
+{
+    struct event_loop_t loop;
+    struct gpio_t g;
+    struct pollfd pd;
+    uint64_t t;
+    int n = 0, i;
+
+    // The kernel rejects the period, so the edges are filtered in software
+    mock_no_debounce = 1;
+    line_open(&g, 5, RFS_GPIO_BOTH);
+    set_debounce(&g, PERIOD);
+    if (rfs_gpio_get_poll_descriptors(&g, &pd) || pd.fd == g.fd
+        || pd.events != POLLIN)
+    {
+        errx(1, "the line must be polled through the filter");
+    }
+    // A burst of edges gives a single event, with the first timestamp
+    t = now();
+    bounce(&g, RFS_GPIO_HIGH, 5, t);
+    check_wait(&g, 1, RFS_GPIO_HIGH, t);
+    // A glitch that ends in the same value gives no event
+    bounce(&g, RFS_GPIO_LOW, 2, now());
+    check_wait(&g, 0, RFS_GPIO_LOW, 0);
+    t = now();
+    bounce(&g, RFS_GPIO_LOW, 3, t);
+    check_wait(&g, 1, RFS_GPIO_LOW, t);
+    // With a single edge, each settled burst of that edge is an event
+    if (rfs_gpio_set_edge(&g, RFS_GPIO_RISING)) {
+        err(1, "setting edge");
+    }
+    t = now();
+    mock_event(mock_request(g.fd), g.pin, GPIO_V2_LINE_EVENT_RISING_EDGE, t);
+    check_wait(&g, 1, RFS_GPIO_HIGH, t);
+    t = now();
+    mock_event(mock_request(g.fd), g.pin, GPIO_V2_LINE_EVENT_RISING_EDGE, t);
+    check_wait(&g, 1, RFS_GPIO_HIGH, t);
+    // Event loops dispatch only the settled transitions
+    if (rfs_event_loop_open(&loop)
+        || rfs_event_loop_add(&loop, &g, count_event, &n))
+    {
+        err(1, "adding the line to an event loop");
+    }
+    if (rfs_gpio_set_debounce(&g, PERIOD) != -1 || errno != EBUSY) {
+        errx(1, "debouncing a pin of a loop must give EBUSY but does not");
+    }
+    mock_event(mock_request(g.fd), g.pin, GPIO_V2_LINE_EVENT_RISING_EDGE,
+        now());
+    for (i = 0; i < 10 && !n; i++) {
+        if (rfs_event_loop_run(&loop, 100) < 0) {
+            err(1, "running the event loop");
+        }
+    }
+    if (n != 1) {
+        errx(1, "%d events dispatched instead of 1", n);
+    }
+    if (rfs_event_loop_remove(&loop, &g) || rfs_event_loop_close(&loop)) {
+        err(1, "removing the line from the event loop");
+    }
+    // Disabling the filter polls the line directly again
+    set_debounce(&g, 0);
+    if (rfs_gpio_get_poll_descriptors(&g, &pd) || pd.fd != g.fd) {
+        errx(1, "the line must be polled directly");
+    }
+    mock_no_debounce = 0;
+    line_close(&g);
+}
+
+int
+main()
+{
+    char root[] = "/tmp/rfstest.XXXXXX";
+    struct gpio_t g;
+
+    make_root(root);
+    make_chip(root, 0);
+    test_kernel(root);
+    test_software(root);
+    // The sysfs filter needs the value file kept opened
+    make_gpio(root, 20);
+    g.pin = 20;
+    g.flags = RFS_DONT_EXPORT;
+    if (rfs_gpio_open(&g, RFS_GPIO_IN)) {
+        err(1, "opening sysfs pin");
+    }
+    if (rfs_gpio_set_debounce(&g, PERIOD) != -1 || errno != EINVAL) {
+        errx(1, "debouncing without RFS_KEEP_OPEN must fail but does not");
+    }
+    if (rfs_gpio_close(&g)) {
+        err(1, "closing sysfs pin");
+    }
+    // The registers give no edges
+    g.flags = RFS_MMIO;
+    if (rfs_gpio_set_debounce(&g, PERIOD) != -1 || errno != ENOTSUP) {
+        errx(1, "debouncing with RFS_MMIO must give ENOTSUP but does not");
+    }
+    remove_root(root);
+    return 0;
+}
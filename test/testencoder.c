@@ -0,0 +1,123 @@
+
+#include "rfsgpio.h"
+#include "mockchardev.h"
+#include "testutil.h"
+
+#include <err.h>    // err
+#include <time.h>   // nanosleep
+#include <unistd.h> // close
+
+#define MS  1000000ULL
+
+uint64_t
+now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void
+edge(struct gpio_t *g, enum gpio_value_t value, uint64_t timestamp)
+{
+    mock_event(mock_request(g->fd), g->pin, (value == RFS_GPIO_HIGH) ?
+        GPIO_V2_LINE_EVENT_RISING_EDGE : GPIO_V2_LINE_EVENT_FALLING_EDGE,
+        timestamp);
+}
+
+// Wait until the decoder thread has decoded the edges given
+void
+wait_decoded(struct encoder_t *e, long long position, unsigned long illegal)
+{
+    struct timespec ts = {0, 1000000};
+    int i;
+
+    for (i = 0; i < 1000; i++) {
+        if (rfs_encoder_position(e) == position
+            && rfs_encoder_illegal(e) == illegal)
+        {
+            return;
+        }
+        nanosleep(&ts, NULL);
+    }
+    errx(1, "position %lld and %lu illegal transitions instead of %lld and "
+        "%lu", rfs_encoder_position(e), rfs_encoder_illegal(e), position,
+        illegal);
+}
+
+// A full cycle forward (A leading B) or backward, one edge per ms
+void
+cycle(struct gpio_t *a, struct gpio_t *b, int forward, uint64_t t)
+{
+    struct gpio_t *first = forward ? a : b, *second = forward ? b : a;
+
+    edge(first, RFS_GPIO_HIGH, t);
+    edge(second, RFS_GPIO_HIGH, t + MS);
+    edge(first, RFS_GPIO_LOW, t + 2 * MS);
+    edge(second, RFS_GPIO_LOW, t + 3 * MS);
+}
+
+int
+main()
+{
+    char root[] = "/tmp/rfstest.XXXXXX";
+    struct gpio_bank_t bank;
+    struct gpio_t g[2], *a = &g[0], *b = &g[1];
+    struct encoder_t e;
+    double v;
+    uint64_t t;
+
+    make_root(root);
+    make_chip(root, 0);
+    // Both channels in the same line request, so their edges come in order
+    g[0].chip = g[1].chip = 0;
+    g[0].pin = 0;
+    g[1].pin = 1;
+    bank.gpios = g;
+    bank.n = 2;
+    bank.flags = RFS_CHARDEV;
+    if (rfs_gpio_bank_open(&bank, RFS_GPIO_IN)) {
+        err(1, "opening lines");
+    }
+    if (rfs_encoder_open(&e, a, b) || rfs_encoder_start(&e)) {
+        err(1, "starting encoder");
+    }
+    if (rfs_gpio_get_edge(a) != RFS_GPIO_BOTH
+        || rfs_gpio_get_edge(b) != RFS_GPIO_BOTH)
+    {
+        errx(1, "the encoder must set both edges");
+    }
+    // The velocity comes from the edge timestamps (in the future here, so it
+    // doesn't decay while the test runs): 3 steps in 3 ms
+    t = now() + 1000 * MS;
+    cycle(a, b, 1, t);
+    wait_decoded(&e, 4, 0);
+    v = rfs_encoder_velocity(&e);
+    if (v < 999.0 || v > 1001.0) {
+        errx(1, "velocity of %f steps per second instead of 1000", v);
+    }
+    // Backward, with edges of the past: the velocity decays to at most a
+    // step since the last one
+    t = now() - 1000 * MS;
+    cycle(a, b, 0, t);
+    cycle(a, b, 0, t + 4 * MS);
+    wait_decoded(&e, -4, 0);
+    v = rfs_encoder_velocity(&e);
+    if (v >= 0 || v < -2.0) {
+        errx(1, "velocity of %f steps per second, not decayed", v);
+    }
+    // A lost edge is an illegal transition, and not a step
+    edge(a, RFS_GPIO_HIGH, now());
+    edge(a, RFS_GPIO_HIGH, now());
+    wait_decoded(&e, -3, 1);
+    if (rfs_encoder_stop(&e) || rfs_encoder_close(&e)) {
+        err(1, "closing encoder");
+    }
+    close(mock_request(a->fd)->event_fd);
+    if (rfs_gpio_bank_close(&bank)) {
+        err(1, "closing lines");
+    }
+    remove_root(root);
+    return 0;
+}
@@ -0,0 +1,154 @@
+
+#include "rfsgpio.h"
+#include "mockchardev.h"
+#include "testutil.h"
+
+#include <err.h>    // err
+#include <errno.h>  // errno
+
+#define NPINS   4
+
+// Number of events received by each pin, and value of the last one
+int counts[NPINS + 1];
+int values[NPINS + 1];
+
+void
+on_event(const struct gpio_event_t *event, void *data)
+{
+    int i = *(int *)data;
+
+    counts[i]++;
+    values[i] = event->value;
+}
+
+void
+gpio_open(struct gpio_t *g, gpio_pin_t pin)
+{
+    g->chip = 0;
+    g->pin = pin;
+    g->flags = RFS_CHARDEV;
+    if (rfs_gpio_open(g, RFS_GPIO_IN) || rfs_gpio_set_edge(g, RFS_GPIO_BOTH)) {
+        err(1, "opening line %u", pin);
+    }
+}
+
+void
+check_run(struct event_loop_t *loop, int expected)
+{
+    int n;
+
+    if ((n = rfs_event_loop_run(loop, 100)) != expected) {
+        errx(1, "%d events dispatched instead of %d", n, expected);
+    }
+}
+
+void
+check_count(int i, int count, int value)
+{
+    if (counts[i] != count || values[i] != value) {
+        errx(1, "pin %d got %d events (last %d) instead of %d (last %d)", i,
+            counts[i], values[i], count, value);
+    }
+}
+
+int
+main()
+{
+    char root[] = "/tmp/rfstest.XXXXXX";
+    int ids[NPINS + 1] = {0, 1, 2, 3, 4};
+    struct gpio_t g[NPINS], bg[2], legacy;
+    struct gpio_bank_t bank;
+    struct gpio_event_t ev;
+    struct event_loop_t loop;
+    int i;
+
+    make_root(root);
+    make_chip(root, 0);
+    make_gpio(root, 40);
+    if (rfs_event_loop_open(&loop)) {
+        err(1, "opening event loop");
+    }
+    for (i = 0; i < NPINS; i++) {
+        gpio_open(&g[i], i);
+        if (rfs_event_loop_add(&loop, &g[i], on_event, &ids[i])) {
+            err(1, "adding pin %d", i);
+        }
+    }
+    // Nothing to dispatch
+    check_run(&loop, 0);
+    // Events of several pins in a single wait
+    mock_event(mock_request(g[1].fd), 1, GPIO_V2_LINE_EVENT_RISING_EDGE, 1);
+    mock_event(mock_request(g[3].fd), 3, GPIO_V2_LINE_EVENT_RISING_EDGE, 2);
+    check_run(&loop, 2);
+    check_count(1, 1, RFS_GPIO_HIGH);
+    check_count(3, 1, RFS_GPIO_HIGH);
+    check_count(0, 0, 0);
+    // The descriptors are rearmed after each event
+    check_run(&loop, 0);
+    mock_event(mock_request(g[1].fd), 1, GPIO_V2_LINE_EVENT_FALLING_EDGE, 3);
+    check_run(&loop, 1);
+    check_count(1, 2, RFS_GPIO_LOW);
+    // A pin can't be added twice
+    if (rfs_event_loop_add(&loop, &g[1], on_event, &ids[1]) != -1
+        || errno != EEXIST)
+    {
+        errx(1, "adding a pin twice must give EEXIST but does not");
+    }
+    // Removed pins are not dispatched anymore
+    if (rfs_event_loop_remove(&loop, &g[1])) {
+        err(1, "removing pin");
+    }
+    mock_event(mock_request(g[1].fd), 1, GPIO_V2_LINE_EVENT_RISING_EDGE, 4);
+    check_run(&loop, 0);
+    // But its events can still be waited for
+    if (rfs_gpio_wait_edge(&g[1], 100, &ev) != 1 || ev.gpio != &g[1]
+        || ev.value != RFS_GPIO_HIGH || ev.timestamp != 4)
+    {
+        errx(1, "wrong wait for edge");
+    }
+    if (rfs_gpio_wait_edge(&g[1], 0, &ev) != 0) {
+        errx(1, "wait for edge must time out but does not");
+    }
+    // Pins of a bank share the descriptor, each one gets its events
+    for (i = 0; i < 2; i++) {
+        bg[i].chip = 0;
+        bg[i].pin = 10 + i;
+    }
+    bank.gpios = bg;
+    bank.n = 2;
+    bank.flags = RFS_CHARDEV;
+    if (rfs_gpio_bank_open(&bank, RFS_GPIO_IN)
+        || rfs_gpio_set_edge(&bg[0], RFS_GPIO_BOTH)
+        || rfs_gpio_set_edge(&bg[1], RFS_GPIO_BOTH)
+        || rfs_event_loop_add(&loop, &bg[0], on_event, &ids[0])
+        || rfs_event_loop_add(&loop, &bg[1], on_event, &ids[4]))
+    {
+        err(1, "adding bank");
+    }
+    mock_event(mock_request(bg[0].fd), 11, GPIO_V2_LINE_EVENT_RISING_EDGE, 5);
+    check_run(&loop, 1);
+    check_count(4, 1, RFS_GPIO_HIGH);
+    check_count(0, 0, 0);
+    if (rfs_event_loop_remove(&loop, &bg[1])) {
+        err(1, "removing pin of the bank");
+    }
+    mock_event(mock_request(bg[0].fd), 10, GPIO_V2_LINE_EVENT_RISING_EDGE, 6);
+    check_run(&loop, 1);
+    check_count(0, 1, RFS_GPIO_HIGH);
+    // Sysfs pins must be kept opened
+    legacy.pin = 40;
+    legacy.flags = RFS_DONT_EXPORT;
+    if (rfs_gpio_open(&legacy, RFS_GPIO_IN)) {
+        err(1, "opening sysfs pin");
+    }
+    if (rfs_event_loop_add(&loop, &legacy, on_event, &ids[0]) != -1
+        || errno != EINVAL)
+    {
+        errx(1, "adding a sysfs pin without RFS_KEEP_OPEN must fail");
+    }
+    if (rfs_event_loop_close(&loop)) {
+        err(1, "closing event loop");
+    }
+    remove_root(root);
+    return 0;
+}
@@ -0,0 +1,258 @@
+
+#define _GNU_SOURCE
+
+#include "rfsgpio.h"
+#include "testutil.h"
+
+#include <dlfcn.h>          // dlsym
+#include <err.h>            // err
+#include <errno.h>          // errno
+#include <stdarg.h>         // va_list
+#include <stdio.h>          // snprintf
+#include <string.h>         // strncmp
+#include <sys/syscall.h>    // SYS_io_uring_enter
+
+#define NPINS   4
+
+// Number of the next io_uring_enter calls that fail, as when the kernel
+// can't allocate the requests. The syscalls are interposed through the libc
+// wrapper
+int enter_failures = 0;
+
+long
+syscall(long number, ...)
+{
+    static long (*real_syscall)(long, ...) = NULL;
+    long a[6];
+    va_list ap;
+    int i;
+
+    va_start(ap, number);
+    for (i = 0; i < 6; i++) {
+        a[i] = va_arg(ap, long);
+    }
+    va_end(ap);
+    if (number == SYS_io_uring_enter && enter_failures > 0) {
+        enter_failures--;
+        errno = EAGAIN;
+        return -1;
+    }
+    if (!real_syscall) {
+        real_syscall = dlsym(RTLD_NEXT, "syscall");
+    }
+    return real_syscall(number, a[0], a[1], a[2], a[3], a[4], a[5]);
+}
+
+void
+check_file(const char *root, const char *path, const char *expected)
+{
+    char val[16];
+
+    // The fake files are not truncated when written, only the start counts
+    read_file(root, path, val, sizeof(val));
+    if (strncmp(val, expected, strlen(expected)) != 0) {
+        errx(1, "%s is %s instead of %s", path, val, expected);
+    }
+}
+
+void
+test_batch(const char *root, int flags)
+{
+    struct gpio_t g[NPINS + 1];
+    struct pwm_t p[2];
+    struct io_batch_t b;
+    char path[64];
+    int values[NPINS + 1];
+    int i;
+
+    if (rfs_io_batch_open(&b, flags)) {
+        err(1, "opening batch");
+    }
+    // The last pin is not kept opened, so it is written synchronously
+    for (i = 0; i <= NPINS; i++) {
+        g[i].pin = 10 + i;
+        g[i].flags = RFS_DONT_EXPORT | (i < NPINS ? RFS_KEEP_OPEN : 0);
+        if (rfs_gpio_open(&g[i], RFS_GPIO_OUT_LOW)) {
+            err(1, "opening pin %d", 10 + i);
+        }
+    }
+    for (i = 0; i < 2; i++) {
+        p[i].chip = 0;
+        p[i].channel = i;
+        p[i].flags = RFS_DONT_EXPORT | RFS_KEEP_OPEN | RFS_CACHE;
+        p[i].period = 1000;
+        if (rfs_pwm_open(&p[i])) {
+            err(1, "opening channel %d", i);
+        }
+    }
+    // A control cycle
+    for (i = 0; i <= NPINS; i++) {
+        if (rfs_io_batch_gpio_set_value(&b, &g[i], i & 1)) {
+            err(1, "queuing value");
+        }
+    }
+    if (rfs_io_batch_pwm_set_duty_cycle(&b, &p[0], 250)
+        || rfs_io_batch_pwm_set_duty_cycle(&b, &p[1], 750))
+    {
+        err(1, "queuing duty cycle");
+    }
+    if (rfs_io_batch_submit(&b)) {
+        err(1, "submitting batch");
+    }
+    // Everything on files kept opened is submitted with one syscall
+    if (b.enters != (b.ring ? 1 : 0)) {
+        errx(1, "%lu io_uring_enter calls", b.enters);
+    }
+    for (i = 0; i <= NPINS; i++) {
+        snprintf(path, sizeof(path), "sys/class/gpio/gpio%d/value", 10 + i);
+        check_file(root, path, (i & 1) ? "1" : "0");
+    }
+    check_file(root, "sys/class/pwm/pwmchip0/pwm0/duty_cycle", "250");
+    check_file(root, "sys/class/pwm/pwmchip0/pwm1/duty_cycle", "750");
+    if (p[1].cached_duty_cycle != 750) {
+        errx(1, "duty cycle not cached");
+    }
+    // Reads
+    for (i = 0; i <= NPINS; i++) {
+        snprintf(path, sizeof(path), "sys/class/gpio/gpio%d/value", 10 + i);
+        write_file(root, path, (i & 1) ? "0\n" : "1\n");
+        if (rfs_io_batch_gpio_get_value(&b, &g[i], &values[i])) {
+            err(1, "queuing read");
+        }
+    }
+    if (rfs_io_batch_submit(&b)) {
+        err(1, "submitting batch");
+    }
+    for (i = 0; i <= NPINS; i++) {
+        if (values[i] != !(i & 1) || b.ops[i].error) {
+            errx(1, "wrong value %d of pin %d", values[i], 10 + i);
+        }
+    }
+    // Wrong values and full batches
+    if (rfs_io_batch_gpio_set_value(&b, &g[0], 2) != -1 || errno != EINVAL) {
+        errx(1, "queuing a wrong value must give EINVAL but does not");
+    }
+    for (i = 0; i < RFS_IO_BATCH_MAX_OPS; i++) {
+        if (rfs_io_batch_pwm_set_duty_cycle(&b, &p[0], 500)) {
+            err(1, "queuing duty cycle");
+        }
+    }
+    if (rfs_io_batch_pwm_set_duty_cycle(&b, &p[0], 500) != -1
+        || errno != ENOSPC)
+    {
+        errx(1, "queuing in a full batch must give ENOSPC but does not");
+    }
+    if (rfs_io_batch_close(&b)) {
+        err(1, "closing batch");
+    }
+    for (i = 0; i <= NPINS; i++) {
+        rfs_gpio_close(&g[i]);
+    }
+    rfs_pwm_close(&p[0]);
+    rfs_pwm_close(&p[1]);
+}
+
+// A descriptor closed and reused by another pin between two submissions
+// must reach the new pin
+void
+test_reuse(const char *root, int flags)
+{
+    struct io_batch_t b;
+    struct gpio_t g;
+    int i, fd = -1;
+
+    if (rfs_io_batch_open(&b, flags)) {
+        err(1, "opening batch");
+    }
+    for (i = 0; i < 2; i++) {
+        g.pin = 20 + i;
+        g.flags = RFS_DONT_EXPORT | RFS_KEEP_OPEN;
+        if (rfs_gpio_open(&g, RFS_GPIO_OUT_LOW)) {
+            err(1, "opening pin %d", 20 + i);
+        }
+        if (i && g.fd != fd) {
+            errx(1, "descriptor %d not reused (%d)", fd, g.fd);
+        }
+        fd = g.fd;
+        if (rfs_io_batch_gpio_set_value(&b, &g, RFS_GPIO_HIGH)
+            || rfs_io_batch_submit(&b) || b.ops[0].error)
+        {
+            err(1, "writing pin %d", 20 + i);
+        }
+        if (rfs_gpio_close(&g)) {
+            err(1, "closing pin %d", 20 + i);
+        }
+    }
+    check_file(root, "sys/class/gpio/gpio21/value", "1");
+    if (rfs_io_batch_close(&b)) {
+        err(1, "closing batch");
+    }
+}
+
+// The operations of a failed submission are not left in the rings for the
+// next one
+void
+test_failure(const char *root)
+{
+    struct io_batch_t b;
+    struct gpio_t g[2];
+    int i;
+
+    if (rfs_io_batch_open(&b, 0)) {
+        err(1, "opening batch");
+    }
+    for (i = 0; i < 2; i++) {
+        write_file(root, i ? "sys/class/gpio/gpio21/value"
+            : "sys/class/gpio/gpio20/value", "0\n");
+        g[i].pin = 20 + i;
+        g[i].flags = RFS_DONT_EXPORT | RFS_KEEP_OPEN;
+        if (rfs_gpio_open(&g[i], RFS_GPIO_OUT_LOW)) {
+            err(1, "opening pin %d", 20 + i);
+        }
+    }
+    enter_failures = 1;
+    if (rfs_io_batch_gpio_set_value(&b, &g[0], RFS_GPIO_HIGH)) {
+        err(1, "queuing value");
+    }
+    if (b.ring && (rfs_io_batch_submit(&b) != -1 || errno != EAGAIN
+        || b.ops[0].error != EAGAIN))
+    {
+        errx(1, "a failed submission must give EAGAIN but does not");
+    }
+    enter_failures = 0;
+    b.n = 0;
+    if (rfs_io_batch_gpio_set_value(&b, &g[1], RFS_GPIO_HIGH)
+        || rfs_io_batch_submit(&b) || b.ops[0].error)
+    {
+        err(1, "writing pin 21");
+    }
+    check_file(root, "sys/class/gpio/gpio20/value", "0");
+    check_file(root, "sys/class/gpio/gpio21/value", "1");
+    if (rfs_io_batch_close(&b) || rfs_gpio_close(&g[0])
+        || rfs_gpio_close(&g[1]))
+    {
+        err(1, "closing");
+    }
+}
+
+int
+main()
+{
+    char root[] = "/tmp/rfstest.XXXXXX";
+    int i;
+
+    make_root(root);
+    for (i = 0; i <= NPINS; i++) {
+        make_gpio(root, 10 + i);
+    }
+    make_gpio(root, 20);
+    make_gpio(root, 21);
+    make_pwm(root, 0, 0);
+    make_pwm(root, 0, 1);
+    test_batch(root, 0);
+    test_batch(root, RFS_IO_SYNC);
+    test_reuse(root, 0);
+    test_failure(root);
+    remove_root(root);
+    return 0;
+}
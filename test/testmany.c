@@ -0,0 +1,109 @@
+
+#include "rfsgpio.h"
+#include "testutil.h"
+
+#include <err.h>    // err
+#include <errno.h>  // errno
+#include <stdio.h>  // snprintf
+#include <string.h> // strcmp
+
+#define NPINS   8
+
+void
+test_gpio(const char *root)
+{
+    struct gpio_t g[NPINS];
+    int errors[NPINS];
+    char path[64], val[8];
+    int i;
+
+    write_file(root, "sys/class/gpio/export", "");
+    write_file(root, "sys/class/gpio/unexport", "");
+    for (i = 0; i < NPINS; i++) {
+        make_gpio(root, 20 + i);
+        g[i].pin = 20 + i;
+        g[i].flags = (i & 1) ? RFS_KEEP_OPEN : 0;
+    }
+    if (rfs_gpio_open_many(g, NPINS, RFS_GPIO_OUT_HIGH, errors)) {
+        err(1, "opening pins");
+    }
+    for (i = 0; i < NPINS; i++) {
+        snprintf(path, sizeof(path), "sys/class/gpio/gpio%u/direction",
+            20 + i);
+        read_file(root, path, val, sizeof(val));
+        if (errors[i] || strcmp(val, "high") != 0) {
+            errx(1, "pin %d not opened", 20 + i);
+        }
+    }
+    // The pins are unexported through the same descriptor, the last one is
+    // the last written
+    if (rfs_gpio_close_many(g, NPINS, errors)) {
+        err(1, "closing pins");
+    }
+    read_file(root, "sys/class/gpio/unexport", val, sizeof(val));
+    if (strcmp(val, "27") != 0) {
+        errx(1, "wrong last unexported pin %s", val);
+    }
+    // A missing pin makes the whole set fail, and the others are closed
+    if (rfs_set_wait_timeout(0)) {
+        err(1, "setting wait timeout");
+    }
+    g[3].pin = 99;
+    write_file(root, "sys/class/gpio/unexport", "");
+    if (rfs_gpio_open_many(g, NPINS, RFS_GPIO_OUT_HIGH, errors) != -1
+        || errno != ENOENT || errors[3] != ENOENT || errors[2] != 0)
+    {
+        errx(1, "opening a set with a missing pin must fail but does not");
+    }
+    read_file(root, "sys/class/gpio/unexport", val, sizeof(val));
+    if (strcmp(val, "27") != 0) {
+        errx(1, "pins not closed after failing");
+    }
+}
+
+void
+test_pwm(const char *root)
+{
+    struct pwm_t p[4];
+    int errors[4];
+    int i;
+
+    // Channels of two chips
+    for (i = 0; i < 4; i++) {
+        p[i].chip = i / 2;
+        p[i].channel = i % 2;
+        p[i].flags = RFS_DONT_EXPORT;
+        p[i].period = 1000;
+        make_pwm(root, p[i].chip, p[i].channel);
+    }
+    if (rfs_pwm_open_many(p, 4, errors)) {
+        err(1, "opening channels");
+    }
+    for (i = 0; i < 4; i++) {
+        if (rfs_pwm_get_period(&p[i]) != 1000
+            || rfs_pwm_get_enabled(&p[i]) != RFS_PWM_ENABLED)
+        {
+            errx(1, "channel %d not opened", i);
+        }
+    }
+    if (rfs_pwm_close_many(p, 4, NULL)) {
+        err(1, "closing channels");
+    }
+    for (i = 0; i < 4; i++) {
+        if (rfs_pwm_get_enabled(&p[i]) != RFS_PWM_DISABLED) {
+            errx(1, "channel %d not closed", i);
+        }
+    }
+}
+
+int
+main()
+{
+    char root[] = "/tmp/rfstest.XXXXXX";
+
+    make_root(root);
+    test_gpio(root);
+    test_pwm(root);
+    remove_root(root);
+    return 0;
+}
@@ -0,0 +1,194 @@
+
+#include "rfsgpio.h"
+#include "testutil.h"
+
+#include <err.h>        // err
+#include <errno.h>      // errno
+#include <fcntl.h>      // open
+#include <stdio.h>      // snprintf
+#include <unistd.h>     // pread
+
+#define BCM_FSEL    0x00
+#define BCM_SET     0x1c
+#define BCM_CLR     0x28
+#define BCM_LEV     0x34
+
+// Registers of the fake controller, a regular file mapped by the library
+static int regs_fd;
+
+uint32_t
+reg(unsigned long offset)
+{
+    uint32_t r;
+
+    if (pread(regs_fd, &r, sizeof(r), offset) != sizeof(r)) {
+        err(1, "reading register %#lx", offset);
+    }
+    return r;
+}
+
+void
+set_reg(unsigned long offset, uint32_t r)
+{
+    if (pwrite(regs_fd, &r, sizeof(r), offset) != sizeof(r)) {
+        err(1, "writing register %#lx", offset);
+    }
+}
+
+void
+check_reg(unsigned long offset, uint32_t expected)
+{
+    uint32_t r = reg(offset);
+
+    if (r != expected) {
+        errx(1, "register %#lx is %#x instead of %#x", offset, r, expected);
+    }
+}
+
+void
+make_regs(const char *root)
+{
+    char path[64];
+
+    write_file(root, "dev/gpiomem", "");
+    snprintf(path, sizeof(path), "%s/dev/gpiomem", root);
+    if ((regs_fd = open(path, O_RDWR)) < 0 || ftruncate(regs_fd, 4096)) {
+        err(1, "creating registers file");
+    }
+}
+
+void
+test_pin(void)
+{
+    struct gpio_t g;
+    struct pollfd pd;
+
+    g.pin = 17;
+    g.flags = RFS_MMIO;
+    if (rfs_gpio_open(&g, RFS_GPIO_OUT_HIGH)) {
+        err(1, "opening pin");
+    }
+    // Pin 17 is in the second function select register, bits 21 to 23
+    check_reg(BCM_FSEL + 4, 1 << 21);
+    check_reg(BCM_SET, 1 << 17);
+    if (rfs_gpio_get_direction(&g) != RFS_GPIO_OUT) {
+        errx(1, "wrong direction");
+    }
+    if (rfs_gpio_set_value(&g, RFS_GPIO_LOW)) {
+        err(1, "setting value");
+    }
+    check_reg(BCM_CLR, 1 << 17);
+    // The value is read from the level register
+    set_reg(BCM_LEV, 1 << 17);
+    if (rfs_gpio_get_value(&g) != RFS_GPIO_HIGH) {
+        errx(1, "wrong value");
+    }
+    set_reg(BCM_LEV, 0);
+    if (rfs_gpio_get_value(&g) != RFS_GPIO_LOW) {
+        errx(1, "wrong value");
+    }
+    // There are no edges
+    if (rfs_gpio_set_edge(&g, RFS_GPIO_BOTH) != -1 || errno != ENOTSUP
+        || rfs_gpio_get_poll_descriptors(&g, &pd) != -1 || errno != ENOTSUP)
+    {
+        errx(1, "edges must not be supported but are");
+    }
+    // The layout can't be changed with opened pins
+    if (rfs_mmio_set_layout(&rfs_mmio_bcm2835) != -1 || errno != EBUSY) {
+        errx(1, "changing the layout must give EBUSY but does not");
+    }
+    if (rfs_gpio_close(&g)) {
+        err(1, "closing pin");
+    }
+    check_reg(BCM_FSEL + 4, 0);
+    // Pins out of the controller
+    g.pin = 60;
+    if (rfs_gpio_open(&g, RFS_GPIO_IN) != -1 || errno != EINVAL) {
+        errx(1, "opening a missing pin must give EINVAL but does not");
+    }
+}
+
+void
+test_bank(void)
+{
+    struct gpio_t g[4];
+    struct gpio_bank_t b;
+    uint64_t bits;
+
+    // Pins of both set and clear registers
+    g[0].pin = 4;
+    g[1].pin = 5;
+    g[2].pin = 40;
+    g[3].pin = 41;
+    b.gpios = g;
+    b.n = 4;
+    b.flags = RFS_MMIO;
+    if (rfs_gpio_bank_open(&b, RFS_GPIO_OUT_LOW)) {
+        err(1, "opening bank");
+    }
+    check_reg(BCM_FSEL, (1 << 12) | (1 << 15));
+    check_reg(BCM_FSEL + 16, (1 << 0) | (1 << 3));
+    if (rfs_gpio_bank_set(&b, 0xf, 0x5)) {
+        err(1, "setting bank");
+    }
+    check_reg(BCM_SET, 1 << 4);
+    check_reg(BCM_SET + 4, 1 << 8);
+    check_reg(BCM_CLR, 1 << 5);
+    check_reg(BCM_CLR + 4, 1 << 9);
+    set_reg(BCM_LEV, 1 << 5);
+    set_reg(BCM_LEV + 4, 1 << 8);
+    if (rfs_gpio_bank_get(&b, &bits) || bits != 0x6) {
+        errx(1, "wrong bank values");
+    }
+    if (rfs_gpio_bank_close(&b)) {
+        err(1, "closing bank");
+    }
+}
+
+void
+check_wrong_layout(const struct mmio_layout_t *layout, const char *what)
+{
+    if (rfs_mmio_set_layout(layout) != -1 || errno != EINVAL) {
+        errx(1, "%s must give EINVAL but does not", what);
+    }
+}
+
+void
+test_layout(void)
+{
+    struct mmio_layout_t layout;
+
+    layout = rfs_mmio_bcm2835;
+    layout.lev = 0xb0;
+    check_wrong_layout(&layout, "level registers out of the block");
+    layout = rfs_mmio_bcm2835;
+    layout.set = 0x1e;
+    check_wrong_layout(&layout, "unaligned set registers");
+    layout = rfs_mmio_bcm2835;
+    layout.fsel = 0xa0;
+    check_wrong_layout(&layout, "function select registers out of the block");
+    layout = rfs_mmio_bcm2835;
+    layout.fsel_output = 8;
+    check_wrong_layout(&layout, "a function that doesn't fit");
+    layout = rfs_mmio_bcm2835;
+    layout.clr = ~0UL;
+    check_wrong_layout(&layout, "clear registers past the address space");
+    if (rfs_mmio_set_layout(&rfs_mmio_bcm2835)) {
+        err(1, "setting layout");
+    }
+}
+
+int
+main()
+{
+    char root[] = "/tmp/rfstest.XXXXXX";
+
+    make_root(root);
+    make_regs(root);
+    test_layout();
+    test_pin();
+    test_bank();
+    close(regs_fd);
+    remove_root(root);
+    return 0;
+}
@@ -0,0 +1,144 @@
+
+#include "rfsgpio.h"
+#include "mockchardev.h"
+#include "testutil.h"
+
+#include <err.h>    // err
+#include <errno.h>  // errno
+#include <time.h>   // nanosleep
+#include <unistd.h> // close
+
+// Wait until the capture thread has measured n pulses
+void
+wait_pulses(struct pulse_capture_t *c, unsigned long n)
+{
+    struct timespec ts = {0, 1000000};
+    int i;
+
+    for (i = 0; i < 1000; i++) {
+        if (__atomic_load_n(&c->head, __ATOMIC_ACQUIRE)
+            + rfs_pulse_capture_overflows(c) >= n)
+        {
+            return;
+        }
+        nanosleep(&ts, NULL);
+    }
+    errx(1, "pulses not measured");
+}
+
+void
+edge(struct gpio_t *g, enum gpio_value_t value, uint64_t timestamp)
+{
+    mock_event(mock_request(g->fd), g->pin, (value == RFS_GPIO_HIGH) ?
+        GPIO_V2_LINE_EVENT_RISING_EDGE : GPIO_V2_LINE_EVENT_FALLING_EDGE,
+        timestamp);
+}
+
+void
+check_pulse(const struct pulse_t *p, uint64_t start, uint64_t width,
+    uint64_t period)
+{
+    if (p->start != start || p->width != width || p->period != period) {
+        errx(1, "wrong pulse (start %llu, width %llu, period %llu)",
+            (unsigned long long)p->start, (unsigned long long)p->width,
+            (unsigned long long)p->period);
+    }
+}
+
+void
+test_gpio(const char *root)
+{
+    struct pulse_capture_t c;
+    struct pulse_t pulses[8];
+    struct gpio_t g;
+    unsigned long n;
+
+    make_chip(root, 0);
+    g.chip = 0;
+    g.pin = 7;
+    g.flags = RFS_CHARDEV;
+    if (rfs_gpio_open(&g, RFS_GPIO_IN)) {
+        err(1, "opening line");
+    }
+    if (rfs_pulse_capture_open(&c, &g, 0) != -1 || errno != EINVAL) {
+        errx(1, "opening an empty capture must give EINVAL but does not");
+    }
+    if (rfs_pulse_capture_open(&c, &g, 4) || rfs_pulse_capture_start(&c)) {
+        err(1, "starting capture");
+    }
+    if (rfs_gpio_get_edge(&g) != RFS_GPIO_BOTH) {
+        errx(1, "the capture must set both edges");
+    }
+    // A falling edge first is ignored, then each pulse has its width and the
+    // period since the previous one
+    edge(&g, RFS_GPIO_LOW, 500);
+    edge(&g, RFS_GPIO_HIGH, 1000);
+    edge(&g, RFS_GPIO_LOW, 1500);
+    edge(&g, RFS_GPIO_HIGH, 3000);
+    edge(&g, RFS_GPIO_LOW, 3700);
+    wait_pulses(&c, 2);
+    if ((n = rfs_pulse_capture_read(&c, pulses, 8)) != 2) {
+        errx(1, "%lu pulses read instead of 2", n);
+    }
+    check_pulse(&pulses[0], 1000, 500, 0);
+    check_pulse(&pulses[1], 3000, 700, 2000);
+    // A lost falling edge makes the period unknown
+    edge(&g, RFS_GPIO_HIGH, 5000);
+    edge(&g, RFS_GPIO_HIGH, 6000);
+    edge(&g, RFS_GPIO_LOW, 6100);
+    wait_pulses(&c, 3);
+    if (rfs_pulse_capture_read(&c, pulses, 8) != 1) {
+        errx(1, "wrong number of pulses after a lost edge");
+    }
+    check_pulse(&pulses[0], 6000, 100, 0);
+    if (rfs_pulse_capture_stop(&c) || rfs_pulse_capture_close(&c)) {
+        err(1, "closing capture");
+    }
+    close(mock_request(g.fd)->event_fd);
+    if (rfs_gpio_close(&g)) {
+        err(1, "closing line");
+    }
+}
+
+void
+test_pwm(const char *root)
+{
+    pwm_time_t period, duty_cycle;
+    struct pwm_t p;
+
+    make_pwm(root, 0, 1);
+    p.chip = 0;
+    p.channel = 1;
+    p.flags = RFS_DONT_EXPORT;
+    p.period = 1000000;
+    if (rfs_pwm_open(&p)) {
+        err(1, "opening PWM channel");
+    }
+    // Without a capture file, the controller doesn't support it
+    if (rfs_pwm_capture(&p, &period, &duty_cycle) != -1) {
+        errx(1, "capturing without support must fail but does not");
+    }
+    write_file(root, "sys/class/pwm/pwmchip0/pwm1/capture", "20000 5000\n");
+    if (rfs_pwm_capture(&p, &period, &duty_cycle)) {
+        err(1, "capturing");
+    }
+    if (period != 20000 || duty_cycle != 5000) {
+        errx(1, "wrong capture (period %d, duty cycle %d)", period,
+            duty_cycle);
+    }
+    if (rfs_pwm_close(&p)) {
+        err(1, "closing PWM channel");
+    }
+}
+
+int
+main()
+{
+    char root[] = "/tmp/rfstest.XXXXXX";
+
+    make_root(root);
+    test_gpio(root);
+    test_pwm(root);
+    remove_root(root);
+    return 0;
+}
@@ -0,0 +1,162 @@
+
+#include "rfsgpio.h"
+#include "testutil.h"
+
+#include <err.h>    // err
+#include <errno.h>  // errno
+#include <stdio.h>  // snprintf
+#include <time.h>   // nanosleep
+#include <unistd.h> // unlink
+
+#define PERIOD      1000000
+#define DURATION    20000000
+
+void
+pwm_open(struct pwm_t *p, const char *root, pwm_chip_t chip,
+    pwm_channel_t channel)
+{
+    make_pwm(root, chip, channel);
+    p->chip = chip;
+    p->channel = channel;
+    p->flags = RFS_DONT_EXPORT | RFS_KEEP_OPEN;
+    p->period = PERIOD;
+    if (rfs_pwm_open(p)) {
+        err(1, "opening PWM channel %u of chip %u", channel, chip);
+    }
+}
+
+void
+play(struct pwm_sequencer_t *s, struct pwm_sequence_t *q, struct pwm_t *p,
+    enum pwm_ramp_t ramp, pwm_time_t from, pwm_time_t to)
+{
+    q->pwm = p;
+    q->ramp = ramp;
+    q->from = from;
+    q->to = to;
+    q->duration = DURATION;
+    if (rfs_pwm_sequencer_play(s, q)) {
+        err(1, "playing sequence");
+    }
+}
+
+// Wait until a sequence ends
+void
+wait_sequence(struct pwm_sequence_t *q)
+{
+    struct timespec ts = {0, 1000000};
+    int i;
+
+    for (i = 0; i < 1000; i++) {
+        if (!rfs_pwm_sequence_playing(q)) {
+            return;
+        }
+        nanosleep(&ts, NULL);
+    }
+    errx(1, "sequence not finished");
+}
+
+void
+check_duty_cycle(struct pwm_t *p, pwm_time_t expected)
+{
+    int d = rfs_pwm_get_duty_cycle(p);
+
+    if (d != expected) {
+        errx(1, "duty cycle of channel %u of chip %u is %d instead of %d",
+            p->channel, p->chip, d, expected);
+    }
+}
+
+int
+main()
+{
+    char root[] = "/tmp/rfstest.XXXXXX";
+    const pwm_time_t table[] = {0, 500000, 250000};
+    struct pwm_sequencer_t s;
+    struct pwm_sequence_t q[3];
+    struct pwm_t p[3];
+    unsigned long writes;
+    char path[96];
+    int i;
+
+    make_root(root);
+    // Channels of several chips share the sequencer
+    pwm_open(&p[0], root, 0, 0);
+    pwm_open(&p[1], root, 0, 1);
+    pwm_open(&p[2], root, 1, 0);
+    if (rfs_pwm_sequencer_open(&s, 1000000)) {
+        err(1, "opening sequencer");
+    }
+    play(&s, &q[0], &p[0], RFS_RAMP_LINEAR, 0, PERIOD);
+    q[1].shape = 2.2;
+    play(&s, &q[1], &p[1], RFS_RAMP_GAMMA, PERIOD, 0);
+    q[2].table = table;
+    q[2].table_len = 3;
+    play(&s, &q[2], &p[2], RFS_RAMP_TABLE, 0, 0);
+    // The initial duty cycles are written at once
+    check_duty_cycle(&p[1], PERIOD);
+    if (rfs_pwm_sequencer_play(&s, &q[0]) != -1 || errno != EBUSY) {
+        errx(1, "playing a sequence twice must give EBUSY but does not");
+    }
+    for (i = 0; i < 3; i++) {
+        wait_sequence(&q[i]);
+    }
+    // The fake files are not truncated when written, so only the longest
+    // value can be read back from them
+    check_duty_cycle(&p[0], PERIOD);
+    if (q[1].last != 0 || q[2].last != 250000) {
+        errx(1, "wrong final duty cycles %d and %d", q[1].last, q[2].last);
+    }
+    // Unchanged duty cycles are not written again
+    writes = s.writes;
+    play(&s, &q[0], &p[0], RFS_RAMP_EXPONENTIAL, 300000, 300000);
+    wait_sequence(&q[0]);
+    if (s.writes - writes != 1) {
+        errx(1, "%lu writes for a constant duty cycle", s.writes - writes);
+    }
+    // Wrong profiles
+    q[1].shape = 0;
+    q[1].ramp = RFS_RAMP_GAMMA;
+    if (rfs_pwm_sequencer_play(&s, &q[1]) != -1 || errno != EINVAL) {
+        errx(1, "playing a wrong profile must give EINVAL but does not");
+    }
+    q[1].ramp = RFS_RAMP_LINEAR;
+    q[1].to = PERIOD + 1;
+    if (rfs_pwm_sequencer_play(&s, &q[1]) != -1 || errno != EINVAL) {
+        errx(1, "playing duty cycles out of the period must give EINVAL but "
+            "does not");
+    }
+    // A sequence ends even if its final duty cycle can't be written
+    if (rfs_pwm_close(&p[2])) {
+        err(1, "closing PWM channel");
+    }
+    p[2].flags = RFS_DONT_EXPORT;
+    if (rfs_pwm_open(&p[2])) {
+        err(1, "opening PWM channel");
+    }
+    play(&s, &q[2], &p[2], RFS_RAMP_LINEAR, 0, PERIOD);
+    snprintf(path, sizeof(path), "%s/sys/class/pwm/pwmchip1/pwm0/duty_cycle",
+        root);
+    if (unlink(path)) {
+        err(1, "removing duty cycle file");
+    }
+    wait_sequence(&q[2]);
+    if (!rfs_pwm_sequencer_errors(&s)) {
+        errx(1, "failed writes not counted");
+    }
+    make_pwm(root, 1, 0);
+    // A sequence can be stopped before it ends
+    play(&s, &q[2], &p[2], RFS_RAMP_LINEAR, 0, PERIOD);
+    if (rfs_pwm_sequencer_stop(&s, &q[2]) || rfs_pwm_sequence_playing(&q[2])) {
+        errx(1, "sequence not stopped");
+    }
+    if (rfs_pwm_sequencer_close(&s)) {
+        err(1, "closing sequencer");
+    }
+    for (i = 0; i < 3; i++) {
+        if (rfs_pwm_close(&p[i])) {
+            err(1, "closing PWM channel");
+        }
+    }
+    remove_root(root);
+    return 0;
+}
@@ -0,0 +1,170 @@
+
+#include "rfsgpio.h"
+#include "mockchardev.h"
+#include "testutil.h"
+
+#include <err.h>    // err
+#include <errno.h>  // errno
+#include <stdio.h>  // snprintf
+#include <time.h>   // nanosleep
+#include <unistd.h> // unlink
+
+#define NCHANNELS   3
+#define PERIOD      2000000
+
+void
+softpwm_open(struct softpwm_t *p, struct softpwm_scheduler_t *s,
+    gpio_pin_t pin)
+{
+    p->gpio.chip = 0;
+    p->gpio.pin = pin;
+    p->gpio.flags = RFS_CHARDEV;
+    p->scheduler = s;
+    p->period = PERIOD;
+    if (rfs_softpwm_open(p)) {
+        err(1, "opening software PWM on line %u", pin);
+    }
+}
+
+// Current value of the pin of a channel, seen by the mock
+int
+pin_value(struct softpwm_t *p)
+{
+    return __atomic_load_n(&mock_request(p->gpio.fd)->bits, __ATOMIC_RELAXED)
+        & 1;
+}
+
+// Sample the pin of a channel for some periods and return the fraction of
+// samples that were high
+double
+sample(struct softpwm_t *p)
+{
+    struct timespec ts = {0, 50000};
+    int i, high = 0;
+
+    for (i = 0; i < 400; i++) {
+        high += pin_value(p);
+        nanosleep(&ts, NULL);
+    }
+    return high / 400.0;
+}
+
+void
+wait_period(void)
+{
+    struct timespec ts = {0, 3 * PERIOD};
+
+    nanosleep(&ts, NULL);
+}
+
+// The edges that can't be written are counted and written again later
+void
+test_errors(const char *root, struct softpwm_scheduler_t *s)
+{
+    struct softpwm_t p;
+    char path[64], val[8];
+
+    make_gpio(root, 10);
+    p.gpio.pin = 10;
+    p.gpio.flags = RFS_DONT_EXPORT;
+    p.scheduler = s;
+    p.period = PERIOD;
+    if (rfs_softpwm_open(&p) || rfs_softpwm_set_duty_cycle(&p, PERIOD)) {
+        err(1, "opening software PWM on pin 10");
+    }
+    snprintf(path, sizeof(path), "%s/sys/class/gpio/gpio10/value", root);
+    unlink(path);
+    wait_period();
+    if (!rfs_softpwm_scheduler_errors(s)) {
+        errx(1, "failed edge not counted");
+    }
+    write_file(root, "sys/class/gpio/gpio10/value", "0\n");
+    wait_period();
+    read_file(root, "sys/class/gpio/gpio10/value", val, sizeof(val));
+    if (val[0] != '1') {
+        errx(1, "failed edge not written again");
+    }
+    if (rfs_softpwm_close(&p)) {
+        err(1, "closing channel");
+    }
+}
+
+int
+main()
+{
+    char root[] = "/tmp/rfstest.XXXXXX";
+    struct softpwm_scheduler_t s;
+    struct softpwm_t p[NCHANNELS];
+    double f;
+    int i;
+
+    make_root(root);
+    make_chip(root, 0);
+    if (rfs_softpwm_scheduler_open(&s)) {
+        err(1, "opening scheduler");
+    }
+    for (i = 0; i < NCHANNELS; i++) {
+        softpwm_open(&p[i], &s, i);
+    }
+    // Same semantics as the hardware channels
+    if (rfs_softpwm_get_period(&p[0]) != PERIOD
+        || rfs_softpwm_get_duty_cycle(&p[0]) != 0
+        || rfs_softpwm_get_enabled(&p[0]) != RFS_PWM_ENABLED)
+    {
+        errx(1, "wrong initial state");
+    }
+    if (rfs_softpwm_set_duty_cycle(&p[0], PERIOD + 1) != -1
+        || errno != EINVAL)
+    {
+        errx(1, "duty cycle greater than the period accepted");
+    }
+    if (rfs_softpwm_set_duty_cycle(&p[0], PERIOD)
+        || rfs_softpwm_set_duty_cycle(&p[1], PERIOD / 2)
+        || rfs_softpwm_set_duty_cycle(&p[2], 0))
+    {
+        err(1, "setting duty cycle");
+    }
+    if (rfs_softpwm_set_period(&p[0], PERIOD / 2) != -1 || errno != EINVAL) {
+        errx(1, "period less than the duty cycle accepted");
+    }
+    // The changes are applied at the next period
+    wait_period();
+    if (pin_value(&p[0]) != 1 || pin_value(&p[2]) != 0) {
+        errx(1, "wrong values with duty cycles 100%% and 0%%");
+    }
+    f = sample(&p[1]);
+    if (f < 0.2 || f > 0.8) {
+        errx(1, "channel with duty cycle 50%% high %.0f%% of the time",
+            f * 100);
+    }
+    // A disabled channel is low
+    if (rfs_softpwm_set_enabled(&p[0], RFS_PWM_DISABLED)) {
+        err(1, "disabling channel");
+    }
+    if (pin_value(&p[0]) != 0
+        || rfs_softpwm_get_enabled(&p[0]) != RFS_PWM_DISABLED)
+    {
+        errx(1, "disabled channel not low");
+    }
+    if (rfs_softpwm_set_enabled(&p[0], RFS_PWM_ENABLED)) {
+        err(1, "enabling channel");
+    }
+    wait_period();
+    if (pin_value(&p[0]) != 1) {
+        errx(1, "enabled channel not high");
+    }
+    if (rfs_softpwm_scheduler_errors(&s)) {
+        errx(1, "errors counted without failed edges");
+    }
+    test_errors(root, &s);
+    for (i = 0; i < NCHANNELS; i++) {
+        if (rfs_softpwm_close(&p[i])) {
+            err(1, "closing channel");
+        }
+    }
+    if (rfs_softpwm_scheduler_close(&s)) {
+        err(1, "closing scheduler");
+    }
+    remove_root(root);
+    return 0;
+}
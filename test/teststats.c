@@ -0,0 +1,105 @@
+
+#include "rfsgpio.h"
+#include "testutil.h"
+
+#include <err.h>        // err
+#include <errno.h>      // errno
+#include <pthread.h>    // pthread_create
+#include <string.h>     // strcmp
+
+#define NWRITES 10
+
+void *
+write_values(void *arg)
+{
+    struct gpio_t *g = arg;
+    int i;
+
+    for (i = 0; i < NWRITES; i++) {
+        if (rfs_gpio_set_value(g, i & 1)) {
+            err(1, "setting value");
+        }
+    }
+    return NULL;
+}
+
+void
+check_op(struct stats_t *stats, enum stats_op_t op, uint64_t calls,
+    uint64_t errors)
+{
+    struct op_stats_t *o = &stats->ops[op];
+    uint64_t n = 0;
+    int i;
+
+    for (i = 0; i < RFS_STATS_BUCKETS; i++) {
+        n += o->histogram[i];
+    }
+    if (o->calls != calls || o->errors != errors || n != calls) {
+        errx(1, "%s: %llu calls, %llu errors, %llu in the histogram",
+            rfs_stats_op_name(op), (unsigned long long)o->calls,
+            (unsigned long long)o->errors, (unsigned long long)n);
+    }
+}
+
+int
+main()
+{
+    char root[] = "/tmp/rfstest.XXXXXX";
+    struct stats_t stats;
+    struct gpio_t g, missing;
+    pthread_t thread;
+
+    if (strcmp(rfs_stats_op_name(RFS_STATS_GPIO_SET_VALUE),
+        "rfs_gpio_set_value") != 0 || rfs_stats_op_name(RFS_STATS_OPS))
+    {
+        errx(1, "wrong operation names");
+    }
+    // Without --enable-stats there's nothing else to check
+    if (rfs_stats_snapshot(&stats)) {
+        if (errno != ENOTSUP || rfs_stats_reset() != -1 || errno != ENOTSUP) {
+            err(1, "getting statistics");
+        }
+        return 0;
+    }
+    make_root(root);
+    make_gpio(root, 4);
+    g.pin = 4;
+    g.flags = RFS_DONT_EXPORT | RFS_KEEP_OPEN;
+    if (rfs_gpio_open(&g, RFS_GPIO_OUT_LOW)) {
+        err(1, "opening pin");
+    }
+    if (rfs_stats_reset()) {
+        err(1, "resetting statistics");
+    }
+    // The calls of all the threads are added up
+    write_values(&g);
+    if (pthread_create(&thread, NULL, write_values, &g)
+        || pthread_join(thread, NULL))
+    {
+        errx(1, "running thread");
+    }
+    missing.pin = 99;
+    missing.flags = RFS_DONT_EXPORT;
+    if (rfs_gpio_open(&missing, RFS_GPIO_IN) != -1 || errno != ENOENT) {
+        errx(1, "opening a missing pin must give ENOENT but does not");
+    }
+    if (rfs_stats_snapshot(&stats)) {
+        err(1, "getting statistics");
+    }
+    check_op(&stats, RFS_STATS_GPIO_SET_VALUE, 2 * NWRITES, 0);
+    check_op(&stats, RFS_STATS_WRITE, 2 * NWRITES, 0);
+    check_op(&stats, RFS_STATS_GPIO_OPEN, 1, 1);
+    // The error comes from opening the direction file
+    if (stats.ops[RFS_STATS_GPIO_OPEN].errnos[ENOENT] != 1
+        || stats.ops[RFS_STATS_OPEN].errnos[ENOENT] != 1)
+    {
+        errx(1, "errors of the open not counted");
+    }
+    if (stats.ops[RFS_STATS_WRITE].bytes != 2 * NWRITES) {
+        errx(1, "%llu bytes written",
+            (unsigned long long)stats.ops[RFS_STATS_WRITE].bytes);
+    }
+    rfs_gpio_close(&g);
+    remove_root(root);
+    return 0;
+}
@@ -0,0 +1,140 @@
+
+#define _GNU_SOURCE
+
+#include "rfsgpio.h"
+#include "testutil.h"
+
+#include <err.h>        // err
+#include <errno.h>      // errno
+#include <pthread.h>    // pthread_getaffinity_np
+#include <sched.h>      // CPU_ISSET
+#include <string.h>     // strncmp
+#include <sys/prctl.h>  // prctl
+
+#define CLOCK_SOURCE_FILE \
+    "sys/devices/system/clocksource/clocksource0/current_clocksource"
+
+// What the writer thread of the queue saw of itself
+struct thread_info_t {
+    int policy;
+    unsigned long timer_slack;
+    cpu_set_t cpus;
+} info;
+
+void
+inspect(const struct write_command_t *command, int error, void *data)
+{
+    struct sched_param param;
+
+    pthread_getschedparam(pthread_self(), &info.policy, &param);
+    info.timer_slack = prctl(PR_GET_TIMERSLACK, 0, 0, 0, 0);
+    pthread_getaffinity_np(pthread_self(), sizeof(info.cpus), &info.cpus);
+}
+
+// Start the writer thread of a queue, and get what it sees of itself with a
+// write
+int
+run_thread(struct gpio_t *g)
+{
+    struct write_queue_t q;
+
+    if (rfs_write_queue_open(&q, 4, inspect, NULL)) {
+        return -1;
+    }
+    rfs_gpio_set_write_queue(g, &q);
+    if (rfs_gpio_set_value(g, RFS_GPIO_HIGH)
+        || rfs_write_queue_fence(&q, 1000) != 1)
+    {
+        errx(1, "write not done");
+    }
+    rfs_gpio_set_write_queue(g, NULL);
+    if (rfs_write_queue_close(&q)) {
+        err(1, "closing queue");
+    }
+    return 0;
+}
+
+void
+check_invalid(const struct thread_config_t *config, const char *what)
+{
+    if (rfs_thread_set_config(config) != -1 || errno != EINVAL) {
+        errx(1, "%s must give EINVAL but does not", what);
+    }
+}
+
+int
+main()
+{
+    char root[] = "/tmp/rfstest.XXXXXX";
+    struct thread_config_t config;
+    struct gpio_t g;
+    char val[16];
+
+    make_root(root);
+    make_gpio(root, 5);
+    g.pin = 5;
+    g.flags = RFS_DONT_EXPORT;
+    if (rfs_gpio_open(&g, RFS_GPIO_OUT_LOW)) {
+        err(1, "opening pin");
+    }
+    // Wrong configurations
+    config = rfs_thread_default;
+    config.policy = RFS_THREAD_FIFO;
+    check_invalid(&config, "a priority of 0");
+    config = rfs_thread_default;
+    config.policy = RFS_THREAD_DEADLINE;
+    config.runtime = 2000000;
+    config.deadline = 1000000;
+    config.period = 1000000;
+    check_invalid(&config, "a runtime longer than the deadline");
+    config = rfs_thread_default;
+    config.stack_size = 256 * 1024;
+    config.prefault = 256 * 1024;
+    check_invalid(&config, "prefaulting the whole stack");
+    // The CPUs, timer slack and stack are applied to the threads started
+    config = rfs_thread_default;
+    config.policy = RFS_THREAD_OTHER;
+    config.cpus = 1;
+    config.timer_slack = 12345;
+    config.prefault = 128 * 1024;
+    config.stack_size = 512 * 1024;
+    config.clock_source = "tsc";
+    write_file(root, CLOCK_SOURCE_FILE, "hpet\n");
+    if (rfs_thread_set_config(&config)) {
+        err(1, "setting configuration");
+    }
+    if (run_thread(&g)) {
+        err(1, "starting thread");
+    }
+    if (info.policy != SCHED_OTHER || info.timer_slack != 12345
+        || CPU_COUNT(&info.cpus) != 1 || !CPU_ISSET(0, &info.cpus))
+    {
+        errx(1, "configuration not applied to the thread");
+    }
+    read_file(root, CLOCK_SOURCE_FILE, val, sizeof(val));
+    if (strncmp(val, "tsc", 3)) {
+        errx(1, "clock source is %s instead of tsc", val);
+    }
+    // A real time policy, if allowed: otherwise the thread isn't started
+    config = rfs_thread_default;
+    config.policy = RFS_THREAD_FIFO;
+    config.priority = 10;
+    if (rfs_thread_set_config(&config)) {
+        err(1, "setting configuration");
+    }
+    if (run_thread(&g)) {
+        if (errno != EPERM) {
+            err(1, "starting thread");
+        }
+    } else if (info.policy != SCHED_FIFO) {
+        errx(1, "policy not applied to the thread");
+    }
+    if (rfs_thread_set_config(&rfs_thread_default)) {
+        err(1, "setting configuration");
+    }
+    if (rfs_gpio_close(&g)) {
+        err(1, "closing pin");
+    }
+    remove_root(root);
+    return 0;
+}
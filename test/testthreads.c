@@ -0,0 +1,174 @@
+
+#include "rfsgpio.h"
+#include "testutil.h"
+
+#include <dirent.h>     // opendir
+#include <err.h>        // err
+#include <errno.h>      // errno
+#include <fcntl.h>      // fcntl
+#include <pthread.h>    // pthread_create
+#include <stdio.h>      // snprintf
+#include <sys/stat.h>   // fstat
+
+#define THREADS 4
+#define LOOPS   2000
+
+char root[] = "/tmp/rfstest.XXXXXX";
+
+// Pin polled by all the readers, and the pin and channel of each writer
+struct gpio_t input, outputs[THREADS];
+struct pwm_t channels[THREADS];
+
+// Inode of the value file of the input pin
+ino_t input_ino;
+
+// Number of descriptors opened by the process
+int
+count_fds()
+{
+    struct dirent *entry;
+    DIR *dir;
+    int n = 0;
+
+    if (!(dir = opendir("/proc/self/fd"))) {
+        err(1, "listing descriptors");
+    }
+    while ((entry = readdir(dir))) {
+        n += entry->d_name[0] != '.';
+    }
+    closedir(dir);
+    return n - 1;
+}
+
+// Each reader polls the input pin while the others read it: the descriptor
+// taken must stay the one of the value file until released
+void *
+reader(void *arg)
+{
+    struct gpio_event_t event;
+    struct pollfd pd;
+    struct stat st;
+    int i;
+
+    for (i = 0; i < LOOPS; i++) {
+        if (rfs_gpio_get_poll_descriptors(&input, &pd)) {
+            err(1, "getting poll descriptors");
+        }
+        if (rfs_gpio_get_value(&input) != RFS_GPIO_LOW
+            || rfs_gpio_wait_edge(&input, 0, &event) < 0)
+        {
+            err(1, "reading input");
+        }
+        if (fstat(pd.fd, &st) || st.st_ino != input_ino) {
+            errx(1, "descriptor %d closed or reused while polled", pd.fd);
+        }
+        if (rfs_gpio_put_poll_descriptors(&input)) {
+            err(1, "releasing poll descriptors");
+        }
+    }
+    return NULL;
+}
+
+// Each writer writes its own pin and channel, and reads them back
+void *
+writer(void *arg)
+{
+    struct gpio_t *g = &outputs[(long)arg];
+    struct pwm_t *p = &channels[(long)arg];
+    int i;
+
+    for (i = 0; i < LOOPS; i++) {
+        if (rfs_gpio_set_value(g, i & 1)
+            || rfs_pwm_set_duty_cycle(p, 1000 + i))
+        {
+            err(1, "writing output");
+        }
+        if (rfs_gpio_get_value(g) != (i & 1)
+            || rfs_pwm_get_duty_cycle(p) != 1000 + i)
+        {
+            errx(1, "output %u doesn't keep its value", g->pin);
+        }
+    }
+    return NULL;
+}
+
+int
+main()
+{
+    pthread_t threads[2 * THREADS];
+    struct stat st;
+    char path[128];
+    int errors[1];
+    long i;
+    int fds;
+
+    make_root(root);
+    make_gpio(root, 5);
+    snprintf(path, sizeof(path), "%s/sys/class/gpio/gpio5/value", root);
+    if (stat(path, &st)) {
+        err(1, "stat of the value file");
+    }
+    input_ino = st.st_ino;
+    input.pin = 5;
+    input.flags = RFS_DONT_EXPORT | RFS_THREAD_SAFE | RFS_CACHE;
+    if (rfs_gpio_open(&input, RFS_GPIO_IN) != -1 || errno != EINVAL) {
+        errx(1, "sharing the cache must give EINVAL but does not");
+    }
+    // Also when opened with the others
+    make_pwm(root, 0, 0);
+    channels[0].chip = 0;
+    channels[0].channel = 0;
+    channels[0].flags = RFS_DONT_EXPORT | RFS_THREAD_SAFE | RFS_CACHE;
+    channels[0].period = 1000000;
+    if (rfs_gpio_open_many(&input, 1, RFS_GPIO_IN, errors) != -1
+        || errors[0] != EINVAL || rfs_pwm_open_many(channels, 1, errors) != -1
+        || errors[0] != EINVAL)
+    {
+        errx(1, "sharing the cache must give EINVAL but does not");
+    }
+    input.flags = RFS_DONT_EXPORT | RFS_THREAD_SAFE;
+    if (rfs_gpio_open(&input, RFS_GPIO_IN)) {
+        err(1, "opening input");
+    }
+    for (i = 0; i < THREADS; i++) {
+        make_gpio(root, 10 + i);
+        make_pwm(root, 0, i);
+        outputs[i].pin = 10 + i;
+        outputs[i].flags = RFS_DONT_EXPORT | RFS_THREAD_SAFE;
+        channels[i].chip = 0;
+        channels[i].channel = i;
+        channels[i].flags = RFS_DONT_EXPORT | RFS_THREAD_SAFE;
+        channels[i].period = 1000000;
+        if (rfs_gpio_open(&outputs[i], RFS_GPIO_OUT_LOW)
+            || rfs_pwm_open(&channels[i]))
+        {
+            err(1, "opening outputs");
+        }
+    }
+    if (rfs_gpio_put_poll_descriptors(&input) != -1 || errno != EINVAL) {
+        errx(1, "releasing a descriptor not taken must give EINVAL but does "
+            "not");
+    }
+    fds = count_fds();
+    for (i = 0; i < THREADS; i++) {
+        pthread_create(&threads[i], NULL, reader, NULL);
+        pthread_create(&threads[THREADS + i], NULL, writer, (void *)i);
+    }
+    for (i = 0; i < 2 * THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    // Once all the references are released, no descriptor is left opened
+    if (input.poll_ref || count_fds() != fds) {
+        errx(1, "descriptors left opened");
+    }
+    if (rfs_gpio_close(&input)) {
+        err(1, "closing input");
+    }
+    for (i = 0; i < THREADS; i++) {
+        if (rfs_gpio_close(&outputs[i]) || rfs_pwm_close(&channels[i])) {
+            err(1, "closing outputs");
+        }
+    }
+    remove_root(root);
+    return 0;
+}
@@ -0,0 +1,114 @@
+
+#define _XOPEN_SOURCE 500
+
+#include "testutil.h"
+
+#include <err.h>        // err
+#include <ftw.h>        // nftw
+#include <stdio.h>      // snprintf
+#include <stdlib.h>     // mkdtemp
+#include <string.h>     // strlen
+#include <sys/stat.h>   // mkdir
+#include <unistd.h>     // rmdir
+
+#define PATH_LEN    256
+
+void
+make_root(char *root)
+{
+    if (!mkdtemp(root)) {
+        err(1, "creating temporary directory");
+    }
+    if (rfs_set_root(root)) {
+        err(1, "setting root");
+    }
+}
+
+static int
+remove_entry(const char *path, const struct stat *st, int type,
+    struct FTW *ftw)
+{
+    return remove(path);
+}
+
+void
+remove_root(const char *root)
+{
+    nftw(root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+void
+write_file(const char *root, const char *path, const char *val)
+{
+    char file[PATH_LEN];
+    char *p;
+    FILE *f;
+
+    snprintf(file, PATH_LEN, "%s/%s", root, path);
+    for (p = file + strlen(root) + 1; *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            mkdir(file, 0755);
+            *p = '/';
+        }
+    }
+    if (!(f = fopen(file, "w"))) {
+        err(1, "creating %s", file);
+    }
+    fputs(val, f);
+    fclose(f);
+}
+
+void
+read_file(const char *root, const char *path, char *val, size_t n)
+{
+    char file[PATH_LEN];
+    size_t r;
+    FILE *f;
+
+    snprintf(file, PATH_LEN, "%s/%s", root, path);
+    if (!(f = fopen(file, "r"))) {
+        err(1, "opening %s", file);
+    }
+    r = fread(val, 1, n - 1, f);
+    val[r] = '\0';
+    fclose(f);
+}
+
+void
+make_gpio(const char *root, gpio_pin_t pin)
+{
+    char path[PATH_LEN];
+
+    snprintf(path, PATH_LEN, "sys/class/gpio/gpio%u/direction", pin);
+    write_file(root, path, "in\n");
+    snprintf(path, PATH_LEN, "sys/class/gpio/gpio%u/value", pin);
+    write_file(root, path, "0\n");
+    snprintf(path, PATH_LEN, "sys/class/gpio/gpio%u/edge", pin);
+    write_file(root, path, "none\n");
+}
+
+void
+make_pwm(const char *root, pwm_chip_t chip, pwm_channel_t channel)
+{
+    char path[PATH_LEN];
+
+    snprintf(path, PATH_LEN, "sys/class/pwm/pwmchip%u/pwm%u/period", chip,
+        channel);
+    write_file(root, path, "0\n");
+    snprintf(path, PATH_LEN, "sys/class/pwm/pwmchip%u/pwm%u/duty_cycle", chip,
+        channel);
+    write_file(root, path, "0\n");
+    snprintf(path, PATH_LEN, "sys/class/pwm/pwmchip%u/pwm%u/enable", chip,
+        channel);
+    write_file(root, path, "0\n");
+}
+
+void
+make_chip(const char *root, gpio_chip_t chip)
+{
+    char path[PATH_LEN];
+
+    snprintf(path, PATH_LEN, "dev/gpiochip%u", chip);
+    write_file(root, path, "");
+}
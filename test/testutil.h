@@ -0,0 +1,39 @@
+
+#ifndef TESTUTIL_H
+#define TESTUTIL_H
+
+#include "rfsgpio.h"
+
+#include <stddef.h> // size_t
+
+// Create a temporary directory from the template root and use it as the root
+// of the library
+void
+make_root(char *root);
+
+// Remove the temporary root directory and all its contents
+void
+remove_root(const char *root);
+
+// Write a file (path relative to root), creating its parent directories
+void
+write_file(const char *root, const char *path, const char *val);
+
+// Read a file (path relative to root)
+void
+read_file(const char *root, const char *path, char *val, size_t n);
+
+// Create the sysfs files of an exported GPIO pin
+void
+make_gpio(const char *root, gpio_pin_t pin);
+
+// Create the sysfs files of an exported PWM channel
+void
+make_pwm(const char *root, pwm_chip_t chip, pwm_channel_t channel);
+
+// Create the device file of a GPIO chip
+void
+make_chip(const char *root, gpio_chip_t chip);
+
+#endif
+
@@ -0,0 +1,96 @@
+
+#include "rfsgpio.h"
+#include "testutil.h"
+
+#include <err.h>        // err
+#include <errno.h>      // errno
+#include <pthread.h>    // pthread_create
+#include <time.h>       // nanosleep
+
+#define DELAY   50
+
+static const char *root;
+
+// Create the files of pin 9 and channel 0 after a while, as the kernel and
+// udev would do after the export
+void *
+create_files(void *arg)
+{
+    struct timespec ts = {0, DELAY * 1000000};
+
+    nanosleep(&ts, NULL);
+    make_gpio(root, 9);
+    make_pwm(root, 0, 0);
+    return NULL;
+}
+
+long
+elapsed(struct timespec *start)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec - start->tv_sec) * 1000
+        + (ts.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+int
+main()
+{
+    char tmp[] = "/tmp/rfstest.XXXXXX";
+    struct timespec start;
+    struct gpio_t g;
+    struct pwm_t p;
+    pthread_t thread;
+    long t;
+
+    make_root(tmp);
+    root = tmp;
+    write_file(root, "sys/class/gpio/export", "");
+    write_file(root, "sys/class/gpio/unexport", "");
+    write_file(root, "sys/class/pwm/pwmchip0/export", "");
+    write_file(root, "sys/class/pwm/pwmchip0/unexport", "");
+    if (pthread_create(&thread, NULL, create_files, NULL)) {
+        errx(1, "creating thread");
+    }
+    // The opening waits for the files, and returns as soon as they appear
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    g.pin = 9;
+    g.flags = 0;
+    if (rfs_gpio_open(&g, RFS_GPIO_OUT_HIGH)) {
+        err(1, "opening pin");
+    }
+    p.chip = 0;
+    p.channel = 0;
+    p.flags = RFS_KEEP_OPEN;
+    p.period = 1000;
+    if (rfs_pwm_open(&p)) {
+        err(1, "opening PWM channel");
+    }
+    t = elapsed(&start);
+    if (t < DELAY || t > RFS_DEFAULT_WAIT_TIMEOUT / 2) {
+        errx(1, "opened after %ld ms", t);
+    }
+    pthread_join(thread, NULL);
+    if (rfs_gpio_close(&g) || rfs_pwm_close(&p)) {
+        err(1, "closing");
+    }
+    // The wait is bounded
+    if (rfs_set_wait_timeout(-1) != -1 || errno != EINVAL) {
+        errx(1, "negative timeout accepted");
+    }
+    if (rfs_set_wait_timeout(100)) {
+        err(1, "setting timeout");
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    g.pin = 10;
+    if (rfs_gpio_open(&g, RFS_GPIO_IN) != -1 || errno != ENOENT) {
+        errx(1, "opening a missing pin must give ENOENT but does not");
+    }
+    t = elapsed(&start);
+    if (t < 100 || t > RFS_DEFAULT_WAIT_TIMEOUT / 2) {
+        errx(1, "missing pin waited for %ld ms", t);
+    }
+    remove_root(root);
+    return 0;
+}
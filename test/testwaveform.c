@@ -0,0 +1,182 @@
+
+#include "rfsgpio.h"
+#include "mockchardev.h"
+#include "testutil.h"
+
+#include <err.h>    // err
+#include <errno.h>  // errno
+#include <time.h>   // nanosleep
+
+#define RATE    10000
+#define SAMPLES 8
+
+uint64_t
+now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Wait until the player thread has played n buffers
+void
+wait_played(struct waveform_t *w, unsigned long n)
+{
+    struct timespec ts = {0, 1000000};
+    int i;
+
+    for (i = 0; i < 1000; i++) {
+        if (rfs_waveform_played(w) >= n) {
+            return;
+        }
+        nanosleep(&ts, NULL);
+    }
+    errx(1, "buffers not played");
+}
+
+// Wait until the stream has run out of samples
+void
+wait_underrun(struct waveform_t *w)
+{
+    struct timespec ts = {0, 1000000};
+    int i;
+
+    for (i = 0; i < 1000; i++) {
+        if (rfs_waveform_underruns(w)) {
+            return;
+        }
+        nanosleep(&ts, NULL);
+    }
+    errx(1, "no underrun");
+}
+
+// Check the samples written from the given one, and their number
+void
+check_writes(unsigned long first, const uint64_t *samples, unsigned long n)
+{
+    unsigned long i;
+
+    if (mock_nwrites < first + n) {
+        errx(1, "%lu samples written, less than %lu", mock_nwrites,
+            first + n);
+    }
+    for (i = 0; i < n; i++) {
+        if (mock_writes[first + i] != samples[i]) {
+            errx(1, "wrong sample %lu", first + i);
+        }
+    }
+}
+
+int
+main()
+{
+    char root[] = "/tmp/rfstest.XXXXXX";
+    struct mock_request_t *req;
+    struct gpio_bank_t bank;
+    struct gpio_t g[3];
+    struct waveform_t w;
+    uint64_t a[SAMPLES], b[SAMPLES], t;
+    int i;
+
+    make_root(root);
+    make_chip(root, 0);
+    for (i = 0; i < 3; i++) {
+        g[i].chip = 0;
+        g[i].pin = i;
+    }
+    bank.gpios = g;
+    bank.n = 3;
+    bank.flags = RFS_CHARDEV;
+    if (rfs_gpio_bank_open(&bank, RFS_GPIO_OUT_LOW)) {
+        err(1, "opening bank");
+    }
+    for (i = 0; i < SAMPLES; i++) {
+        a[i] = i;
+        b[i] = 7 - i;
+    }
+    if (rfs_waveform_open(&w, &bank, 0, 0) != -1 || errno != EINVAL) {
+        errx(1, "opening a player without rate must give EINVAL but does "
+            "not");
+    }
+    if (rfs_waveform_open(&w, &bank, RATE, 50000)) {
+        err(1, "opening player");
+    }
+    // Two buffers can be queued at once
+    if (rfs_waveform_queue(&w, a, 0) != -1 || errno != EINVAL) {
+        errx(1, "queueing an empty buffer must give EINVAL but does not");
+    }
+    if (rfs_waveform_queue(&w, a, SAMPLES)
+        || rfs_waveform_queue(&w, b, SAMPLES))
+    {
+        err(1, "queueing buffers");
+    }
+    if (rfs_waveform_queue(&w, a, SAMPLES) != -1 || errno != EAGAIN) {
+        errx(1, "queueing a third buffer must give EAGAIN but does not");
+    }
+    if (rfs_waveform_wait(&w, 0)) {
+        errx(1, "a buffer can be queued with both queued");
+    }
+    // Each sample is a single bank write, at the given rate
+    mock_nwrites = 0;
+    t = now();
+    if (rfs_waveform_start(&w)) {
+        err(1, "starting player");
+    }
+    if (rfs_waveform_start(&w) != -1 || errno != EBUSY) {
+        errx(1, "starting the player twice must give EBUSY but does not");
+    }
+    if (rfs_waveform_wait(&w, 1000) != 1) {
+        errx(1, "no buffer played");
+    }
+    wait_played(&w, 2);
+    if (now() - t < (2 * SAMPLES - 1) * 1000000000ULL / RATE) {
+        errx(1, "samples played faster than the rate");
+    }
+    check_writes(0, a, SAMPLES);
+    check_writes(SAMPLES, b, SAMPLES);
+    // Once out of samples, a new buffer starts a new stream
+    wait_underrun(&w);
+    if (rfs_waveform_underruns(&w) != 1) {
+        errx(1, "%lu underruns instead of 1", rfs_waveform_underruns(&w));
+    }
+    if (rfs_waveform_queue(&w, b, SAMPLES)) {
+        err(1, "queueing buffer");
+    }
+    wait_played(&w, 3);
+    check_writes(2 * SAMPLES, b, SAMPLES);
+    if (mock_nwrites != 3 * SAMPLES) {
+        errx(1, "%lu samples written instead of %d", mock_nwrites,
+            3 * SAMPLES);
+    }
+    // The samples that can't be written are counted, as the mock rejects
+    // writes to a line that isn't an output
+    if (rfs_waveform_errors(&w)) {
+        errx(1, "errors counted without failed writes");
+    }
+    req = mock_request(g[0].fd);
+    req->flags[0] &= ~GPIO_V2_LINE_FLAG_OUTPUT;
+    if (rfs_waveform_queue(&w, a, SAMPLES)) {
+        err(1, "queueing buffer");
+    }
+    wait_played(&w, 4);
+    if (rfs_waveform_errors(&w) != SAMPLES) {
+        errx(1, "%lu errors instead of %d", rfs_waveform_errors(&w),
+            SAMPLES);
+    }
+    req->flags[0] |= GPIO_V2_LINE_FLAG_OUTPUT;
+    if (rfs_waveform_stop(&w)) {
+        err(1, "stopping player");
+    }
+    if (rfs_waveform_stop(&w) != -1 || errno != EINVAL) {
+        errx(1, "stopping a stopped player must give EINVAL but does not");
+    }
+    if (rfs_waveform_close(&w)) {
+        err(1, "closing player");
+    }
+    if (rfs_gpio_bank_close(&bank)) {
+        err(1, "closing bank");
+    }
+    remove_root(root);
+    return 0;
+}
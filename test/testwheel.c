@@ -0,0 +1,193 @@
+
+#include "rfsgpio.h"
+#include "mockchardev.h"
+#include "testutil.h"
+
+#include <err.h>    // err
+#include <errno.h>  // errno
+#include <stdio.h>  // snprintf
+#include <stdlib.h> // rand
+#include <time.h>   // nanosleep
+#include <unistd.h> // unlink
+
+#define MS      1000000ULL
+#define MANY    1000
+
+uint64_t
+now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Changes written, and those written before their time
+int fired = 0, early = 0;
+
+// Value of the bank when the first change of its pin 0 was written
+uint64_t merged = 0;
+
+void
+count_change(struct gpio_t *gpio, enum gpio_value_t value, uint64_t time,
+    uint64_t lateness, void *data)
+{
+    struct gpio_t *bank = data;
+
+    if (now() < time) {
+        early++;
+    }
+    if (gpio == &bank[0] && value == RFS_GPIO_HIGH) {
+        merged = mock_request(gpio->fd)->bits;
+    }
+    fired++;
+}
+
+// Wait until the scheduler thread has written all the changes but n
+void
+wait_pending(struct gpio_scheduler_t *s, unsigned long n)
+{
+    struct timespec ts = {0, 1000000};
+    int i;
+
+    for (i = 0; i < 2000; i++) {
+        if (rfs_gpio_scheduler_pending(s) == n) {
+            return;
+        }
+        nanosleep(&ts, NULL);
+    }
+    errx(1, "%lu changes not written", rfs_gpio_scheduler_pending(s) - n);
+}
+
+void
+schedule(struct gpio_scheduler_t *s, struct gpio_t *g,
+    enum gpio_value_t value, uint64_t time)
+{
+    if (rfs_gpio_schedule(s, g, value, time)) {
+        err(1, "scheduling a change");
+    }
+}
+
+int
+main()
+{
+    char root[] = "/tmp/rfstest.XXXXXX";
+    const uint64_t writes[] = {1, 0, 3, 2, 0};
+    struct gpio_scheduler_t s;
+    struct gpio_bank_t bank;
+    struct gpio_t b[2], g, f;
+    char path[64];
+    uint64_t t;
+    int i;
+
+    make_root(root);
+    make_chip(root, 0);
+    b[0].chip = b[1].chip = g.chip = 0;
+    b[0].pin = 0;
+    b[1].pin = 1;
+    g.pin = 2;
+    g.flags = RFS_CHARDEV;
+    bank.gpios = b;
+    bank.n = 2;
+    bank.flags = RFS_CHARDEV;
+    if (rfs_gpio_bank_open(&bank, RFS_GPIO_OUT_LOW)
+        || rfs_gpio_open(&g, RFS_GPIO_OUT_LOW))
+    {
+        err(1, "opening lines");
+    }
+    if (rfs_gpio_scheduler_open(&s, 0, 6, NULL, NULL) != -1
+        || errno != EINVAL)
+    {
+        errx(1, "opening a scheduler without tick must give EINVAL but does "
+            "not");
+    }
+    if (rfs_gpio_scheduler_open(&s, 100000, 6, count_change, b)) {
+        err(1, "opening scheduler");
+    }
+    // A change already due, changes in the first level and in the higher
+    // ones, and two changes of the bank at the same time
+    mock_nwrites = 0;
+    t = now();
+    schedule(&s, &g, RFS_GPIO_HIGH, t - MS);
+    schedule(&s, &b[1], RFS_GPIO_LOW, t + 200 * MS);
+    schedule(&s, &b[0], RFS_GPIO_LOW, t + 30 * MS);
+    schedule(&s, &b[0], RFS_GPIO_HIGH, t + 20 * MS);
+    schedule(&s, &b[1], RFS_GPIO_HIGH, t + 20 * MS);
+    schedule(&s, &g, RFS_GPIO_LOW, t + 10 * MS);
+    // The change already due is written at once, and its place is free again
+    wait_pending(&s, 5);
+    schedule(&s, &b[1], RFS_GPIO_LOW, t + 200 * MS);
+    if (rfs_gpio_schedule(&s, &g, RFS_GPIO_LOW, t) != -1 || errno != EAGAIN) {
+        errx(1, "scheduling too many changes must give EAGAIN but does not");
+    }
+    wait_pending(&s, 0);
+    if (now() < t + 200 * MS) {
+        errx(1, "changes written before their time");
+    }
+    if (fired != 7 || early) {
+        errx(1, "%d changes written, %d of them early", fired, early);
+    }
+    // The changes of the bank at the same time are a single write, even of
+    // the same pin
+    if (mock_nwrites != 5 || merged != 3) {
+        errx(1, "%lu writes instead of 5", mock_nwrites);
+    }
+    for (i = 0; i < 5; i++) {
+        if (mock_writes[i] != writes[i]) {
+            errx(1, "write %d is %llu instead of %llu", i,
+                (unsigned long long)mock_writes[i],
+                (unsigned long long)writes[i]);
+        }
+    }
+    if (rfs_gpio_scheduler_max_lateness(&s) < MS) {
+        errx(1, "the change already due isn't late");
+    }
+    // A wrong value is rejected, and the changes that can't be written are
+    // counted
+    if (rfs_gpio_schedule(&s, &g, 2, t) != -1 || errno != EINVAL) {
+        errx(1, "scheduling a wrong value must give EINVAL but does not");
+    }
+    if (rfs_gpio_scheduler_errors(&s)) {
+        errx(1, "errors counted without failed writes");
+    }
+    make_gpio(root, 3);
+    f.pin = 3;
+    f.flags = RFS_DONT_EXPORT;
+    if (rfs_gpio_open(&f, RFS_GPIO_OUT_LOW)) {
+        err(1, "opening pin");
+    }
+    snprintf(path, sizeof(path), "%s/sys/class/gpio/gpio3/value", root);
+    unlink(path);
+    schedule(&s, &f, RFS_GPIO_HIGH, now());
+    wait_pending(&s, 0);
+    if (rfs_gpio_scheduler_errors(&s) != 1) {
+        errx(1, "%lu errors instead of 1", rfs_gpio_scheduler_errors(&s));
+    }
+    if (rfs_gpio_close(&f)) {
+        err(1, "closing pin");
+    }
+    if (rfs_gpio_scheduler_close(&s)) {
+        err(1, "closing scheduler");
+    }
+    // Many changes pending at once, in any order
+    if (rfs_gpio_scheduler_open(&s, 10000, MANY, count_change, b)) {
+        err(1, "opening scheduler");
+    }
+    fired = 0;
+    t = now();
+    for (i = 0; i < MANY; i++) {
+        schedule(&s, &g, i & 1, t + rand() % (100 * MS));
+    }
+    wait_pending(&s, 0);
+    if (fired != MANY || early) {
+        errx(1, "%d changes written, %d of them early", fired, early);
+    }
+    if (rfs_gpio_scheduler_close(&s)) {
+        err(1, "closing scheduler");
+    }
+    if (rfs_gpio_close(&g) || rfs_gpio_bank_close(&bank)) {
+        err(1, "closing lines");
+    }
+    remove_root(root);
+    return 0;
+}
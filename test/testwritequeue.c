@@ -0,0 +1,280 @@
+
+#include "rfsgpio.h"
+#include "testutil.h"
+
+#include <err.h>        // err
+#include <errno.h>      // errno
+#include <pthread.h>    // pthread_create
+#include <stdio.h>      // snprintf
+#include <string.h>     // strncmp
+#include <time.h>       // nanosleep
+
+#define THREADS 4
+#define WRITES  1000
+
+// Writes done and failed (with the last error), and whether the writer
+// thread must wait in the callback until the test releases it
+int done = 0, failed = 0, last_error = 0, hold = 0, held = 0;
+
+void
+count_write(const struct write_command_t *command, int error, void *data)
+{
+    struct timespec ts = {0, 1000000};
+
+    if (error) {
+        failed++;
+        last_error = error;
+    } else {
+        done++;
+    }
+    if (__atomic_load_n(&hold, __ATOMIC_ACQUIRE)) {
+        __atomic_store_n(&held, 1, __ATOMIC_RELEASE);
+        while (__atomic_load_n(&hold, __ATOMIC_ACQUIRE)) {
+            nanosleep(&ts, NULL);
+        }
+    }
+}
+
+// Wait until the writer thread is held in the callback
+void
+wait_held()
+{
+    struct timespec ts = {0, 1000000};
+    int i;
+
+    for (i = 0; i < 1000; i++) {
+        if (__atomic_load_n(&held, __ATOMIC_ACQUIRE)) {
+            return;
+        }
+        nanosleep(&ts, NULL);
+    }
+    errx(1, "writer thread not held");
+}
+
+void
+check_file(const char *root, const char *path, const char *expected)
+{
+    char val[16];
+
+    read_file(root, path, val, sizeof(val));
+    if (strncmp(val, expected, strlen(expected))) {
+        errx(1, "%s is %s instead of %s", path, val, expected);
+    }
+}
+
+void
+fence(struct write_queue_t *q)
+{
+    if (rfs_write_queue_fence(q, 1000) != 1) {
+        errx(1, "writes not done");
+    }
+}
+
+// Each thread writes its own pin
+void *
+producer(void *arg)
+{
+    struct gpio_t *g = arg;
+    struct timespec ts = {0, 100000};
+    int i;
+
+    for (i = 0; i < WRITES; i++) {
+        while (rfs_gpio_set_value(g, i & 1)) {
+            if (errno != EAGAIN) {
+                err(1, "pushing a write");
+            }
+            nanosleep(&ts, NULL);
+        }
+    }
+    return NULL;
+}
+
+void
+test_threads(const char *root, struct write_queue_t *q)
+{
+    struct gpio_t g[THREADS];
+    pthread_t threads[THREADS];
+    char path[64];
+    int i;
+
+    for (i = 0; i < THREADS; i++) {
+        make_gpio(root, 10 + i);
+        g[i].pin = 10 + i;
+        g[i].flags = RFS_DONT_EXPORT | RFS_KEEP_OPEN;
+        if (rfs_gpio_open(&g[i], RFS_GPIO_OUT_HIGH)) {
+            err(1, "opening pin");
+        }
+        rfs_gpio_set_write_queue(&g[i], q);
+    }
+    done = 0;
+    for (i = 0; i < THREADS; i++) {
+        pthread_create(&threads[i], NULL, producer, &g[i]);
+    }
+    for (i = 0; i < THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    fence(q);
+    // Every write is either done or merged with a later one, and the last
+    // one of each pin is always done
+    if (done + rfs_write_queue_merged(q) != THREADS * WRITES + 4) {
+        errx(1, "%d writes done and %lu merged", done,
+            rfs_write_queue_merged(q));
+    }
+    for (i = 0; i < THREADS; i++) {
+        snprintf(path, sizeof(path), "sys/class/gpio/gpio%d/value", 10 + i);
+        check_file(root, path, "1");
+        rfs_gpio_set_write_queue(&g[i], NULL);
+        if (rfs_gpio_close(&g[i])) {
+            err(1, "closing pin");
+        }
+    }
+}
+
+// Release the writer thread held in the callback, after a while
+void *
+release(void *arg)
+{
+    struct timespec ts = {0, 20000000};
+
+    nanosleep(&ts, NULL);
+    __atomic_store_n(&hold, 0, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+// A pin and a channel closed while attached wait for their pending writes,
+// and are released right away
+void
+test_close(const char *root, struct write_queue_t *q)
+{
+    pthread_t thread;
+    struct gpio_t g;
+    struct pwm_t p;
+    int errors;
+
+    make_gpio(root, 20);
+    make_pwm(root, 0, 2);
+    g.pin = 20;
+    g.flags = RFS_DONT_EXPORT | RFS_KEEP_OPEN;
+    p.chip = 0;
+    p.channel = 2;
+    p.flags = RFS_DONT_EXPORT | RFS_KEEP_OPEN;
+    p.period = 1000000;
+    if (rfs_gpio_open(&g, RFS_GPIO_OUT_LOW) || rfs_pwm_open(&p)) {
+        err(1, "opening pin and channel");
+    }
+    rfs_gpio_set_write_queue(&g, q);
+    rfs_pwm_set_write_queue(&p, q);
+    errors = failed;
+    held = 0;
+    __atomic_store_n(&hold, 1, __ATOMIC_RELEASE);
+    if (rfs_gpio_set_value(&g, RFS_GPIO_HIGH)) {
+        err(1, "pushing a write");
+    }
+    wait_held();
+    if (rfs_gpio_set_value(&g, RFS_GPIO_LOW)
+        || rfs_pwm_set_duty_cycle(&p, 500))
+    {
+        err(1, "pushing a write");
+    }
+    pthread_create(&thread, NULL, release, NULL);
+    if (rfs_gpio_close(&g) || rfs_pwm_close(&p)) {
+        err(1, "closing pin and channel");
+    }
+    pthread_join(thread, NULL);
+    if (failed != errors || g.write_queue || p.write_queue) {
+        errx(1, "writes done after the close");
+    }
+    check_file(root, "sys/class/gpio/gpio20/value", "0");
+    check_file(root, "sys/class/gpio/gpio20/direction", "in");
+    check_file(root, "sys/class/pwm/pwmchip0/pwm2/duty_cycle", "500");
+    check_file(root, "sys/class/pwm/pwmchip0/pwm2/enable", "0");
+}
+
+int
+main()
+{
+    char root[] = "/tmp/rfstest.XXXXXX";
+    struct write_queue_t q;
+    struct gpio_t g;
+    struct pwm_t p;
+    int i;
+
+    make_root(root);
+    make_gpio(root, 5);
+    make_pwm(root, 0, 1);
+    g.pin = 5;
+    g.flags = RFS_DONT_EXPORT | RFS_KEEP_OPEN;
+    p.chip = 0;
+    p.channel = 1;
+    p.flags = RFS_DONT_EXPORT;
+    p.period = 1000000;
+    if (rfs_gpio_open(&g, RFS_GPIO_OUT_LOW) || rfs_pwm_open(&p)) {
+        err(1, "opening pin and channel");
+    }
+    if (rfs_write_queue_open(&q, 0, NULL, NULL) != -1 || errno != EINVAL) {
+        errx(1, "opening an empty queue must give EINVAL but does not");
+    }
+    if (rfs_write_queue_open(&q, 5, count_write, NULL)) {
+        err(1, "opening queue");
+    }
+    rfs_gpio_set_write_queue(&g, &q);
+    rfs_pwm_set_write_queue(&p, &q);
+    // Hold the writer thread in the callback of a first write, so the next
+    // ones are popped in a single batch
+    __atomic_store_n(&hold, 1, __ATOMIC_RELEASE);
+    if (rfs_gpio_set_value(&g, RFS_GPIO_HIGH)) {
+        err(1, "pushing a write");
+    }
+    wait_held();
+    // The setters return at once, until the ring buffer (of 8) is full
+    for (i = 0; i < 4; i++) {
+        if (rfs_gpio_set_value(&g, i & 1)) {
+            err(1, "pushing a write");
+        }
+    }
+    if (rfs_pwm_set_duty_cycle(&p, 1000) || rfs_pwm_set_period(&p, 2000)
+        || rfs_pwm_set_duty_cycle(&p, 1500) || rfs_pwm_set_enabled(&p, 5))
+    {
+        err(1, "pushing a write");
+    }
+    if (rfs_gpio_set_value(&g, RFS_GPIO_LOW) != -1 || errno != EAGAIN) {
+        errx(1, "pushing to a full queue must give EAGAIN but does not");
+    }
+    if (rfs_write_queue_fence(&q, 0)) {
+        errx(1, "the writes held are done");
+    }
+    __atomic_store_n(&hold, 0, __ATOMIC_RELEASE);
+    fence(&q);
+    // Only the last value of each attribute is written, in its place
+    if (rfs_write_queue_merged(&q) != 4) {
+        errx(1, "%lu writes merged instead of 4", rfs_write_queue_merged(&q));
+    }
+    if (done != 4 || failed != 1 || last_error != EINVAL
+        || rfs_write_queue_errors(&q) != 1)
+    {
+        errx(1, "%d writes done and %d failed", done, failed);
+    }
+    check_file(root, "sys/class/gpio/gpio5/value", "1");
+    check_file(root, "sys/class/pwm/pwmchip0/pwm1/period", "2000");
+    check_file(root, "sys/class/pwm/pwmchip0/pwm1/duty_cycle", "1500");
+    // Detached, the writes are done right away
+    rfs_gpio_set_write_queue(&g, NULL);
+    rfs_pwm_set_write_queue(&p, NULL);
+    if (rfs_gpio_set_value(&g, RFS_GPIO_LOW)) {
+        err(1, "writing value");
+    }
+    check_file(root, "sys/class/gpio/gpio5/value", "0");
+    if (rfs_pwm_set_enabled(&p, 5) != -1 || errno != EINVAL) {
+        errx(1, "a wrong value must give EINVAL right away but does not");
+    }
+    test_threads(root, &q);
+    test_close(root, &q);
+    if (rfs_write_queue_close(&q)) {
+        err(1, "closing queue");
+    }
+    if (rfs_gpio_close(&g) || rfs_pwm_close(&p)) {
+        err(1, "closing pin and channel");
+    }
+    remove_root(root);
+    return 0;
+}